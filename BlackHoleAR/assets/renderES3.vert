@@ -10,8 +10,16 @@ uniform mat4    uTouchMatrix;
 
 uniform vec2    uViewport;
 uniform float   uOffset;
+// How far the frame is into the next step, and the length of a step as in updateES3.vert
+uniform float   uAlpha;
+uniform float   uStepScale;
 
 in vec4			ciPosition;
+#ifdef HALF_VELOCITY
+in uvec2        iVelocity;
+#else
+in vec3         iVelocity;
+#endif
 in vec3			iPositionOrg;
 in vec3			iRandom;
 in float        iLife;
@@ -27,6 +35,8 @@ const mat4 biasMatrix = mat4( 0.5, 0.0, 0.0, 0.0,
                                 0.5, 0.5, 0.5, 1.0 );
 
 const float radius = 0.005;
+// Velocity damping of updateES3.vert, which applies it after moving
+const float damping = 0.9;
 
 float exponentialInOut(float t) {
   return t == 0.0 || t == 1.0
@@ -38,7 +48,14 @@ float exponentialInOut(float t) {
 
 void main( void )
 {
+#ifdef HALF_VELOCITY
+    vec3 vel = vec3(unpackHalf2x16(iVelocity.x), unpackHalf2x16(iVelocity.y).x);
+#else
+    vec3 vel = iVelocity;
+#endif
+    // Back along the last step to between it and the one before
 	vec4 pos = ciPosition;
+    pos.xyz -= vel / pow(damping, uStepScale) * uStepScale * (1.0 - uAlpha);
 	// gl_Position	= ciModelViewProjection * uTranslateMatrix * pos;
 	gl_Position	= ciProjectionMatrix * ciViewMatrix * uTranslateMatrix * ciModelMatrix * pos;
     color = vec3(1.0);
@@ -9,8 +9,6 @@ in float  iLife;
 
 out vec3  position;
 out vec3  velocity;
-out vec3  positionOrg;
-out vec3  random;
 out float life;
 
 uniform float uTime;
@@ -148,9 +146,6 @@ void main()
 {
     vec3 pos    = iPosition;
     vec3 vel    = iVelocity;
-
-    positionOrg = iPositionOrg;
-    random      = iRandom;
     
     float f;
     vec3 acc = vec3(0.0);
@@ -176,7 +171,7 @@ void main()
     pos += vel;
     vel *= 0.9;
     
-    life = iLife - mix(0.01, 0.02, random.x);
+    life = iLife - mix(0.01, 0.02, iRandom.x);
     
     if(life < 0.0f) {
         life = 1.0;
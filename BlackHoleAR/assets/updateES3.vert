@@ -3,20 +3,28 @@
 precision highp float;
 
 in highp vec3   iPosition;
+#ifdef HALF_VELOCITY
+in highp uvec2  iVelocity;  // packHalf2x16 of xy and z0
+#else
 in highp vec3   iVelocity;
+#endif
 in highp vec3   iPositionOrg;
 in highp vec3   iRandom;
 in highp float  iLife;
 
 out vec3  position;
+#ifdef HALF_VELOCITY
+flat out uvec2 velocity;
+#else
 out vec3  velocity;
-out vec3  positionOrg;
-out vec3  random;
+#endif
 out float life;
 
 uniform float uTime;
 uniform float uOffset;
 uniform float uIsClosing;
+// Length of the step in steps of 1/60s, what the constants below are tuned for
+uniform float uStepScale;
 
 vec3 mod289(vec3 x) { return x - floor(x * (1.0 / 289.0)) * 289.0;  }
 vec4 mod289(vec4 x) { return x - floor(x * (1.0 / 289.0)) * 289.0;  }
@@ -159,10 +167,11 @@ float exponentialInOut(float t) {
 void main()
 {
     vec3 pos    = iPosition;
+#ifdef HALF_VELOCITY
+    vec3 vel    = vec3(unpackHalf2x16(iVelocity.x), unpackHalf2x16(iVelocity.y).x);
+#else
     vec3 vel    = iVelocity;
-
-    positionOrg = iPositionOrg;
-    random      = iRandom;
+#endif
     
     float f;
     vec3 acc = vec3(0.0);
@@ -187,11 +196,11 @@ void main()
     float offset = smoothstep(0.0, 1.0, uOffset * 2.0 - iRandom.x);
     offset = exponentialInOut(offset);
 
-    vel += acc * 0.003 * speedOffset * offset;
-    pos += vel;
-    vel *= 0.9;
+    vel += acc * 0.003 * speedOffset * offset * uStepScale;
+    pos += vel * uStepScale;
+    vel *= pow(0.9, uStepScale);
     
-    life = iLife - mix(0.01, 0.02, random.x);
+    life = iLife - mix(0.01, 0.02, iRandom.x) * uStepScale;
     
     if(life < 0.0f) {
 
@@ -208,5 +217,9 @@ void main()
 
 
     position = pos;
+#ifdef HALF_VELOCITY
+    velocity = uvec2(packHalf2x16(vel.xy), packHalf2x16(vec2(vel.z, 0.0)));
+#else
     velocity = vel;
+#endif
 }
@@ -4,12 +4,17 @@
 
 #include "CinderARKit.h"
 #include "Config.hpp"
+#include "ParticleSystem.hpp"
+#include "ParticleCache.hpp"
+#include "CounterRand.hpp"
+#include "FixedTimestep.hpp"
 
 #include "cinder/gl/Fbo.h"
 #include "cinder/GeomIo.h"
 #include "cinder/Perlin.h"
 #include "cinder/Rand.h"
 #include "cinder/Camera.h"
+#include "cinder/Timer.h"
 #include "cmath"
 
 
@@ -19,6 +24,50 @@ using namespace std;
 
 const int    FBO_WIDTH = 2048;
 const int    FBO_HEIGHT = 2048;
+// Same seed, same particles, which is what lets them be cached on disk.
+// Bump the version after changing generateParticles().
+const uint32_t PARTICLE_SEED = 1;
+const uint32_t PARTICLE_GENERATOR_VERSION = 2;
+
+struct ParticleLayout {
+    static constexpr ParticleField FIELDS[] = {
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iPosition",    "position", "ciPosition" },
+        { Config::HALF_VELOCITY ? ParticleType::UVec2 : ParticleType::Vec3,
+                                ParticleStream::Dynamic,    "iVelocity",    "velocity" },
+        { ParticleType::Vec3,   ParticleStream::Static,     "iPositionOrg" },
+        { ParticleType::Vec3,   ParticleStream::Static,     "iRandom" },
+        { ParticleType::Float,  ParticleStream::Dynamic,    "iLife",        "life" },
+    };
+};
+constexpr ParticleField ParticleLayout::FIELDS[];
+
+typedef ParticleSystem<ParticleLayout> Particles;
+
+// Never changes after setup, bound once and shared by both VAOs
+struct ParticleStatic
+{
+    vec3    posOrg;
+    vec3    random;
+};
+
+// The only part written by transform feedback
+struct Particle
+{
+    vec3    pos;
+    vec3    vel;
+    float   life;
+};
+
+// Particle with the velocity as half floats, packHalf2x16() of xy and z0
+struct ParticleHalf
+{
+    vec3        pos;
+    uint32_t    vel[2];
+    float       life;
+};
+
+static_assert( Particles::DYNAMIC_STRIDE == ( Config::HALF_VELOCITY ? sizeof(ParticleHalf) : sizeof(Particle) ), "ParticleLayout doesn't match Particle" );
+static_assert( Particles::STATIC_STRIDE == sizeof(ParticleStatic), "ParticleLayout doesn't match ParticleStatic" );
 
 class BlackHoleARApp : public App {
   public:
@@ -32,6 +81,7 @@ class BlackHoleARApp : public App {
 private:
     void updateShadowMap();
     void updateEnvMap();
+    void generateParticles( vector<Particle>& particles, vector<ParticleStatic>& particlesStatic, uint32_t seed );
 
     gl::GlslProgRef mRenderProg;
     gl::GlslProgRef mUpdateProg;
@@ -39,13 +89,10 @@ private:
     gl::GlslProgRef mEnvProg;
     gl::GlslProgRef mFloorProg;
     
-    // Descriptions of particle data layout.
-    gl::VaoRef          mAttributes[2];
-    // Buffers holding raw particle data on GPU.
-    gl::VboRef          mParticleBuffer[2];
-    
-    std::uint32_t       mSourceIndex        = 0;
-    std::uint32_t       mDestinationIndex   = 1;
+    // Ping-pong buffers and VAOs, laid out by ParticleLayout
+    Particles           mParticles;
+    // Same speed at any frame rate, drawn in between steps
+    FixedTimestep       mTimestep;
     
     gl::FboRef              mFbo;
     gl::FboRef              mFboParticle;
@@ -75,15 +122,6 @@ private:
     float targetOffset = 0.0f;
 };
 
-struct Particle
-{
-    vec3    pos;
-    vec3    vel;
-    vec3    posOrg;
-    vec3    random;
-    float   life;
-};
-
 
 void prepareSettings( BlackHoleARApp::Settings *settings) {
     settings->setHighDensityDisplayEnabled(); // try removing this line
@@ -104,74 +142,51 @@ void BlackHoleARApp::setup()
     mARSession.runConfiguration( config );
     
     console() << "Number of particles : " << Config::getInstance().NUM_PARTICLES << endl;
-    // init particles
-    vector<Particle> particles;
-    particles.assign( Config::getInstance().NUM_PARTICLES, Particle() );
-    float zRange = 0.1f;
-    
-    
-    for( int i =0; i<particles.size(); i++) {
-        float a = randFloat() * M_PI * 2.0;
-        float r = 3.0;
-        float _x = cos(a) * r;
-        float _y = sin(a) * r;
-        float z = randFloat(-zRange, zRange);
-        
-        float s = mPerlin.fBm(_x, _y, z) * 0.2;
-        r = randFloat(2.0, 2.5);
-        float x = cos(a) * r * ( 1.0 + s);
-        float y = sin(a) * r * ( 1.0 + s);
-        
-        auto &p = particles.at( i );
+    // init particles, generated on the first launch and mapped from the cache after that
+    bool halfVelocity = Config::HALF_VELOCITY;
+    ParticleCache::Key key = { PARTICLE_SEED, (uint32_t)Config::getInstance().NUM_PARTICLES, PARTICLE_GENERATOR_VERSION, Particles::DYNAMIC_STRIDE, Particles::STATIC_STRIDE };
+    fs::path cachePath = ParticleCache::getPath( "BlackHoleAR", key );
+    Timer timer( true );
+    
+    if( ParticleCacheRef cache = ParticleCache::load( cachePath, key ) ) {
+        mParticles.init( key.mCount, cache->getDynamicData(), cache->getStaticData() );
+        console() << "Particles loaded from cache in " << timer.getSeconds() * 1000.0 << " ms" << endl;
+    } else {
+        vector<Particle> particles( key.mCount );
+        vector<ParticleStatic> particlesStatic( key.mCount );
+        generateParticles( particles, particlesStatic, PARTICLE_SEED );
         
-        p.pos = vec3(x, y, z);
-        p.posOrg = vec3(x, y, z);
-        p.life = Rand::randFloat(0.01f, 1.0f);
-        p.random = vec3(randFloat(), randFloat(), randFloat());
+        if( halfVelocity ) {
+            vector<ParticleHalf> particlesHalf( particles.size() );
+            for( int i = 0; i < particles.size(); i++ ) {
+                particlesHalf[i].pos = particles[i].pos;
+                particlesHalf[i].vel[0] = glm::packHalf2x16( vec2( particles[i].vel ) );
+                particlesHalf[i].vel[1] = glm::packHalf2x16( vec2( particles[i].vel.z, 0.0f ) );
+                particlesHalf[i].life = particles[i].life;
+            }
+            
+            mParticles.init( particlesHalf.size(), particlesHalf.data(), particlesStatic.data() );
+            ParticleCache::save( cachePath, key, particlesHalf.data(), particlesStatic.data() );
+        } else {
+            mParticles.init( particles.size(), particles.data(), particlesStatic.data() );
+            ParticleCache::save( cachePath, key, particles.data(), particlesStatic.data() );
+        }
+        console() << "Particles generated in " << timer.getSeconds() * 1000.0 << " ms" << endl;
     }
     
     
-    mParticleBuffer[mSourceIndex]       = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), particles.data(), GL_STATIC_DRAW );
-    mParticleBuffer[mDestinationIndex]  = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), nullptr, GL_STATIC_DRAW );
-    
-    for( int i = 0; i < 2; ++i )
-    {    // Describe the particle layout for OpenGL.
-        mAttributes[i] = gl::Vao::create();
-        gl::ScopedVao vao( mAttributes[i] );
-        
-        // Define attributes as offsets into the bound particle buffer
-        gl::ScopedBuffer buffer( mParticleBuffer[i] );
-        gl::enableVertexAttribArray( 0 );
-        gl::enableVertexAttribArray( 1 );
-        gl::enableVertexAttribArray( 2 );
-        gl::enableVertexAttribArray( 3 );
-        gl::enableVertexAttribArray( 4 );
-        gl::vertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, pos) );
-        gl::vertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, vel) );
-        gl::vertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, posOrg) );
-        gl::vertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, random) );
-        gl::vertexAttribPointer( 4, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, life) );
-        
+    gl::GlslProg::Format renderFormat = Particles::renderFormat( gl::GlslProg::Format().vertex( loadAsset( "renderES3.vert" ) ).fragment( loadAsset("renderES3.frag")) );
+    if( halfVelocity ) {
+        renderFormat.define( "HALF_VELOCITY" );
     }
+    mRenderProg = gl::GlslProg::create( renderFormat );
     
     
-    mRenderProg = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "renderES3.vert" ) ).fragment( loadAsset("renderES3.frag"))
-       .attribLocation( "ciPosition", 0 )
-       .attribLocation( "iPositionOrg", 2 )
-       .attribLocation( "iRandom", 3 )
-       .attribLocation( "iLife", 4 )
-    );
-    
-    
-    mUpdateProg = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "updateES3.vert" ) ).fragment( loadAsset( "no_op_es3.frag" ) )
-        .feedbackFormat( GL_INTERLEAVED_ATTRIBS )
-        .feedbackVaryings( { "position", "velocity", "positionOrg", "random", "life"} )
-        .attribLocation( "iPosition", 0 )
-        .attribLocation( "iVelocity", 1 )
-        .attribLocation( "iPositionOrg", 2 )
-        .attribLocation( "iRandom", 3 )
-        .attribLocation( "iLife", 4 )
-        );
+    gl::GlslProg::Format updateFormat = Particles::updateFormat( gl::GlslProg::Format().vertex( loadAsset( "updateES3.vert" ) ).fragment( loadAsset( "no_op_es3.frag" ) ) );
+    if( halfVelocity ) {
+        updateFormat.define( "HALF_VELOCITY" );
+    }
+    mUpdateProg = gl::GlslProg::create( updateFormat );
     
     // shadow mapping
     float scale = 0.035f;
@@ -227,6 +242,44 @@ void BlackHoleARApp::setup()
     mSphere->draw();
 }
 
+void BlackHoleARApp::generateParticles( vector<Particle>& particles, vector<ParticleStatic>& particlesStatic, uint32_t seed )
+{
+    // Every value is a function of ( seed, stream, particle ), batched per attribute
+    enum { RAND_ANGLE, RAND_Z, RAND_RADIUS, RAND_LIFE, RAND_RANDOM };
+    CounterRand rand( seed );
+    size_t count = particles.size();
+    float zRange = 0.1f;
+    
+    vector<float> angle( count ), zs( count ), radius( count ), life( count );
+    vector<vec3> random( count );
+    rand.fill( angle.data(), count, RAND_ANGLE, 0, 0.0f, M_PI * 2.0 );
+    rand.fill( zs.data(), count, RAND_Z, 0, -zRange, zRange );
+    rand.fill( radius.data(), count, RAND_RADIUS, 0, 2.0f, 2.5f );
+    rand.fill( life.data(), count, RAND_LIFE, 0, 0.01f, 1.0f );
+    rand.fill( &random[0].x, count * 3, RAND_RANDOM, 0 );
+    
+    for( int i =0; i<count; i++) {
+        float a = angle[i];
+        float r = 3.0;
+        float _x = cos(a) * r;
+        float _y = sin(a) * r;
+        float z = zs[i];
+        
+        float s = mPerlin.fBm(_x, _y, z) * 0.2;
+        r = radius[i];
+        float x = cos(a) * r * ( 1.0 + s);
+        float y = sin(a) * r * ( 1.0 + s);
+        
+        auto &p = particles.at( i );
+        auto &ps = particlesStatic.at( i );
+        
+        p.pos = vec3(x, y, z);
+        ps.posOrg = vec3(x, y, z);
+        p.life = life[i];
+        ps.random = random[i];
+    }
+}
+
 void BlackHoleARApp::touchesBegan( TouchEvent event )
 {
     aID = mARSession.addAnchorRelativeToCamera( vec3(0.0f, 0.0f, -2.0f) );
@@ -250,37 +303,30 @@ void BlackHoleARApp::touchesBegan( TouchEvent event )
 
 void BlackHoleARApp::update()
 {
+    int steps = mTimestep.update( getElapsedSeconds() );
+    float stepScale = mTimestep.getStepScale();
     
-    if(targetOffset > 0.5) {
-        offset += 0.005f;
-        if(offset > 1.0) {
-            offset = 1.0;
-        }
-    }
     // Update particles on the GPU
     gl::ScopedGlslProg prog( mUpdateProg );
-    gl::ScopedState rasterizer( GL_RASTERIZER_DISCARD, true );    // turn off fragment stage
 
     // mUpdateProg->uniform("uCenter", getWindowCenter());
-    mUpdateProg->uniform("uTime", float(getElapsedSeconds()) + mSeed);
-    mUpdateProg->uniform("uOffset", offset);
     float t =(targetOffset > 1.0f) ? 1.0f : 0.0f;
     mUpdateProg->uniform("uIsClosing", t);
-    
-
-    // Bind the source data (Attributes refer to specific buffers).
-    gl::ScopedVao source( mAttributes[mSourceIndex] );
-    // Bind destination as buffer base.
-    gl::bindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, mParticleBuffer[mDestinationIndex] );
-    gl::beginTransformFeedback( GL_POINTS );
-
-    // Draw source into destination, performing our vertex transformations.
-    gl::drawArrays( GL_POINTS, 0, Config::getInstance().NUM_PARTICLES );
-
-    gl::endTransformFeedback();
+    mUpdateProg->uniform("uStepScale", stepScale);
+    
+    for( int i = 0; i < steps; i++ ) {
+        if(targetOffset > 0.5) {
+            offset += 0.005f * stepScale;
+            if(offset > 1.0) {
+                offset = 1.0;
+            }
+        }
+        mUpdateProg->uniform("uTime", float(mTimestep.getStepTime( i )) + mSeed);
+        mUpdateProg->uniform("uOffset", offset);
 
-    // Swap source and destination for next loop
-    std::swap( mSourceIndex, mDestinationIndex );
+        // Draw source into destination, then swap them for the next frame
+        mParticles.update();
+    }
 }
 
 void BlackHoleARApp::updateShadowMap() {
@@ -298,12 +344,12 @@ void BlackHoleARApp::updateShadowMap() {
     gl::ScopedGlslProg prog( mRenderProg );
     
     mRenderProg->uniform("uViewport", vec2(getWindowSize()));
+    mRenderProg->uniform("uAlpha", mTimestep.getAlpha());
+    mRenderProg->uniform("uStepScale", mTimestep.getStepScale());
     mRenderProg->uniform("uTranslateMatrix", mMtxIdentity);
     mRenderProg->uniform("uTouchMatrix", mMtxTouch);
     
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, Config::getInstance().NUM_PARTICLES );
+    mParticles.draw();
 }
 
 
@@ -365,6 +411,8 @@ void BlackHoleARApp::draw()
     mat4 shadowMatrix = mLightCam.getProjectionMatrix() * mLightCam.getViewMatrix();
     mRenderProg->uniform("uViewport", vec2(getWindowSize()));
     mRenderProg->uniform("uOffset", offset);
+    mRenderProg->uniform("uAlpha", mTimestep.getAlpha());
+    mRenderProg->uniform("uStepScale", mTimestep.getStepScale());
     mRenderProg->uniform("uTranslateMatrix", anchor.mTransform);
     mRenderProg->uniform("uShadowMatrix", shadowMatrix);
     mRenderProg->uniform("uTouchMatrix", mMtxTouch);
@@ -378,9 +426,7 @@ void BlackHoleARApp::draw()
     gl::ScopedTextureBind texScopeEnv( mFboEnv->getColorTexture(), (uint8_t) 2 );
     mRenderProg->uniform( "uEnvMap", 2 );
     
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, Config::getInstance().NUM_PARTICLES );
+    mParticles.draw();
     
     
     gl::setViewMatrix( mARSession.getViewMatrix() );
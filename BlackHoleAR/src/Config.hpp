@@ -22,6 +22,9 @@ static Config& getInstance()
     return instance;
 }
     int NUM_PARTICLES = 120e3;
+    // Velocity as half floats in the transform feedback buffers, 24 instead of 28 bytes a particle.
+    // Constant since it picks the type of a ParticleLayout field
+    static const bool HALF_VELOCITY = false;
 private:
     Config() {
         
@@ -0,0 +1,82 @@
+//
+//  CounterRand.hpp
+//  BlackHoleAR
+//
+//  Stateless random numbers: value number i of a stream is a pure function of
+//  (seed, stream, i), so loops can draw them in any order or on any thread and
+//  still get the same result for a given seed.
+//
+
+#ifndef CounterRand_hpp
+#define CounterRand_hpp
+
+#include "cinder/Vector.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+using namespace ci;
+using namespace std;
+
+/**  Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+     One counter block holds four values, value i of a stream is word i % 4 of
+     block i / 4, so fill() and the single value getters always agree.
+*/
+class CounterRand {
+
+public:
+    explicit CounterRand( uint64_t seed = 0 ) : mSeed( seed ) {}
+
+    uint64_t    getSeed() const     { return mSeed; }
+
+    /**  Seed for this launch: the number after --seed in \a args, or else a new one
+         from the clock. Log it, running again with --seed repeats the run.
+    */
+    static uint32_t pickSeed( const vector<string>& args );
+
+    uint32_t    getUint( uint64_t stream, uint64_t index ) const;
+    // [0, 1)
+    float       getFloat( uint64_t stream, uint64_t index ) const;
+    float       getFloat( uint64_t stream, uint64_t index, float min, float max ) const;
+    // Point on the unit sphere like randVec3(), uses values 2 * index and 2 * index + 1
+    vec3        getVec3( uint64_t stream, uint64_t index ) const;
+
+    /**  Values [offset, offset + count) of \a stream into \a out, mapped to [min, max).
+         The bulk goes through a vector kernel, four or eight blocks at a time.
+    */
+    void        fill( float* out, size_t count, uint64_t stream, uint64_t offset, float min = 0.0f, float max = 1.0f ) const;
+    // Unit vectors [offset, offset + count) of \a stream, same as getVec3( stream, 2 * i )
+    void        fillVec3( vec3* out, size_t count, uint64_t stream, uint64_t offset ) const;
+
+    /**  Cursor over one stream for short sequential draws, like the few values a
+         single object needs at setup. Only the cursor has state.
+    */
+    class Stream {
+
+    public:
+        Stream( const CounterRand& rand, uint64_t stream, uint64_t offset = 0 )
+        : mRand( rand ), mStream( stream ), mIndex( offset ) {}
+
+        uint32_t    nextUint()                          { return mRand.getUint( mStream, mIndex++ ); }
+        float       nextFloat()                         { return mRand.getFloat( mStream, mIndex++ ); }
+        float       nextFloat( float min, float max )   { return mRand.getFloat( mStream, mIndex++, min, max ); }
+        vec3        nextVec3();
+
+    private:
+        const CounterRand&  mRand;
+        uint64_t            mStream;
+        uint64_t            mIndex;
+    };
+
+    Stream      getStream( uint64_t stream, uint64_t offset = 0 ) const     { return Stream( *this, stream, offset ); }
+
+private:
+    // [0, 1)^2 to the unit sphere, uniformly
+    static vec3 toVec3( float u, float v );
+
+    uint64_t    mSeed;
+};
+
+#endif /* CounterRand_hpp */
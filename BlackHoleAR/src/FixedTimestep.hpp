@@ -0,0 +1,51 @@
+//
+//  FixedTimestep.hpp
+//  BlackHoleAR
+//
+//  Runs a simulation at a fixed rate whatever the frame rate: a few steps a
+//  frame at most, and how far the frame is into the next step so drawing can
+//  blend the last two states.
+//
+
+#ifndef FixedTimestep_hpp
+#define FixedTimestep_hpp
+
+#include <stdio.h>
+
+
+class FixedTimestep {
+
+public:
+    // Rate the per step constants of the update shaders were tuned at, one step a frame at 60 fps
+    static constexpr double REFERENCE_RATE = 60.0;
+
+    explicit FixedTimestep( double rate = REFERENCE_RATE, int maxSteps = 4 );
+
+    /**  Steps due by \a seconds, like getElapsedSeconds(), at most maxSteps. When
+         more are due the simulation slows down instead of spiralling, the rest
+         is dropped.
+    */
+    int     update( double seconds );
+
+    // Simulation time at the end of step \a step of the ones update() returned
+    double  getStepTime( int step ) const   { return mTime - ( mSteps - 1 - step ) * mDelta; }
+    double  getTime() const                 { return mTime; }
+    double  getDelta() const                { return mDelta; }
+    double  getRate() const                 { return 1.0 / mDelta; }
+    void    setRate( double rate )          { mDelta = 1.0 / rate; }
+
+    // Delta in steps of REFERENCE_RATE, what the update shaders scale their per step constants by
+    float   getStepScale() const            { return float( mDelta * REFERENCE_RATE ); }
+    // [0, 1) from the state before the last step to the last one, for drawing in between
+    float   getAlpha() const                { return float( mAccumulator / mDelta ); }
+
+private:
+    double  mDelta;
+    int     mMaxSteps;
+    int     mSteps          = 0;
+    double  mTime           = 0.0;
+    double  mAccumulator    = 0.0;
+    double  mLastSeconds    = -1.0;
+};
+
+#endif /* FixedTimestep_hpp */
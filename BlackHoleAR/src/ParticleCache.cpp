@@ -0,0 +1,128 @@
+//
+//  ParticleCache.cpp
+//  BlackHoleAR
+//
+
+#include "ParticleCache.hpp"
+#include "cinder/app/App.h"
+#include "cinder/Utilities.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ci::app;
+
+namespace {
+
+const uint32_t  MAGIC   = 0x48435450;   // "PTCH"
+const uint32_t  VERSION = 1;
+
+struct Header
+{
+    uint32_t            mMagic      = MAGIC;
+    uint32_t            mVersion    = VERSION;
+    ParticleCache::Key  mKey;
+    uint32_t            mReserved   = 0;
+};
+
+static_assert( sizeof(Header) % 16 == 0, "Keep the particle data aligned after the header" );
+
+size_t getFileSize( const ParticleCache::Key& key )
+{
+    return sizeof(Header) + (size_t)key.mCount * ( key.mDynamicStride + key.mStaticStride );
+}
+
+}
+
+
+bool ParticleCache::Key::operator==( const Key& other ) const
+{
+    return mSeed == other.mSeed && mCount == other.mCount && mGeneratorVersion == other.mGeneratorVersion
+        && mDynamicStride == other.mDynamicStride && mStaticStride == other.mStaticStride;
+}
+
+ParticleCache::ParticleCache( const uint8_t* data, size_t size, const Key& key )
+: mData( data )
+, mSize( size )
+{
+    mDynamicData = mData + sizeof(Header);
+    mStaticData = mData + sizeof(Header) + (size_t)key.mCount * key.mDynamicStride;
+}
+
+ParticleCache::~ParticleCache()
+{
+    munmap( (void*)mData, mSize );
+}
+
+fs::path ParticleCache::getPath( const string& name, const Key& key )
+{
+    return getTemporaryDirectory() / ( name + "_particles_" + to_string( key.mSeed ) + "_" + to_string( key.mCount ) + ".bin" );
+}
+
+ParticleCacheRef ParticleCache::load( const fs::path& path, const Key& key )
+{
+    const int fd = ::open( path.string().c_str(), O_RDONLY );
+    if( fd < 0 ) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if( fstat( fd, &st ) != 0 || (size_t)st.st_size != getFileSize( key ) ) {
+        console() << "Particle cache " << path << " doesn't match, generating again" << endl;
+        ::close( fd );
+        return nullptr;
+    }
+
+    void* data = mmap( nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+    if( data == MAP_FAILED ) {
+        console() << "Cannot map particle cache " << path << endl;
+        return nullptr;
+    }
+
+    Header header;
+    memcpy( &header, data, sizeof(Header) );
+    if( header.mMagic != MAGIC || header.mVersion != VERSION || header.mKey != key ) {
+        console() << "Particle cache " << path << " doesn't match, generating again" << endl;
+        munmap( data, (size_t)st.st_size );
+        return nullptr;
+    }
+
+    // It all goes to the VBOs in one pass, read it ahead
+    madvise( data, (size_t)st.st_size, MADV_WILLNEED );
+
+    return ParticleCacheRef( new ParticleCache( (const uint8_t*)data, (size_t)st.st_size, key ) );
+}
+
+bool ParticleCache::save( const fs::path& path, const Key& key, const void* dynamicData, const void* staticData )
+{
+    fs::path tmpPath = path;
+    tmpPath += ".tmp";
+
+    FILE* file = fopen( tmpPath.string().c_str(), "wb" );
+    if( !file ) {
+        console() << "Cannot create particle cache " << tmpPath << endl;
+        return false;
+    }
+
+    Header header;
+    header.mKey = key;
+
+    bool written = fwrite( &header, sizeof(Header), 1, file ) == 1;
+    written = written && fwrite( dynamicData, key.mDynamicStride, key.mCount, file ) == key.mCount;
+    if( key.mStaticStride > 0 ) {
+        written = written && fwrite( staticData, key.mStaticStride, key.mCount, file ) == key.mCount;
+    }
+    written = fclose( file ) == 0 && written;
+
+    if( !written || rename( tmpPath.string().c_str(), path.string().c_str() ) != 0 ) {
+        console() << "Cannot write particle cache " << path << endl;
+        remove( tmpPath.string().c_str() );
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,195 @@
+//
+//  CounterRand.cpp
+//  Entrainment
+//
+
+#include "CounterRand.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+const uint32_t  PHILOX_M0 = 0xD2511F53;
+const uint32_t  PHILOX_M1 = 0xCD9E8D57;
+const uint32_t  PHILOX_W0 = 0x9E3779B9;
+const uint32_t  PHILOX_W1 = 0xBB67AE85;
+const int       PHILOX_ROUNDS = 10;
+
+// Top 24 bits, every one of them lands exactly in a float's mantissa
+const float     TO_UNIT = 1.0f / 16777216.0f;
+
+// Blocks per vector, as wide as the registers of the target
+#if defined( __AVX__ )
+const size_t LANES = 8;
+typedef uint32_t    UintV   __attribute__(( vector_size( 32 ) ));
+typedef uint64_t    Uint64V __attribute__(( vector_size( 64 ) ));
+typedef float       FloatV  __attribute__(( vector_size( 32 ) ));
+#else
+const size_t LANES = 4;
+typedef uint32_t    UintV   __attribute__(( vector_size( 16 ) ));
+typedef uint64_t    Uint64V __attribute__(( vector_size( 32 ) ));
+typedef float       FloatV  __attribute__(( vector_size( 16 ) ));
+#endif
+
+struct Block
+{
+    uint32_t    mWords[4];
+};
+
+Block philox( uint64_t block, uint64_t stream, uint64_t seed )
+{
+    uint32_t c0 = (uint32_t)block, c1 = (uint32_t)( block >> 32 );
+    uint32_t c2 = (uint32_t)stream, c3 = (uint32_t)( stream >> 32 );
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)( seed >> 32 );
+
+    for( int r = 0; r < PHILOX_ROUNDS; r++ ) {
+        const uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        const uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)( p1 >> 32 ) ^ c1 ^ k0;
+        c1 = (uint32_t)p1;
+        c2 = (uint32_t)( p0 >> 32 ) ^ c3 ^ k1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    return Block{ { c0, c1, c2, c3 } };
+}
+
+// philox() for LANES consecutive blocks starting at \a block
+void philox( uint64_t block, uint64_t stream, uint64_t seed, UintV (&words)[4] )
+{
+    UintV lane;
+    for( size_t i = 0; i < LANES; i++ ) {
+        lane[i] = (uint32_t)i;
+    }
+
+    // Carry into the high word where the low one wrapped, comparisons are -1 per true lane
+    UintV c0 = (uint32_t)block + lane;
+    UintV c1 = UintV{} + (uint32_t)( block >> 32 );
+    c1 -= (UintV)( c0 < lane );
+    UintV c2 = UintV{} + (uint32_t)stream;
+    UintV c3 = UintV{} + (uint32_t)( stream >> 32 );
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)( seed >> 32 );
+
+    for( int r = 0; r < PHILOX_ROUNDS; r++ ) {
+        const Uint64V p0 = __builtin_convertvector( c0, Uint64V ) * (uint64_t)PHILOX_M0;
+        const Uint64V p1 = __builtin_convertvector( c2, Uint64V ) * (uint64_t)PHILOX_M1;
+        c0 = __builtin_convertvector( p1 >> 32, UintV ) ^ c1 ^ k0;
+        c1 = __builtin_convertvector( p1, UintV );
+        c2 = __builtin_convertvector( p0 >> 32, UintV ) ^ c3 ^ k1;
+        c3 = __builtin_convertvector( p0, UintV );
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    words[0] = c0;
+    words[1] = c1;
+    words[2] = c2;
+    words[3] = c3;
+}
+
+}
+
+
+uint32_t CounterRand::pickSeed( const vector<string>& args )
+{
+    auto arg = find( args.begin(), args.end(), "--seed" );
+    if( arg != args.end() && ++arg != args.end() ) {
+        return (uint32_t)strtoul( arg->c_str(), nullptr, 10 );
+    }
+
+    // Through one Philox block, so launches a tick apart still get unrelated seeds
+    const uint64_t ticks = (uint64_t)chrono::high_resolution_clock::now().time_since_epoch().count();
+    return CounterRand( ticks ).getUint( 0, 0 );
+}
+
+uint32_t CounterRand::getUint( uint64_t stream, uint64_t index ) const
+{
+    return philox( index / 4, stream, mSeed ).mWords[index % 4];
+}
+
+float CounterRand::getFloat( uint64_t stream, uint64_t index ) const
+{
+    return getFloat( stream, index, 0.0f, 1.0f );
+}
+
+float CounterRand::getFloat( uint64_t stream, uint64_t index, float min, float max ) const
+{
+    // Separate statements so no compiler fuses them into an fma here but not in fill()
+    const float f = (float)( getUint( stream, index ) >> 8 ) * ( ( max - min ) * TO_UNIT );
+    return min + f;
+}
+
+vec3 CounterRand::getVec3( uint64_t stream, uint64_t index ) const
+{
+    return toVec3( getFloat( stream, index * 2 ), getFloat( stream, index * 2 + 1 ) );
+}
+
+void CounterRand::fill( float* out, size_t count, uint64_t stream, uint64_t offset, float min, float max ) const
+{
+    const size_t GROUP = LANES * 4;
+    const float scale = ( max - min ) * TO_UNIT;
+    size_t i = 0;
+
+    // One at a time up to a block boundary, then whole groups of blocks
+    for( ; i < count && ( offset + i ) % 4 != 0; i++ ) {
+        out[i] = getFloat( stream, offset + i, min, max );
+    }
+
+    UintV words[4];
+    for( ; count - i >= GROUP; i += GROUP ) {
+        philox( ( offset + i ) / 4, stream, mSeed, words );
+
+        FloatV values[4];
+        for( int w = 0; w < 4; w++ ) {
+            const FloatV f = __builtin_convertvector( words[w] >> 8, FloatV ) * scale;
+            values[w] = min + f;
+        }
+
+        // Block by block, word by word
+        float* dst = out + i;
+        for( size_t lane = 0; lane < LANES; lane++ ) {
+            dst[lane * 4 + 0] = values[0][lane];
+            dst[lane * 4 + 1] = values[1][lane];
+            dst[lane * 4 + 2] = values[2][lane];
+            dst[lane * 4 + 3] = values[3][lane];
+        }
+    }
+
+    for( ; i < count; i++ ) {
+        out[i] = getFloat( stream, offset + i, min, max );
+    }
+}
+
+void CounterRand::fillVec3( vec3* out, size_t count, uint64_t stream, uint64_t offset ) const
+{
+    const size_t CHUNK = 512;
+    float uv[CHUNK * 2];
+
+    for( size_t i = 0; i < count; i += CHUNK ) {
+        const size_t n = std::min( CHUNK, count - i );
+        fill( uv, n * 2, stream, ( offset + i ) * 2 );
+        for( size_t j = 0; j < n; j++ ) {
+            out[i + j] = toVec3( uv[j * 2], uv[j * 2 + 1] );
+        }
+    }
+}
+
+vec3 CounterRand::Stream::nextVec3()
+{
+    const float u = nextFloat();
+    const float v = nextFloat();
+    return toVec3( u, v );
+}
+
+vec3 CounterRand::toVec3( float u, float v )
+{
+    const float z = 1.0f - 2.0f * u;
+    const float a = 2.0f * (float)M_PI * v;
+    const float r = std::sqrt( std::max( 0.0f, 1.0f - z * z ) );
+    return vec3( r * std::cos( a ), r * std::sin( a ), z );
+}
@@ -7,28 +7,37 @@
 
 #include "DrawSave.hpp"
 #include "Config.hpp"
-#include "cinder/Rand.h"
+#include "CounterRand.hpp"
 
 
+enum { RAND_POSITION, RAND_ANGLE, RAND_DATA_Y, RAND_DATA_Z, RAND_EXTRA };
+
 void DrawSave::draw(gl::FboRef mFbo) {
     
     int NUM_PARTICLES = Config::getInstance().NUM_PARTICLES;
-    vector<vec3> positions;
-    vector<vec2> uvs;
-    vector<vec3> extras;
-    vector<vec3> data;
+    size_t total = NUM_PARTICLES * NUM_PARTICLES;
+    vector<vec3> positions( total );
+    vector<vec2> uvs( total );
+    vector<vec3> extras( total );
+    vector<vec3> data( total );
+    vector<float> angle( total ), dataY( total ), dataZ( total );
     float num = float(NUM_PARTICLES);
     
+    // Every value is a function of ( seed, stream, i * NUM_PARTICLES + j ), batched per attribute
+    CounterRand rand( mSeed );
+    rand.fillVec3( positions.data(), total, RAND_POSITION, 0 );
+    rand.fill( angle.data(), total, RAND_ANGLE, 0, 0.0f, M_PI * 2.0 );
+    rand.fill( dataY.data(), total, RAND_DATA_Y, 0 );
+    rand.fill( dataZ.data(), total, RAND_DATA_Z, 0 );
+    rand.fillVec3( extras.data(), total, RAND_EXTRA, 0 );
+    
     for(int i=0; i<NUM_PARTICLES; i++) {
         for(int j=0; j<NUM_PARTICLES; j++) {
-            vec3 p = randVec3();
-            
-            positions.push_back(p);
+            size_t index = i * NUM_PARTICLES + j;
             float u = i/num * 2.0f - 1.0f;
             float v = j/num * 2.0f - 1.0f;
-            uvs.push_back(vec2(u, v));
-            data.push_back(vec3(randFloat(M_PI * 2.0), randFloat(), randFloat()));
-            extras.push_back(randVec3());
+            uvs[index] = vec2(u, v);
+            data[index] = vec3(angle[index], dataY[index], dataZ[index]);
         }
     }
     
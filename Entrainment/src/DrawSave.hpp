@@ -20,11 +20,15 @@ using namespace std;
 class DrawSave {
 public:
     
-    DrawSave() {
+    // Same seed, same initial state
+    DrawSave( uint32_t seed ) : mSeed( seed ) {
         
     }
     
     void draw(gl::FboRef);
+    
+private:
+    uint32_t mSeed;
 };
 
 
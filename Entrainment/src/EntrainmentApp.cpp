@@ -7,6 +7,7 @@
 #include "CinderARKit.h"
 #include "FboPingPong.hpp"
 #include "DrawSave.hpp"
+#include "CounterRand.hpp"
 #include "DrawParticles.hpp"
 
 using namespace ci;
@@ -61,7 +62,10 @@ void EntrainmentApp::setup()
    
    mFbo = FboPingPong::create(size, size, format1, format2);
    
-   DrawSave* drawSave = new DrawSave();
+   // --seed N starts from the same particles again
+   uint32_t seed = CounterRand::pickSeed( getCommandLineArgs() );
+   console() << "Particle seed " << seed << ", run with --seed " << seed << " for the same particles" << endl;
+   DrawSave* drawSave = new DrawSave( seed );
    drawSave->draw(mFbo->read());
     
     // draw calls
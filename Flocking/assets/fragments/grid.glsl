@@ -0,0 +1,27 @@
+// Uniform grid over the boids, built by DrawGrid. Cells are at least as wide
+// as the largest sense radius, so every neighbour of a boid is in one of the 27
+// cells around its own. Boids outside of the grid are clamped into its border
+// cells, which keeps that true.
+
+uniform int     uGridSize;
+uniform float   uCellSize;
+uniform int     uSortWidth;
+
+ivec3 getCell(vec3 pos) {
+    ivec3 cell = ivec3(floor(pos / uCellSize)) + uGridSize / 2;
+    return clamp(cell, ivec3(0), ivec3(uGridSize - 1));
+}
+
+int getCellIndex(ivec3 cell) {
+    return (cell.z * uGridSize + cell.y) * uGridSize + cell.x;
+}
+
+// The cell table is uGridSize * uGridSize wide and uGridSize high
+ivec2 getCellTexel(ivec3 cell) {
+    return ivec2(cell.x + cell.y * uGridSize, cell.z);
+}
+
+// Entry i of the sorted ( cell, boid ) list
+ivec2 getSortTexel(int i) {
+    return ivec2(i % uSortWidth, i / uSortWidth);
+}
@@ -0,0 +1,21 @@
+// What a boid's neighbours read of it, written next to the full state by the
+// update pass: position and cycle in one RGBA32F texel, the direction it heads
+// in as an octahedral unit vector in one RG16F texel. 20 bytes a neighbour
+// instead of 48 for the position, velocity and data texels.
+
+vec2 octahedronWrap(vec2 v) {
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encodeDirection(vec3 v) {
+    vec3 n = v / (abs(v.x) + abs(v.y) + abs(v.z));
+    return n.z >= 0.0 ? n.xy : octahedronWrap(n.xy);
+}
+
+vec3 decodeDirection(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
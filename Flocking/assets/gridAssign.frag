@@ -0,0 +1,20 @@
+#version 330 core
+#include "./fragments/grid.glsl"
+
+uniform sampler2D uTexPos;
+uniform int uNum;
+
+out vec4 oFragColor;
+
+void main( void )
+{
+    int i = int(gl_FragCoord.y) * uSortWidth + int(gl_FragCoord.x);
+    if(i >= uNum * uNum) {
+        // padding up to a power of two, sorted after every cell
+        oFragColor = vec4(float(uGridSize * uGridSize * uGridSize), -1.0, 0.0, 1.0);
+        return;
+    }
+
+    vec3 pos = texelFetch(uTexPos, ivec2(i % uNum, i / uNum), 0).xyz;
+    oFragColor = vec4(float(getCellIndex(getCell(pos))), float(i), 0.0, 1.0);
+}
@@ -0,0 +1,10 @@
+#version 330 core
+
+in vec2 vRange;
+
+out vec4 oFragColor;
+
+void main( void )
+{
+    oFragColor = vec4(vRange, 0.0, 1.0);
+}
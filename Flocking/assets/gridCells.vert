@@ -0,0 +1,31 @@
+#version 330 core
+#include "./fragments/grid.glsl"
+
+uniform sampler2D uTexSort;
+uniform int uNum;
+
+out vec2 vRange;
+
+void main( void )
+{
+    int i = gl_VertexID;
+    float cell = texelFetch(uTexSort, getSortTexel(i), 0).x;
+    bool isFirst = i == 0 || texelFetch(uTexSort, getSortTexel(i - 1), 0).x != cell;
+    bool isLast = i == uNum * uNum - 1 || texelFetch(uTexSort, getSortTexel(i + 1), 0).x != cell;
+
+    gl_PointSize = 1.0;
+    vRange = vec2(0.0);
+    if(!isFirst && !isLast) {
+        // nothing to write, outside of the clip volume
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    int c = int(cell);
+    ivec3 cellPos = ivec3(c % uGridSize, (c / uGridSize) % uGridSize, c / (uGridSize * uGridSize));
+    vec2 texel = vec2(getCellTexel(cellPos)) + 0.5;
+    gl_Position = vec4(texel / vec2(uGridSize * uGridSize, uGridSize) * 2.0 - 1.0, 0.0, 1.0);
+
+    // blended with the other end of the cell into [start, end)
+    vRange = vec2(isFirst ? float(i) : 0.0, isLast ? float(i + 1) : 0.0);
+}
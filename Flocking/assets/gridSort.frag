@@ -0,0 +1,25 @@
+#version 330 core
+#include "./fragments/grid.glsl"
+
+uniform sampler2D uTexSort;
+// length of the sequences being merged, and distance between the compared entries
+uniform int uStage;
+uniform int uStep;
+
+out vec4 oFragColor;
+
+bool isLess(vec2 a, vec2 b) {
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+}
+
+void main( void )
+{
+    int i = int(gl_FragCoord.y) * uSortWidth + int(gl_FragCoord.x);
+    int partner = i ^ uStep;
+    vec2 a = texelFetch(uTexSort, getSortTexel(i), 0).xy;
+    vec2 b = texelFetch(uTexSort, getSortTexel(partner), 0).xy;
+
+    // ascending where the uStage bit of i is clear, the lower entry of a pair keeps the smaller one
+    bool keepSmaller = ((i & uStage) == 0) == (i < partner);
+    oFragColor = vec4(keepSmaller == isLess(a, b) ? a : b, 0.0, 1.0);
+}
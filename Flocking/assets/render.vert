@@ -7,6 +7,8 @@ in vec2 inUV;
 
 uniform sampler2D texturePos;
 uniform sampler2D textureData;
+uniform sampler2D texturePosPrev;
+uniform float uAlpha;
 
 out vec3 vColor;
 
@@ -16,7 +18,7 @@ const float radius = 0.04;
 
 void main( void )
 {
-    vec3 pos = texture(texturePos, inUV).xyz;
+    vec3 pos = mix(texture(texturePosPrev, inUV).xyz, texture(texturePos, inUV).xyz, uAlpha);
     vec3 data = texture(textureData, inUV).xyz;
 	gl_Position	= ciModelViewProjection * vec4(pos, 1.0);
 
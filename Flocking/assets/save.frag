@@ -1,4 +1,5 @@
 #version 330 core
+#include "./fragments/neighbor.glsl"
 
 in vec3 vPosition;
 in vec3 vData;
@@ -8,16 +9,21 @@ layout (location = 0) out vec4 oFragColor0;
 layout (location = 1) out vec4 oFragColor1;
 layout (location = 2) out vec4 oFragColor2;
 layout (location = 3) out vec4 oFragColor3;
+layout (location = 4) out vec4 oFragColor4;
+layout (location = 5) out vec4 oFragColor5;
 
 #define PI 3.141592653
 
 void main( void )
 {
     oFragColor0 = vec4(vPosition, 1.0);
-    oFragColor1 = vec4(vExtra.zxy * 0.01, 1.0);
+    vec3 vel = vExtra.zxy * 0.01;
+    oFragColor1 = vec4(vel, 1.0);
     oFragColor2 = vec4(vData, 1.0);
 
     vec3 extra = vExtra * .5 + .5;
     extra.x *= PI;
     oFragColor3 = vec4(extra, 1.0);
+    oFragColor4 = vec4(vPosition, vData.x);
+    oFragColor5 = vec4(encodeDirection(vel), 0.0, 1.0);
 }
@@ -1,6 +1,8 @@
 #version 330 core
 #include "./fragments/curlNoise.glsl"
 #include "./fragments/map.glsl"
+#include "./fragments/grid.glsl"
+#include "./fragments/neighbor.glsl"
 
 in vec2 vUV;
 
@@ -8,13 +10,23 @@ uniform sampler2D uTexPos;
 uniform sampler2D uTexVel;
 uniform sampler2D uTexData;
 uniform sampler2D uTexExtra;
+// what the neighbour loop reads, see fragments/neighbor.glsl
+uniform sampler2D uTexNeighborPos;
+uniform sampler2D uTexNeighborDir;
+// boids sorted by cell and where each cell starts and ends in that list, from DrawGrid
+uniform sampler2D uTexSort;
+uniform sampler2D uTexCells;
 uniform float uTime;
 uniform int uNum;
+// Length of the step in steps of 1/60s, what the constants below are tuned for
+uniform float uStepScale;
 
 layout (location = 0) out vec4 oFragColor0;
 layout (location = 1) out vec4 oFragColor1;
 layout (location = 2) out vec4 oFragColor2;
 layout (location = 3) out vec4 oFragColor3;
+layout (location = 4) out vec4 oFragColor4;
+layout (location = 5) out vec4 oFragColor5;
 
 // int NUM = 80;
 
@@ -43,21 +55,28 @@ void main( void )
 
     vec3 acc = vec3(0.0);
 
-    // flocking
-    vec2 uvParticles = vec2(0.0);
-    vec3 posParticle, velParticle, dataParticle;
+    // flocking, with the boids of the 27 cells around this one
+    ivec2 texelParticle;
+    vec4 neighbor;
+    vec3 posParticle, dirParticle;
     float cycleParticle, d0, d1, d;
-    float num = 80.0;
     float senseRadius = mix(1.0, 1.5, extra.b) * maxSenseRadius;
 
-    
+    ivec3 cell = getCell(pos);
+    ivec3 cellMin = max(cell - 1, ivec3(0));
+    ivec3 cellMax = min(cell + 1, ivec3(uGridSize - 1));
+
+    for(int z=cellMin.z; z<=cellMax.z; z++) {
+    for(int y=cellMin.y; y<=cellMax.y; y++) {
+    for(int x=cellMin.x; x<=cellMax.x; x++) {
+        vec2 range = texelFetch(uTexCells, getCellTexel(ivec3(x, y, z)), 0).xy;
 
-    for(float i=0.0; i<uNum; i++) {
-        for(float j=0.0; j<uNum; j++) {
-            uvParticles = vec2(i/num, j/num);
-            posParticle = texture(uTexPos, uvParticles).xyz;
-            velParticle = texture(uTexVel, uvParticles).xyz;
-            dataParticle = texture(uTexData, uvParticles).xyz;
+        for(int i=int(range.x); i<int(range.y); i++) {
+            int index = int(texelFetch(uTexSort, getSortTexel(i), 0).y);
+            texelParticle = ivec2(index % uNum, index / uNum);
+            neighbor = texelFetch(uTexNeighborPos, texelParticle, 0);
+            posParticle = neighbor.xyz;
+            dirParticle = decodeDirection(texelFetch(uTexNeighborDir, texelParticle, 0).xy);
 
             dist = distance(pos, posParticle);
             if(dist > 0.0 && dist < senseRadius) {
@@ -77,7 +96,7 @@ void main( void )
                 }
 
                 // alignment
-                dir = (normalize(vel) + normalize(velParticle)) * 0.5;
+                dir = (normalize(vel) + dirParticle) * 0.5;
                 // dir = (normalize(velParticle) - normalize(vel) );
                 // dir = normalize(dir);
                 f = sin(p * PI);
@@ -87,7 +106,7 @@ void main( void )
                 // dirAlignment += normalize(velParticle) * f;
 
                 // flash sync - Entrainment
-                cycleParticle = dataParticle.x;
+                cycleParticle = neighbor.w;
 
                 if(cycleParticle > cycle) {
                     d0 = cycleParticle - cycle;
@@ -100,12 +119,14 @@ void main( void )
                 }
 
                 if(dist < senseRadius * 0.5) {
-                    cycle += d * flashEasing * mix(0.5, 1.0, extra.r);
+                    cycle += d * flashEasing * mix(0.5, 1.0, extra.r) * uStepScale;
                 }
                 
             } 
         }
     }
+    }
+    }
 
     // if(numNeighbors > 0.0) {
     //     dirAlignment /= numNeighbors;
@@ -131,19 +152,19 @@ void main( void )
     t = mix(0.25, 1.0, extra.g) * uTime + extra.b;
     t = sin(t) * .5 + .5;
     float speedOffset = mix(0.5, 1.0, t);
-    vel += acc * 0.0005 * speedOffset;
+    vel += acc * 0.0005 * speedOffset * uStepScale;
 
     if(length(vel) > maxSpeed) {
         vel = normalize(vel) * maxSpeed;
     }
 
-    pos += vel;
+    pos += vel * uStepScale;
 
-    vel *= 0.97;
+    vel *= pow(0.97, uStepScale);
 
 
     float cycleSpeed = mix(0.25, 1.0, data.y) * 0.05;
-    cycle += cycleSpeed;
+    cycle += cycleSpeed * uStepScale;
     data.x = mod(cycle, PI2);
 
 
@@ -151,4 +172,6 @@ void main( void )
     oFragColor1 = vec4(vel, 1.0);
     oFragColor2 = vec4(data, 1.0);
     oFragColor3 = vec4(extra, 1.0);
+    oFragColor4 = vec4(pos, data.x);
+    oFragColor5 = vec4(encodeDirection(vel), 0.0, 1.0);
 }
@@ -23,7 +23,17 @@ static Config& getInstance()
                         
     return instance;
 }
+    // Boids per side of the state textures, NUM_PARTICLES^2 in all. Set at launch
+    // with --boids N, --boids large for LARGE_NUM_PARTICLES
     int NUM_PARTICLES = 80;
+    const int LARGE_NUM_PARTICLES = 256;
+    const int MAX_NUM_PARTICLES = 1024;
+    // Neighbour search grid, GRID_SIZE^3 cells around the origin. CELL_SIZE can't
+    // be smaller than the largest sense radius of update.frag, 1.5 * maxSenseRadius
+    int GRID_SIZE = 16;
+    float CELL_SIZE = 3.0f;
+    // Flocking steps a second, drawn in between at the display rate
+    double SIM_RATE = 30.0;
 private:
     Config() {
         
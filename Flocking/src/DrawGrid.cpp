@@ -0,0 +1,115 @@
+//
+//  DrawGrid.cpp
+//  Flocking
+//
+
+#include "DrawGrid.hpp"
+#include "Config.hpp"
+
+void DrawGrid::_init() {
+    int NUM_PARTICLES = Config::getInstance().NUM_PARTICLES;
+    int GRID_SIZE = Config::getInstance().GRID_SIZE;
+    
+    // The bitonic sort wants a power of two, as square as it gets
+    int count = 1;
+    while( count < NUM_PARTICLES * NUM_PARTICLES ) {
+        count <<= 1;
+    }
+    int bits = 0;
+    while( ( 1 << bits ) < count ) {
+        bits++;
+    }
+    mSortWidth = 1 << ( ( bits + 1 ) / 2 );
+    mSortHeight = count / mSortWidth;
+    console() << "Init draw grid, " << GRID_SIZE << "^3 cells, sorting " << mSortWidth << "x" << mSortHeight << endl;
+    
+    auto texFormat = gl::Texture::Format().internalFormat( GL_RG32F ).dataType(GL_FLOAT).minFilter(GL_NEAREST).magFilter(GL_NEAREST);
+    gl::Fbo::Format format1;
+    format1.attachment( GL_COLOR_ATTACHMENT0, gl::Texture2d::create( mSortWidth, mSortHeight, texFormat ) ).disableDepth();
+    gl::Fbo::Format format2;
+    format2.attachment( GL_COLOR_ATTACHMENT0, gl::Texture2d::create( mSortWidth, mSortHeight, texFormat ) ).disableDepth();
+    mSort = FboPingPong::create(mSortWidth, mSortHeight, format1, format2);
+    
+    gl::Fbo::Format formatCells;
+    formatCells.attachment( GL_COLOR_ATTACHMENT0, gl::Texture2d::create( GRID_SIZE * GRID_SIZE, GRID_SIZE, texFormat ) ).disableDepth();
+    mCells = gl::Fbo::create(GRID_SIZE * GRID_SIZE, GRID_SIZE, formatCells);
+    
+    mShaderAssign = gl::GlslProg::create(gl::GlslProg::Format()
+        .vertex( loadAsset( "update.vert" ) )
+        .fragment( loadAsset("gridAssign.frag") )
+    );
+    mShaderSort = gl::GlslProg::create(gl::GlslProg::Format()
+        .vertex( loadAsset( "update.vert" ) )
+        .fragment( loadAsset("gridSort.frag") )
+    );
+    mShaderCells = gl::GlslProg::create(gl::GlslProg::Format()
+        .vertex( loadAsset( "gridCells.vert" ) )
+        .fragment( loadAsset("gridCells.frag") )
+    );
+    
+    auto plane = gl::VboMesh::create( geom::Plane() );
+    mBatchAssign = gl::Batch::create(plane, mShaderAssign);
+    mBatchSort = gl::Batch::create(plane, mShaderSort);
+    // Everything comes from gl_VertexID
+    mVaoCells = gl::Vao::create();
+}
+
+void DrawGrid::setUniforms(gl::GlslProgRef shader) {
+    shader->uniform( "uGridSize", Config::getInstance().GRID_SIZE );
+    shader->uniform( "uCellSize", Config::getInstance().CELL_SIZE );
+    shader->uniform( "uSortWidth", mSortWidth );
+}
+
+void DrawGrid::render(gl::FboRef mFbo) {
+    int NUM_PARTICLES = Config::getInstance().NUM_PARTICLES;
+    
+    gl::ScopedMatrices matScope;
+    gl::ScopedDepth depthScope( false );
+    
+    {
+        gl::ScopedViewport viewport( vec2( 0.0f ), mSort->write()->getSize() );
+        
+        // Cell of every boid
+        {
+            gl::ScopedFramebuffer fbo( mSort->write() );
+            gl::ScopedGlslProg glslScope( mShaderAssign );
+            gl::ScopedTextureBind tex0( mFbo->getTexture2d(GL_COLOR_ATTACHMENT0), (uint8_t) 0 );
+            mShaderAssign->uniform( "uTexPos", 0 );
+            mShaderAssign->uniform( "uNum", NUM_PARTICLES );
+            setUniforms( mShaderAssign );
+            mBatchAssign->draw();
+        }
+        mSort->swap();
+        
+        // Sorted by cell, log2(n) * ( log2(n) + 1 ) / 2 passes
+        gl::ScopedGlslProg glslScope( mShaderSort );
+        mShaderSort->uniform( "uTexSort", 0 );
+        setUniforms( mShaderSort );
+        for( int stage = 2; stage <= mSortWidth * mSortHeight; stage <<= 1 ) {
+            for( int step = stage >> 1; step > 0; step >>= 1 ) {
+                gl::ScopedFramebuffer fbo( mSort->write() );
+                gl::ScopedTextureBind tex0( mSort->read()->getColorTexture(), (uint8_t) 0 );
+                mShaderSort->uniform( "uStage", stage );
+                mShaderSort->uniform( "uStep", step );
+                mBatchSort->draw();
+                mSort->swap();
+            }
+        }
+    }
+    
+    // Where every cell starts and ends
+    gl::ScopedFramebuffer fbo( mCells );
+    gl::ScopedViewport viewport( vec2( 0.0f ), mCells->getSize() );
+    gl::clear( Color( 0, 0, 0 ) );
+    
+    gl::ScopedBlendAdditive blendScope;
+    gl::ScopedGlslProg glslScope( mShaderCells );
+    gl::ScopedTextureBind tex0( mSort->read()->getColorTexture(), (uint8_t) 0 );
+    mShaderCells->uniform( "uTexSort", 0 );
+    mShaderCells->uniform( "uNum", NUM_PARTICLES );
+    setUniforms( mShaderCells );
+    
+    gl::ScopedVao vao( mVaoCells );
+    gl::setDefaultShaderVars();
+    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES * NUM_PARTICLES );
+}
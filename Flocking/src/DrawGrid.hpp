@@ -0,0 +1,66 @@
+//
+//  DrawGrid.hpp
+//  Flocking
+//
+//  Sorts the boids by grid cell before every update, so update.frag only
+//  visits the 27 cells around a boid instead of every other boid. Fragment
+//  passes only, nothing past GL 3.3:
+//
+//  - gridAssign.frag writes ( cell, boid ) for every boid, padded to a power of two
+//  - gridSort.frag bitonic sorts those by cell, one pass per merge step
+//  - gridCells.vert puts the first and last entry of each cell into a
+//    uGridSize^3 table with additive blending, [start, end) of the cell
+//
+
+#ifndef DrawGrid_hpp
+#define DrawGrid_hpp
+
+#include <stdio.h>
+#include "cinder/gl/gl.h"
+#include "FboPingPong.hpp"
+
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+typedef std::shared_ptr<class DrawGrid> DrawGridRef;
+
+
+class DrawGrid {
+    
+public:
+    gl::GlslProgRef mShaderAssign;
+    gl::GlslProgRef mShaderSort;
+    gl::GlslProgRef mShaderCells;
+    gl::BatchRef    mBatchAssign;
+    gl::BatchRef    mBatchSort;
+    gl::VaoRef      mVaoCells;
+    
+    // ( cell, boid ) entries, sorted in mSort->read() after render()
+    FboPingPongRef  mSort;
+    // [start, end) of every cell in the sorted entries
+    gl::FboRef      mCells;
+    
+    int             mSortWidth;
+    int             mSortHeight;
+    
+    // methods
+    DrawGrid() {
+        _init();
+    }
+    
+    // Sorts the boids in \a mFbo, its positions
+    void render(gl::FboRef mFbo);
+    // Uniforms of fragments/grid.glsl, for a shader looking boids up
+    void setUniforms(gl::GlslProgRef shader);
+    
+    gl::Texture2dRef getSortTexture() { return mSort->read()->getColorTexture(); }
+    gl::Texture2dRef getCellTexture() { return mCells->getColorTexture(); }
+    
+    static DrawGridRef create() { return std::make_shared<DrawGrid>(); }
+    
+private:
+    void _init();
+};
+#endif /* DrawGrid_hpp */
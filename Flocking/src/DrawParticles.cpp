@@ -40,7 +40,7 @@ void DrawParticles::_init() {
 }
 
 
-void DrawParticles::render(gl::FboRef mFbo) {
+void DrawParticles::render(gl::FboRef mFbo, gl::FboRef prevFbo, float alpha) {
     int NUM_PARTICLES = Config::getInstance().NUM_PARTICLES;
     
     gl::ScopedGlslProg glsl(mShaderRender);
@@ -52,6 +52,10 @@ void DrawParticles::render(gl::FboRef mFbo) {
     gl::ScopedTextureBind texScope1( mFbo->getTexture2d(GL_COLOR_ATTACHMENT2), (uint8_t) 1 );
     mShaderRender->uniform( "textureData", 1 );
     
+    gl::ScopedTextureBind texScope2( prevFbo->getTexture2d(GL_COLOR_ATTACHMENT0), (uint8_t) 2 );
+    mShaderRender->uniform( "texturePosPrev", 2 );
+    mShaderRender->uniform( "uAlpha", alpha );
+    
     mShaderRender->uniform("uViewport", vec2(getWindowSize()));
     
     gl::drawArrays(GL_POINTS, 0, NUM_PARTICLES * NUM_PARTICLES);
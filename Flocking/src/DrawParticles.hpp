@@ -31,7 +31,8 @@ public:
         _init();
     }
     
-    void render(gl::FboRef);
+    // Positions mixed from \a prevFbo to \a mFbo by \a alpha
+    void render(gl::FboRef mFbo, gl::FboRef prevFbo, float alpha);
     
     static DrawParticlesRef create() { return std::make_shared<DrawParticles>(); }
     
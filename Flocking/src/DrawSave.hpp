@@ -22,11 +22,17 @@ using namespace std;
 
 class DrawSave {
 public:
+    // Random streams of the initial state, FlockCpu::init() draws the same ones
+    enum { RAND_POSITION, RAND_RADIUS, RAND_ANGLE, RAND_DATA_Y, RAND_DATA_Z, RAND_EXTRA };
     
-    DrawSave() {
+    // Same seed, same initial state
+    DrawSave( uint32_t seed ) : mSeed( seed ) {
         
     }
     
     void draw(gl::FboRef);
+    
+private:
+    uint32_t mSeed;
 };
 
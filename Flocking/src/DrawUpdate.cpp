@@ -22,7 +22,7 @@ void DrawUpdate::_init() {
     
 }
 
-void DrawUpdate::render(FboPingPongRef mFbo) { 
+void DrawUpdate::render(FboPingPongRef mFbo, DrawGridRef grid, float time, float stepScale) { 
     gl::ScopedFramebuffer fbo( mFbo->write() );
     gl::ScopedViewport viewport( vec2( 0.0f ), mFbo->write()->getSize() );
     gl::ScopedMatrices matScope;
@@ -42,7 +42,22 @@ void DrawUpdate::render(FboPingPongRef mFbo) {
     gl::ScopedTextureBind tex3( mFbo->read()->getTexture2d(GL_COLOR_ATTACHMENT3), (uint8_t) 3 );
     mShader->uniform( "uTexExtra", 3 );
     
-    mShader->uniform( "uTime", (float)getElapsedSeconds() * 0.1f );
+    // The neighbour loop only reads these two
+    gl::ScopedTextureBind tex6( mFbo->read()->getTexture2d(GL_COLOR_ATTACHMENT4), (uint8_t) 6 );
+    mShader->uniform( "uTexNeighborPos", 6 );
+    
+    gl::ScopedTextureBind tex7( mFbo->read()->getTexture2d(GL_COLOR_ATTACHMENT5), (uint8_t) 7 );
+    mShader->uniform( "uTexNeighborDir", 7 );
+    
+    gl::ScopedTextureBind tex4( grid->getSortTexture(), (uint8_t) 4 );
+    mShader->uniform( "uTexSort", 4 );
+    
+    gl::ScopedTextureBind tex5( grid->getCellTexture(), (uint8_t) 5 );
+    mShader->uniform( "uTexCells", 5 );
+    grid->setUniforms( mShader );
+    
+    mShader->uniform( "uTime", time * 0.1f );
+    mShader->uniform( "uStepScale", stepScale );
     mShader->uniform( "uNum", Config::getInstance().NUM_PARTICLES );
     
     mBatch->draw();
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include "cinder/gl/gl.h"
 #include "FboPingPong.hpp"
+#include "DrawGrid.hpp"
 
 
 using namespace ci;
@@ -32,7 +33,8 @@ public:
         _init();
     }
     
-    void render(FboPingPongRef mFbo);
+    // One step of \a stepScale steps at 60 a second, ending at \a time, with the neighbours in \a grid
+    void render(FboPingPongRef mFbo, DrawGridRef grid, float time, float stepScale);
     static DrawUpdateRef create() { return std::make_shared<DrawUpdate>(); }
     
 private:
@@ -0,0 +1,71 @@
+//
+//  DrawUpdateCompute.cpp
+//  Flocking
+//
+
+#include "DrawUpdateCompute.hpp"
+#include "Config.hpp"
+
+bool DrawUpdateCompute::isAvailable() {
+#if defined( CINDER_GL_HAS_COMPUTE_SHADER )
+    auto version = gl::getVersion();
+    return version.first > 4 || ( version.first == 4 && version.second >= 3 );
+#else
+    return false;
+#endif
+}
+
+void DrawUpdateCompute::_init() {
+#if defined( CINDER_GL_HAS_COMPUTE_SHADER )
+    console() << "Init draw update compute" << endl;
+    mShader = gl::GlslProg::create(gl::GlslProg::Format()
+        .compute( loadAsset( "update.comp" ) )
+    );
+#endif
+}
+
+void DrawUpdateCompute::render(FboPingPongRef mFbo, float time, float stepScale) {
+#if defined( CINDER_GL_HAS_COMPUTE_SHADER )
+    int NUM_PARTICLES = Config::getInstance().NUM_PARTICLES;
+    
+    gl::ScopedGlslProg glslScope( mShader );
+    gl::ScopedTextureBind tex0( mFbo->read()->getTexture2d(GL_COLOR_ATTACHMENT0), (uint8_t) 0 );
+    mShader->uniform( "uTexPos", 0 );
+    
+    gl::ScopedTextureBind tex1( mFbo->read()->getTexture2d(GL_COLOR_ATTACHMENT1), (uint8_t) 1 );
+    mShader->uniform( "uTexVel", 1 );
+    
+    gl::ScopedTextureBind tex2( mFbo->read()->getTexture2d(GL_COLOR_ATTACHMENT2), (uint8_t) 2 );
+    mShader->uniform( "uTexData", 2 );
+    
+    gl::ScopedTextureBind tex3( mFbo->read()->getTexture2d(GL_COLOR_ATTACHMENT3), (uint8_t) 3 );
+    mShader->uniform( "uTexExtra", 3 );
+    
+    gl::ScopedTextureBind tex4( mFbo->read()->getTexture2d(GL_COLOR_ATTACHMENT4), (uint8_t) 4 );
+    mShader->uniform( "uTexNeighborPos", 4 );
+    
+    gl::ScopedTextureBind tex5( mFbo->read()->getTexture2d(GL_COLOR_ATTACHMENT5), (uint8_t) 5 );
+    mShader->uniform( "uTexNeighborDir", 5 );
+    
+    mShader->uniform( "uTime", time * 0.1f );
+    mShader->uniform( "uStepScale", stepScale );
+    mShader->uniform( "uNum", NUM_PARTICLES );
+    
+    // The write side attachments as images 0 to 5, same order as the fragment outputs
+    GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5 };
+    for( GLuint i = 0; i < 6; i++ ) {
+        GLenum format = attachments[i] == GL_COLOR_ATTACHMENT5 ? GL_RG16F : GL_RGBA32F;
+        glBindImageTexture( i, mFbo->write()->getTexture2d( attachments[i] )->getId(), 0, GL_FALSE, 0, GL_WRITE_ONLY, format );
+    }
+    
+    int count = NUM_PARTICLES * NUM_PARTICLES;
+    gl::dispatchCompute( ( count + TILE_SIZE - 1 ) / TILE_SIZE );
+    
+    // Drawing and the next step read the result as textures
+    gl::memoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT );
+    
+    for( GLuint i = 0; i < 6; i++ ) {
+        glBindImageTexture( i, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F );
+    }
+#endif
+}
@@ -0,0 +1,46 @@
+//
+//  DrawUpdateCompute.hpp
+//  Flocking
+//
+//  Same step as DrawUpdate, as the tiled compute shader of update.comp. Needs
+//  GL 4.3, so never on macOS, where DrawUpdate and its grid are all there is.
+//
+
+#ifndef DrawUpdateCompute_hpp
+#define DrawUpdateCompute_hpp
+
+#include <stdio.h>
+#include "cinder/gl/gl.h"
+#include "FboPingPong.hpp"
+
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+typedef std::shared_ptr<class DrawUpdateCompute> DrawUpdateComputeRef;
+
+
+class DrawUpdateCompute {
+    
+public:
+    // Boids per work group and per tile of update.comp
+    static const int TILE_SIZE = 256;
+    
+    gl::GlslProgRef mShader;
+    
+    // methods
+    DrawUpdateCompute() {
+        _init();
+    }
+    
+    // Same as DrawUpdate::render(), without a grid
+    void render(FboPingPongRef mFbo, float time, float stepScale);
+    static DrawUpdateComputeRef create() { return std::make_shared<DrawUpdateCompute>(); }
+    
+    static bool isAvailable();
+    
+private:
+    void _init();
+};
+#endif /* DrawUpdateCompute_hpp */
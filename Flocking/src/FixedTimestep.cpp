@@ -0,0 +1,45 @@
+//
+//  FixedTimestep.cpp
+//  Flocking
+//
+
+#include "FixedTimestep.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+// Frame times that are a whole number of steps shouldn't lose one to rounding
+const double EPSILON = 1e-6;
+
+}
+
+
+constexpr double FixedTimestep::REFERENCE_RATE;
+
+FixedTimestep::FixedTimestep( double rate, int maxSteps )
+: mDelta( 1.0 / rate )
+, mMaxSteps( maxSteps )
+{
+}
+
+int FixedTimestep::update( double seconds )
+{
+    if( mLastSeconds < 0.0 ) {
+        mLastSeconds = seconds;
+    }
+    mAccumulator += seconds - mLastSeconds;
+    mLastSeconds = seconds;
+
+    mSteps = std::min( (int)( ( mAccumulator + EPSILON ) / mDelta ), mMaxSteps );
+    mAccumulator = std::max( mAccumulator - mSteps * mDelta, 0.0 );
+    // Too far behind, catching up over the next frames would only make them slower
+    if( mAccumulator >= mDelta ) {
+        mAccumulator = std::fmod( mAccumulator, mDelta );
+    }
+
+    mTime += mSteps * mDelta;
+    return mSteps;
+}
@@ -0,0 +1,185 @@
+//
+//  FlockCheckpoint.cpp
+//  Flocking
+//
+
+#include "FlockCheckpoint.hpp"
+#include "Config.hpp"
+#include "cinder/app/App.h"
+#include "cinder/Timer.h"
+
+#include <cstring>
+
+namespace {
+
+const uint32_t  MAGIC   = 0x4B434C46;   // "FLCK"
+// Bump whenever the attachments change
+const uint32_t  VERSION = 1;
+const int       NUM_ATTACHMENTS = 4;
+
+struct Header
+{
+    uint32_t    mMagic      = MAGIC;
+    uint32_t    mVersion    = VERSION;
+    uint32_t    mSize       = 0;
+    uint32_t    mReserved   = 0;
+};
+
+}
+
+
+FlockCheckpoint::~FlockCheckpoint()
+{
+    if( mWriter.joinable() ) {
+        mWriter.join();
+    }
+}
+
+bool FlockCheckpoint::save( gl::FboRef fbo, const fs::path& path )
+{
+    if( isSaving() ) {
+        console() << "Still saving the flock to " << mPath << endl;
+        return false;
+    }
+    if( mWriter.joinable() ) {
+        mWriter.join();
+    }
+
+    mSize = fbo->getWidth();
+    mPath = path;
+    const size_t bytes = (size_t)mSize * mSize * sizeof(vec4);
+    if( !mPbo || mPbo->getSize() != bytes * NUM_ATTACHMENTS ) {
+        mPbo = gl::Pbo::create( GL_PIXEL_PACK_BUFFER, bytes * NUM_ATTACHMENTS, nullptr, GL_STREAM_READ );
+    }
+
+    // Into the buffer instead of client memory, so glReadPixels() returns right away
+    {
+        gl::ScopedFramebuffer scopedFbo( fbo, GL_READ_FRAMEBUFFER );
+        gl::ScopedBuffer scopedPbo( mPbo );
+        for( int i = 0; i < NUM_ATTACHMENTS; i++ ) {
+            gl::readBuffer( GL_COLOR_ATTACHMENT0 + i );
+            gl::readPixels( 0, 0, mSize, mSize, GL_RGBA, GL_FLOAT, reinterpret_cast<void*>( bytes * i ) );
+        }
+        gl::readBuffer( GL_COLOR_ATTACHMENT0 );
+    }
+    mSync = gl::Sync::create();
+
+    return true;
+}
+
+void FlockCheckpoint::update()
+{
+    if( !mSync ) {
+        return;
+    }
+
+    // Flushes the first time round so the fence gets anywhere, never waits
+    GLenum status = mSync->clientWaitSync( GL_SYNC_FLUSH_COMMANDS_BIT, 0 );
+    if( status == GL_TIMEOUT_EXPIRED ) {
+        return;
+    }
+    mSync.reset();
+    if( status == GL_WAIT_FAILED ) {
+        console() << "Cannot read the flock back for " << mPath << endl;
+        return;
+    }
+
+    const size_t bytes = (size_t)mSize * mSize * sizeof(vec4) * NUM_ATTACHMENTS;
+    mTexels.resize( (size_t)mSize * mSize * NUM_ATTACHMENTS );
+    {
+        gl::ScopedBuffer scopedPbo( mPbo );
+        void* texels = mPbo->mapBufferRange( 0, bytes, GL_MAP_READ_BIT );
+        if( !texels ) {
+            console() << "Cannot map the flock read back for " << mPath << endl;
+            return;
+        }
+        memcpy( mTexels.data(), texels, bytes );
+        mPbo->unmap();
+    }
+
+    mIsWriting = true;
+    mWriter = thread( &FlockCheckpoint::write, this );
+}
+
+void FlockCheckpoint::write()
+{
+    Timer timer( true );
+    fs::path tmpPath = mPath;
+    tmpPath += ".tmp";
+
+    const size_t count = (size_t)mSize * mSize;
+    vector<float> xyz( count * 3 );
+
+    bool written = false;
+    FILE* file = fopen( tmpPath.string().c_str(), "wb" );
+    if( file ) {
+        Header header;
+        header.mSize = mSize;
+        written = fwrite( &header, sizeof(Header), 1, file ) == 1;
+
+        for( int i = 0; i < NUM_ATTACHMENTS && written; i++ ) {
+            const vec4* texels = &mTexels[count * i];
+            for( size_t b = 0; b < count; b++ ) {
+                xyz[b * 3 + 0] = texels[b].x;
+                xyz[b * 3 + 1] = texels[b].y;
+                xyz[b * 3 + 2] = texels[b].z;
+            }
+            written = fwrite( xyz.data(), sizeof(float), xyz.size(), file ) == xyz.size();
+        }
+        written = fclose( file ) == 0 && written;
+    }
+
+    if( !written || rename( tmpPath.string().c_str(), mPath.string().c_str() ) != 0 ) {
+        console() << "Cannot write flock " << mPath << endl;
+        remove( tmpPath.string().c_str() );
+    } else {
+        console() << "Flock " << mSize << "x" << mSize << " saved to " << mPath << " in " << timer.getSeconds() * 1000.0 << " ms" << endl;
+    }
+
+    mIsWriting = false;
+}
+
+bool FlockCheckpoint::load( const fs::path& path, int& size, vector<vec4>& texels )
+{
+    FILE* file = fopen( path.string().c_str(), "rb" );
+    if( !file ) {
+        console() << "Cannot open flock " << path << endl;
+        return false;
+    }
+
+    // Checked against the file before anything is sized by the header
+    Header header;
+    bool loaded = fread( &header, sizeof(Header), 1, file ) == 1;
+    loaded = loaded && header.mMagic == MAGIC && header.mVersion == VERSION;
+    loaded = loaded && header.mSize > 0 && header.mSize <= (uint32_t)Config::getInstance().MAX_NUM_PARTICLES;
+    if( loaded ) {
+        uintmax_t payload = (uintmax_t)header.mSize * header.mSize * NUM_ATTACHMENTS * 3 * sizeof(float);
+        try {
+            loaded = fs::file_size( path ) >= sizeof(Header) + payload;
+        } catch( fs::filesystem_error& ) {
+            loaded = false;
+        }
+    }
+
+    vector<float> xyz;
+    if( loaded ) {
+        size = header.mSize;
+        const size_t count = (size_t)size * size;
+        xyz.resize( count * 3 );
+        texels.resize( count * NUM_ATTACHMENTS );
+
+        for( int i = 0; i < NUM_ATTACHMENTS && loaded; i++ ) {
+            loaded = fread( xyz.data(), sizeof(float), xyz.size(), file ) == xyz.size();
+            for( size_t b = 0; b < count && loaded; b++ ) {
+                texels[count * i + b] = vec4( xyz[b * 3], xyz[b * 3 + 1], xyz[b * 3 + 2], 1.0f );
+            }
+        }
+    }
+    fclose( file );
+
+    if( !loaded ) {
+        console() << "Flock " << path << " doesn't match, keeping the current one" << endl;
+        texels.clear();
+    }
+    return loaded;
+}
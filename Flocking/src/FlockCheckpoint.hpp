@@ -0,0 +1,73 @@
+//
+//  FlockCheckpoint.hpp
+//  Flocking
+//
+//  The state of a flock to a file and back, to pick a converged flock up again
+//  instead of starting over from DrawSave every launch.
+//
+
+#ifndef FlockCheckpoint_hpp
+#define FlockCheckpoint_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Fbo.h"
+#include "cinder/Filesystem.h"
+
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+typedef std::shared_ptr<class FlockCheckpoint> FlockCheckpointRef;
+
+/**  The four state attachments of the FboPingPong, position, velocity, data and
+     extra, as xyz floats after a small header. The w of all four is always 1
+     and the neighbour view is rebuilt from the rest, so neither is stored.
+
+     Saving never waits for the GPU: save() only queues the reads into a pixel
+     pack buffer and a fence behind them, update() picks the texels up once the
+     fence has passed, and a thread of its own writes the file.
+*/
+class FlockCheckpoint {
+
+public:
+    FlockCheckpoint() {}
+    ~FlockCheckpoint();
+
+    static FlockCheckpointRef create() { return std::make_shared<FlockCheckpoint>(); }
+
+    /**  Reads the state of \a fbo back to \a path over the next frames. False if
+         the last save is still underway.
+    */
+    bool save( gl::FboRef fbo, const fs::path& path );
+
+    // Once a frame, finishes a save whose reads have landed
+    void update();
+
+    bool isSaving() const               { return mSync || mIsWriting; }
+
+    /**  \a size x \a size boids from \a path, as RGBA texels of the four
+         attachments one after the other like FlockCpu::setTexels() takes them.
+         False for another format or version, a size past MAX_NUM_PARTICLES, or a
+         file shorter than its header says.
+    */
+    static bool load( const fs::path& path, int& size, vector<vec4>& texels );
+
+private:
+    void write();
+
+    gl::PboRef      mPbo;
+    gl::SyncRef     mSync;
+    int             mSize = 0;
+    fs::path        mPath;
+    // Owned by the writer while it runs
+    vector<vec4>    mTexels;
+    thread          mWriter;
+    atomic<bool>    mIsWriting{ false };
+};
+
+#endif /* FlockCheckpoint_hpp */
@@ -0,0 +1,487 @@
+//
+//  FlockCpu.cpp
+//  Flocking
+//
+
+#include "FlockCpu.hpp"
+#include "DrawSave.hpp"
+#include "CounterRand.hpp"
+#include "cinder/Timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace CpuSimd;
+
+namespace {
+
+// Constants of update.frag
+const float MAX_RADIUS          = 12.0f;
+const float MAX_SENSE_RADIUS    = 2.0f;
+const float MIN_THRESHOLD       = 0.2f;
+const float MAX_THRESHOLD       = 0.6f;
+const float MAX_SPEED           = 0.02f;
+const float FLASH_EASING        = 0.0005f;
+const float PI                  = 3.141592653f;
+const float PI2                 = PI * 2.0f;
+
+// Boids per chunk handed to a worker, a multiple of LANES, and cells per chunk
+// of the neighbour pass, where a cell can hold anything from none to hundreds
+const size_t GRAIN = 4096;
+const size_t CELL_GRAIN = 8;
+
+// sin() on [0, PI], all the neighbour loop takes it on. Taylor series of cos()
+// around PI / 2, within 5e-7
+inline FloatV sinHalfTurn( FloatV x )
+{
+    const FloatV y = x - PI * 0.5f;
+    const FloatV y2 = y * y;
+    return 1.0f + y2 * ( -1.0f / 2.0f + y2 * ( 1.0f / 24.0f + y2 * ( -1.0f / 720.0f + y2 * ( 1.0f / 40320.0f + y2 * ( -1.0f / 3628800.0f ) ) ) ) );
+}
+
+inline FloatV smoothstep( float edge0, float edge1, FloatV x )
+{
+    const FloatV t = vmin( vmax( ( x - edge0 ) / ( edge1 - edge0 ), splat( 0.0f ) ), splat( 1.0f ) );
+    return t * t * ( 3.0f - 2.0f * t );
+}
+
+inline bool any( IntV mask )
+{
+    for( size_t i = 0; i < LANES; i++ ) {
+        if( mask[i] ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline float sum( FloatV v )
+{
+    float s = 0.0f;
+    for( size_t i = 0; i < LANES; i++ ) {
+        s += v[i];
+    }
+    return s;
+}
+
+// encodeDirection() of fragments/neighbor.glsl
+vec2 encodeDirection( const vec3& v )
+{
+    const vec3 n = v / ( fabsf( v.x ) + fabsf( v.y ) + fabsf( v.z ) );
+    if( n.z >= 0.0f ) {
+        return vec2( n.x, n.y );
+    }
+    return vec2( ( 1.0f - fabsf( n.y ) ) * ( n.x >= 0.0f ? 1.0f : -1.0f ), ( 1.0f - fabsf( n.x ) ) * ( n.y >= 0.0f ? 1.0f : -1.0f ) );
+}
+
+void resize( vector<float>* arrays, size_t numArrays, size_t size )
+{
+    for( size_t i = 0; i < numArrays; i++ ) {
+        arrays[i].assign( size, 0.0f );
+    }
+}
+
+} // anonymous namespace
+
+
+//===== FlockCpu ===============================================================//
+
+FlockCpu::FlockCpu( size_t numThreads )
+    : mPool( numThreads > 0 ? numThreads : std::max( thread::hardware_concurrency(), 1u ) )
+{
+}
+
+void FlockCpu::setGrid( int gridSize, float cellSize )
+{
+    mGrid.mGridSize = gridSize;
+    mGrid.mCellSize = cellSize;
+}
+
+void FlockCpu::allocate( int size )
+{
+    const size_t count = (size_t)size * size;
+    const size_t padded = ( count + LANES - 1 ) / LANES * LANES;
+    mState.mSize = size;
+    mState.mCount = count;
+    resize( mState.mPos, 3, padded );
+    resize( mState.mVel, 3, padded );
+    resize( mState.mData, 3, padded );
+    resize( mState.mExtra, 3, padded );
+
+    // Padding sits on a valid position and moves so it can't produce NaNs
+    for( size_t i = count; i < padded; i++ ) {
+        mState.mPos[0][i] = 1.0f;
+        mState.mVel[2][i] = 1.0f;
+    }
+
+    mGrid.mCell.assign( count, 0 );
+    mGrid.mIndex.assign( count, 0 );
+    resize( mGrid.mPos, 3, count + LANES );
+    resize( mGrid.mDir, 3, count + LANES );
+    resize( &mGrid.mCycle, 1, count + LANES );
+    resize( mGrid.mAcc, 3, padded );
+    resize( &mGrid.mNeighbors, 1, padded );
+    resize( &mGrid.mSync, 1, padded );
+}
+
+void FlockCpu::init( int size, uint32_t seed )
+{
+    allocate( size );
+
+    // DrawSave's values, which it draws point i * size + j of onto texel ( i, j )
+    const size_t count = mState.mCount;
+    vector<vec3> positions( count ), extras( count );
+    vector<float> radius( count ), angle( count ), dataY( count ), dataZ( count );
+
+    CounterRand rand( seed );
+    rand.fillVec3( positions.data(), count, DrawSave::RAND_POSITION, 0 );
+    rand.fill( radius.data(), count, DrawSave::RAND_RADIUS, 0, 2.0f, 8.0f );
+    rand.fill( angle.data(), count, DrawSave::RAND_ANGLE, 0, 0.0f, M_PI * 2.0 );
+    rand.fill( dataY.data(), count, DrawSave::RAND_DATA_Y, 0 );
+    rand.fill( dataZ.data(), count, DrawSave::RAND_DATA_Z, 0 );
+    rand.fillVec3( extras.data(), count, DrawSave::RAND_EXTRA, 0 );
+
+    for( size_t b = 0; b < count; b++ ) {
+        const size_t i = ( b % size ) * size + b / size;
+
+        // What save.frag writes
+        const vec3 pos = positions[i] * radius[i];
+        const vec3 vel = vec3( extras[i].z, extras[i].x, extras[i].y ) * 0.01f;
+        vec3 extra = extras[i] * 0.5f + 0.5f;
+        extra.x *= PI;
+
+        for( int c = 0; c < 3; c++ ) {
+            mState.mPos[c][b] = pos[c];
+            mState.mVel[c][b] = vel[c];
+            mState.mExtra[c][b] = extra[c];
+        }
+        mState.mData[0][b] = angle[i];
+        mState.mData[1][b] = dataY[i];
+        mState.mData[2][b] = dataZ[i];
+    }
+}
+
+void FlockCpu::setTexels( int size, const vec4* pos, const vec4* vel, const vec4* data, const vec4* extra )
+{
+    allocate( size );
+
+    State& state = mState;
+    mPool.run( state.mCount, GRAIN, [&]( size_t begin, size_t end ) {
+        for( size_t b = begin; b < end; b++ ) {
+            for( int c = 0; c < 3; c++ ) {
+                state.mPos[c][b] = pos[b][c];
+                state.mVel[c][b] = vel[b][c];
+                state.mData[c][b] = data[b][c];
+                state.mExtra[c][b] = extra[b][c];
+            }
+        }
+    });
+}
+
+void FlockCpu::writeTexels( vec4* pos, vec4* vel, vec4* data, vec4* extra )
+{
+    const State& state = mState;
+    mPool.run( state.mCount, GRAIN, [&]( size_t begin, size_t end ) {
+        for( size_t b = begin; b < end; b++ ) {
+            pos[b] = vec4( state.mPos[0][b], state.mPos[1][b], state.mPos[2][b], 1.0f );
+            vel[b] = vec4( state.mVel[0][b], state.mVel[1][b], state.mVel[2][b], 1.0f );
+            data[b] = vec4( state.mData[0][b], state.mData[1][b], state.mData[2][b], 1.0f );
+            extra[b] = vec4( state.mExtra[0][b], state.mExtra[1][b], state.mExtra[2][b], 1.0f );
+        }
+    });
+}
+
+void FlockCpu::upload( gl::FboRef fbo )
+{
+    const size_t count = mState.mCount;
+    vector<vec4> texels( count * 4 );
+    writeTexels( &texels[0], &texels[count], &texels[count * 2], &texels[count * 3] );
+
+    GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+    for( int i = 0; i < 4; i++ ) {
+        fbo->getTexture2d( attachments[i] )->update( &texels[count * i], GL_RGBA, GL_FLOAT, 0, mState.mSize, mState.mSize );
+    }
+
+    // Position and cycle over the position texels, the direction GL turns into half floats
+    vector<vec2> directions( count );
+    mPool.run( count, GRAIN, [&]( size_t begin, size_t end ) {
+        for( size_t b = begin; b < end; b++ ) {
+            texels[b].w = texels[count * 2 + b].x;
+            directions[b] = encodeDirection( vec3( texels[count + b] ) );
+        }
+    });
+    fbo->getTexture2d( GL_COLOR_ATTACHMENT4 )->update( &texels[0], GL_RGBA, GL_FLOAT, 0, mState.mSize, mState.mSize );
+    fbo->getTexture2d( GL_COLOR_ATTACHMENT5 )->update( &directions[0], GL_RG, GL_FLOAT, 0, mState.mSize, mState.mSize );
+}
+
+void FlockCpu::update( float time, float stepScale )
+{
+    Timer timer( true );
+    step( mPool, mState, mGrid, time, stepScale );
+    mLastUpdateSeconds = timer.getSeconds();
+}
+
+void FlockCpu::step( WorkerPool& pool, State& state, Grid& grid, float time, float stepScale )
+{
+    sort( pool, state, grid );
+
+    // Reads the sorted copies only, so the state can be written right after
+    pool.run( grid.mStart.size() - 1, CELL_GRAIN, [&]( size_t begin, size_t end ) {
+        flock( state, grid, begin, end );
+    });
+
+    pool.run( state.mPos[0].size(), GRAIN, [&]( size_t begin, size_t end ) {
+        integrate( state, grid, begin, end, time, stepScale );
+    });
+}
+
+void FlockCpu::sort( WorkerPool& pool, const State& state, Grid& grid )
+{
+    const size_t count = state.mCount;
+    const int gridSize = grid.mGridSize;
+    const size_t numCells = (size_t)gridSize * gridSize * gridSize;
+
+    // getCell() of fragments/grid.glsl, clamped before the cast
+    pool.run( count, GRAIN, [&]( size_t begin, size_t end ) {
+        for( size_t b = begin; b < end; b++ ) {
+            int cell[3];
+            for( int c = 0; c < 3; c++ ) {
+                const float f = floorf( state.mPos[c][b] / grid.mCellSize ) + gridSize / 2;
+                cell[c] = (int)std::min( std::max( f, 0.0f ), (float)( gridSize - 1 ) );
+            }
+            grid.mCell[b] = ( cell[2] * gridSize + cell[1] ) * gridSize + cell[0];
+        }
+    });
+
+    // Counting sort, a cell's boids stay in texel order like gridSort.frag leaves them
+    grid.mStart.assign( numCells + 1, 0 );
+    for( size_t b = 0; b < count; b++ ) {
+        grid.mStart[grid.mCell[b] + 1]++;
+    }
+    for( size_t c = 0; c < numCells; c++ ) {
+        grid.mStart[c + 1] += grid.mStart[c];
+    }
+    vector<uint32_t> next( grid.mStart.begin(), grid.mStart.end() - 1 );
+    for( size_t b = 0; b < count; b++ ) {
+        grid.mIndex[next[grid.mCell[b]]++] = (uint32_t)b;
+    }
+
+    // Copied in sorted order, so every range of cells is read front to back
+    pool.run( count, GRAIN, [&]( size_t begin, size_t end ) {
+        for( size_t s = begin; s < end; s++ ) {
+            const uint32_t b = grid.mIndex[s];
+            const float length = sqrtf( state.mVel[0][b] * state.mVel[0][b] + state.mVel[1][b] * state.mVel[1][b] + state.mVel[2][b] * state.mVel[2][b] );
+            for( int c = 0; c < 3; c++ ) {
+                grid.mPos[c][s] = state.mPos[c][b];
+                grid.mDir[c][s] = state.mVel[c][b] / length;
+            }
+            grid.mCycle[s] = state.mData[0][b];
+        }
+    });
+}
+
+void FlockCpu::flock( const State& state, Grid& grid, size_t cellBegin, size_t cellEnd )
+{
+    const int gridSize = grid.mGridSize;
+    const FloatV zero = splat( 0.0f );
+
+    IntV lane;
+    for( size_t i = 0; i < LANES; i++ ) {
+        lane[i] = (int32_t)i;
+    }
+
+    for( size_t cell = cellBegin; cell < cellEnd; cell++ ) {
+        const uint32_t first = grid.mStart[cell];
+        const uint32_t last = grid.mStart[cell + 1];
+        if( first == last ) {
+            continue;
+        }
+
+        // The 27 cells around this one are 9 runs of 3 along x, each a single range of sorted boids
+        const int x = cell % gridSize;
+        const int y = ( cell / gridSize ) % gridSize;
+        const int z = cell / ( gridSize * gridSize );
+        const int x0 = std::max( x - 1, 0 );
+        const int x1 = std::min( x + 1, gridSize - 1 );
+
+        uint32_t ranges[9][2];
+        int numRanges = 0;
+        for( int cz = std::max( z - 1, 0 ); cz <= std::min( z + 1, gridSize - 1 ); cz++ ) {
+            for( int cy = std::max( y - 1, 0 ); cy <= std::min( y + 1, gridSize - 1 ); cy++ ) {
+                const size_t row = ( (size_t)cz * gridSize + cy ) * gridSize;
+                ranges[numRanges][0] = grid.mStart[row + x0];
+                ranges[numRanges][1] = grid.mStart[row + x1 + 1];
+                numRanges++;
+            }
+        }
+
+        for( uint32_t s = first; s < last; s++ ) {
+            const uint32_t b = grid.mIndex[s];
+            const float px = grid.mPos[0][s];
+            const float py = grid.mPos[1][s];
+            const float pz = grid.mPos[2][s];
+            const float dirX = grid.mDir[0][s];
+            const float dirY = grid.mDir[1][s];
+            const float dirZ = grid.mDir[2][s];
+            const float cycle = grid.mCycle[s];
+            const float senseRadius = ( 1.0f + 0.5f * state.mExtra[2][b] ) * MAX_SENSE_RADIUS;
+
+            FloatV ax = zero, ay = zero, az = zero;
+            FloatV neighbors = zero, sync = zero;
+
+            for( int r = 0; r < numRanges; r++ ) {
+                const int32_t end = ranges[r][1];
+                for( uint32_t j = ranges[r][0]; j < (uint32_t)end; j += LANES ) {
+                    const FloatV dx = px - load( &grid.mPos[0][j] );
+                    const FloatV dy = py - load( &grid.mPos[1][j] );
+                    const FloatV dz = pz - load( &grid.mPos[2][j] );
+                    const FloatV dist = vsqrt( dx * dx + dy * dy + dz * dz );
+
+                    // Lanes past the range are boids of the next cells, or the padding
+                    const IntV inRange = ( ( IntV{} + (int32_t)j ) + lane < end ) & ( dist > 0.0f ) & ( dist < senseRadius );
+                    if( !any( inRange ) ) {
+                        continue;
+                    }
+
+                    const FloatV p = dist / senseRadius;
+
+                    // Away from the close ones, towards the far ones, along normalize( pos - posParticle )
+                    const FloatV away = vmin( MIN_THRESHOLD / p, splat( 5.0f ) ) * 0.005f;
+                    const FloatV delta = vmax( sinHalfTurn( ( p - MAX_THRESHOLD ) * ( PI / ( 1.0f - MAX_THRESHOLD ) ) ), zero );
+                    const FloatV towards = delta * vsqrt( delta ) * ( 0.02f * 0.003f );
+                    const FloatV f = select( p < MIN_THRESHOLD, away, select( p > MAX_THRESHOLD, -towards, zero ) ) / dist;
+
+                    // alignment, with the mean of both directions
+                    const FloatV align = sinHalfTurn( p * PI ) * ( 0.5f * 0.0005f );
+
+                    ax += select( inRange, dx * f + ( dirX + load( &grid.mDir[0][j] ) ) * align, zero );
+                    ay += select( inRange, dy * f + ( dirY + load( &grid.mDir[1][j] ) ) * align, zero );
+                    az += select( inRange, dz * f + ( dirZ + load( &grid.mDir[2][j] ) ) * align, zero );
+                    neighbors += maskToFloat( inRange );
+
+                    // flash sync - Entrainment, the shorter way round to the other cycle
+                    const FloatV other = load( &grid.mCycle[j] );
+                    const IntV ahead = other > cycle;
+                    const FloatV d0 = select( ahead, other - cycle, cycle - other );
+                    const FloatV d1 = select( ahead, cycle + PI2 - other, other + PI2 - cycle );
+                    const FloatV d = select( ahead, select( d0 < d1, d0, -d1 ), select( d0 < d1, -d0, d1 ) );
+                    sync += select( inRange & ( dist < senseRadius * 0.5f ), d, zero );
+                }
+            }
+
+            grid.mAcc[0][b] = sum( ax );
+            grid.mAcc[1][b] = sum( ay );
+            grid.mAcc[2][b] = sum( az );
+            grid.mNeighbors[b] = sum( neighbors );
+            grid.mSync[b] = sum( sync );
+        }
+    }
+}
+
+void FlockCpu::integrate( State& state, const Grid& grid, size_t begin, size_t end, float time, float stepScale )
+{
+    // DrawUpdate passes time * 0.1 as uTime
+    const float t = time * 0.1f;
+    const float damping = powf( 0.97f, stepScale );
+
+    for( size_t i = begin; i < end; i += LANES ) {
+        FloatV px = load( &state.mPos[0][i] );
+        FloatV py = load( &state.mPos[1][i] );
+        FloatV pz = load( &state.mPos[2][i] );
+        FloatV vx = load( &state.mVel[0][i] );
+        FloatV vy = load( &state.mVel[1][i] );
+        FloatV vz = load( &state.mVel[2][i] );
+        FloatV cycle = load( &state.mData[0][i] );
+        const FloatV speed = load( &state.mData[1][i] );
+        const FloatV ex = load( &state.mExtra[0][i] );
+        const FloatV ey = load( &state.mExtra[1][i] );
+        const FloatV ez = load( &state.mExtra[2][i] );
+
+        FloatV ax = load( &grid.mAcc[0][i] );
+        FloatV ay = load( &grid.mAcc[1][i] );
+        FloatV az = load( &grid.mAcc[2][i] );
+
+        // noise
+        FloatV posOffset = snoise( px * 0.1f + ex * 5.0f + t * 0.5f, py * 0.1f + ey * 5.0f + t * 0.5f, pz * 0.1f + ez * 5.0f + t * 0.5f ) * 0.5f + 0.5f;
+        posOffset = mix( 0.1f, 0.2f, posOffset );
+        FloatV nx, ny, nz;
+        curlNoise( px * posOffset + t, py * posOffset + t, pz * posOffset + t, nx, ny, nz );
+        ax += nx * 0.1f;
+        ay += ny * 0.1f;
+        az += nz * 0.1f;
+
+        // pull back in
+        const FloatV f = smoothstep( MAX_RADIUS * 0.25f, MAX_RADIUS, vsqrt( px * px + py * py + pz * pz ) );
+        FloatV gx = px, gy = py, gz = pz;
+        normalize3( gx, gy, gz );
+        ax -= gx * f;
+        ay -= gy * f;
+        az -= gz * f;
+
+        const FloatV phase = mix( 0.25f, 1.0f, ey ) * t + ez;
+        FloatV speedOffset;
+        for( size_t k = 0; k < LANES; k++ ) {
+            speedOffset[k] = sinf( phase[k] ) * 0.5f + 0.5f;
+        }
+        speedOffset = mix( 0.5f, 1.0f, speedOffset ) * ( 0.0005f * stepScale );
+        vx += ax * speedOffset;
+        vy += ay * speedOffset;
+        vz += az * speedOffset;
+
+        const FloatV length = vsqrt( vx * vx + vy * vy + vz * vz );
+        const FloatV limit = select( length > MAX_SPEED, MAX_SPEED / length, splat( 1.0f ) );
+        vx *= limit;
+        vy *= limit;
+        vz *= limit;
+
+        px += vx * stepScale;
+        py += vy * stepScale;
+        pz += vz * stepScale;
+        vx *= damping;
+        vy *= damping;
+        vz *= damping;
+
+        // flash sync, then the cycle's own pace, wrapped like mod( cycle, PI2 )
+        cycle += load( &grid.mSync[i] ) * mix( 0.5f, 1.0f, ex ) * ( FLASH_EASING * stepScale );
+        cycle += mix( 0.25f, 1.0f, speed ) * ( 0.05f * stepScale );
+        cycle -= vfloor( cycle / PI2 ) * PI2;
+
+        store( &state.mPos[0][i], px );
+        store( &state.mPos[1][i], py );
+        store( &state.mPos[2][i], pz );
+        store( &state.mVel[0][i], vx );
+        store( &state.mVel[1][i], vy );
+        store( &state.mVel[2][i], vz );
+        store( &state.mData[0][i], cycle );
+        store( &state.mData[2][i], load( &grid.mNeighbors[i] ) );
+    }
+}
+
+void FlockCpu::benchmark( int numSteps )
+{
+    if( mState.mCount == 0 || numSteps <= 0 ) {
+        return;
+    }
+
+    vector<size_t> counts = { 1 };
+    if( mPool.getNumThreads() > 1 ) {
+        counts.push_back( mPool.getNumThreads() );
+    }
+
+    for( size_t numThreads : counts ) {
+        WorkerPool pool( numThreads );
+        State state = mState;
+        Grid grid = mGrid;
+
+        Timer timer( true );
+        for( int i = 0; i < numSteps; i++ ) {
+            step( pool, state, grid, i / 60.0f, 1.0f );
+        }
+        const double seconds = timer.getSeconds();
+
+        const double rate = (double)state.mCount * numSteps / seconds;
+        console() << "CPU flocking " << state.mSize << "x" << state.mSize << ", " << numThreads << " threads : " << rate / 1e6 << "M boids/s, "
+                  << rate / 1e6 / numThreads << "M per core, " << seconds * 1000.0 / numSteps << " ms a step" << endl;
+    }
+}
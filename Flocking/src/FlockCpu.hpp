@@ -0,0 +1,121 @@
+//
+//  FlockCpu.hpp
+//  Flocking
+//
+//  The update.frag step on the CPU, without a GL context: a reference to check
+//  the GPU against, and for flocks too big for it in offline renders.
+//
+
+#ifndef FlockCpu_hpp
+#define FlockCpu_hpp
+
+#include <stdio.h>
+#include <vector>
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Fbo.h"
+#include "CpuSimd.hpp"
+
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+
+typedef std::shared_ptr<class FlockCpu> FlockCpuRef;
+
+/**  Same step as update.frag over structure of arrays. Boid b is texel
+     ( b % size, b / size ) of the FboPingPong attachments, so the state goes up
+     and down as whole textures.
+
+     Every step the boids are counting sorted into the same clamped grid as
+     DrawGrid, then the cells are split across a WorkerPool. Each boid walks the
+     boids of the 27 cells around it four or eight at a time with the compiler's
+     vector extensions (AVX, SSE or NEON, whatever the target has). Noise and
+     integration run afterwards, vectorised over the boids.
+
+     The one difference to the shader is the flash sync: update.frag moves the
+     cycle after every neighbour, so later neighbours see the moved cycle and the
+     result depends on the order it visits them in. Here every neighbour is
+     compared to the cycle at the start of the step. Each neighbour moves it by at
+     most flashEasing * PI * stepScale, so the two only drift apart in dense
+     flocks, by a few hundredths of a radian a step with hundreds of neighbours.
+*/
+class FlockCpu {
+
+public:
+    // 0 threads is one per core
+    explicit FlockCpu( size_t numThreads = 0 );
+
+    static FlockCpuRef create( size_t numThreads = 0 ) { return std::make_shared<FlockCpu>( numThreads ); }
+
+    // Cells around the origin and their size, same as DrawGrid's
+    void setGrid( int gridSize, float cellSize );
+
+    // \a size x \a size boids, the flock DrawSave draws with \a seed
+    void init( int size, uint32_t seed );
+
+    /**  RGBA texels of the four attachments, a row after the other, like
+         glGetTexImage() reads them back.
+    */
+    void setTexels( int size, const vec4* pos, const vec4* vel, const vec4* data, const vec4* extra );
+    void writeTexels( vec4* pos, vec4* vel, vec4* data, vec4* extra );
+    /**  writeTexels() into the attachments of \a fbo, and the neighbour view of
+         fragments/neighbor.glsl next to them like update.frag writes it.
+    */
+    void upload( gl::FboRef fbo );
+
+    // One step, same arguments as DrawUpdate::render()
+    void update( float time, float stepScale );
+
+    /**  Times \a numSteps updates of a copy of the flock on one thread and on all
+         of them, and logs boids per second in total and per core.
+    */
+    void benchmark( int numSteps );
+
+    int    getSize() const              { return mState.mSize; }
+    size_t getNumBoids() const          { return mState.mCount; }
+    size_t getNumThreads() const        { return mPool.getNumThreads(); }
+    double getLastUpdateSeconds() const { return mLastUpdateSeconds; }
+
+private:
+    // Padded to a whole number of vectors, the padding is never written back
+    struct State {
+        int             mSize = 0;
+        size_t          mCount = 0;
+        vector<float>   mPos[3];
+        vector<float>   mVel[3];
+        // cycle, speed and number of neighbours
+        vector<float>   mData[3];
+        vector<float>   mExtra[3];
+    };
+
+    // Boids sorted by cell, rebuilt every step, and what the cells found for them
+    struct Grid {
+        int                 mGridSize = 16;
+        float               mCellSize = 3.0f;
+        vector<uint32_t>    mCell;
+        // First sorted boid of every cell, and one past the last
+        vector<uint32_t>    mStart;
+        vector<uint32_t>    mIndex;
+        // Copies in sorted order, one vector longer than the flock for the loads past the end
+        vector<float>       mPos[3];
+        vector<float>       mDir[3];
+        vector<float>       mCycle;
+        // By boid
+        vector<float>       mAcc[3];
+        vector<float>       mNeighbors;
+        vector<float>       mSync;
+    };
+
+    void allocate( int size );
+    static void step( WorkerPool& pool, State& state, Grid& grid, float time, float stepScale );
+    static void sort( WorkerPool& pool, const State& state, Grid& grid );
+    static void flock( const State& state, Grid& grid, size_t cellBegin, size_t cellEnd );
+    static void integrate( State& state, const Grid& grid, size_t begin, size_t end, float time, float stepScale );
+
+    WorkerPool  mPool;
+    State       mState;
+    Grid        mGrid;
+    double      mLastUpdateSeconds = 0.0;
+};
+#endif /* FlockCpu_hpp */
@@ -2,10 +2,13 @@
 #include "cinder/app/RendererGl.h"
 #include "cinder/gl/gl.h"
 #include "cinder/gl/Fbo.h"
+#include "cinder/gl/Query.h"
 
 #include "cinder/Camera.h"
 #include "cinder/CameraUi.h"
 #include "cinder/Rand.h"
+#include "cinder/Timer.h"
+#include "cinder/Utilities.h"
 
 #include "Config.hpp"
 #include "BatchHelpers.h"
@@ -13,6 +16,12 @@
 #include "DrawSave.hpp"
 #include "DrawParticles.hpp"
 #include "DrawUpdate.hpp"
+#include "DrawUpdateCompute.hpp"
+#include "FlockCpu.hpp"
+#include "FlockCheckpoint.hpp"
+#include "DrawGrid.hpp"
+#include "FixedTimestep.hpp"
+#include "CounterRand.hpp"
 
 
 
@@ -33,11 +42,20 @@ class FlockingApp : public App {
   public:
 	void setup() override;
 	void mouseDown( MouseEvent event ) override;
+	void keyDown( KeyEvent event ) override;
 	void update() override;
 	void draw() override;
 
 private:
     void                    initParticles();
+    FboPingPongRef          createFbo( int size );
+    void                    benchmarkUpdate();
+    void                    setCpuUpdateEnabled( bool enabled );
+    void                    readTexels( gl::FboRef fbo, vector<vec4>& texels );
+    void                    readBackFlock();
+    void                    compareCpuUpdate();
+    void                    saveFlock();
+    bool                    loadFlock();
     
     CameraPersp             mCam;
     CameraUi                mCamUi;
@@ -53,6 +71,23 @@ private:
     // drawcalls
     DrawParticlesRef      mDrawParticles;
     DrawUpdateRef         mDrawUpdate;
+    DrawGridRef           mDrawGrid;
+    // Tiled all pairs instead of the grid, where there's GL 4.3. Toggled with 'u'
+    DrawUpdateComputeRef  mDrawUpdateCompute;
+    bool                  mUseCompute = false;
+    // update.frag on the CPU, toggled with 'c'
+    FlockCpuRef           mFlockCpu;
+    bool                  mUseCpu = false;
+    // 's' saves the flock, 'l' loads it back
+    FlockCheckpointRef    mCheckpoint;
+    fs::path              mCheckpointPath;
+    gl::QueryTimeSwappedRef mStepQuery;
+    // Steps timed by the query whose result mStepQuery reads back, 0 until there is one
+    int                   mQueriedSteps = 0;
+    
+    FixedTimestep         mTimestep{ Config::getInstance().SIM_RATE };
+    // Initial flock of this launch, --seed N to start from the same one again
+    uint32_t              mFlockSeed;
     
     
     float mSeed = randFloat(10000.0f);
@@ -71,6 +106,22 @@ void FlockingApp::setup()
 {
     setFrameRate(60.0f);
     gl::enableDepth();
+    
+    // --boids N for N x N boids, before anything sized by NUM_PARTICLES is made
+    const auto& args = getCommandLineArgs();
+    auto boidsArg = find( args.begin(), args.end(), "--boids" );
+    if( boidsArg != args.end() && boidsArg + 1 != args.end() ) {
+        Config& config = Config::getInstance();
+        int num = *( boidsArg + 1 ) == "large" ? config.LARGE_NUM_PARTICLES : atoi( ( boidsArg + 1 )->c_str() );
+        if( num > 0 && num <= config.MAX_NUM_PARTICLES ) {
+            config.NUM_PARTICLES = num;
+        } else {
+            console() << "--boids takes 1 to " << config.MAX_NUM_PARTICLES << " or large, keeping " << config.NUM_PARTICLES << endl;
+        }
+    }
+    mFlockSeed = CounterRand::pickSeed( args );
+    console() << "Flock seed " << mFlockSeed << ", run with --seed " << mFlockSeed << " for the same flock" << endl;
+    
     gl::enable( GL_POINT_SPRITE_ARB ); // or use: glEnable
     gl::enable( GL_VERTEX_PROGRAM_POINT_SIZE );   // or use: glEnable
     
@@ -87,41 +138,325 @@ void FlockingApp::setup()
     
     mDrawParticles = DrawParticles::create();
     mDrawUpdate = DrawUpdate::create();
+    mDrawGrid = DrawGrid::create();
+    if( DrawUpdateCompute::isAvailable() ) {
+        mDrawUpdateCompute = DrawUpdateCompute::create();
+    }
+    mStepQuery = gl::QueryTimeSwapped::create();
+    
+    mFlockCpu = FlockCpu::create();
+    mFlockCpu->setGrid( Config::getInstance().GRID_SIZE, Config::getInstance().CELL_SIZE );
+    
+    // --checkpoint FILE picks up the flock saved there, if there is one
+    mCheckpoint = FlockCheckpoint::create();
+    mCheckpointPath = getDocumentsDirectory() / "Flocking.flock";
+    auto checkpointArg = find( args.begin(), args.end(), "--checkpoint" );
+    if( checkpointArg != args.end() && checkpointArg + 1 != args.end() ) {
+        mCheckpointPath = *( checkpointArg + 1 );
+        if( fs::exists( mCheckpointPath ) ) {
+            loadFlock();
+        }
+    }
 }
 
 void FlockingApp::initParticles()
 {
-    int size = Config::getInstance().NUM_PARTICLES;
-    
-    // init fbo
+    mFbo = createFbo( Config::getInstance().NUM_PARTICLES );
     
+    DrawSave* drawSave = new DrawSave( mFlockSeed );
+    drawSave->draw(mFbo->read());
+    // Drawing blends in the previous state, which is the same until the first step
+    drawSave->draw(mFbo->write());
+}
+
+FboPingPongRef FlockingApp::createFbo( int size )
+{
     auto texFormat = gl::Texture::Format().internalFormat( GL_RGBA32F ).dataType(GL_FLOAT).minFilter(GL_NEAREST).magFilter(GL_NEAREST);
+    // The neighbour view of fragments/neighbor.glsl, the direction in half floats
+    auto dirFormat = gl::Texture::Format().internalFormat( GL_RG16F ).dataType(GL_FLOAT).minFilter(GL_NEAREST).magFilter(GL_NEAREST);
+    
     gl::Fbo::Format format1;
     format1.attachment( GL_COLOR_ATTACHMENT0, gl::Texture2d::create( size, size, texFormat ) )
     .attachment( GL_COLOR_ATTACHMENT1, gl::Texture2d::create( size, size, texFormat ) )
     .attachment( GL_COLOR_ATTACHMENT2, gl::Texture2d::create( size, size, texFormat ) )
-    .attachment( GL_COLOR_ATTACHMENT3, gl::Texture2d::create( size, size, texFormat ) );
+    .attachment( GL_COLOR_ATTACHMENT3, gl::Texture2d::create( size, size, texFormat ) )
+    .attachment( GL_COLOR_ATTACHMENT4, gl::Texture2d::create( size, size, texFormat ) )
+    .attachment( GL_COLOR_ATTACHMENT5, gl::Texture2d::create( size, size, dirFormat ) );
     
     gl::Fbo::Format format2;
     format2.attachment( GL_COLOR_ATTACHMENT0, gl::Texture2d::create( size, size, texFormat ) )
     .attachment( GL_COLOR_ATTACHMENT1, gl::Texture2d::create( size, size, texFormat ) )
     .attachment( GL_COLOR_ATTACHMENT2, gl::Texture2d::create( size, size, texFormat ) )
-    .attachment( GL_COLOR_ATTACHMENT3, gl::Texture2d::create( size, size, texFormat ) );
+    .attachment( GL_COLOR_ATTACHMENT3, gl::Texture2d::create( size, size, texFormat ) )
+    .attachment( GL_COLOR_ATTACHMENT4, gl::Texture2d::create( size, size, texFormat ) )
+    .attachment( GL_COLOR_ATTACHMENT5, gl::Texture2d::create( size, size, dirFormat ) );
     
-    mFbo = FboPingPong::create(size, size, format1, format2);
-    
-    DrawSave* drawSave = new DrawSave();
-    drawSave->draw(mFbo->read());
+    return FboPingPong::create(size, size, format1, format2);
 }
 
 void FlockingApp::mouseDown( MouseEvent event )
 {
 }
 
+void FlockingApp::keyDown( KeyEvent event )
+{
+    if( event.getChar() == 'u' ) {
+        if( mDrawUpdateCompute ) {
+            mUseCompute = !mUseCompute;
+            console() << "Flocking update on the " << ( mUseCompute ? "tiled compute shader" : "grid and fragment shader" ) << endl;
+        } else {
+            console() << "Compute shaders need GL 4.3, staying on the fragment shader" << endl;
+        }
+    } else if( event.getChar() == 'b' ) {
+        benchmarkUpdate();
+    } else if( event.getChar() == 'c' ) {
+        setCpuUpdateEnabled( !mUseCpu );
+    } else if( event.getChar() == 'x' ) {
+        compareCpuUpdate();
+    } else if( event.getChar() == 's' ) {
+        saveFlock();
+    } else if( event.getChar() == 'l' ) {
+        loadFlock();
+    }
+}
+
+void FlockingApp::setCpuUpdateEnabled( bool enabled )
+{
+    if( enabled == mUseCpu ) {
+        return;
+    }
+    
+    mUseCpu = enabled;
+    if( mUseCpu ) {
+        // Carry on from wherever the GPU left the flock
+        readBackFlock();
+    }
+    
+    console() << "Flocking update on the " << ( mUseCpu ? "CPU" : "GPU" ) << endl;
+}
+
+// The four attachments of \a fbo one after the other, each a row after the other
+void FlockingApp::readTexels( gl::FboRef fbo, vector<vec4>& texels )
+{
+    int size = Config::getInstance().NUM_PARTICLES;
+    size_t count = size * size;
+    texels.resize( count * 4 );
+    
+    GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+    for( int i = 0; i < 4; i++ ) {
+        gl::ScopedTextureBind tex( fbo->getTexture2d( attachments[i] ) );
+        glGetTexImage( GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &texels[count * i] );
+    }
+}
+
+void FlockingApp::readBackFlock()
+{
+    vector<vec4> texels;
+    readTexels( mFbo->read(), texels );
+    
+    size_t count = texels.size() / 4;
+    mFlockCpu->setTexels( Config::getInstance().NUM_PARTICLES, &texels[0], &texels[count], &texels[count * 2], &texels[count * 3] );
+}
+
+void FlockingApp::saveFlock()
+{
+    if( mCheckpoint->save( mFbo->read(), mCheckpointPath ) ) {
+        console() << "Saving the flock to " << mCheckpointPath << endl;
+    }
+}
+
+// Straight into the textures of both sides, and the CPU flock along with them
+bool FlockingApp::loadFlock()
+{
+    int size = 0;
+    vector<vec4> texels;
+    if( !FlockCheckpoint::load( mCheckpointPath, size, texels ) ) {
+        return false;
+    }
+    
+    int num = Config::getInstance().NUM_PARTICLES;
+    if( size != num ) {
+        console() << "Flock " << mCheckpointPath << " is " << size << "x" << size << ", this one " << num << "x" << num << endl;
+        return false;
+    }
+    
+    size_t count = texels.size() / 4;
+    mFlockCpu->setTexels( size, &texels[0], &texels[count], &texels[count * 2], &texels[count * 3] );
+    // Drawing blends in the previous state, the same one until the next step
+    mFlockCpu->upload( mFbo->read() );
+    mFlockCpu->upload( mFbo->write() );
+    
+    console() << "Flock loaded from " << mCheckpointPath << endl;
+    return true;
+}
+
+// One step of the current flock on the GPU and on the CPU from the same state, and
+// how far apart they end up. Neither touches the flock on screen.
+void FlockingApp::compareCpuUpdate()
+{
+    int size = Config::getInstance().NUM_PARTICLES;
+    float time = (float)mTimestep.getTime();
+    float stepScale = mTimestep.getStepScale();
+    
+    readBackFlock();
+    FboPingPongRef fbo = createFbo( size );
+    mFlockCpu->upload( fbo->read() );
+    
+    mDrawGrid->render( fbo->read() );
+    mDrawUpdate->render( fbo, mDrawGrid, time, stepScale );
+    mFlockCpu->update( time, stepScale );
+    
+    vector<vec4> gpu, cpu( size * size * 4 );
+    readTexels( fbo->write(), gpu );
+    size_t count = size * size;
+    mFlockCpu->writeTexels( &cpu[0], &cpu[count], &cpu[count * 2], &cpu[count * 3] );
+    
+    float maxPos = 0.0f, maxVel = 0.0f, maxCycle = 0.0f;
+    double sumPos = 0.0;
+    int numNeighborsDiffer = 0;
+    for( size_t i = 0; i < count; i++ ) {
+        float pos = distance( vec3( gpu[i] ), vec3( cpu[i] ) );
+        maxPos = std::max( maxPos, pos );
+        sumPos += pos;
+        maxVel = std::max( maxVel, distance( vec3( gpu[count + i] ), vec3( cpu[count + i] ) ) );
+        
+        // The short way round
+        float cycle = fabsf( gpu[count * 2 + i].x - cpu[count * 2 + i].x );
+        maxCycle = std::max( maxCycle, std::min( cycle, float( M_PI * 2.0 ) - cycle ) );
+        if( gpu[count * 2 + i].z != cpu[count * 2 + i].z ) {
+            numNeighborsDiffer++;
+        }
+    }
+    
+    console() << "GPU against CPU step, " << size << "x" << size << " boids : position max " << maxPos << " mean " << sumPos / count
+              << ", velocity max " << maxVel << ", cycle max " << maxCycle << ", " << numNeighborsDiffer << " neighbour counts differ" << endl;
+    
+    if( mUseCpu ) {
+        // Back to the step on screen
+        readBackFlock();
+    }
+}
+
+// Both GPU update paths and the CPU one on their own flocks from 64x64 to 256x256
+// boids, then the CPU one at 320x320. NUM_PARTICLES is what every pass reads the
+// size from, so it's swapped for the duration.
+//
+// The fragment shader also runs on a grid of a single cell, which makes every boid
+// a neighbour candidate of every other, all pairs like before the grid. The sort
+// still runs there, so all pairs comes out a little slower than it was.
+void FlockingApp::benchmarkUpdate()
+{
+    const int NUM_WARMUP = 5;
+    const int NUM_STEPS = 60;
+    const int NUM_ALL_PAIRS_WARMUP = 1;
+    const int NUM_ALL_PAIRS_STEPS = 5;
+    const int NUM_CPU_STEPS = 10;
+    enum { GRID, ALL_PAIRS, COMPUTE };
+    const char* names[] = { "Grid and fragment", "All pairs and fragment", "Tiled compute" };
+    
+    if( !mDrawUpdateCompute ) {
+        console() << "No compute shaders in this context, timing the fragment shader only" << endl;
+    }
+    
+    int numParticles = Config::getInstance().NUM_PARTICLES;
+    
+    for( int size : { 64, 128, 192, 256 } ) {
+        Config::getInstance().NUM_PARTICLES = size;
+        
+        // Same flock on the CPU, on one thread and on all of them
+        FlockCpuRef flockCpu = FlockCpu::create();
+        flockCpu->setGrid( Config::getInstance().GRID_SIZE, Config::getInstance().CELL_SIZE );
+        flockCpu->init( size, mFlockSeed );
+        flockCpu->benchmark( NUM_CPU_STEPS );
+        
+        double msPerStep[3] = { 0.0, 0.0, 0.0 };
+        for( int mode = GRID; mode <= ( mDrawUpdateCompute ? COMPUTE : ALL_PAIRS ); mode++ ) {
+            int gridSize = Config::getInstance().GRID_SIZE;
+            if( mode == ALL_PAIRS ) {
+                Config::getInstance().GRID_SIZE = 1;
+            }
+            int numWarmup = mode == ALL_PAIRS ? NUM_ALL_PAIRS_WARMUP : NUM_WARMUP;
+            int numSteps = mode == ALL_PAIRS ? NUM_ALL_PAIRS_STEPS : NUM_STEPS;
+            
+            FboPingPongRef fbo = createFbo( size );
+            DrawSave( mFlockSeed ).draw( fbo->read() );
+            DrawGridRef grid = DrawGrid::create();
+            
+            // Wait for the GPU on both ends of the timed steps
+            Timer timer;
+            for( int step = 0; step < numWarmup + numSteps; step++ ) {
+                if( step == numWarmup ) {
+                    glFinish();
+                    timer.start();
+                }
+                float time = step / 60.0f;
+                if( mode == COMPUTE ) {
+                    mDrawUpdateCompute->render( fbo, time, 1.0f );
+                } else {
+                    grid->render( fbo->read() );
+                    mDrawUpdate->render( fbo, grid, time, 1.0f );
+                }
+                fbo->swap();
+            }
+            glFinish();
+            Config::getInstance().GRID_SIZE = gridSize;
+            
+            double seconds = timer.getSeconds();
+            msPerStep[mode] = seconds * 1000.0 / numSteps;
+            console() << names[mode] << ", " << size << "x" << size << " boids : "
+                      << msPerStep[mode] << " ms a step, " << (double)size * size * numSteps / seconds / 1e6 << "M boids/s" << endl;
+        }
+        console() << "Grid against all pairs, " << size << "x" << size << " boids : " << msPerStep[GRID] << " ms against "
+                  << msPerStep[ALL_PAIRS] << " ms a step, " << msPerStep[ALL_PAIRS] / msPerStep[GRID] << " times faster" << endl;
+    }
+    
+    // The CPU on its own past 100k boids, for offline renders
+    FlockCpuRef flockCpu = FlockCpu::create();
+    flockCpu->setGrid( Config::getInstance().GRID_SIZE, Config::getInstance().CELL_SIZE );
+    flockCpu->init( 320, mFlockSeed );
+    flockCpu->benchmark( NUM_CPU_STEPS );
+    
+    Config::getInstance().NUM_PARTICLES = numParticles;
+}
+
 void FlockingApp::update()
 {
-    mDrawUpdate->render(mFbo);
-    mFbo->swap();
+    mCheckpoint->update();
+    
+    int steps = mTimestep.update( getElapsedSeconds() );
+    if( steps == 0 ) {
+        return;
+    }
+    
+    mStepQuery->begin();
+    for( int i = 0; i < steps; i++ ) {
+        float time = (float)mTimestep.getStepTime( i );
+        if( mUseCpu ) {
+            mFlockCpu->update(time, mTimestep.getStepScale());
+            mFlockCpu->upload(mFbo->write());
+        } else if( mUseCompute ) {
+            mDrawUpdateCompute->render(mFbo, time, mTimestep.getStepScale());
+        } else {
+            mDrawGrid->render(mFbo->read());
+            mDrawUpdate->render(mFbo, mDrawGrid, time, mTimestep.getStepScale());
+        }
+        mFbo->swap();
+    }
+    mStepQuery->end();
+    
+    // The swapped query reads back the last frame that stepped, not this one
+    int queriedSteps = mQueriedSteps;
+    mQueriedSteps = steps;
+    
+    if( getElapsedFrames() % 120 == 0 ) {
+        int num = Config::getInstance().NUM_PARTICLES;
+        if( mUseCpu ) {
+            console() << "CPU flocking " << num << "x" << num << " : " << mFlockCpu->getLastUpdateSeconds() * 1000.0 << " ms a step on "
+                      << mFlockCpu->getNumThreads() << " threads" << endl;
+        } else if( queriedSteps > 0 ) {
+            console() << "Flocking " << num << "x" << num << " : " << mStepQuery->getElapsedMilliseconds() / queriedSteps << " ms a step" << endl;
+        }
+    }
 }
 
 void FlockingApp::draw()
@@ -134,7 +469,7 @@ void FlockingApp::draw()
     bAxis->draw();
     bDots->draw();
     
-    mDrawParticles->render(mFbo->read());
+    mDrawParticles->render(mFbo->read(), mFbo->write(), mTimestep.getAlpha());
     
     
     gl::setMatricesWindow( toPixels( getWindowSize() ) );
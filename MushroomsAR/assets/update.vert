@@ -3,15 +3,21 @@
 precision highp float;
 
 in highp vec3   iPosition;
+#ifdef HALF_VELOCITY
+in highp uvec2  iVelocity;  // packHalf2x16 of xy and z0
+#else
 in highp vec3   iVelocity;
+#endif
 in highp vec3   iPositionOrg;
 in highp vec3   iRandom;
 in highp float  iLife;
 
 out vec3  position;
+#ifdef HALF_VELOCITY
+flat out uvec2 velocity;
+#else
 out vec3  velocity;
-out vec3  positionOrg;
-out vec3  random;
+#endif
 out float life;
 
 uniform float uTime;
@@ -148,10 +154,11 @@ vec3 rotate(vec3 v, vec3 axis, float angle) {
 void main()
 {
     vec3 pos    = iPosition;
+#ifdef HALF_VELOCITY
+    vec3 vel    = vec3(unpackHalf2x16(iVelocity.x), unpackHalf2x16(iVelocity.y).x);
+#else
     vec3 vel    = iVelocity;
-
-    positionOrg = iPositionOrg;
-    random      = iRandom;
+#endif
     
     vec3 acc = vec3(0.0, 0.0, 0.5);
     float speedOffset = mix(0.95, 1.0, iRandom.z);
@@ -188,7 +195,7 @@ void main()
     pos += vel;
     vel *= 0.95;
     
-    life = iLife - mix(0.015, 0.02, random.x) * 0.2;
+    life = iLife - mix(0.015, 0.02, iRandom.x) * 0.2;
     
     if(life < 0.0f) {
         life = 1.0;
@@ -198,5 +205,9 @@ void main()
 
 
     position = pos;
+#ifdef HALF_VELOCITY
+    velocity = uvec2(packHalf2x16(vel.xy), packHalf2x16(vec2(vel.z, 0.0)));
+#else
     velocity = vel;
+#endif
 }
@@ -5,6 +5,8 @@
 #include "CinderARKit.h"
 #include "cinder/Rand.h"
 #include "Config.hpp"
+#include "ParticleSystem.hpp"
+#include "CounterRand.hpp"
 
 
 using namespace ci;
@@ -15,6 +17,20 @@ const int    NUM_PARTICLES = 100e3;
 const int    FBO_WIDTH = 2048;
 const int    FBO_HEIGHT = 2048;
 
+struct ParticleLayout {
+    static constexpr ParticleField FIELDS[] = {
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iPosition",    "position", "ciPosition" },
+        { Config::HALF_VELOCITY ? ParticleType::UVec2 : ParticleType::Vec3,
+                                ParticleStream::Dynamic,    "iVelocity",    "velocity" },
+        { ParticleType::Vec3,   ParticleStream::Static,     "iPositionOrg" },
+        { ParticleType::Vec3,   ParticleStream::Static,     "iRandom" },
+        { ParticleType::Float,  ParticleStream::Dynamic,    "iLife",        "life" },
+    };
+};
+constexpr ParticleField ParticleLayout::FIELDS[];
+
+typedef ParticleSystem<ParticleLayout> Particles;
+
 class MushroomsARApp : public App {
   public:
 	void setup() override;
@@ -38,11 +54,7 @@ private:
     gl::GlslProgRef         mShaderRender;
     
     // particles
-    gl::VaoRef              mAttributes[2];
-    gl::VboRef              mParticleBuffer[2];
-    
-    std::uint32_t           mSourceIndex        = 0;
-    std::uint32_t           mDestinationIndex   = 1;
+    Particles               mParticles;
     
     
     gl::FboRef              mFbo;
@@ -67,15 +79,32 @@ private:
     
 };
 
+// Never changes after setup, bound once and shared by both VAOs
+struct ParticleStatic
+{
+    vec3    posOrg;
+    vec3    random;
+};
+
+// The only part written by transform feedback
 struct Particle
 {
     vec3    pos;
     vec3    vel;
-    vec3    posOrg;
-    vec3    random;
     float   life;
 };
 
+// Particle with the velocity as half floats, packHalf2x16() of xy and z0
+struct ParticleHalf
+{
+    vec3        pos;
+    uint32_t    vel[2];
+    float       life;
+};
+
+static_assert( Particles::DYNAMIC_STRIDE == ( Config::HALF_VELOCITY ? sizeof(ParticleHalf) : sizeof(Particle) ), "ParticleLayout doesn't match Particle" );
+static_assert( Particles::STATIC_STRIDE == sizeof(ParticleStatic), "ParticleLayout doesn't match ParticleStatic" );
+
 
 
 void MushroomsARApp::setup()
@@ -97,6 +126,7 @@ void MushroomsARApp::setup()
 void MushroomsARApp::initParticles() {
     vector<Particle> particles;
     particles.assign( NUM_PARTICLES, Particle() );
+    vector<ParticleStatic> particlesStatic( NUM_PARTICLES );
     
     float w = 0.2 * 0.5;
     float h = 0.294 * 0.5;;
@@ -104,59 +134,57 @@ void MushroomsARApp::initParticles() {
     console() << " size : " << mColorTex->getSize() << endl;
     
     
+    // Every value is a function of ( seed, stream, particle ), batched per attribute
+    enum { RAND_X, RAND_Y, RAND_Z, RAND_LIFE, RAND_RANDOM };
+    // --seed N starts from the same particles again
+    uint32_t seed = CounterRand::pickSeed( getCommandLineArgs() );
+    console() << "Particle seed " << seed << ", run with --seed " << seed << " for the same particles" << endl;
+    CounterRand rand( seed );
+    size_t count = particles.size();
+    vector<float> xs( count ), ys( count ), zs( count ), life( count );
+    vector<vec3> random( count );
+    rand.fill( xs.data(), count, RAND_X, 0, -w, w );
+    rand.fill( ys.data(), count, RAND_Y, 0, -h, h );
+    rand.fill( zs.data(), count, RAND_Z, 0, -0.01f, 0.01f );
+    rand.fill( life.data(), count, RAND_LIFE, 0, 0.01f, 1.0f );
+    rand.fill( &random[0].x, count * 3, RAND_RANDOM, 0 );
+    
     for( int i =0; i<particles.size(); i++) {
-        float x = randFloat(-w, w);
-        float y = randFloat(-h, h);
-        float z = randFloat(-0.01, 0.01);
+        float x = xs[i];
+        float y = ys[i];
+        float z = zs[i];
         
         auto &p = particles.at( i );
+        auto &ps = particlesStatic.at( i );
         
         p.pos = vec3(x, y, z);
-        p.posOrg = vec3(x, y, z);
-        p.life = Rand::randFloat(0.01f, 1.0f);
-        p.random = vec3(randFloat(), randFloat(), randFloat());
+        ps.posOrg = vec3(x, y, z);
+        p.life = life[i];
+        ps.random = random[i];
     }
     
-    mParticleBuffer[mSourceIndex]       = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), particles.data(), GL_STATIC_DRAW );
-    mParticleBuffer[mDestinationIndex]  = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), nullptr, GL_STATIC_DRAW );
-    
-    for( int i = 0; i < 2; ++i )
-    {    // Describe the particle layout for OpenGL.
-        mAttributes[i] = gl::Vao::create();
-        gl::ScopedVao vao( mAttributes[i] );
-        
-        // Define attributes as offsets into the bound particle buffer
-        gl::ScopedBuffer buffer( mParticleBuffer[i] );
-        gl::enableVertexAttribArray( 0 );
-        gl::enableVertexAttribArray( 1 );
-        gl::enableVertexAttribArray( 2 );
-        gl::enableVertexAttribArray( 3 );
-        gl::enableVertexAttribArray( 4 );
-        gl::vertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, pos) );
-        gl::vertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, vel) );
-        gl::vertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, posOrg) );
-        gl::vertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, random) );
-        gl::vertexAttribPointer( 4, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, life) );
+    bool halfVelocity = Config::HALF_VELOCITY;
+    if( halfVelocity ) {
+        vector<ParticleHalf> particlesHalf( particles.size() );
+        for( int i = 0; i < particles.size(); i++ ) {
+            particlesHalf[i].pos = particles[i].pos;
+            particlesHalf[i].vel[0] = glm::packHalf2x16( vec2( particles[i].vel ) );
+            particlesHalf[i].vel[1] = glm::packHalf2x16( vec2( particles[i].vel.z, 0.0f ) );
+            particlesHalf[i].life = particles[i].life;
+        }
         
+        mParticles.init( particlesHalf.size(), particlesHalf.data(), particlesStatic.data() );
+    } else {
+        mParticles.init( particles.size(), particles.data(), particlesStatic.data() );
     }
     
     
-    
-    mShaderRender = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag"))
-                                       .attribLocation( "ciPosition", 0 )
-                                       .attribLocation( "iPositionOrg", 2 )
-                                       .attribLocation( "iRandom", 3 )
-                                       .attribLocation( "iLife", 4 )
-                                    );
-    mShaderUpdate = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "update.vert" ) ).fragment( loadAsset("no_op_es3.frag"))
-                                    .feedbackFormat( GL_INTERLEAVED_ATTRIBS )
-                                    .feedbackVaryings( { "position", "velocity", "positionOrg", "random", "life"} )
-                                    .attribLocation( "iPosition", 0 )
-                                    .attribLocation( "iVelocity", 1 )
-                                    .attribLocation( "iPositionOrg", 2 )
-                                    .attribLocation( "iRandom", 3 )
-                                    .attribLocation( "iLife", 4 )
-                                    );
+    mShaderRender = gl::GlslProg::create( Particles::renderFormat( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag") ) ) );
+    gl::GlslProg::Format updateFormat = Particles::updateFormat( gl::GlslProg::Format().vertex( loadAsset( "update.vert" ) ).fragment( loadAsset("no_op_es3.frag") ) );
+    if( halfVelocity ) {
+        updateFormat.define( "HALF_VELOCITY" );
+    }
+    mShaderUpdate = gl::GlslProg::create( updateFormat );
     
     
     // shadow mapping
@@ -216,18 +244,10 @@ void MushroomsARApp::update()
     mOffset += (mTargetOffset - mOffset) * 0.05;
     mParticleSize += (mTargetParticleSize - mParticleSize) * 0.05;
     gl::ScopedGlslProg prog( mShaderUpdate );
-    gl::ScopedState rasterizer( GL_RASTERIZER_DISCARD, true );    // turn off fragment stage
     mShaderUpdate->uniform("uTime", float(getElapsedSeconds()) + mSeed);
     mShaderUpdate->uniform("uOffset", mOffset);
     
-    gl::ScopedVao source( mAttributes[mSourceIndex] );
-    gl::bindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, mParticleBuffer[mDestinationIndex] );
-    gl::beginTransformFeedback( GL_POINTS );
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
-
-    gl::endTransformFeedback();
-
-    std::swap( mSourceIndex, mDestinationIndex );
+    mParticles.update();
 }
 
 void MushroomsARApp::updateShadowMap()
@@ -242,9 +262,7 @@ void MushroomsARApp::updateShadowMap()
 
     mShaderRender->uniform("uViewport", vec2(getWindowSize()));
     mShaderRender->uniform("uParticleSize", mParticleSize);
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+    mParticles.draw();
     
 }
 
@@ -295,9 +313,7 @@ void MushroomsARApp::draw()
         gl::ScopedTextureBind texColor( mColorTex, (uint8_t) 2 );
         mShaderRender->uniform( "uColorMap", 2 );
         
-        gl::ScopedVao vao( mAttributes[mSourceIndex] );
-        gl::context()->setDefaultShaderVars();
-        gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+        mParticles.draw();
     }
 
 //    gl::setMatricesWindow( toPixels( getWindowSize() ) );
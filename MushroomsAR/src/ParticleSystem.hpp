@@ -0,0 +1,506 @@
+//
+//  ParticleSystem.hpp
+//  MushroomsAR
+//
+//  Transform feedback or compute particles described by a constexpr list of
+//  fields, stored in chunks that can come and go at runtime. The VAOs, the
+//  attribute locations of both shaders, the feedback varyings, the compute
+//  shader accessors, the cull shader and the buffer strides all come from that
+//  one list.
+//
+
+#ifndef ParticleSystem_hpp
+#define ParticleSystem_hpp
+
+#include "cinder/gl/gl.h"
+#if ! defined( CINDER_GL_ES )
+#include "cinder/gl/Query.h"
+#endif
+#include <stdio.h>
+
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+enum class ParticleType
+{
+    Float,
+    Vec2,
+    Vec3,
+    Vec4,
+    UVec2,          // two packed words, e.g. packHalf2x16()
+    UByte4Norm      // read as a vec4 in [0, 1], static fields only since feedback can't write bytes
+};
+
+enum class ParticleStream
+{
+    Dynamic,        // ping-ponged and written by the update shader
+    Static          // written once in init(), shared by both VAOs
+};
+
+enum class ParticleBackend
+{
+    TransformFeedback,  // ping-pong VBOs written by an update vertex shader
+    Compute             // one buffer updated in place by a compute shader, GL 4.3
+};
+
+/**  One attribute. Its location is its index in the layout, and it sits in its
+     stream right after the fields of the same stream before it.
+*/
+struct ParticleField
+{
+    ParticleType    mType;
+    ParticleStream  mStream;
+    const char*     mAttrib;            // input of the update and render shaders
+    const char*     mVarying;           // output of the update shader, dynamic fields only
+    const char*     mRenderAttrib;      // render shader input when it differs from mAttrib, like ciPosition
+
+    constexpr GLint getComponents() const
+    {
+        return mType == ParticleType::Float ? 1 :
+               mType == ParticleType::Vec2 || mType == ParticleType::UVec2 ? 2 :
+               mType == ParticleType::Vec3 ? 3 : 4;
+    }
+
+    constexpr GLsizei getBytes() const
+    {
+        return mType == ParticleType::UByte4Norm ? 4 : getComponents() * 4;
+    }
+
+    constexpr GLenum getGlType() const
+    {
+        return mType == ParticleType::UVec2 ? GL_UNSIGNED_INT :
+               mType == ParticleType::UByte4Norm ? GL_UNSIGNED_BYTE : GL_FLOAT;
+    }
+
+    constexpr bool isInteger() const    { return mType == ParticleType::UVec2; }
+    constexpr bool isNormalized() const { return mType == ParticleType::UByte4Norm; }
+
+    const char* getGlslType() const
+    {
+        return mType == ParticleType::Float ? "float" :
+               mType == ParticleType::Vec2 ? "vec2" :
+               mType == ParticleType::Vec3 ? "vec3" :
+               mType == ParticleType::UVec2 ? "uvec2" : "vec4";
+    }
+};
+
+// Tightly packed size of one particle in a stream
+template<size_t N>
+constexpr GLsizei particleStride( const ParticleField (&fields)[N], ParticleStream stream, size_t i = 0 )
+{
+    return i == N ? 0 : ( fields[i].mStream == stream ? fields[i].getBytes() : 0 ) + particleStride( fields, stream, i + 1 );
+}
+
+// Offset of fields[index] in its stream
+template<size_t N>
+constexpr GLsizei particleOffset( const ParticleField (&fields)[N], size_t index, size_t i = 0 )
+{
+    return i == index ? 0 : ( fields[i].mStream == fields[index].mStream ? fields[i].getBytes() : 0 ) + particleOffset( fields, index, i + 1 );
+}
+
+// Dynamic fields need a varying and a type transform feedback can write
+template<size_t N>
+constexpr bool particleLayoutIsValid( const ParticleField (&fields)[N], size_t i = 0 )
+{
+    return i == N || ( ( fields[i].mStream == ParticleStream::Static || ( fields[i].mVarying != nullptr && !fields[i].isNormalized() ) )
+                       && particleLayoutIsValid( fields, i + 1 ) );
+}
+
+/**  \a Layout is a struct with a static constexpr ParticleField FIELDS[], for example
+
+         struct ParticleLayout {
+             static constexpr ParticleField FIELDS[] = {
+                 { ParticleType::Vec3,  ParticleStream::Dynamic, "iPosition", "position", "ciPosition" },
+                 { ParticleType::Vec3,  ParticleStream::Static,  "iRandom" },
+                 { ParticleType::Float, ParticleStream::Dynamic, "iLife", "life" },
+             };
+         };
+         constexpr ParticleField ParticleLayout::FIELDS[];
+*/
+template<typename Layout>
+class ParticleSystem {
+
+public:
+    static constexpr size_t     NUM_FIELDS = sizeof( Layout::FIELDS ) / sizeof( ParticleField );
+    static constexpr GLsizei    DYNAMIC_STRIDE = particleStride( Layout::FIELDS, ParticleStream::Dynamic );
+    static constexpr GLsizei    STATIC_STRIDE = particleStride( Layout::FIELDS, ParticleStream::Static );
+    // What cull() writes in place of the index of a particle it drops
+    static constexpr GLuint     CULLED_INDEX = 0xFFFFFFFF;
+    static constexpr GLuint     COMPUTE_LOCAL_SIZE = 256;
+    // Particles a buffer holds at most
+    static constexpr size_t     CHUNK_SIZE = 256 * 1024;
+
+    static_assert( DYNAMIC_STRIDE > 0, "A particle layout needs at least one dynamic field" );
+    static_assert( particleLayoutIsValid( Layout::FIELDS ), "Dynamic fields need a varying and can't be normalized bytes" );
+
+    /**  Creates the buffers and VAOs for \a count particles, in chunks of at most
+         CHUNK_SIZE. \a dynamicData has DYNAMIC_STRIDE bytes a particle, \a staticData
+         STATIC_STRIDE and may be null without static fields. The compute backend
+         needs isComputeAvailable().
+    */
+    void init( size_t count, const void* dynamicData, const void* staticData = nullptr, ParticleBackend backend = ParticleBackend::TransformFeedback )
+    {
+        mBackend = backend;
+        mSourceIndex = 0;
+        // Updated in place, source and destination are the same buffer
+        mDestinationIndex = backend == ParticleBackend::Compute ? 0 : 1;
+        mChunks.clear();
+        mCount = 0;
+
+        addParticles( count, dynamicData, staticData );
+    }
+
+    /**  Appends \a count particles as new chunks, laid out like in init(). Nothing
+         that's already there gets reallocated. Returns the index of the first new chunk.
+    */
+    size_t addParticles( size_t count, const void* dynamicData, const void* staticData = nullptr )
+    {
+        const size_t firstChunk = mChunks.size();
+        for( size_t begin = 0; begin < count; begin += CHUNK_SIZE ) {
+            const size_t chunkCount = std::min( CHUNK_SIZE, count - begin );
+            const uint8_t* dynamicChunk = dynamicData ? (const uint8_t*)dynamicData + begin * DYNAMIC_STRIDE : nullptr;
+            const uint8_t* staticChunk = staticData ? (const uint8_t*)staticData + begin * STATIC_STRIDE : nullptr;
+            mChunks.push_back( createChunk( chunkCount, dynamicChunk, staticChunk ) );
+            mCount += chunkCount;
+        }
+        return firstChunk;
+    }
+
+    // Frees one chunk, the ones after it move down an index
+    void removeChunk( size_t chunk )
+    {
+        mCount -= mChunks[chunk].mCount;
+        mChunks.erase( mChunks.begin() + chunk );
+    }
+
+    /**  \a format with the feedback varyings and attribute locations of an update shader.
+    */
+    static gl::GlslProg::Format updateFormat( gl::GlslProg::Format format )
+    {
+        vector<string> varyings;
+        for( size_t f = 0; f < NUM_FIELDS; ++f ) {
+            const ParticleField& field = Layout::FIELDS[f];
+            format.attribLocation( field.mAttrib, f );
+            if( field.mStream == ParticleStream::Dynamic ) {
+                varyings.push_back( field.mVarying );
+            }
+        }
+
+        format.feedbackFormat( GL_INTERLEAVED_ATTRIBS );
+        format.feedbackVaryings( varyings );
+        return format;
+    }
+
+    /**  Compute shaders need GL 4.3, which rules out macOS and ES 3.0.
+    */
+    static bool isComputeAvailable()
+    {
+#if defined( CINDER_GL_HAS_COMPUTE_SHADER )
+        auto version = gl::getVersion();
+        return version.first > 4 || ( version.first == 4 && version.second >= 3 );
+#else
+        return false;
+#endif
+    }
+
+#if defined( CINDER_GL_HAS_COMPUTE_SHADER )
+    /**  \a format with the compute shader \a source, after its #version line gets
+         the work group size, the buffers, particleCount() and for every field
+         load_<mAttrib>( i ), plus store_<mVarying>( i, value ) for dynamic ones.
+         One invocation per particle, reading and writing only its own.
+    */
+    static gl::GlslProg::Format computeFormat( gl::GlslProg::Format format, const string& source )
+    {
+        const size_t versionEnd = source.find( '\n', source.find( "#version" ) ) + 1;
+        return format.compute( source.substr( 0, versionEnd ) + computeHeader() + source.substr( versionEnd ) );
+    }
+
+    /**  Buffers and accessors computeFormat() puts in front of a compute shader.
+         The buffers are declared as uints so packed fields keep their bits.
+    */
+    static string computeHeader()
+    {
+        string header = "layout( local_size_x = " + to_string( COMPUTE_LOCAL_SIZE ) + " ) in;\n";
+        header += "layout( std430, binding = 0 ) buffer ParticleDynamicBuffer { uint particleDynamic[]; };\n";
+        if( STATIC_STRIDE > 0 ) {
+            header += "layout( std430, binding = 1 ) readonly buffer ParticleStaticBuffer { uint particleStatic[]; };\n";
+        }
+        header += "uint particleCount() { return uint( particleDynamic.length() ) / " + to_string( DYNAMIC_STRIDE / 4 ) + "u; }\n";
+
+        for( size_t f = 0; f < NUM_FIELDS; ++f ) {
+            const ParticleField& field = Layout::FIELDS[f];
+            const bool isStatic = field.mStream == ParticleStream::Static;
+            const string buffer = isStatic ? "particleStatic" : "particleDynamic";
+            const string type = field.getGlslType();
+            const string offset = "uint o = i * " + to_string( ( isStatic ? STATIC_STRIDE : DYNAMIC_STRIDE ) / 4 ) + "u + "
+                                + to_string( particleOffset( Layout::FIELDS, f ) / 4 ) + "u; ";
+
+            // Components as read from the buffer and as written back
+            vector<string> words;
+            for( GLint c = 0; c < ( field.isNormalized() ? 1 : field.getComponents() ); ++c ) {
+                words.push_back( buffer + "[o + " + to_string( c ) + "u]" );
+            }
+
+            string value;
+            for( size_t c = 0; c < words.size(); ++c ) {
+                value += ( c > 0 ? ", " : "" ) + ( field.isInteger() ? words[c] : "uintBitsToFloat( " + words[c] + " )" );
+            }
+            if( field.isNormalized() ) {
+                value = "unpackUnorm4x8( " + words[0] + " )";
+            }
+            header += type + " load_" + field.mAttrib + "( uint i ) { " + offset + "return " + type + "( " + value + " ); }\n";
+
+            if( !isStatic ) {
+                header += "void store_" + string( field.mVarying ) + "( uint i, " + type + " v ) { " + offset;
+                for( size_t c = 0; c < words.size(); ++c ) {
+                    const string component = words.size() == 1 ? "v" : string( "v." ) + "xyzw"[c];
+                    header += words[c] + " = " + ( field.isInteger() ? component : "floatBitsToUint( " + component + " )" ) + "; ";
+                }
+                header += "}\n";
+            }
+        }
+
+        return header;
+    }
+#endif
+
+    /**  \a format with the attribute locations of a shader drawing the particles.
+    */
+    static gl::GlslProg::Format renderFormat( gl::GlslProg::Format format )
+    {
+        for( size_t f = 0; f < NUM_FIELDS; ++f ) {
+            const ParticleField& field = Layout::FIELDS[f];
+            format.attribLocation( field.mRenderAttrib ? field.mRenderAttrib : field.mAttrib, f );
+        }
+        return format;
+    }
+
+#if ! defined( CINDER_GL_ES )
+    /**  Culling needs primitive restart with a chosen index, GL 3.1.
+    */
+    static bool isCullingAvailable()
+    {
+        auto version = gl::getVersion();
+        return version.first > 3 || ( version.first == 3 && version.second >= 1 );
+    }
+
+    /**  \a format with a cull shader made of the vertex shader \a source, which
+         defines bool isVisible() for the particle in its inputs. They get declared
+         after its #version line with the mAttrib names, and a main() that captures
+         the particle's index, or CULLED_INDEX when it isn't visible, is added at
+         the end. Only that uint goes through transform feedback, the particle
+         itself stays where it is.
+    */
+    static gl::GlslProg::Format cullFormat( gl::GlslProg::Format format, const string& source )
+    {
+        string inputs;
+        for( size_t f = 0; f < NUM_FIELDS; ++f ) {
+            const ParticleField& field = Layout::FIELDS[f];
+            format.attribLocation( field.mAttrib, f );
+            inputs += "in " + string( field.getGlslType() ) + " " + field.mAttrib + ";\n";
+        }
+
+        const size_t versionEnd = source.find( '\n', source.find( "#version" ) ) + 1;
+        format.vertex( source.substr( 0, versionEnd ) + inputs + "flat out uint cullIndex;\n" + source.substr( versionEnd )
+                       + "\nvoid main()\n{\n    cullIndex = isVisible() ? uint( gl_VertexID ) : " + to_string( CULLED_INDEX ) + "u;\n}\n" );
+
+        format.feedbackFormat( GL_INTERLEAVED_ATTRIBS );
+        format.feedbackVaryings( { "cullIndex" } );
+        return format;
+    }
+
+    /**  Writes an index for every current particle into the buffers of \a view,
+         one per camera or light, with the bound cull shader and the current
+         matrices. Four bytes a particle whether it's kept or not, so the count
+         of each chunk stays the one the CPU already knows.
+    */
+    void cull( size_t view )
+    {
+        if( view >= mViews.size() ) {
+            mViews.resize( view + 1 );
+        }
+        View& v = mViews[view];
+        if( !v.mQuery ) {
+            v.mQuery = gl::Query::create( GL_PRIMITIVES_GENERATED );
+        }
+        v.mIndices.resize( mChunks.size() );
+
+        gl::ScopedState rasterizer( GL_RASTERIZER_DISCARD, true );
+        gl::context()->setDefaultShaderVars();
+
+        for( size_t c = 0; c < mChunks.size(); ++c ) {
+            const Chunk& chunk = mChunks[c];
+            // Chunks come and go, the index buffer of a slot grows with what's there now
+            if( !v.mIndices[c] || v.mIndices[c]->getSize() < chunk.mCount * sizeof( GLuint ) ) {
+                v.mIndices[c] = gl::Vbo::create( GL_ELEMENT_ARRAY_BUFFER, chunk.mCount * sizeof( GLuint ), nullptr, GL_STREAM_COPY );
+            }
+
+            gl::ScopedVao source( chunk.mAttributes[mSourceIndex] );
+            gl::bindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, v.mIndices[c] );
+            gl::beginTransformFeedback( GL_POINTS );
+            gl::drawArrays( GL_POINTS, 0, (GLsizei)chunk.mCount );
+            gl::endTransformFeedback();
+        }
+    }
+
+    /**  Draws the particles the last cull() of \a view kept with the bound shader,
+         straight from the same buffers as draw(). Primitive restart skips the
+         CULLED_INDEX entries before they reach the vertex shader.
+    */
+    void drawCulled( size_t view ) const
+    {
+        const View& v = mViews[view];
+        gl::context()->setDefaultShaderVars();
+        gl::ScopedState restart( GL_PRIMITIVE_RESTART, true );
+        glPrimitiveRestartIndex( CULLED_INDEX );
+
+        v.mQuery->begin();
+        for( size_t c = 0; c < mChunks.size(); ++c ) {
+            gl::ScopedVao vao( mChunks[c].mAttributes[mSourceIndex] );
+            v.mIndices[c]->bind();
+            gl::drawElements( GL_POINTS, (GLsizei)mChunks[c].mCount, GL_UNSIGNED_INT, nullptr );
+        }
+        v.mQuery->end();
+    }
+
+    // Particles the last drawCulled() of \a view drew. Waits for the GPU, so only now and then
+    size_t getVisibleCount( size_t view ) const                 { return mViews[view].mQuery->getValue(); }
+#endif
+
+    /**  Runs the bound update shader over the particles into the other buffers,
+         a chunk at a time, then swaps. With the compute backend it dispatches the
+         bound compute shader over each chunk in place instead.
+    */
+    void update()
+    {
+#if defined( CINDER_GL_HAS_COMPUTE_SHADER )
+        if( mBackend == ParticleBackend::Compute ) {
+            for( const Chunk& chunk : mChunks ) {
+                gl::bindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, chunk.mParticleBuffer[mSourceIndex] );
+                if( STATIC_STRIDE > 0 ) {
+                    gl::bindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, chunk.mStaticBuffer );
+                }
+                gl::dispatchCompute( (GLuint)( ( chunk.mCount + COMPUTE_LOCAL_SIZE - 1 ) / COMPUTE_LOCAL_SIZE ) );
+            }
+            // Drawn as vertices, read back or updated again next
+            gl::memoryBarrier( GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT );
+            return;
+        }
+#endif
+
+        gl::ScopedState rasterizer( GL_RASTERIZER_DISCARD, true );    // turn off fragment stage
+
+        for( const Chunk& chunk : mChunks ) {
+            gl::ScopedVao source( chunk.mAttributes[mSourceIndex] );
+            gl::bindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, chunk.mParticleBuffer[mDestinationIndex] );
+            gl::beginTransformFeedback( GL_POINTS );
+            gl::drawArrays( GL_POINTS, 0, (GLsizei)chunk.mCount );
+            gl::endTransformFeedback();
+        }
+
+        swap();
+    }
+
+    /**  Draws the current particles as points with the bound shader, one draw
+         call a chunk since every chunk has its own buffers.
+    */
+    void draw() const
+    {
+        gl::context()->setDefaultShaderVars();
+        for( const Chunk& chunk : mChunks ) {
+            gl::ScopedVao vao( chunk.mAttributes[mSourceIndex] );
+            gl::drawArrays( GL_POINTS, 0, (GLsizei)chunk.mCount );
+        }
+    }
+
+    // For writing the next state some other way, like on the CPU. Nothing to swap with compute
+    void swap()                                                 { std::swap( mSourceIndex, mDestinationIndex ); }
+
+    ParticleBackend getBackend() const                          { return mBackend; }
+    size_t getCount() const                                     { return mCount; }
+    size_t getNumChunks() const                                 { return mChunks.size(); }
+
+    // Chunk \a chunk holds particles [ sum of the counts before it, + getChunkCount() )
+    size_t getChunkCount( size_t chunk ) const                  { return mChunks[chunk].mCount; }
+    const gl::VaoRef& getVao( size_t chunk ) const              { return mChunks[chunk].mAttributes[mSourceIndex]; }
+    const gl::VboRef& getBuffer( size_t chunk ) const           { return mChunks[chunk].mParticleBuffer[mSourceIndex]; }
+    const gl::VboRef& getDestinationBuffer( size_t chunk ) const { return mChunks[chunk].mParticleBuffer[mDestinationIndex]; }
+    const gl::VboRef& getStaticBuffer( size_t chunk ) const     { return mChunks[chunk].mStaticBuffer; }
+
+private:
+    struct Chunk
+    {
+        size_t          mCount = 0;
+        gl::VaoRef      mAttributes[2];
+        gl::VboRef      mParticleBuffer[2];
+        gl::VboRef      mStaticBuffer;
+    };
+
+#if ! defined( CINDER_GL_ES )
+    struct View
+    {
+        vector<gl::VboRef>  mIndices;       // one element buffer a chunk
+        gl::QueryRef        mQuery;
+    };
+#endif
+
+    // Buffers of the current source index are filled, the others left for the next update
+    Chunk createChunk( size_t count, const void* dynamicData, const void* staticData ) const
+    {
+        const bool isCompute = mBackend == ParticleBackend::Compute;
+        Chunk chunk;
+        chunk.mCount = count;
+
+        chunk.mParticleBuffer[mSourceIndex]         = gl::Vbo::create( GL_ARRAY_BUFFER, count * DYNAMIC_STRIDE, dynamicData, GL_STATIC_DRAW );
+        if( !isCompute ) {
+            chunk.mParticleBuffer[mDestinationIndex]    = gl::Vbo::create( GL_ARRAY_BUFFER, count * DYNAMIC_STRIDE, nullptr, GL_STATIC_DRAW );
+        }
+        if( STATIC_STRIDE > 0 ) {
+            chunk.mStaticBuffer = gl::Vbo::create( GL_ARRAY_BUFFER, count * STATIC_STRIDE, staticData, GL_STATIC_DRAW );
+        }
+
+        for( int i = 0; i < ( isCompute ? 1 : 2 ); ++i ) {
+            chunk.mAttributes[i] = gl::Vao::create();
+            gl::ScopedVao vao( chunk.mAttributes[i] );
+
+            for( size_t f = 0; f < NUM_FIELDS; ++f ) {
+                const ParticleField& field = Layout::FIELDS[f];
+                const bool isStatic = field.mStream == ParticleStream::Static;
+                const GLsizei stride = isStatic ? STATIC_STRIDE : DYNAMIC_STRIDE;
+                const GLvoid* offset = (const GLvoid*)(size_t)particleOffset( Layout::FIELDS, f );
+
+                gl::ScopedBuffer buffer( isStatic ? chunk.mStaticBuffer : chunk.mParticleBuffer[i] );
+                gl::enableVertexAttribArray( f );
+                if( field.isInteger() ) {
+                    gl::vertexAttribIPointer( f, field.getComponents(), field.getGlType(), stride, offset );
+                } else {
+                    gl::vertexAttribPointer( f, field.getComponents(), field.getGlType(), field.isNormalized() ? GL_TRUE : GL_FALSE, stride, offset );
+                }
+            }
+        }
+
+        return chunk;
+    }
+
+    vector<Chunk>   mChunks;
+#if ! defined( CINDER_GL_ES )
+    // Indices of the particles each view keeps, grown in cull() when chunks get added
+    vector<View>    mViews;
+#endif
+
+    std::uint32_t   mSourceIndex        = 0;
+    std::uint32_t   mDestinationIndex   = 1;
+    size_t          mCount              = 0;
+    ParticleBackend mBackend            = ParticleBackend::TransformFeedback;
+};
+
+template<typename Layout> constexpr size_t  ParticleSystem<Layout>::NUM_FIELDS;
+template<typename Layout> constexpr GLsizei ParticleSystem<Layout>::DYNAMIC_STRIDE;
+template<typename Layout> constexpr GLsizei ParticleSystem<Layout>::STATIC_STRIDE;
+template<typename Layout> constexpr GLuint  ParticleSystem<Layout>::CULLED_INDEX;
+template<typename Layout> constexpr GLuint  ParticleSystem<Layout>::COMPUTE_LOCAL_SIZE;
+template<typename Layout> constexpr size_t  ParticleSystem<Layout>::CHUNK_SIZE;
+
+#endif /* ParticleSystem_hpp */
@@ -9,8 +9,6 @@ in float  iLife;
 
 out vec3  position;
 out vec3  velocity;
-out vec3  positionOrg;
-out vec3  random;
 out float life;
 
 uniform float uTime;
@@ -82,6 +80,18 @@ float snoise(float x, float y, float z){
 }
 
 
+#ifdef CURL_VOLUME
+
+// Baked by NoiseVolume, repeats every uCurlPeriod
+uniform sampler3D uCurlVolume;
+uniform float     uCurlPeriod;
+
+vec3 curlNoise( vec3 p ){
+    return normalize( texture( uCurlVolume, p / uCurlPeriod ).xyz );
+}
+
+#else
+
 vec3 snoiseVec3( vec3 x ){
 
     float s  = snoise(vec3( x ));
@@ -116,6 +126,8 @@ vec3 curlNoise( vec3 p ){
 
 }
 
+#endif
+
 
 vec2 rotate(vec2 v, float a) {
 	float s = sin(a);
@@ -148,9 +160,6 @@ void main()
 {
     vec3 pos    = iPosition;
     vec3 vel    = iVelocity;
-
-    positionOrg = iPositionOrg;
-    random      = iRandom;
     
     float f;
     vec3 acc = vec3(0.0);
@@ -176,7 +185,7 @@ void main()
     pos += vel;
     vel *= 0.9;
     
-    life = iLife - mix(0.01, 0.02, random.x);
+    life = iLife - mix(0.01, 0.02, iRandom.x);
     
     if(life < 0.0f) {
         life = 1.0;
@@ -0,0 +1,190 @@
+//
+//  CpuSimd.cpp
+//  Particles001
+//
+
+#include "CpuSimd.hpp"
+
+#include <algorithm>
+
+namespace CpuSimd {
+
+namespace {
+
+// mod( x, 289.0 ) of GLSL
+inline FloatV mod289( FloatV x )                { return x - vfloor( x * ( 1.0f / 289.0f ) ) * 289.0f; }
+inline FloatV permute( FloatV x )               { return mod289( ( x * 34.0f + 1.0f ) * x ); }
+
+} // anonymous namespace
+
+// The corners of the simplex are unrolled into arrays
+FloatV snoise( FloatV vx, FloatV vy, FloatV vz )
+{
+    const float Cx = 1.0f / 6.0f;
+    const float Cy = 1.0f / 3.0f;
+
+    const FloatV s = ( vx + vy + vz ) * Cy;
+    FloatV ix = vfloor( vx + s );
+    FloatV iy = vfloor( vy + s );
+    FloatV iz = vfloor( vz + s );
+    const FloatV t = ( ix + iy + iz ) * Cx;
+
+    FloatV x[4], y[4], z[4];
+    x[0] = vx - ix + t;
+    y[0] = vy - iy + t;
+    z[0] = vz - iz + t;
+
+    const FloatV gx = vstep( y[0], x[0] );
+    const FloatV gy = vstep( z[0], y[0] );
+    const FloatV gz = vstep( x[0], z[0] );
+    const FloatV lx = 1.0f - gx;
+    const FloatV ly = 1.0f - gy;
+    const FloatV lz = 1.0f - gz;
+
+    // Offsets of the four corners from i
+    FloatV ox[4], oy[4], oz[4];
+    ox[0] = oy[0] = oz[0] = splat( 0.0f );
+    ox[1] = vmin( gx, lz ); oy[1] = vmin( gy, lx ); oz[1] = vmin( gz, ly );
+    ox[2] = vmax( gx, lz ); oy[2] = vmax( gy, lx ); oz[2] = vmax( gz, ly );
+    ox[3] = oy[3] = oz[3] = splat( 1.0f );
+
+    for( int k = 1; k < 4; k++ ) {
+        x[k] = x[0] - ox[k] + Cx * k;
+        y[k] = y[0] - oy[k] + Cx * k;
+        z[k] = z[0] - oz[k] + Cx * k;
+    }
+
+    ix = mod289( ix );
+    iy = mod289( iy );
+    iz = mod289( iz );
+
+    // ns = n_ * D.wyz - D.xzx
+    const float nsx = 2.0f / 7.0f;
+    const float nsy = 0.5f / 7.0f - 1.0f;
+    const float nsz = 1.0f / 7.0f;
+
+    FloatV result = splat( 0.0f );
+    for( int k = 0; k < 4; k++ ) {
+        const FloatV p = permute( permute( permute( iz + oz[k] ) + iy + oy[k] ) + ix + ox[k] );
+
+        const FloatV j = p - 49.0f * vfloor( p * ( nsz * nsz ) );
+        const FloatV cx = vfloor( j * nsz );
+        const FloatV cy = vfloor( j - 7.0f * cx );
+
+        const FloatV gradX = cx * nsx + nsy;
+        const FloatV gradY = cy * nsx + nsy;
+        const FloatV h = 1.0f - vabs( gradX ) - vabs( gradY );
+
+        const FloatV sh = -vstep( h, splat( 0.0f ) );
+        FloatV px = gradX + ( vfloor( gradX ) * 2.0f + 1.0f ) * sh;
+        FloatV py = gradY + ( vfloor( gradY ) * 2.0f + 1.0f ) * sh;
+        FloatV pz = h;
+
+        const FloatV norm = 1.79284291400159f - 0.85373472095314f * ( px * px + py * py + pz * pz );
+        px *= norm;
+        py *= norm;
+        pz *= norm;
+
+        FloatV m = vmax( 0.6f - ( x[k] * x[k] + y[k] * y[k] + z[k] * z[k] ), splat( 0.0f ) );
+        m = m * m;
+        result += m * m * ( px * x[k] + py * y[k] + pz * z[k] );
+    }
+
+    return 42.0f * result;
+}
+
+// Each of the six samples only feeds two of its three components into the
+// curl, so this takes 12 snoise() instead of 18. The 1 / ( 2 * e ) scale
+// doesn't survive the normalize and is left out
+void curlNoise( FloatV px, FloatV py, FloatV pz, FloatV& cx, FloatV& cy, FloatV& cz )
+{
+    const float e = 0.1f;
+
+    const FloatV x0y = snoise1( px - e, py, pz ), x0z = snoise2( px - e, py, pz );
+    const FloatV x1y = snoise1( px + e, py, pz ), x1z = snoise2( px + e, py, pz );
+    const FloatV y0x = snoise0( px, py - e, pz ), y0z = snoise2( px, py - e, pz );
+    const FloatV y1x = snoise0( px, py + e, pz ), y1z = snoise2( px, py + e, pz );
+    const FloatV z0x = snoise0( px, py, pz - e ), z0y = snoise1( px, py, pz - e );
+    const FloatV z1x = snoise0( px, py, pz + e ), z1y = snoise1( px, py, pz + e );
+
+    cx = y1z - y0z - z1y + z0y;
+    cy = z1x - z0x - x1z + x0z;
+    cz = x1y - x0y - y1x + y0x;
+    normalize3( cx, cy, cz );
+}
+
+} // namespace CpuSimd
+
+
+//===== WorkerPool =============================================================//
+
+WorkerPool::WorkerPool( size_t numThreads )
+{
+    mNext = 0;
+    for( size_t i = 1; i < numThreads; i++ ) {
+        mThreads.emplace_back( &WorkerPool::threadFn, this );
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<mutex> lock( mMutex );
+        mIsStopping = true;
+    }
+    mStartCondition.notify_all();
+
+    for( auto& t : mThreads ) {
+        t.join();
+    }
+}
+
+void WorkerPool::run( size_t count, size_t grain, const function<void( size_t, size_t )>& fn )
+{
+    {
+        lock_guard<mutex> lock( mMutex );
+        mTask = &fn;
+        mCount = count;
+        mGrain = std::max<size_t>( grain, 1 );
+        mNext = 0;
+        mBusy = mThreads.size();
+        mGeneration++;
+    }
+    mStartCondition.notify_all();
+
+    work();
+
+    unique_lock<mutex> lock( mMutex );
+    mDoneCondition.wait( lock, [this] { return mBusy == 0; } );
+    mTask = nullptr;
+}
+
+void WorkerPool::threadFn()
+{
+    uint64_t generation = 0;
+    while( true ) {
+        {
+            unique_lock<mutex> lock( mMutex );
+            mStartCondition.wait( lock, [&] { return mIsStopping || mGeneration != generation; } );
+            if( mIsStopping ) {
+                return;
+            }
+            generation = mGeneration;
+        }
+
+        work();
+
+        lock_guard<mutex> lock( mMutex );
+        if( --mBusy == 0 ) {
+            mDoneCondition.notify_one();
+        }
+    }
+}
+
+void WorkerPool::work()
+{
+    size_t begin;
+    while( ( begin = mNext.fetch_add( mGrain ) ) < mCount ) {
+        ( *mTask )( begin, std::min( begin + mGrain, mCount ) );
+    }
+}
@@ -0,0 +1,166 @@
+//
+//  CpuSimd.hpp
+//  Particles001
+//
+//  What the CPU updates share: a WorkerPool that splits a range across the
+//  cores, and floats in vectors as wide as the target's registers with the
+//  simplex and curl noise of the shaders on them.
+//
+
+#ifndef CpuSimd_hpp
+#define CpuSimd_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined( __SSE__ )
+    #include <immintrin.h>
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+    #include <arm_neon.h>
+#endif
+
+
+using namespace std;
+
+/**  Fixed set of threads that split a range between them. The calling thread
+     joins in, so a pool of N threads starts N - 1.
+*/
+class WorkerPool {
+
+public:
+    explicit WorkerPool( size_t numThreads );
+    ~WorkerPool();
+
+    size_t getNumThreads() const        { return mThreads.size() + 1; }
+
+    /**  Calls \a fn on chunks of at most \a grain items until [0, count) is
+         covered, returns once all are done.
+    */
+    void run( size_t count, size_t grain, const function<void( size_t, size_t )>& fn );
+
+private:
+    void threadFn();
+    void work();
+
+    vector<thread>          mThreads;
+    mutex                   mMutex;
+    condition_variable      mStartCondition;
+    condition_variable      mDoneCondition;
+    uint64_t                mGeneration = 0;
+    size_t                  mBusy = 0;
+    bool                    mIsStopping = false;
+
+    const function<void( size_t, size_t )>* mTask = nullptr;
+    size_t                  mCount = 0;
+    size_t                  mGrain = 1;
+    atomic<size_t>          mNext;
+};
+
+
+namespace CpuSimd {
+
+// As wide as the registers of the target, wider vectors get split up badly
+#if defined( __AVX__ )
+const size_t LANES = 8;
+typedef float   FloatV __attribute__(( vector_size( 32 ) ));
+typedef int32_t IntV   __attribute__(( vector_size( 32 ) ));
+#else
+const size_t LANES = 4;
+typedef float   FloatV __attribute__(( vector_size( 16 ) ));
+typedef int32_t IntV   __attribute__(( vector_size( 16 ) ));
+#endif
+
+inline FloatV load( const float* p )
+{
+    FloatV v;
+    memcpy( &v, p, sizeof( v ) );
+    return v;
+}
+
+inline void store( float* p, FloatV v )
+{
+    memcpy( p, &v, sizeof( v ) );
+}
+
+inline FloatV splat( float f )
+{
+    return FloatV{} + f;
+}
+
+// Comparison masks are all ones or all zeros per lane
+inline FloatV select( IntV mask, FloatV a, FloatV b )
+{
+    return (FloatV)( ( (IntV)a & mask ) | ( (IntV)b & ~mask ) );
+}
+
+inline FloatV maskToFloat( IntV mask )
+{
+    return -__builtin_convertvector( mask, FloatV );
+}
+
+inline FloatV vfloor( FloatV x )
+{
+    // Truncate, then step down where that rounded up. Fine for |x| < 2^31
+    const FloatV t = __builtin_convertvector( __builtin_convertvector( x, IntV ), FloatV );
+    return t - maskToFloat( t > x );
+}
+
+inline FloatV vabs( FloatV x )
+{
+    return (FloatV)( (IntV)x & 0x7fffffff );
+}
+
+inline FloatV vmin( FloatV a, FloatV b )        { return select( a < b, a, b ); }
+inline FloatV vmax( FloatV a, FloatV b )        { return select( a > b, a, b ); }
+inline FloatV mix( float a, float b, FloatV t ) { return a + ( b - a ) * t; }
+
+// step( edge, x ) of GLSL
+inline FloatV vstep( FloatV edge, FloatV x )    { return maskToFloat( x >= edge ); }
+
+inline FloatV vsqrt( FloatV x )
+{
+    FloatV r;
+#if defined( __AVX__ )
+    r = (FloatV)_mm256_sqrt_ps( (__m256)x );
+#elif defined( __SSE__ )
+    r = (FloatV)_mm_sqrt_ps( (__m128)x );
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+    r = (FloatV)vsqrtq_f32( (float32x4_t)x );
+#else
+    for( size_t i = 0; i < LANES; i++ ) {
+        r[i] = sqrtf( x[i] );
+    }
+#endif
+    return r;
+}
+
+inline void normalize3( FloatV& x, FloatV& y, FloatV& z )
+{
+    const FloatV invLength = 1.0f / vsqrt( x * x + y * y + z * z );
+    x *= invLength;
+    y *= invLength;
+    z *= invLength;
+}
+
+// snoise() of the update shader
+FloatV snoise( FloatV vx, FloatV vy, FloatV vz );
+
+// Components of snoiseVec3()
+inline FloatV snoise0( FloatV x, FloatV y, FloatV z )   { return snoise( x, y, z ); }
+inline FloatV snoise1( FloatV x, FloatV y, FloatV z )   { return snoise( y - 19.1f, z + 33.4f, x + 47.2f ); }
+inline FloatV snoise2( FloatV x, FloatV y, FloatV z )   { return snoise( z + 74.2f, x - 124.5f, y + 99.4f ); }
+
+// curlNoise() of the update shader, normalized
+void curlNoise( FloatV px, FloatV py, FloatV pz, FloatV& cx, FloatV& cy, FloatV& cz );
+
+} // namespace CpuSimd
+
+#endif /* CpuSimd_hpp */
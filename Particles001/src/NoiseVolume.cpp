@@ -0,0 +1,323 @@
+//
+//  NoiseVolume.cpp
+//  Particles001
+//
+
+#include "NoiseVolume.hpp"
+#include "UpdateCpu.hpp"
+#include "CounterRand.hpp"
+#include "cinder/app/App.h"
+#include "cinder/Timer.h"
+#include "cinder/Utilities.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ci::app;
+
+namespace {
+
+const uint32_t  MAGIC   = 0x564C5243;   // "CRLV"
+// Bump whenever the bake changes
+const uint32_t  VERSION = 1;
+
+struct Header
+{
+    uint32_t    mMagic      = MAGIC;
+    uint32_t    mVersion    = VERSION;
+    uint32_t    mSize       = 0;
+    float       mPeriod     = 0.0f;
+};
+
+// Weight of the copy one period back, smoothstep across the last BLEND of the period
+float getBlendWeight( float coord, float period )
+{
+    const float s = ( coord / period - ( 1.0f - NoiseVolume::BLEND ) ) / NoiseVolume::BLEND;
+    if( s <= 0.0f ) {
+        return 0.0f;
+    }
+    return s * s * ( 3.0f - 2.0f * s );
+}
+
+inline int wrap( int i, int size )
+{
+    i %= size;
+    return i < 0 ? i + size : i;
+}
+
+// Angle in degrees between two unit vectors
+float getAngle( const vec3& a, const vec3& b )
+{
+    return acosf( std::min( std::max( dot( a, b ), -1.0f ), 1.0f ) ) * 180.0f / (float)M_PI;
+}
+
+void logErrors( const char* label, vector<float>& errors )
+{
+    if( errors.empty() ) {
+        return;
+    }
+
+    double sum = 0.0;
+    for( float e : errors ) {
+        sum += e;
+    }
+    const size_t p99 = errors.size() * 99 / 100;
+    std::nth_element( errors.begin(), errors.begin() + p99, errors.end() );
+    const float percentile = errors[p99];
+    const float maximum = *std::max_element( errors.begin(), errors.end() );
+
+    console() << "Curl volume error " << label << " (" << errors.size() << " points) : mean " << sum / errors.size()
+              << " deg, 99% " << percentile << " deg, max " << maximum << " deg" << endl;
+}
+
+}
+
+
+constexpr float NoiseVolume::BLEND;
+
+NoiseVolume::NoiseVolume( int size, float period )
+: mSize( size )
+, mPeriod( period )
+{
+}
+
+NoiseVolumeRef NoiseVolume::create( const string& name, int size, float period )
+{
+    NoiseVolumeRef volume( new NoiseVolume( size, period ) );
+    const fs::path path = getTemporaryDirectory() / ( name + "_curl_" + to_string( size ) + ".bin" );
+
+    Timer timer( true );
+    if( volume->load( path ) ) {
+        console() << "Curl volume loaded from " << path << " in " << timer.getSeconds() * 1000.0 << " ms" << endl;
+    } else {
+        volume->bake();
+        console() << "Curl volume " << size << "^3 baked in " << timer.getSeconds() * 1000.0 << " ms" << endl;
+        volume->save( path );
+    }
+
+    return volume;
+}
+
+void NoiseVolume::bake()
+{
+    const size_t size = mSize;
+    const size_t numVoxels = size * size * size;
+    const float h = mPeriod / size;
+
+    // First voxel with any of the copy one period back
+    size_t blendStart = 0;
+    while( blendStart < size && getBlendWeight( ( blendStart + 0.5f ) * h, mPeriod ) == 0.0f ) {
+        blendStart++;
+    }
+
+    vector<float> potential[3];
+    for( auto& p : potential ) {
+        p.assign( numVoxels, 0.0f );
+    }
+
+    WorkerPool pool( std::max( thread::hardware_concurrency(), 1u ) );
+
+    // The tileable potential, a row along x at a time
+    pool.run( size * size, 4, [&]( size_t begin, size_t end ) {
+        vector<float> x( size ), y( size ), z( size ), n[3];
+        for( auto& c : n ) {
+            c.resize( size );
+        }
+
+        for( size_t row = begin; row < end; row++ ) {
+            const float py = ( row % size + 0.5f ) * h;
+            const float pz = ( row / size + 0.5f ) * h;
+            const float ty = getBlendWeight( py, mPeriod );
+            const float tz = getBlendWeight( pz, mPeriod );
+
+            for( int shift = 0; shift < 8; shift++ ) {
+                const int sx = shift & 1, sy = ( shift >> 1 ) & 1, sz = shift >> 2;
+                const float wyz = ( sy ? ty : 1.0f - ty ) * ( sz ? tz : 1.0f - tz );
+                if( wyz == 0.0f ) {
+                    continue;
+                }
+
+                const size_t first = sx ? blendStart : 0;
+                const size_t count = size - first;
+                for( size_t i = 0; i < count; i++ ) {
+                    x[i] = ( first + i + 0.5f ) * h - sx * mPeriod;
+                    y[i] = py - sy * mPeriod;
+                    z[i] = pz - sz * mPeriod;
+                }
+                UpdateCpu::computeNoiseVec3( x.data(), y.data(), z.data(), n[0].data(), n[1].data(), n[2].data(), count );
+
+                for( size_t i = 0; i < count; i++ ) {
+                    const float tx = getBlendWeight( ( first + i + 0.5f ) * h, mPeriod );
+                    const float w = ( sx ? tx : 1.0f - tx ) * wyz;
+                    const size_t voxel = row * size + first + i;
+                    for( int c = 0; c < 3; c++ ) {
+                        potential[c][voxel] += w * n[c][i];
+                    }
+                }
+            }
+        }
+    });
+
+    // Curl of the potential with central differences, as curlNoise() does with e = h
+    mData.assign( numVoxels * 3, 0.0f );
+    pool.run( size * size, 16, [&]( size_t begin, size_t end ) {
+        auto at = [&]( int c, int x, int y, int z ) {
+            return potential[c][( (size_t)wrap( z, mSize ) * size + wrap( y, mSize ) ) * size + wrap( x, mSize )];
+        };
+
+        for( size_t row = begin; row < end; row++ ) {
+            const int y = row % size;
+            const int z = row / size;
+            for( int x = 0; x < mSize; x++ ) {
+                vec3 curl;
+                curl.x = at( 2, x, y + 1, z ) - at( 2, x, y - 1, z ) - at( 1, x, y, z + 1 ) + at( 1, x, y, z - 1 );
+                curl.y = at( 0, x, y, z + 1 ) - at( 0, x, y, z - 1 ) - at( 2, x + 1, y, z ) + at( 2, x - 1, y, z );
+                curl.z = at( 1, x + 1, y, z ) - at( 1, x - 1, y, z ) - at( 0, x, y + 1, z ) + at( 0, x, y - 1, z );
+
+                const float length = glm::length( curl );
+                if( length > 0.0f ) {
+                    curl /= length;
+                }
+
+                float* voxel = &mData[( row * size + x ) * 3];
+                voxel[0] = curl.x;
+                voxel[1] = curl.y;
+                voxel[2] = curl.z;
+            }
+        }
+    });
+}
+
+vec3 NoiseVolume::sample( const vec3& p ) const
+{
+    const float scale = mSize / mPeriod;
+    const vec3 u = p * scale - 0.5f;
+    const vec3 cell = glm::floor( u );
+    const vec3 f = u - cell;
+
+    int i0[3], i1[3];
+    for( int c = 0; c < 3; c++ ) {
+        i0[c] = wrap( (int)cell[c], mSize );
+        i1[c] = i0[c] + 1 == mSize ? 0 : i0[c] + 1;
+    }
+
+    auto at = [&]( int x, int y, int z ) {
+        const float* voxel = &mData[( ( (size_t)z * mSize + y ) * mSize + x ) * 3];
+        return vec3( voxel[0], voxel[1], voxel[2] );
+    };
+
+    const vec3 c00 = glm::mix( at( i0[0], i0[1], i0[2] ), at( i1[0], i0[1], i0[2] ), f.x );
+    const vec3 c10 = glm::mix( at( i0[0], i1[1], i0[2] ), at( i1[0], i1[1], i0[2] ), f.x );
+    const vec3 c01 = glm::mix( at( i0[0], i0[1], i1[2] ), at( i1[0], i0[1], i1[2] ), f.x );
+    const vec3 c11 = glm::mix( at( i0[0], i1[1], i1[2] ), at( i1[0], i1[1], i1[2] ), f.x );
+    const vec3 v = glm::mix( glm::mix( c00, c10, f.y ), glm::mix( c01, c11, f.y ), f.z );
+
+    const float length = glm::length( v );
+    return length > 0.0f ? v / length : v;
+}
+
+gl::Texture3dRef NoiseVolume::createTexture() const
+{
+    gl::Texture3d::Format format;
+    format.internalFormat( GL_RGB16F );
+    format.dataType( GL_FLOAT );
+    format.wrap( GL_REPEAT );
+    format.minFilter( GL_LINEAR );
+    format.magFilter( GL_LINEAR );
+
+    return gl::Texture3d::create( mData.data(), GL_RGB, mSize, mSize, mSize, format );
+}
+
+void NoiseVolume::compare( size_t numSamples ) const
+{
+    CounterRand rand( 1 );
+    vector<float> x( numSamples ), y( numSamples ), z( numSamples );
+    rand.fill( x.data(), numSamples, 0, 0, 0.0f, mPeriod );
+    rand.fill( y.data(), numSamples, 1, 0, 0.0f, mPeriod );
+    rand.fill( z.data(), numSamples, 2, 0, 0.0f, mPeriod );
+
+    vector<float> analytic[3];
+    for( auto& c : analytic ) {
+        c.resize( numSamples );
+    }
+    vector<vec3> baked( numSamples );
+
+    Timer timer( true );
+    UpdateCpu::computeCurlNoise( x.data(), y.data(), z.data(), analytic[0].data(), analytic[1].data(), analytic[2].data(), numSamples );
+    const double analyticSeconds = timer.getSeconds();
+
+    timer.start();
+    for( size_t i = 0; i < numSamples; i++ ) {
+        baked[i] = sample( vec3( x[i], y[i], z[i] ) );
+    }
+    const double bakedSeconds = timer.getSeconds();
+
+    // Inside the band the field is cross faded on purpose, keep it apart from the
+    // error of the grid and the interpolation
+    const float bandStart = mPeriod * ( 1.0f - BLEND );
+    vector<float> inside, band;
+    for( size_t i = 0; i < numSamples; i++ ) {
+        const float angle = getAngle( baked[i], vec3( analytic[0][i], analytic[1][i], analytic[2][i] ) );
+        if( x[i] < bandStart && y[i] < bandStart && z[i] < bandStart ) {
+            inside.push_back( angle );
+        } else {
+            band.push_back( angle );
+        }
+    }
+
+    logErrors( "inside", inside );
+    logErrors( "in the blend band", band );
+    console() << "Curl noise on one thread : analytic " << numSamples / analyticSeconds / 1e6 << "M samples/s, volume "
+              << numSamples / bakedSeconds / 1e6 << "M samples/s, " << analyticSeconds / bakedSeconds << "x" << endl;
+}
+
+bool NoiseVolume::load( const fs::path& path )
+{
+    FILE* file = fopen( path.string().c_str(), "rb" );
+    if( !file ) {
+        return false;
+    }
+
+    Header header;
+    bool loaded = fread( &header, sizeof(Header), 1, file ) == 1;
+    loaded = loaded && header.mMagic == MAGIC && header.mVersion == VERSION && header.mSize == (uint32_t)mSize && header.mPeriod == mPeriod;
+    if( loaded ) {
+        mData.resize( (size_t)mSize * mSize * mSize * 3 );
+        loaded = fread( mData.data(), sizeof(float), mData.size(), file ) == mData.size();
+    }
+    fclose( file );
+
+    if( !loaded ) {
+        console() << "Curl volume " << path << " doesn't match, baking again" << endl;
+        mData.clear();
+    }
+    return loaded;
+}
+
+bool NoiseVolume::save( const fs::path& path ) const
+{
+    fs::path tmpPath = path;
+    tmpPath += ".tmp";
+
+    FILE* file = fopen( tmpPath.string().c_str(), "wb" );
+    if( !file ) {
+        console() << "Cannot create curl volume " << tmpPath << endl;
+        return false;
+    }
+
+    Header header;
+    header.mSize = mSize;
+    header.mPeriod = mPeriod;
+
+    bool written = fwrite( &header, sizeof(Header), 1, file ) == 1;
+    written = written && fwrite( mData.data(), sizeof(float), mData.size(), file ) == mData.size();
+    written = fclose( file ) == 0 && written;
+
+    if( !written || rename( tmpPath.string().c_str(), path.string().c_str() ) != 0 ) {
+        console() << "Cannot write curl volume " << path << endl;
+        remove( tmpPath.string().c_str() );
+        return false;
+    }
+
+    return true;
+}
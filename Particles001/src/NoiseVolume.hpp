@@ -0,0 +1,74 @@
+//
+//  NoiseVolume.hpp
+//  Particles001
+//
+//  curlNoise() of update.vert baked once into a tileable 3D texture, so the
+//  update shader can do one trilinear fetch per particle instead of the 18
+//  snoise() of the analytic version.
+//
+
+#ifndef NoiseVolume_hpp
+#define NoiseVolume_hpp
+
+#include "cinder/gl/gl.h"
+#include "cinder/Filesystem.h"
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+using namespace ci;
+using namespace std;
+
+typedef std::shared_ptr<class NoiseVolume> NoiseVolumeRef;
+
+/**  size^3 unit curl vectors over [0, period)^3 of noise space, voxel k centered
+     on ( k + 0.5 ) * period / size. Sampled with wrapping the field repeats
+     every period units, so p / period can go straight into texture().
+
+     The snoiseVec3() potential is cross faded into its copy one period back over
+     the last BLEND of each axis, which makes it wrap smoothly, then the curl is
+     taken on the grid. Outside of that band it's the analytic field.
+*/
+class NoiseVolume {
+
+public:
+    static constexpr float  BLEND = 0.2f;
+
+    /**  Loads the volume from the temporary directory, or bakes it on all cores
+         and saves it there for the next launch. \a name keeps apps apart.
+    */
+    static NoiseVolumeRef create( const string& name, int size, float period );
+
+    int     getSize() const             { return mSize; }
+    float   getPeriod() const           { return mPeriod; }
+
+    // Normalized trilinear sample at \a p, wrapped like GL_REPEAT
+    vec3    sample( const vec3& p ) const;
+
+    /**  RGB16F with linear filtering and GL_REPEAT, for a sampler3D. Half floats
+         are plenty for unit vectors and halve the texture cache footprint.
+    */
+    gl::Texture3dRef createTexture() const;
+
+    /**  Logs the angle between sample() and the analytic curlNoise() at
+         \a numSamples random points, inside and across the blend band, and the
+         samples per second of both on one thread.
+    */
+    void    compare( size_t numSamples ) const;
+
+private:
+    NoiseVolume( int size, float period );
+
+    void    bake();
+    bool    load( const fs::path& path );
+    bool    save( const fs::path& path ) const;
+
+    int             mSize;
+    float           mPeriod;
+    // xyz per voxel, x fastest then y then z like glTexImage3D wants it
+    vector<float>   mData;
+};
+
+#endif /* NoiseVolume_hpp */
@@ -0,0 +1,71 @@
+//
+//  ParticleCache.hpp
+//  Particles001
+//
+//  The generated initial particle buffers, saved on the first launch and mapped
+//  straight into the VBOs on the next ones instead of generating them again.
+//
+
+#ifndef ParticleCache_hpp
+#define ParticleCache_hpp
+
+#include "cinder/Filesystem.h"
+#include <stdio.h>
+#include <memory>
+#include <string>
+
+
+using namespace ci;
+using namespace std;
+
+typedef std::shared_ptr<class ParticleCache> ParticleCacheRef;
+
+/**  A header, then count * mDynamicStride bytes of dynamic data, then count *
+     mStaticStride bytes of static data, exactly as the VBOs want them.
+*/
+class ParticleCache {
+
+public:
+    // Anything the generated data depends on. Bump mGeneratorVersion whenever the
+    // generator changes, the strides change with the layout by themselves.
+    struct Key
+    {
+        uint32_t    mSeed;
+        uint32_t    mCount;
+        uint32_t    mGeneratorVersion;
+        uint32_t    mDynamicStride;
+        uint32_t    mStaticStride;
+
+        bool operator==( const Key& other ) const;
+        bool operator!=( const Key& other ) const      { return !( *this == other ); }
+    };
+
+    ~ParticleCache();
+
+    // File for \a key in the temporary directory, \a name keeps apps apart
+    static fs::path getPath( const string& name, const Key& key );
+
+    /**  Maps \a path read only. Null when it doesn't exist yet or was written for
+         another key, the caller then generates the particles and save()s them.
+    */
+    static ParticleCacheRef load( const fs::path& path, const Key& key );
+
+    /**  Writes the buffers next to \a path and renames them over it, so a launch
+         that dies halfway never leaves a truncated cache behind.
+    */
+    static bool save( const fs::path& path, const Key& key, const void* dynamicData, const void* staticData );
+
+    // Valid for as long as the cache lives, pass them to gl::Vbo::create
+    const void* getDynamicData() const  { return mDynamicData; }
+    const void* getStaticData() const   { return mStaticData; }
+
+private:
+    ParticleCache( const uint8_t* data, size_t size, const Key& key );
+
+    const uint8_t*  mData;
+    size_t          mSize;
+    const void*     mDynamicData;
+    const void*     mStaticData;
+};
+
+#endif /* ParticleCache_hpp */
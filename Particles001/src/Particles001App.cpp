@@ -6,10 +6,18 @@
 #include "cinder/Camera.h"
 #include "cinder/CameraUi.h"
 #include "cinder/gl/Fbo.h"
+#include "cinder/gl/Query.h"
 #include "cinder/GeomIo.h"
 #include "cinder/Perlin.h"
 
 #include "cinder/Log.h"
+#include "cinder/Timer.h"
+#include "cinder/Utilities.h"
+#include "UpdateCpu.hpp"
+#include "ParticleSystem.hpp"
+#include "ParticleCache.hpp"
+#include "CounterRand.hpp"
+#include "NoiseVolume.hpp"
 
 
 using namespace ci;
@@ -19,32 +27,54 @@ using namespace std;
 const int    FBO_WIDTH = 2048;
 const int    FBO_HEIGHT = 2048;
 
+struct ParticleLayout {
+    static constexpr ParticleField FIELDS[] = {
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iPosition",    "position", "ciPosition" },
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iVelocity",    "velocity" },
+        { ParticleType::Vec3,   ParticleStream::Static,     "iPositionOrg" },
+        { ParticleType::Vec3,   ParticleStream::Static,     "iRandom" },
+        { ParticleType::Float,  ParticleStream::Dynamic,    "iLife",        "life" },
+    };
+};
+constexpr ParticleField ParticleLayout::FIELDS[];
+
+typedef ParticleSystem<ParticleLayout> Particles;
+static_assert( Particles::DYNAMIC_STRIDE == sizeof(Particle), "ParticleLayout doesn't match Particle" );
+static_assert( Particles::STATIC_STRIDE == sizeof(ParticleStatic), "ParticleLayout doesn't match ParticleStatic" );
+
 class Particles001App : public App {
   public:
 	void setup() override;
 	void mouseDown( MouseEvent event ) override;
+    void keyDown( KeyEvent event ) override;
 	void update() override;
 	void draw() override;
     
+    void updateGpu( float time );
+    void updateCpu( float time );
+    void setCpuUpdateEnabled( bool enabled );
+    void readBackParticles();
+    void addParticleChunk();
+    void removeParticleChunk();
+    void benchmarkBackends();
+    gl::GlslProgRef createUpdateProg( ParticleBackend backend, bool curlVolume );
+    void generateParticles( vector<Particle>& particles, vector<ParticleStatic>& particlesStatic, uint32_t seed );
     void updateShadowMap();
     void updateEnvMap();
+    void cullParticles( size_t view );
+    void drawParticles( size_t view );
     
     private :
         gl::GlslProgRef mRenderProg;
         gl::GlslProgRef mUpdateProg;
+        gl::GlslProgRef mUpdateProgVolume;
         gl::GlslProgRef mParticleProg;
         gl::GlslProgRef mEnvProg;
     
-    // Descriptions of particle data layout.
-    gl::VaoRef        mAttributes[2];
-    // Buffers holding raw particle data on GPU.
-    gl::VboRef        mParticleBuffer[2];
-    
-    
-    // Current source and destination buffers for transform feedback.
-    // Source and destination are swapped each frame after update.
-    std::uint32_t    mSourceIndex        = 0;
-    std::uint32_t    mDestinationIndex    = 1;
+    // Ping-pong buffers and VAOs, laid out by ParticleLayout
+    Particles               mParticles;
+    // Compute when started with --compute on GL 4.3, transform feedback otherwise
+    ParticleBackend         mBackend = ParticleBackend::TransformFeedback;
     
     // cameras
     CameraPersp             mCam;
@@ -62,21 +92,35 @@ class Particles001App : public App {
     gl::BatchRef            mSphere;
     gl::BatchRef            mEnv;
     Perlin                  mPerlin;
+    
+    // Alternative to transform feedback, toggled with 'c'
+    UpdateCpuRef            mUpdateCpu;
+    bool                    mUseCpu = false;
+    
+    // Baked curl noise for update.vert instead of the analytic one, toggled with 'n'
+    NoiseVolumeRef          mCurlVolume;
+    gl::Texture3dRef        mCurlTex;
+    bool                    mUseCurlVolume = false;
+    gl::QueryTimeSwappedRef mUpdateQuery;
+    
+    // Off-screen and dead particles dropped before each pass once 'v' turns it on
+    gl::GlslProgRef         mCullProg;
+    bool                    mUseCulling = false;
 
     float mSeed;
 };
 
-
-struct Particle
-{
-    vec3    pos;
-    vec3    vel;
-    vec3    posOrg;
-    vec3    random;
-    float   life;
-};
-
 const int NUM_PARTICLES = 400e3;
+// Same seed, same particles, which is what lets them be cached on disk.
+// Bump the version after changing generateParticles().
+const uint32_t PARTICLE_SEED = 1;
+const uint32_t PARTICLE_GENERATOR_VERSION = 2;
+// Voxels 0.1 apart, the same step curlNoise() takes its differences over
+const int    CURL_VOLUME_SIZE = 64;
+const float  CURL_VOLUME_PERIOD = 6.4f;
+// Culled particles of the shadow map and of the main pass
+const size_t VIEW_LIGHT = 0;
+const size_t VIEW_CAMERA = 1;
 
 
 void prepareSettings( Particles001App::Settings *settings) {
@@ -103,74 +147,53 @@ void Particles001App::setup()
     mCam.setPerspective( 60.0f, getWindowAspectRatio(), 0.5f, 500.0f );
     mCam.lookAt( vec3( 0.0, 0.0, 5.0), vec3( 0.0f ) );
     
-    console() << "Number of particles :  " << NUM_PARTICLES << endl;
-    vector<Particle> particles;
-    particles.assign( NUM_PARTICLES, Particle() );
-
-    float zRange = 0.1f;
-    
-    
-    for( int i =0; i<particles.size(); i++) {
-        float a = randFloat() * M_PI * 2.0;
-        float r = 3.0;
-        float _x = cos(a) * r;
-        float _y = sin(a) * r;
-        float z = randFloat(-zRange, zRange);
-        
-        float s = mPerlin.fBm(_x, _y, z) * 0.2;
-        r = randFloat(2.0, 2.5);
-        float x = cos(a) * r * ( 1.0 + s);
-        float y = sin(a) * r * ( 1.0 + s);
-        
-        auto &p = particles.at( i );
-        
-        p.pos = vec3(x, y, z);
-        p.posOrg = vec3(x, y, z);
-        p.life = Rand::randFloat(0.01f, 1.0f);
-        p.random = vec3(randFloat(), randFloat(), randFloat());
+    const auto& args = getCommandLineArgs();
+    // --particles N starts with N instead, ']' and '[' add and remove chunks later
+    uint32_t numParticles = NUM_PARTICLES;
+    auto countArg = find( args.begin(), args.end(), "--particles" );
+    if( countArg != args.end() && countArg + 1 != args.end() ) {
+        numParticles = (uint32_t)stoul( *( countArg + 1 ) );
     }
+    console() << "Number of particles :  " << numParticles << endl;
     
-    mParticleBuffer[mSourceIndex]       = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), particles.data(), GL_STATIC_DRAW );
-    mParticleBuffer[mDestinationIndex]  = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), nullptr, GL_STATIC_DRAW );
+    bool wantsCompute = find( args.begin(), args.end(), "--compute" ) != args.end();
+    if( wantsCompute && Particles::isComputeAvailable() ) {
+        mBackend = ParticleBackend::Compute;
+    } else if( wantsCompute ) {
+        console() << "Compute shaders need GL 4.3, using transform feedback" << endl;
+    }
     
-    for( int i = 0; i < 2; ++i )
-    {    // Describe the particle layout for OpenGL.
-        mAttributes[i] = gl::Vao::create();
-        gl::ScopedVao vao( mAttributes[i] );
-        
-        // Define attributes as offsets into the bound particle buffer
-        gl::ScopedBuffer buffer( mParticleBuffer[i] );
-        gl::enableVertexAttribArray( 0 );
-        gl::enableVertexAttribArray( 1 );
-        gl::enableVertexAttribArray( 2 );
-        gl::enableVertexAttribArray( 3 );
-        gl::enableVertexAttribArray( 4 );
-        gl::vertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, pos) );
-        gl::vertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, vel) );
-        gl::vertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, posOrg) );
-        gl::vertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, random) );
-        gl::vertexAttribPointer( 4, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, life) );
+    // Generating takes seconds at this count, so it happens once and is mapped
+    // from the cache after that
+    ParticleCache::Key key = { PARTICLE_SEED, numParticles, PARTICLE_GENERATOR_VERSION, Particles::DYNAMIC_STRIDE, Particles::STATIC_STRIDE };
+    fs::path cachePath = ParticleCache::getPath( "Particles001", key );
+    Timer timer( true );
+    
+    if( ParticleCacheRef cache = ParticleCache::load( cachePath, key ) ) {
+        mParticles.init( numParticles, cache->getDynamicData(), cache->getStaticData(), mBackend );
+        console() << "Particles loaded from " << cachePath << " in " << timer.getSeconds() * 1000.0 << " ms" << endl;
+    } else {
+        vector<Particle> particles( numParticles );
+        vector<ParticleStatic> particlesStatic( numParticles );
+        generateParticles( particles, particlesStatic, PARTICLE_SEED );
         
+        mParticles.init( particles.size(), particles.data(), particlesStatic.data(), mBackend );
+        console() << "Particles generated in " << timer.getSeconds() * 1000.0 << " ms" << endl;
+        ParticleCache::save( cachePath, key, particles.data(), particlesStatic.data() );
     }
     
+    mRenderProg = gl::GlslProg::create( Particles::renderFormat( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag") ) ) );
+    mUpdateProg = createUpdateProg( mBackend, false );
+    mUpdateProgVolume = createUpdateProg( mBackend, true );
+    if( Particles::isCullingAvailable() ) {
+        mCullProg = gl::GlslProg::create( Particles::cullFormat( gl::GlslProg::Format(), loadString( loadAsset( "cull.vert" ) ) ) );
+    }
     
+    mCurlVolume = NoiseVolume::create( "Particles001", CURL_VOLUME_SIZE, CURL_VOLUME_PERIOD );
+    mCurlTex = mCurlVolume->createTexture();
+    mUpdateQuery = gl::QueryTimeSwapped::create();
     
-    mRenderProg = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag"))
-                                       .attribLocation( "ciPosition", 0 )
-                                       .attribLocation( "iPositionOrg", 2 )
-                                       .attribLocation( "iRandom", 3 )
-                                       .attribLocation( "iLife", 4 )
-                                    );
-    mUpdateProg = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "update.vert" ) )
-                                    .feedbackFormat( GL_INTERLEAVED_ATTRIBS )
-                                    .feedbackVaryings( { "position", "velocity", "positionOrg", "random", "life"} )
-                                    .attribLocation( "iPosition", 0 )
-                                    .attribLocation( "iVelocity", 1 )
-                                    .attribLocation( "iPositionOrg", 2 )
-                                    .attribLocation( "iRandom", 3 )
-                                    .attribLocation( "iLife", 4 )
-                                    );
-    
+    mUpdateCpu = UpdateCpu::create();
     
     mCamUi = CameraUi( &mCam, getWindow() );
     
@@ -231,32 +254,248 @@ void Particles001App::setup()
     mSphere->draw();
 }
 
+void Particles001App::generateParticles( vector<Particle>& particles, vector<ParticleStatic>& particlesStatic, uint32_t seed )
+{
+    // Every value is a function of ( seed, stream, particle ), so the chunks can run
+    // on any thread in any order and still give the same particles
+    enum { RAND_ANGLE, RAND_Z, RAND_RADIUS, RAND_LIFE, RAND_RANDOM };
+    CounterRand rand( seed );
+    float zRange = 0.1f;
+    
+    WorkerPool pool( thread::hardware_concurrency() );
+    pool.run( particles.size(), 4096, [&]( size_t begin, size_t end ) {
+        size_t count = end - begin;
+        vector<float> angle( count ), z( count ), radius( count ), life( count ), random( count * 3 );
+        rand.fill( angle.data(), count, RAND_ANGLE, begin, 0.0f, M_PI * 2.0 );
+        rand.fill( z.data(), count, RAND_Z, begin, -zRange, zRange );
+        rand.fill( radius.data(), count, RAND_RADIUS, begin, 2.0f, 2.5f );
+        rand.fill( life.data(), count, RAND_LIFE, begin, 0.01f, 1.0f );
+        rand.fill( random.data(), count * 3, RAND_RANDOM, begin * 3 );
+        
+        for( size_t j = 0; j < count; j++ ) {
+            float a = angle[j];
+            float r = 3.0;
+            float _x = cos(a) * r;
+            float _y = sin(a) * r;
+            
+            float s = mPerlin.fBm(_x, _y, z[j]) * 0.2;
+            r = radius[j];
+            float x = cos(a) * r * ( 1.0 + s);
+            float y = sin(a) * r * ( 1.0 + s);
+            
+            auto &p = particles[begin + j];
+            auto &ps = particlesStatic[begin + j];
+            
+            p.pos = vec3(x, y, z[j]);
+            ps.posOrg = vec3(x, y, z[j]);
+            p.life = life[j];
+            ps.random = vec3(random[j * 3], random[j * 3 + 1], random[j * 3 + 2]);
+        }
+    } );
+}
+
+gl::GlslProgRef Particles001App::createUpdateProg( ParticleBackend backend, bool curlVolume )
+{
+    gl::GlslProg::Format format;
+    if( curlVolume ) {
+        format.define( "CURL_VOLUME" );
+    }
+    
+#if defined( CINDER_GL_HAS_COMPUTE_SHADER )
+    if( backend == ParticleBackend::Compute ) {
+        return gl::GlslProg::create( Particles::computeFormat( format, loadString( loadAsset( "update.comp" ) ) ) );
+    }
+#endif
+    return gl::GlslProg::create( Particles::updateFormat( format.vertex( loadAsset( "update.vert" ) ) ) );
+}
+
 void Particles001App::mouseDown( MouseEvent event )
 {
 }
 
-void Particles001App::update()
+void Particles001App::keyDown( KeyEvent event )
 {
-    // Update particles on the GPU
-    gl::ScopedGlslProg prog( mUpdateProg );
-    gl::ScopedState rasterizer( GL_RASTERIZER_DISCARD, true );    // turn off fragment stage
+    if( event.getChar() == 'c' ) {
+        setCpuUpdateEnabled( !mUseCpu );
+    } else if( event.getChar() == 'b' ) {
+        if( !mUseCpu ) {
+            readBackParticles();
+        }
+        mUpdateCpu->benchmark( 60, float(getElapsedSeconds()) + mSeed );
+        mCurlVolume->compare( 1 << 18 );
+    } else if( event.getChar() == 'g' ) {
+        benchmarkBackends();
+    } else if( event.getChar() == ']' ) {
+        addParticleChunk();
+    } else if( event.getChar() == '[' ) {
+        removeParticleChunk();
+    } else if( event.getChar() == 'v' && mCullProg ) {
+        mUseCulling = !mUseCulling;
+        console() << "Particle culling " << ( mUseCulling ? "on" : "off" ) << endl;
+    } else if( event.getChar() == 'n' ) {
+        mUseCurlVolume = !mUseCurlVolume;
+        console() << "Curl noise from the " << ( mUseCurlVolume ? "baked volume" : "analytic function" ) << endl;
+    }
+}
+
+void Particles001App::setCpuUpdateEnabled( bool enabled )
+{
+    if( enabled == mUseCpu ) {
+        return;
+    }
     
-//    mUpdateProg->uniform("uCenter", getWindowCenter());
-    mUpdateProg->uniform("uTime", float(getElapsedSeconds()) + mSeed);
+    mUseCpu = enabled;
+    if( mUseCpu ) {
+        // Carry on from wherever the GPU left the particles
+        readBackParticles();
+    }
     
-    // Bind the source data (Attributes refer to specific buffers).
-    gl::ScopedVao source( mAttributes[mSourceIndex] );
-    // Bind destination as buffer base.
-    gl::bindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, mParticleBuffer[mDestinationIndex] );
-    gl::beginTransformFeedback( GL_POINTS );
+    console() << "Updating particles on the " << ( mUseCpu ? "CPU" : "GPU" ) << endl;
+}
 
-    // Draw source into destination, performing our vertex transformations.
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+void Particles001App::readBackParticles()
+{
+    vector<ParticleStatic> particlesStatic( mParticles.getCount() );
+    vector<Particle> particles( mParticles.getCount() );
+    size_t offset = 0;
+    for( size_t chunk = 0; chunk < mParticles.getNumChunks(); chunk++ ) {
+        size_t count = mParticles.getChunkCount( chunk );
+        mParticles.getStaticBuffer( chunk )->getBufferSubData( 0, count * sizeof(ParticleStatic), &particlesStatic[offset] );
+        mParticles.getBuffer( chunk )->getBufferSubData( 0, count * sizeof(Particle), &particles[offset] );
+        offset += count;
+    }
+    mUpdateCpu->setParticles( particlesStatic.data(), particles.data(), particles.size() );
+}
 
-    gl::endTransformFeedback();
+void Particles001App::addParticleChunk()
+{
+    vector<Particle> particles( Particles::CHUNK_SIZE );
+    vector<ParticleStatic> particlesStatic( Particles::CHUNK_SIZE );
+    // Another seed a chunk, or they'd all start on top of each other
+    generateParticles( particles, particlesStatic, PARTICLE_SEED + (uint32_t)mParticles.getNumChunks() );
+    mParticles.addParticles( particles.size(), particles.data(), particlesStatic.data() );
+    
+    if( mUseCpu ) {
+        readBackParticles();
+    }
+    console() << "Number of particles :  " << mParticles.getCount() << " in " << mParticles.getNumChunks() << " chunks" << endl;
+}
+
+void Particles001App::removeParticleChunk()
+{
+    if( mParticles.getNumChunks() <= 1 ) {
+        return;
+    }
+    
+    mParticles.removeChunk( mParticles.getNumChunks() - 1 );
+    
+    if( mUseCpu ) {
+        readBackParticles();
+    }
+    console() << "Number of particles :  " << mParticles.getCount() << " in " << mParticles.getNumChunks() << " chunks" << endl;
+}
+
+void Particles001App::benchmarkBackends()
+{
+    vector<ParticleBackend> backends = { ParticleBackend::TransformFeedback };
+    if( Particles::isComputeAvailable() ) {
+        backends.push_back( ParticleBackend::Compute );
+    } else {
+        console() << "No compute shaders in this context, timing transform feedback only" << endl;
+    }
+    
+    const int NUM_WARMUP = 5;
+    const int NUM_FRAMES = 60;
+    
+    for( int count : { 100000, 400000, 1000000, 2000000, 4000000 } ) {
+        vector<Particle> particles( count );
+        vector<ParticleStatic> particlesStatic( count );
+        generateParticles( particles, particlesStatic, PARTICLE_SEED );
+        
+        for( ParticleBackend backend : backends ) {
+            Particles particleSystem;
+            particleSystem.init( count, particles.data(), particlesStatic.data(), backend );
+            gl::GlslProgRef prog = createUpdateProg( backend, false );
+            gl::ScopedGlslProg scopedProg( prog );
+            
+            // Wait for the GPU on both ends of the timed frames
+            Timer timer;
+            for( int frame = 0; frame < NUM_WARMUP + NUM_FRAMES; frame++ ) {
+                if( frame == NUM_WARMUP ) {
+                    glFinish();
+                    timer.start();
+                }
+                prog->uniform( "uTime", frame / 60.0f );
+                particleSystem.update();
+            }
+            glFinish();
+            
+            double seconds = timer.getSeconds();
+            console() << ( backend == ParticleBackend::Compute ? "Compute" : "Transform feedback" ) << ", " << count << " particles : "
+                      << seconds * 1000.0 / NUM_FRAMES << " ms per frame, " << (double)count * NUM_FRAMES / seconds / 1e6 << "M particles/s" << endl;
+        }
+    }
+}
+
+void Particles001App::update()
+{
+    float time = float(getElapsedSeconds()) + mSeed;
+    if( mUseCpu ) {
+        updateCpu( time );
+    } else {
+        updateGpu( time );
+    }
+}
+
+void Particles001App::updateCpu( float time )
+{
+    mUpdateCpu->update( time );
+    
+    // Write straight into the destination buffers, the GPU path's output
+    size_t offset = 0;
+    for( size_t chunk = 0; chunk < mParticles.getNumChunks(); chunk++ ) {
+        size_t count = mParticles.getChunkCount( chunk );
+        auto buffer = mParticles.getDestinationBuffer( chunk );
+        Particle *particles = (Particle*)buffer->mapReplace();
+        if( particles ) {
+            mUpdateCpu->writeParticles( particles, offset, count );
+            buffer->unmap();
+        }
+        offset += count;
+    }
+    mParticles.swap();
+    
+    if( getElapsedFrames() % 120 == 0 ) {
+        double seconds = mUpdateCpu->getLastUpdateSeconds();
+        console() << "CPU update : " << seconds * 1000.0 << " ms, " << mParticles.getCount() / seconds / mUpdateCpu->getNumThreads() / 1e6
+                  << "M particles/s per core on " << mUpdateCpu->getNumThreads() << " threads" << endl;
+    }
+}
 
-    // Swap source and destination for next loop
-    std::swap( mSourceIndex, mDestinationIndex );
+void Particles001App::updateGpu( float time )
+{
+    // Update particles on the GPU
+    gl::GlslProgRef updateProg = mUseCurlVolume ? mUpdateProgVolume : mUpdateProg;
+    gl::ScopedGlslProg prog( updateProg );
+    
+//    mUpdateProg->uniform("uCenter", getWindowCenter());
+    updateProg->uniform("uTime", time);
+    
+    gl::ScopedTextureBind texScope( mCurlTex, (uint8_t) 0 );
+    if( mUseCurlVolume ) {
+        updateProg->uniform( "uCurlVolume", 0 );
+        updateProg->uniform( "uCurlPeriod", CURL_VOLUME_PERIOD );
+    }
+    
+    // Draw source into destination, then swap them for the next frame
+    mUpdateQuery->begin();
+    mParticles.update();
+    mUpdateQuery->end();
+    
+    if( getElapsedFrames() % 120 == 0 ) {
+        console() << "GPU update with " << ( mUseCurlVolume ? "the baked" : "analytic" ) << " curl noise : "
+                  << mUpdateQuery->getElapsedMilliseconds() << " ms" << endl;
+    }
 }
 
 
@@ -270,13 +509,12 @@ void Particles001App::updateShadowMap() {
     gl::setMatrices( mLightCam );
     gl::enableDepthRead();
     gl::enableDepthWrite();
+    cullParticles( VIEW_LIGHT );
 
     gl::ScopedGlslProg prog( mRenderProg );
     
     mRenderProg->uniform("uViewport", vec2(getWindowSize()));
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+    drawParticles( VIEW_LIGHT );
 }
 
 void Particles001App::updateEnvMap() {
@@ -293,6 +531,27 @@ void Particles001App::updateEnvMap() {
     mEnv->draw();
 }
 
+void Particles001App::cullParticles( size_t view )
+{
+    if( !mUseCulling ) {
+        return;
+    }
+    
+    gl::ScopedGlslProg prog( mCullProg );
+    mCullProg->uniform( "uViewport", vec2( getWindowSize() ) );
+    mCullProg->uniform( "uTargetSize", vec2( gl::getViewport().second ) );
+    mParticles.cull( view );
+}
+
+void Particles001App::drawParticles( size_t view )
+{
+    if( mUseCulling ) {
+        mParticles.drawCulled( view );
+    } else {
+        mParticles.draw();
+    }
+}
+
 void Particles001App::draw()
 {
     updateShadowMap();
@@ -312,6 +571,7 @@ void Particles001App::draw()
     
 	
     gl::setMatrices( mCam );
+    cullParticles( VIEW_CAMERA );
     
 
     gl::ScopedGlslProg prog( mRenderProg );
@@ -330,9 +590,12 @@ void Particles001App::draw()
     gl::ScopedTextureBind texScopeEnv( mFboEnv->getColorTexture(), (uint8_t) 2 );
     mRenderProg->uniform( "uEnvMap", 2 );
     
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+    drawParticles( VIEW_CAMERA );
+    
+    if( mUseCulling && getElapsedFrames() % 120 == 0 ) {
+        console() << "Visible particles : " << mParticles.getVisibleCount( VIEW_LIGHT ) << " from the light, "
+                  << mParticles.getVisibleCount( VIEW_CAMERA ) << " from the camera, of " << mParticles.getCount() << endl;
+    }
 
     //*/
 //    gl::setMatricesWindow( toPixels( getWindowSize() ) );
@@ -0,0 +1,235 @@
+//
+//  UpdateCpu.cpp
+//  Particles001
+//
+
+#include "UpdateCpu.hpp"
+#include "cinder/Timer.h"
+
+#include <cstring>
+
+using namespace CpuSimd;
+
+namespace {
+
+// Particles per chunk handed to a worker, a multiple of LANES
+const size_t GRAIN = 4096;
+
+// Runs \a kernel over arrays of any length, the last vector is padded with zeros
+template<typename Kernel>
+void forEachVector( const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t count, Kernel kernel )
+{
+    for( size_t i = 0; i < count; i += LANES ) {
+        const size_t n = std::min( LANES, count - i );
+        float in[3][LANES] = {};
+        memcpy( in[0], x + i, n * sizeof( float ) );
+        memcpy( in[1], y + i, n * sizeof( float ) );
+        memcpy( in[2], z + i, n * sizeof( float ) );
+
+        FloatV ox, oy, oz;
+        kernel( load( in[0] ), load( in[1] ), load( in[2] ), ox, oy, oz );
+
+        float out[3][LANES];
+        store( out[0], ox );
+        store( out[1], oy );
+        store( out[2], oz );
+        memcpy( outX + i, out[0], n * sizeof( float ) );
+        memcpy( outY + i, out[1], n * sizeof( float ) );
+        memcpy( outZ + i, out[2], n * sizeof( float ) );
+    }
+}
+
+void resize( vector<float>* arrays, size_t numArrays, size_t size )
+{
+    for( size_t i = 0; i < numArrays; i++ ) {
+        arrays[i].assign( size, 0.0f );
+    }
+}
+
+} // anonymous namespace
+
+
+//===== UpdateCpu ==============================================================//
+
+UpdateCpu::UpdateCpu( size_t numThreads )
+    : mPool( numThreads > 0 ? numThreads : std::max( thread::hardware_concurrency(), 1u ) )
+{
+}
+
+void UpdateCpu::setParticles( const ParticleStatic* particlesStatic, const Particle* particles, size_t count )
+{
+    const size_t padded = ( count + LANES - 1 ) / LANES * LANES;
+    mState.mCount = count;
+    resize( mState.mPos, 3, padded );
+    resize( mState.mVel, 3, padded );
+    resize( mState.mPosOrg, 3, padded );
+    resize( mState.mRandom, 3, padded );
+    resize( &mState.mLife, 1, padded );
+
+    for( size_t i = 0; i < count; i++ ) {
+        const Particle& p = particles[i];
+        const ParticleStatic& ps = particlesStatic[i];
+        for( int c = 0; c < 3; c++ ) {
+            mState.mPos[c][i] = p.pos[c];
+            mState.mVel[c][i] = p.vel[c];
+            mState.mPosOrg[c][i] = ps.posOrg[c];
+            mState.mRandom[c][i] = ps.random[c];
+        }
+        mState.mLife[i] = p.life;
+    }
+
+    // Padding sits on a valid position so it can't produce NaNs
+    for( size_t i = count; i < padded; i++ ) {
+        mState.mPos[0][i] = mState.mPosOrg[0][i] = 1.0f;
+        mState.mLife[i] = 1.0f;
+    }
+}
+
+void UpdateCpu::writeParticles( Particle* particles )
+{
+    writeParticles( particles, 0, mState.mCount );
+}
+
+void UpdateCpu::writeParticles( Particle* particles, size_t first, size_t count )
+{
+    const State& state = mState;
+    mPool.run( count, GRAIN, [&]( size_t begin, size_t end ) {
+        for( size_t i = begin; i < end; i++ ) {
+            Particle& p = particles[i];
+            const size_t j = first + i;
+            p.pos = vec3( state.mPos[0][j], state.mPos[1][j], state.mPos[2][j] );
+            p.vel = vec3( state.mVel[0][j], state.mVel[1][j], state.mVel[2][j] );
+            p.life = state.mLife[j];
+        }
+    });
+}
+
+void UpdateCpu::update( float time )
+{
+    Timer timer( true );
+
+    State& state = mState;
+    mPool.run( state.mLife.size(), GRAIN, [&]( size_t begin, size_t end ) {
+        step( state, begin, end, time );
+    });
+
+    mLastUpdateSeconds = timer.getSeconds();
+}
+
+void UpdateCpu::step( State& state, size_t begin, size_t end, float time )
+{
+    // forceRotate.xy = rotate( forceRotate.xy, PI * 0.7 )
+    const float angle = 3.141592653f * 0.7f;
+    const float s = sinf( angle );
+    const float c = cosf( angle );
+    const float t = time * 0.5f;
+
+    for( size_t i = begin; i < end; i += LANES ) {
+        FloatV px = load( &state.mPos[0][i] );
+        FloatV py = load( &state.mPos[1][i] );
+        FloatV pz = load( &state.mPos[2][i] );
+        FloatV vx = load( &state.mVel[0][i] );
+        FloatV vy = load( &state.mVel[1][i] );
+        FloatV vz = load( &state.mVel[2][i] );
+        const FloatV rx = load( &state.mRandom[0][i] );
+        const FloatV ry = load( &state.mRandom[1][i] );
+        const FloatV rz = load( &state.mRandom[2][i] );
+        FloatV life = load( &state.mLife[i] );
+
+        FloatV posOffset = snoise( px * 0.5f + rx * 0.01f + t, py * 0.5f + ry * 0.01f + t, pz * 0.5f + rz * 0.01f + t ) * 0.5f + 0.5f;
+        posOffset = mix( 0.1f, 1.0f, posOffset ) * 1.5f;
+
+        FloatV nx, ny, nz;
+        curlNoise( px * posOffset + t, py * posOffset + t, pz * posOffset + t, nx, ny, nz );
+        nz = ( nz * 0.5f + 0.5f ) * 3.0f;
+
+        FloatV gx = px, gy = py, gz = pz;
+        normalize3( gx, gy, gz );
+
+        FloatV fx = px, fy = py, fz = splat( 0.0f );
+        normalize3( fx, fy, fz );
+        const FloatV rotX = c * fx - s * fy;
+        const FloatV rotY = s * fx + c * fy;
+
+        const FloatV ax = -gx + rotX * 0.75f + nx * 0.5f;
+        const FloatV ay = -gy + rotY * 0.75f + ny * 0.5f;
+        const FloatV az = -2.0f - gz + nz * 0.5f;
+
+        const FloatV speed = mix( 0.95f, 1.0f, rz ) * 0.003f;
+        vx += ax * speed;
+        vy += ay * speed;
+        vz += az * speed;
+        px += vx;
+        py += vy;
+        pz += vz;
+        vx *= 0.9f;
+        vy *= 0.9f;
+        vz *= 0.9f;
+
+        life -= mix( 0.01f, 0.02f, rx );
+
+        // Dead particles restart from their original position at rest
+        const IntV dead = life < 0.0f;
+        life = select( dead, splat( 1.0f ), life );
+        px = select( dead, load( &state.mPosOrg[0][i] ), px );
+        py = select( dead, load( &state.mPosOrg[1][i] ), py );
+        pz = select( dead, load( &state.mPosOrg[2][i] ), pz );
+        vx = select( dead, splat( 0.0f ), vx );
+        vy = select( dead, splat( 0.0f ), vy );
+        vz = select( dead, splat( 0.0f ), vz );
+
+        store( &state.mPos[0][i], px );
+        store( &state.mPos[1][i], py );
+        store( &state.mPos[2][i], pz );
+        store( &state.mVel[0][i], vx );
+        store( &state.mVel[1][i], vy );
+        store( &state.mVel[2][i], vz );
+        store( &state.mLife[i], life );
+    }
+}
+
+void UpdateCpu::computeNoiseVec3( const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t count )
+{
+    forEachVector( x, y, z, outX, outY, outZ, count, []( FloatV px, FloatV py, FloatV pz, FloatV& nx, FloatV& ny, FloatV& nz ) {
+        nx = snoise0( px, py, pz );
+        ny = snoise1( px, py, pz );
+        nz = snoise2( px, py, pz );
+    });
+}
+
+void UpdateCpu::computeCurlNoise( const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t count )
+{
+    forEachVector( x, y, z, outX, outY, outZ, count, []( FloatV px, FloatV py, FloatV pz, FloatV& cx, FloatV& cy, FloatV& cz ) {
+        curlNoise( px, py, pz, cx, cy, cz );
+    });
+}
+
+void UpdateCpu::benchmark( int numFrames, float time )
+{
+    if( mState.mCount == 0 || numFrames <= 0 ) {
+        return;
+    }
+
+    vector<size_t> counts = { 1 };
+    if( mPool.getNumThreads() > 1 ) {
+        counts.push_back( mPool.getNumThreads() );
+    }
+
+    for( size_t numThreads : counts ) {
+        WorkerPool pool( numThreads );
+        State state = mState;
+
+        Timer timer( true );
+        for( int frame = 0; frame < numFrames; frame++ ) {
+            const float frameTime = time + frame / 60.0f;
+            pool.run( state.mLife.size(), GRAIN, [&]( size_t begin, size_t end ) {
+                step( state, begin, end, frameTime );
+            });
+        }
+        const double seconds = timer.getSeconds();
+
+        const double rate = (double)state.mCount * numFrames / seconds;
+        console() << "CPU update, " << numThreads << " threads : " << rate / 1e6 << "M particles/s, "
+                  << rate / 1e6 / numThreads << "M per core, " << seconds * 1000.0 / numFrames << " ms per frame" << endl;
+    }
+}
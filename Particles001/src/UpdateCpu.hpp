@@ -0,0 +1,90 @@
+//
+//  UpdateCpu.hpp
+//  Particles001
+//
+//  The update.vert step on the CPU, for machines without transform feedback and
+//  for profiling the kernel on its own.
+//
+
+#ifndef UpdateCpu_hpp
+#define UpdateCpu_hpp
+
+#include <stdio.h>
+#include <vector>
+#include "cinder/gl/gl.h"
+#include "CpuSimd.hpp"
+
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+// Never changes after setup, bound once and shared by both VAOs
+struct ParticleStatic
+{
+    vec3    posOrg;
+    vec3    random;
+};
+
+// The only part written by transform feedback
+struct Particle
+{
+    vec3    pos;
+    vec3    vel;
+    float   life;
+};
+
+
+typedef std::shared_ptr<class UpdateCpu> UpdateCpuRef;
+
+/**  Same step as update.vert over structure of arrays, four or eight particles at
+     a time with the compiler's vector extensions (AVX, SSE or NEON, whatever the
+     target has) and split across a WorkerPool.
+*/
+class UpdateCpu {
+
+public:
+    // 0 threads is one per core
+    explicit UpdateCpu( size_t numThreads = 0 );
+
+    static UpdateCpuRef create( size_t numThreads = 0 ) { return std::make_shared<UpdateCpu>( numThreads ); }
+
+    void setParticles( const ParticleStatic* particlesStatic, const Particle* particles, size_t count );
+    // Only the dynamic part, the static one is never written
+    void writeParticles( Particle* particles );
+    // Particles [first, first + count) to particles[0, count), like one chunk of them
+    void writeParticles( Particle* particles, size_t first, size_t count );
+
+    void update( float time );
+
+    /**  Times \a numFrames updates of a copy of the particles on one thread and on
+         all of them, and logs particles per second in total and per core.
+    */
+    void benchmark( int numFrames, float time );
+
+    // snoiseVec3() and curlNoise() of update.vert for \a count points, vectorised the same way
+    static void computeNoiseVec3( const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t count );
+    static void computeCurlNoise( const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t count );
+
+    size_t getNumParticles() const      { return mState.mCount; }
+    size_t getNumThreads() const        { return mPool.getNumThreads(); }
+    double getLastUpdateSeconds() const { return mLastUpdateSeconds; }
+
+private:
+    // Padded to a whole number of vectors, the padding is never written back
+    struct State {
+        size_t          mCount = 0;
+        vector<float>   mPos[3];
+        vector<float>   mVel[3];
+        vector<float>   mPosOrg[3];
+        vector<float>   mRandom[3];
+        vector<float>   mLife;
+    };
+
+    static void step( State& state, size_t begin, size_t end, float time );
+
+    WorkerPool  mPool;
+    State       mState;
+    double      mLastUpdateSeconds = 0.0;
+};
+#endif /* UpdateCpu_hpp */
@@ -0,0 +1,33 @@
+#version 150 core
+
+// ParticleSystem::cullFormat() declares the particle attributes above and
+// calls isVisible() for each of them with the matrices of the pass to come
+
+uniform mat4	ciModelViewProjection;
+uniform mat4    ciProjectionMatrix;
+
+uniform vec2    uViewport;
+uniform vec2    uTargetSize;
+
+const float radius = 0.002;
+
+// Same point and size as render.vert
+bool isVisible()
+{
+    float lifeScale = smoothstep(0.0, 0.1, iLife);
+    if( lifeScale < 0.001 ) {
+        return false;
+    }
+    
+    vec4 clip = ciModelViewProjection * vec4(iPosition, 1.0);
+    if( clip.w <= 0.0 ) {
+        return false;
+    }
+    
+    // Half the sprite in clip space, so the ones on the edges stay
+    float distOffset = uViewport.y * ciProjectionMatrix[1][1] * radius / clip.w;
+    float pointSize = max(distOffset * lifeScale * mix(0.5, 1.0, iRandom.x), 1.0);
+    float margin = pointSize / min(uTargetSize.x, uTargetSize.y) * clip.w;
+    
+    return all(lessThanEqual(abs(clip.xy), vec2(clip.w + margin))) && abs(clip.z) <= clip.w;
+}
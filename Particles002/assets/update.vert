@@ -9,8 +9,6 @@ in float  iLife;
 
 out vec3  position;
 out vec3  velocity;
-out vec3  positionOrg;
-out vec3  random;
 out float life;
 
 uniform float uTime;
@@ -149,9 +147,6 @@ void main()
 {
     vec3 pos    = iPosition;
     vec3 vel    = iVelocity;
-
-    positionOrg = iPositionOrg;
-    random      = iRandom;
     
     vec3 acc = vec3(0.0, 0.0, 0.5);
     float speedOffset = mix(0.95, 1.0, iRandom.z);
@@ -176,7 +171,7 @@ void main()
     pos += vel;
     vel *= 0.95;
     
-    life = iLife - mix(0.015, 0.02, random.x) * 0.15;
+    life = iLife - mix(0.015, 0.02, iRandom.x) * 0.15;
     
     if(life < 0.0f) {
         life = 1.0;
@@ -6,13 +6,31 @@
 #include "cinder/Camera.h"
 #include "cinder/CameraUi.h"
 #include "cinder/Rand.h"
+#include "cinder/Timer.h"
+#include "cinder/Utilities.h"
 
 #include "BatchHelpers.hpp"
+#include "ParticleSystem.hpp"
+#include "ParticleCache.hpp"
+#include "CounterRand.hpp"
 
 using namespace ci;
 using namespace ci::app;
 using namespace std;
 
+struct ParticleLayout {
+    static constexpr ParticleField FIELDS[] = {
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iPosition",    "position", "ciPosition" },
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iVelocity",    "velocity" },
+        { ParticleType::Vec3,   ParticleStream::Static,     "iPositionOrg" },
+        { ParticleType::Vec3,   ParticleStream::Static,     "iRandom" },
+        { ParticleType::Float,  ParticleStream::Dynamic,    "iLife",        "life" },
+    };
+};
+constexpr ParticleField ParticleLayout::FIELDS[];
+
+typedef ParticleSystem<ParticleLayout> Particles;
+
 class Particles002App : public App {
   public:
 	void setup() override;
@@ -22,6 +40,8 @@ class Particles002App : public App {
 
     void initParticles();
     void updateShadowMap();
+    void cullParticles( size_t view );
+    void drawParticles( size_t view );
     
     
 private:
@@ -38,13 +58,12 @@ private:
     // shaders
     gl::GlslProgRef         mShaderUpdate;
     gl::GlslProgRef         mShaderRender;
+    gl::GlslProgRef         mShaderCull;
     
     // particles
-    gl::VaoRef              mAttributes[2];
-    gl::VboRef              mParticleBuffer[2];
-    
-    std::uint32_t           mSourceIndex        = 0;
-    std::uint32_t           mDestinationIndex   = 1;
+    Particles               mParticles;
+    // Off-screen and dead particles dropped before each pass once 'v' turns it on
+    bool                    mUseCulling = false;
     
     
     gl::FboRef              mFbo;
@@ -59,18 +78,34 @@ private:
 };
 
 const int    NUM_PARTICLES = 60e4;
+// Same seed, same particles, which is what lets them be cached on disk.
+// Bump the version after changing generateParticles().
+const uint32_t PARTICLE_SEED = 1;
+const uint32_t PARTICLE_GENERATOR_VERSION = 2;
 const int    FBO_WIDTH = 2048;
 const int    FBO_HEIGHT = 2048;
+// Culled particles of the shadow map and of the main pass
+const size_t VIEW_LIGHT = 0;
+const size_t VIEW_CAMERA = 1;
+
+// Never changes after setup, bound once and shared by both VAOs
+struct ParticleStatic
+{
+    vec3    posOrg;
+    vec3    random;
+};
 
+// The only part written by transform feedback
 struct Particle
 {
     vec3    pos;
     vec3    vel;
-    vec3    posOrg;
-    vec3    random;
     float   life;
 };
 
+static_assert( Particles::DYNAMIC_STRIDE == sizeof(Particle), "ParticleLayout doesn't match Particle" );
+static_assert( Particles::STATIC_STRIDE == sizeof(ParticleStatic), "ParticleLayout doesn't match ParticleStatic" );
+
 
 void prepareSettings( Particles002App::Settings *settings) {
 //    settings->setWindowSize(1920, 1080);
@@ -106,66 +141,58 @@ void Particles002App::setup()
     initParticles();
 }
 
-void Particles002App::initParticles() {
-    vector<Particle> particles;
-    particles.assign( NUM_PARTICLES, Particle() );
-
+static void generateParticles( vector<Particle>& particles, vector<ParticleStatic>& particlesStatic, uint32_t seed )
+{
+    // Every value is a function of ( seed, stream, particle ), batched per attribute
+    enum { RAND_X, RAND_Y, RAND_Z, RAND_LIFE, RAND_RANDOM };
+    CounterRand rand( seed );
+    size_t count = particles.size();
     float w = 0.2 * 0.5f;
     float h = 0.294 * 0.5f;
     
-    for( int i =0; i<particles.size(); i++) {
-        float x = randFloat(-w, w);
-        float y = randFloat(-h, h);
-        float z = randFloat(-0.01, 0.01);
-        
+    vector<float> x( count ), y( count ), z( count ), life( count );
+    vector<vec3> random( count );
+    rand.fill( x.data(), count, RAND_X, 0, -w, w );
+    rand.fill( y.data(), count, RAND_Y, 0, -h, h );
+    rand.fill( z.data(), count, RAND_Z, 0, -0.01f, 0.01f );
+    rand.fill( life.data(), count, RAND_LIFE, 0, 0.01f, 1.0f );
+    rand.fill( &random[0].x, count * 3, RAND_RANDOM, 0 );
+    
+    for( int i =0; i<count; i++) {
         auto &p = particles.at( i );
+        auto &ps = particlesStatic.at( i );
         
-        p.pos = vec3(x, y, z);
-        p.posOrg = vec3(x, y, z);
-        p.life = Rand::randFloat(0.01f, 1.0f);
-        p.random = vec3(randFloat(), randFloat(), randFloat());
+        p.pos = vec3(x[i], y[i], z[i]);
+        ps.posOrg = vec3(x[i], y[i], z[i]);
+        p.life = life[i];
+        ps.random = random[i];
     }
-    
-    mParticleBuffer[mSourceIndex]       = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), particles.data(), GL_STATIC_DRAW );
-    mParticleBuffer[mDestinationIndex]  = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), nullptr, GL_STATIC_DRAW );
-    
-    for( int i = 0; i < 2; ++i )
-    {    // Describe the particle layout for OpenGL.
-        mAttributes[i] = gl::Vao::create();
-        gl::ScopedVao vao( mAttributes[i] );
-        
-        // Define attributes as offsets into the bound particle buffer
-        gl::ScopedBuffer buffer( mParticleBuffer[i] );
-        gl::enableVertexAttribArray( 0 );
-        gl::enableVertexAttribArray( 1 );
-        gl::enableVertexAttribArray( 2 );
-        gl::enableVertexAttribArray( 3 );
-        gl::enableVertexAttribArray( 4 );
-        gl::vertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, pos) );
-        gl::vertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, vel) );
-        gl::vertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, posOrg) );
-        gl::vertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, random) );
-        gl::vertexAttribPointer( 4, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, life) );
+}
+
+void Particles002App::initParticles() {
+    // Generated on the first launch and mapped from the cache after that
+    ParticleCache::Key key = { PARTICLE_SEED, NUM_PARTICLES, PARTICLE_GENERATOR_VERSION, Particles::DYNAMIC_STRIDE, Particles::STATIC_STRIDE };
+    fs::path cachePath = ParticleCache::getPath( "Particles002", key );
+    Timer timer( true );
+    
+    if( ParticleCacheRef cache = ParticleCache::load( cachePath, key ) ) {
+        mParticles.init( NUM_PARTICLES, cache->getDynamicData(), cache->getStaticData() );
+        console() << "Particles loaded from " << cachePath << " in " << timer.getSeconds() * 1000.0 << " ms" << endl;
+    } else {
+        vector<Particle> particles( NUM_PARTICLES );
+        vector<ParticleStatic> particlesStatic( NUM_PARTICLES );
+        generateParticles( particles, particlesStatic, PARTICLE_SEED );
         
+        mParticles.init( particles.size(), particles.data(), particlesStatic.data() );
+        console() << "Particles generated in " << timer.getSeconds() * 1000.0 << " ms" << endl;
+        ParticleCache::save( cachePath, key, particles.data(), particlesStatic.data() );
     }
     
-    
-    
-    mShaderRender = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag"))
-                                       .attribLocation( "ciPosition", 0 )
-                                       .attribLocation( "iPositionOrg", 2 )
-                                       .attribLocation( "iRandom", 3 )
-                                       .attribLocation( "iLife", 4 )
-                                    );
-    mShaderUpdate = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "update.vert" ) )
-                                    .feedbackFormat( GL_INTERLEAVED_ATTRIBS )
-                                    .feedbackVaryings( { "position", "velocity", "positionOrg", "random", "life"} )
-                                    .attribLocation( "iPosition", 0 )
-                                    .attribLocation( "iVelocity", 1 )
-                                    .attribLocation( "iPositionOrg", 2 )
-                                    .attribLocation( "iRandom", 3 )
-                                    .attribLocation( "iLife", 4 )
-                                    );
+    mShaderRender = gl::GlslProg::create( Particles::renderFormat( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag") ) ) );
+    mShaderUpdate = gl::GlslProg::create( Particles::updateFormat( gl::GlslProg::Format().vertex( loadAsset( "update.vert" ) ) ) );
+    if( Particles::isCullingAvailable() ) {
+        mShaderCull = gl::GlslProg::create( Particles::cullFormat( gl::GlslProg::Format(), loadString( loadAsset( "cull.vert" ) ) ) );
+    }
     
     
     // shadow mapping
@@ -196,6 +223,9 @@ void Particles002App::keyDown( KeyEvent event )
     if(event.getCode() == 32) {
 
         mTargetOffset = 1.0;
+    } else if( event.getChar() == 'v' && mShaderCull ) {
+        mUseCulling = !mUseCulling;
+        console() << "Particle culling " << ( mUseCulling ? "on" : "off" ) << endl;
     }
 }
 
@@ -203,18 +233,10 @@ void Particles002App::update()
 {
     mOffset += (mTargetOffset - mOffset) * 0.1;
     gl::ScopedGlslProg prog( mShaderUpdate );
-    gl::ScopedState rasterizer( GL_RASTERIZER_DISCARD, true );    // turn off fragment stage
     mShaderUpdate->uniform("uTime", float(getElapsedSeconds()) + mSeed);
     mShaderUpdate->uniform("uOffset", mOffset);
     
-    gl::ScopedVao source( mAttributes[mSourceIndex] );
-    gl::bindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, mParticleBuffer[mDestinationIndex] );
-    gl::beginTransformFeedback( GL_POINTS );
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
-
-    gl::endTransformFeedback();
-
-    std::swap( mSourceIndex, mDestinationIndex );
+    mParticles.update();
     
     
 }
@@ -227,14 +249,34 @@ void Particles002App::updateShadowMap() {
     gl::clear( Color( 0, 0, 0 ) );
     //    gl::setMatricesWindowPersp( getWindowSize(), 60.0f, 1.0f, 10000.0f );
     gl::setMatrices( mCamLight );
+    cullParticles( VIEW_LIGHT );
 
 
     gl::ScopedGlslProg prog( mShaderRender );
     
     mShaderRender->uniform("uViewport", vec2(getWindowSize()));
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+    drawParticles( VIEW_LIGHT );
+}
+
+void Particles002App::cullParticles( size_t view )
+{
+    if( !mUseCulling ) {
+        return;
+    }
+    
+    gl::ScopedGlslProg prog( mShaderCull );
+    mShaderCull->uniform( "uViewport", vec2( getWindowSize() ) );
+    mShaderCull->uniform( "uTargetSize", vec2( gl::getViewport().second ) );
+    mParticles.cull( view );
+}
+
+void Particles002App::drawParticles( size_t view )
+{
+    if( mUseCulling ) {
+        mParticles.drawCulled( view );
+    } else {
+        mParticles.draw();
+    }
 }
 
 void Particles002App::draw()
@@ -250,6 +292,7 @@ void Particles002App::draw()
 //    bBall->draw(mLightPos, vec3(0.1f), vec3(1.0, 1.0, 0.0));
     
     gl::translate(vec3(0.0, 0.0, -0.5));
+    cullParticles( VIEW_CAMERA );
     mat4 shadowMatrix = mCamLight.getProjectionMatrix() * mCamLight.getViewMatrix();
     gl::ScopedGlslProg prog( mShaderRender );
     mShaderRender->uniform("uViewport", vec2(getWindowSize()));
@@ -262,9 +305,12 @@ void Particles002App::draw()
     gl::ScopedTextureBind texColor( mColorTex, (uint8_t) 2 );
     mShaderRender->uniform( "uColorMap", 2 );
     
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+    drawParticles( VIEW_CAMERA );
+    
+    if( mUseCulling && getElapsedFrames() % 120 == 0 ) {
+        console() << "Visible particles : " << mParticles.getVisibleCount( VIEW_LIGHT ) << " from the light, "
+                  << mParticles.getVisibleCount( VIEW_CAMERA ) << " from the camera, of " << mParticles.getCount() << endl;
+    }
     
 //    gl::setMatricesWindow( toPixels( getWindowSize() ) );
 //    int s = 128 * 2;
@@ -6,6 +6,7 @@
 
 #include "CinderARKit.h"
 #include "BatchHelpers.h"
+#include "ParticleSystem.hpp"
 
 
 using namespace ci;
@@ -16,6 +17,18 @@ const int NUM_PARTICLES = 50e4;
 const int    FBO_WIDTH  = 2048;
 const int    FBO_HEIGHT = 2048;
 
+struct ParticleLayout {
+    static constexpr ParticleField FIELDS[] = {
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iPosition",    "position",     "ciPosition" },
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iPositionOrg", "positionOrg" },
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iColor",       "color" },
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iExtra",       "extra" },
+    };
+};
+constexpr ParticleField ParticleLayout::FIELDS[];
+
+typedef ParticleSystem<ParticleLayout> Particles;
+
 class PixelatedApp : public App {
   public:
 	void setup() override;
@@ -39,13 +52,7 @@ private:
     gl::GlslProgRef mShaderUpdate;
     
     // particles
-    // Descriptions of particle data layout.
-    gl::VaoRef          mAttributes[2];
-    // Buffers holding raw particle data on GPU.
-    gl::VboRef          mParticleBuffer[2];
-    
-    std::uint32_t       mSourceIndex        = 0;
-    std::uint32_t       mDestinationIndex   = 1;
+    Particles           mParticles;
     
     gl::FboRef              mFboEnv;
     
@@ -63,6 +70,8 @@ struct Particle
     vec3 extra;
 };
 
+static_assert( Particles::DYNAMIC_STRIDE == sizeof(Particle), "ParticleLayout doesn't match Particle" );
+
 void PixelatedApp::setup()
 {
     auto config = ARKit::SessionConfiguration()
@@ -110,42 +119,11 @@ void PixelatedApp::setup()
         p.extra = vec3(0, randFloat(), randFloat());
     }
     
-    mParticleBuffer[mSourceIndex]       = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), particles.data(), GL_STATIC_DRAW );
-    mParticleBuffer[mDestinationIndex]  = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), nullptr, GL_STATIC_DRAW );
-    
-    for( int i = 0; i < 2; ++i )
-    {    // Describe the particle layout for OpenGL.
-        mAttributes[i] = gl::Vao::create();
-        gl::ScopedVao vao( mAttributes[i] );
-        
-        // Define attributes as offsets into the bound particle buffer
-        gl::ScopedBuffer buffer( mParticleBuffer[i] );
-        gl::enableVertexAttribArray( 0 );
-        gl::enableVertexAttribArray( 1 );
-        gl::enableVertexAttribArray( 2 );
-        gl::enableVertexAttribArray( 3 );
-        gl::vertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, pos) );
-        gl::vertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, posOrg) );
-        gl::vertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, color) );
-        gl::vertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, extra) );
-    }
+    mParticles.init( particles.size(), particles.data() );
     
     // init shaders
-    mShaderRender = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag"))
-       .attribLocation( "ciPosition", 0 )
-       .attribLocation( "iPositionOrg", 1 )
-       .attribLocation( "iColor", 2 )
-       .attribLocation( "iExtra", 3 )
-    );
-    
-    mShaderUpdate = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "update.vert" ) ).fragment( loadAsset( "no_op.frag" ) )
-        .feedbackFormat( GL_INTERLEAVED_ATTRIBS )
-        .feedbackVaryings( { "position", "positionOrg", "color", "extra"} )
-        .attribLocation( "iPosition", 0 )
-        .attribLocation( "iPositionOrg", 1 )
-        .attribLocation( "iColor", 2 )
-        .attribLocation( "iExtra", 3 )
-    );
+    mShaderRender = gl::GlslProg::create( Particles::renderFormat( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag") ) ) );
+    mShaderUpdate = gl::GlslProg::create( Particles::updateFormat( gl::GlslProg::Format().vertex( loadAsset( "update.vert" ) ).fragment( loadAsset( "no_op.frag" ) ) ) );
     
     // frame buffer
     gl::Fbo::Format fboFormatEnv;
@@ -187,8 +165,6 @@ void PixelatedApp::update()
     
     // Update particles on the GPU
     gl::ScopedGlslProg prog( mShaderUpdate );
-    gl::ScopedState rasterizer( GL_RASTERIZER_DISCARD, true );    // turn off fragment stage
-    
     mShaderUpdate->uniform("uMatrix", shadowMatrix);
     mShaderUpdate->uniform("uAlignMatrix", mtxAlign);
     mShaderUpdate->uniform("uCameraPos", mARSession.getCameraPosition());
@@ -199,19 +175,8 @@ void PixelatedApp::update()
     mShaderUpdate->uniform( "uEnvMap", 0 );
     
 
-    // Bind the source data (Attributes refer to specific buffers).
-    gl::ScopedVao source( mAttributes[mSourceIndex] );
-    // Bind destination as buffer base.
-    gl::bindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, mParticleBuffer[mDestinationIndex] );
-    gl::beginTransformFeedback( GL_POINTS );
-
-    // Draw source into destination, performing our vertex transformations.
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
-
-    gl::endTransformFeedback();
-
-    // Swap source and destination for next loop
-    std::swap( mSourceIndex, mDestinationIndex );
+    // Draw source into destination, then swap them for the next frame
+    mParticles.update();
 }
 
 void PixelatedApp::draw()
@@ -234,9 +199,7 @@ void PixelatedApp::draw()
     mShaderRender->uniform("uViewport", vec2(getWindowSize()));
     mShaderRender->uniform("uOffset", offset);
     
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+    mParticles.draw();
     
     
 //    gl::setMatricesWindow( toPixels( getWindowSize() ) );
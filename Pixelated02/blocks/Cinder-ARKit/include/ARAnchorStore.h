@@ -0,0 +1,298 @@
+//
+//  ARAnchorStore.h
+//  CinderARKit
+//
+//  Anchors of one type, kept in a dense array and indexed by AnchorID.
+//
+
+#ifndef ARAnchorStore_h
+#define ARAnchorStore_h
+
+#include "ARAnchorTypes.h"
+
+namespace ARKit {
+
+/**  Stable reference to an anchor in an AnchorStore. Stays valid while other anchors
+     are added and removed, and goes stale once its own anchor is removed.
+*/
+struct AnchorHandle
+{
+    enum : uint32_t { INVALID = 0xffffffff };
+
+    bool isValid() const                                    { return mSlot != INVALID; }
+    bool operator==( const AnchorHandle& other ) const      { return mSlot == other.mSlot && mGeneration == other.mGeneration; }
+    bool operator!=( const AnchorHandle& other ) const      { return !( *this == other ); }
+
+    uint32_t    mSlot       = INVALID;
+    uint32_t    mGeneration = 0;
+};
+
+
+/**  One entry of an AnchorStore's change journal.
+*/
+struct AnchorChange
+{
+    enum Type
+    {
+        Added,
+        Updated,
+        Removed
+    };
+    
+    Type            mType;
+    AnchorHandle    mHandle;        // already stale for Removed
+    AnchorID        mUid;
+    uint32_t        mVersion;       // version of the anchor after this change
+};
+
+
+/**  Anchors live in one dense array, so iterating them is a plain vector walk and
+     getAnchors() can hand that vector out directly. An open addressing hash index
+     maps AnchorIDs to handle slots and the slots map to dense positions, which makes
+     add, update, remove and lookup O(1). Removal swaps the last anchor into the gap,
+     so the order of getAnchors() is not stable but handles are.
+
+     Every change is also appended to a journal, and each anchor carries a version
+     that goes up with every update, so consumers can react to what changed instead
+     of rescanning everything. The session clears the journal once per update().
+*/
+template <typename AnchorType>
+class AnchorStore
+{
+public:
+
+    /**  Adds the anchor, or overwrites the one with the same mUid. Returns its handle.
+    */
+    AnchorHandle addOrUpdate( const AnchorType& anchor )
+    {
+        if (( mDense.size() + 1 ) * 2 > mIndex.size())
+            growIndex();
+
+        const size_t bucket = findBucket( anchor.mUid );
+        if (mIndex[bucket] != EMPTY)
+        {
+            const uint32_t slot = mIndex[bucket];
+            mDense[mSlots[slot].mDense] = anchor;
+            mSlots[slot].mVersion++;
+            return journal( AnchorChange::Updated, slot, anchor.mUid );
+        }
+
+        uint32_t slot;
+        if (mFreeSlots.empty())
+        {
+            slot = (uint32_t)mSlots.size();
+            mSlots.push_back( Slot() );
+        }
+        else
+        {
+            slot = mFreeSlots.back();
+            mFreeSlots.pop_back();
+        }
+
+        mSlots[slot].mDense = (uint32_t)mDense.size();
+        mSlots[slot].mVersion = 1;
+        mDense.push_back( anchor );
+        mDenseSlots.push_back( slot );
+        mIndex[bucket] = slot;
+
+        return journal( AnchorChange::Added, slot, anchor.mUid );
+    }
+
+    /**  Removes the anchor with \a uid. Returns false if there wasn't one.
+    */
+    bool remove( const AnchorID& uid )
+    {
+        if (mIndex.empty())
+            return false;
+
+        const size_t bucket = findBucket( uid );
+        if (mIndex[bucket] == EMPTY)
+            return false;
+
+        const uint32_t slot = mIndex[bucket];
+        const uint32_t dense = mSlots[slot].mDense;
+        const uint32_t last = (uint32_t)mDense.size() - 1;
+
+        mSlots[slot].mVersion++;
+        journal( AnchorChange::Removed, slot, uid );
+
+        if (dense != last)
+        {
+            mDense[dense] = std::move( mDense[last] );
+            mDenseSlots[dense] = mDenseSlots[last];
+            mSlots[mDenseSlots[dense]].mDense = dense;
+        }
+        mDense.pop_back();
+        mDenseSlots.pop_back();
+
+        mSlots[slot].mDense = EMPTY;
+        mSlots[slot].mGeneration++;
+        mFreeSlots.push_back( slot );
+
+        eraseBucket( bucket );
+        return true;
+    }
+
+    void clear()
+    {
+        for (uint32_t slot : mDenseSlots)
+        {
+            mSlots[slot].mVersion++;
+            journal( AnchorChange::Removed, slot, getUidInSlot( slot ));
+            
+            mSlots[slot].mDense = EMPTY;
+            mSlots[slot].mGeneration++;
+            mFreeSlots.push_back( slot );
+        }
+
+        mDense.clear();
+        mDenseSlots.clear();
+        std::fill( mIndex.begin(), mIndex.end(), EMPTY );
+    }
+
+    /**  Returns the handle of the anchor with \a uid, or an invalid handle.
+    */
+    AnchorHandle find( const AnchorID& uid ) const
+    {
+        if (mIndex.empty())
+            return AnchorHandle();
+
+        const uint32_t slot = mIndex[findBucket( uid )];
+        return slot == EMPTY ? AnchorHandle() : makeHandle( slot );
+    }
+
+    /**  Returns the anchor or nullptr if the handle is stale. The pointer is only
+         valid until the store is next modified.
+    */
+    const AnchorType* get( AnchorHandle handle ) const
+    {
+        if (handle.mSlot >= mSlots.size())
+            return nullptr;
+
+        const Slot& slot = mSlots[handle.mSlot];
+        if (slot.mGeneration != handle.mGeneration || slot.mDense == EMPTY)
+            return nullptr;
+
+        return &mDense[slot.mDense];
+    }
+
+    const AnchorType* get( const AnchorID& uid ) const          { return get( find( uid )); }
+
+    /**  Starts at 1 when the anchor is added and goes up with every update. Returns 0
+         for a stale handle.
+    */
+    uint32_t getVersion( AnchorHandle handle ) const            { return get( handle ) ? mSlots[handle.mSlot].mVersion : 0; }
+
+    /**  Changes since the last clearChanges(), oldest first. An anchor that changed
+         more than once appears once per change.
+    */
+    const std::vector<AnchorChange>& getChanges() const         { return mChanges; }
+    void clearChanges()                                         { mChanges.clear(); }
+
+    /**  Handle of the anchor at \a index in getAnchors()
+    */
+    AnchorHandle getHandle( size_t index ) const                { return makeHandle( mDenseSlots[index] ); }
+
+    const std::vector<AnchorType>& getAnchors() const           { return mDense; }
+    size_t size() const                                         { return mDense.size(); }
+    bool empty() const                                          { return mDense.empty(); }
+
+private:
+
+    enum : uint32_t { EMPTY = 0xffffffff };
+
+    struct Slot
+    {
+        uint32_t    mDense      = EMPTY;
+        uint32_t    mGeneration = 0;
+        uint32_t    mVersion    = 0;
+    };
+
+    AnchorHandle journal( AnchorChange::Type type, uint32_t slot, const AnchorID& uid )
+    {
+        AnchorChange change;
+        change.mType = type;
+        change.mHandle = makeHandle( slot );
+        change.mUid = uid;
+        change.mVersion = mSlots[slot].mVersion;
+        mChanges.push_back( change );
+        return change.mHandle;
+    }
+
+    AnchorHandle makeHandle( uint32_t slot ) const
+    {
+        AnchorHandle handle;
+        handle.mSlot = slot;
+        handle.mGeneration = mSlots[slot].mGeneration;
+        return handle;
+    }
+
+    // UUIDs are already random, mixing the two words is enough
+    size_t getHomeBucket( const AnchorID& uid ) const
+    {
+        uint64_t h = uid.mHi ^ ( uid.mLo * 0x9E3779B97F4A7C15ull );
+        h ^= h >> 32;
+        return (size_t)h & ( mIndex.size() - 1 );
+    }
+
+    const AnchorID& getUidInSlot( uint32_t slot ) const         { return mDense[mSlots[slot].mDense].mUid; }
+
+    /**  Linear probing. Returns the bucket holding \a uid, or the empty one it would go in.
+    */
+    size_t findBucket( const AnchorID& uid ) const
+    {
+        const size_t mask = mIndex.size() - 1;
+        size_t bucket = getHomeBucket( uid );
+
+        while (mIndex[bucket] != EMPTY && getUidInSlot( mIndex[bucket] ) != uid)
+            bucket = ( bucket + 1 ) & mask;
+
+        return bucket;
+    }
+
+    /**  Backward shift deletion, keeps probe chains intact without tombstones.
+    */
+    void eraseBucket( size_t hole )
+    {
+        const size_t mask = mIndex.size() - 1;
+        size_t next = hole;
+
+        while (true)
+        {
+            next = ( next + 1 ) & mask;
+            if (mIndex[next] == EMPTY)
+                break;
+
+            // Move the entry back unless its home bucket lies cyclically in (hole, next]
+            const size_t home = getHomeBucket( getUidInSlot( mIndex[next] ));
+            const bool homeInRange = hole <= next ? ( hole < home && home <= next )
+                                                  : ( hole < home || home <= next );
+            if (!homeInRange)
+            {
+                mIndex[hole] = mIndex[next];
+                hole = next;
+            }
+        }
+
+        mIndex[hole] = EMPTY;
+    }
+
+    void growIndex()
+    {
+        mIndex.assign( std::max<size_t>( 16, mIndex.size() * 2 ), EMPTY );
+
+        for (uint32_t slot : mDenseSlots)
+            mIndex[findBucket( getUidInSlot( slot ))] = slot;
+    }
+
+    std::vector<AnchorType>     mDense;
+    std::vector<uint32_t>       mDenseSlots;    // slot of each dense anchor
+    std::vector<Slot>           mSlots;
+    std::vector<uint32_t>       mFreeSlots;
+    std::vector<uint32_t>       mIndex;         // slot per bucket, size is a power of two
+    std::vector<AnchorChange>   mChanges;
+};
+
+} // namespace ARKit
+
+#endif /* ARAnchorStore_h */
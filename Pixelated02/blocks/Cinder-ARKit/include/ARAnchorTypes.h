@@ -14,14 +14,94 @@ using namespace ci;
 
 namespace ARKit {
 
-typedef std::string AnchorID;
+/**  128 bit UUID of an anchor, as ARKit hands them out. Compared and hashed as
+     two words instead of as a 36 character string.
+*/
+struct AnchorID
+{
+    AnchorID() {}
+    AnchorID( uint64_t hi, uint64_t lo ) : mHi( hi ), mLo( lo ) {}
+    
+    /**  From the 16 raw bytes of a uuid_t, most significant first
+    */
+    static AnchorID fromBytes( const uint8_t* bytes )
+    {
+        AnchorID uid;
+        for (int i = 0; i < 8; ++i)
+        {
+            uid.mHi = ( uid.mHi << 8 ) | bytes[i];
+            uid.mLo = ( uid.mLo << 8 ) | bytes[i + 8];
+        }
+        return uid;
+    }
+    
+    /**  Parses the canonical "XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX" form. Dashes are
+         skipped, returns an invalid ID if there aren't 32 hex digits.
+    */
+    static AnchorID fromString( const char* str, size_t length )
+    {
+        uint8_t bytes[16] = { 0 };
+        size_t numDigits = 0;
+        
+        for (size_t i = 0; i < length && numDigits < 32; ++i)
+        {
+            const char c = str[i];
+            int value;
+            if (c >= '0' && c <= '9')       value = c - '0';
+            else if (c >= 'a' && c <= 'f')  value = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')  value = c - 'A' + 10;
+            else continue;
+            
+            bytes[numDigits / 2] |= ( numDigits & 1 ) ? value : value << 4;
+            ++numDigits;
+        }
+        
+        return numDigits == 32 ? fromBytes( bytes ) : AnchorID();
+    }
+    
+    static AnchorID fromString( const std::string& str )     { return fromString( str.data(), str.size() ); }
+    
+    /**  Writes the canonical 36 character form, without a terminator
+    */
+    void toChars( char* out ) const
+    {
+        static const char* hex = "0123456789ABCDEF";
+        
+        for (int i = 0; i < 32; ++i)
+        {
+            if (i == 8 || i == 12 || i == 16 || i == 20)
+                *out++ = '-';
+            
+            const uint64_t word = i < 16 ? mHi : mLo;
+            *out++ = hex[( word >> ( 60 - ( i % 16 ) * 4 )) & 0xf];
+        }
+    }
+    
+    std::string toString() const
+    {
+        std::string str( 36, '-' );
+        toChars( &str[0] );
+        return str;
+    }
+    
+    bool isValid() const                                { return mHi != 0 || mLo != 0; }
+    
+    bool operator==( const AnchorID& other ) const      { return mHi == other.mHi && mLo == other.mLo; }
+    bool operator!=( const AnchorID& other ) const      { return !( *this == other ); }
+    bool operator<( const AnchorID& other ) const       { return mHi < other.mHi || ( mHi == other.mHi && mLo < other.mLo ); }
+    
+    uint64_t    mHi = 0;
+    uint64_t    mLo = 0;
+};
+
+inline std::ostream& operator<<( std::ostream& os, const AnchorID& uid )   { return os << uid.toString(); }
 
 /**  An anchor point that will be tracked by ARKit*/
 class Anchor
 {
 public:
     Anchor() {}
-    Anchor( std::string uid, mat4 transform )
+    Anchor( AnchorID uid, mat4 transform )
         : mUid( uid ),
           mTransform( transform ) {}
     
@@ -34,7 +114,7 @@ class PlaneAnchor
 {
 public:
     PlaneAnchor() {}
-    PlaneAnchor( std::string uid, mat4 transform, vec3 center, vec3 extent )
+    PlaneAnchor( AnchorID uid, mat4 transform, vec3 center, vec3 extent )
         : mUid( uid ),
           mTransform( transform ),
           mCenter( center ),
@@ -51,7 +131,7 @@ class ImageAnchor
 {
 public:
     ImageAnchor(){}
-    ImageAnchor(  std::string uid, mat4 transform, vec2 physicalSize, std::string imageName )
+    ImageAnchor(  AnchorID uid, mat4 transform, vec2 physicalSize, std::string imageName )
         : mUid( uid ),
         mTransform( transform ),
         mPhysicalSize( physicalSize ),
@@ -0,0 +1,93 @@
+//
+//  ARCameraPyramid.h
+//  CinderARKit
+//
+//  Low resolution RGBA copies of the camera image, converted from YCbCr on the
+//  CPU for consumers that don't need the full frame.
+//
+
+#ifndef ARCameraPyramid_h
+#define ARCameraPyramid_h
+
+#include "ARFrameState.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace ARKit {
+
+/**  Converts \a width x \a height pixels of a biplanar YCbCr image (full range,
+     BT.601 like the camera shader) to RGBA at the chroma resolution, averaging each
+     2x2 block of luma. \a y has twice the size of the interleaved \a cbcr plane.
+     Uses SSE2 or NEON when available.
+*/
+void convertYCbCrToRGBA( const uint8_t* y, ptrdiff_t yRowBytes, const uint8_t* cbcr, ptrdiff_t cbcrRowBytes,
+                         int32_t width, int32_t height, uint8_t* rgba, ptrdiff_t rgbaRowBytes );
+
+/**  2x2 box filter of an RGBA image into one of half its size, rounded to nearest
+     like ( a + b + c + d + 2 ) >> 2 on every path.
+*/
+void downsampleRGBA( const uint8_t* src, ptrdiff_t srcRowBytes, int32_t width, int32_t height,
+                     uint8_t* dst, ptrdiff_t dstRowBytes );
+
+
+/**  Builds a small pyramid of each camera frame on a worker thread: level 0 at half
+     the camera resolution, each further level half of the one before. The app
+     thread submit()s frames and picks up finished pyramids with update(), neither
+     side waits on the other. The newest submitted frame wins.
+
+     While a frame is waiting or being converted its image is kept alive through
+     FrameState::mImageOwner, which holds on to at most two extra capture buffers.
+*/
+class CameraPyramid
+{
+public:
+
+    enum : uint32_t { NUM_LEVELS = 3 };
+
+    struct Levels
+    {
+        uint64_t    mFrameId = 0;
+        Surface8u   mSurfaces[NUM_LEVELS];
+    };
+
+    CameraPyramid() {}
+    ~CameraPyramid()                        { stop(); }
+
+    void start();
+    void stop();
+    bool isRunning() const                  { return mThread.joinable(); }
+
+    /**  App thread. Hands a frame with a camera image to the worker.
+    */
+    void submit( const FrameState& frame );
+
+    /**  App thread. Swaps in the newest finished pyramid, returns false if there
+         wasn't a new one.
+    */
+    bool update()                           { return mLevels.update(); }
+
+    /**  The pyramid taken by the last update(). Its surfaces are overwritten a few
+         updates later, copy them to keep them.
+    */
+    const Levels& getLevels() const         { return mLevels.getReadBuffer(); }
+
+private:
+
+    void threadFn();
+    void build( const FrameState& frame, Levels* levels );
+
+    std::thread                 mThread;
+    std::mutex                  mMutex;
+    std::condition_variable     mCondition;
+    FrameState                  mPending;
+    bool                        mHasPending = false;
+    bool                        mIsStopping = false;
+
+    TripleBuffer<Levels>        mLevels;
+};
+
+} // namespace ARKit
+
+#endif /* ARCameraPyramid_h */
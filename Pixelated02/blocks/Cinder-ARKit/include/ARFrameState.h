@@ -0,0 +1,96 @@
+//
+//  ARFrameState.h
+//  CinderARKit
+//
+//  Everything the session delivers for one camera frame, handed from the
+//  ARKit delegate (or the replay thread) to the app thread in one piece.
+//
+
+#ifndef ARFrameState_h
+#define ARFrameState_h
+
+#include "cinder/gl/gl.h"
+
+#include <atomic>
+
+using namespace ci;
+
+namespace ARKit {
+
+struct FrameState
+{
+    uint64_t                mFrameId = 0;           // increases by one with every published frame
+    double                  mTimestamp = 0.0;       // capture time in seconds, from ARKit or the recording
+
+    // Latency bookkeeping, in latencyNow() seconds
+    double                  mArrivalTime = 0.0;     // when the producer started on this frame
+    double                  mPublishTime = 0.0;
+    double                  mCaptureLatency = -1.0; // exposure to arrival, negative if unknown
+
+    mat4                    mViewMatrix;
+    mat4                    mProjectionMatrix;
+    vec3                    mCameraPosition;
+
+    float                   mAmbientLightIntensity = 0.0f;
+    float                   mAmbientColorTemperature = 0.0f;
+    bool                    mPortrait = true;
+
+    Channel8u               mFrameYChannel;
+    Channel8u               mFrameCbChannel;
+    Channel8u               mFrameCrChannel;
+    vec2                    mCameraSize = vec2( 1.0f );
+
+    // Owns the memory the channels point into (a locked CVPixelBuffer or a decoded
+    // plane) so it stays valid for as long as this state is being read
+    std::shared_ptr<void>   mImageOwner;
+};
+
+
+/**  Single producer, single consumer triple buffer. The producer fills
+     getWriteBuffer() and publish()es it, the consumer calls update() and reads
+     getReadBuffer(). Neither side ever waits on the other: the newest published
+     buffer wins and older unread ones are dropped.
+*/
+template <typename T>
+class TripleBuffer
+{
+public:
+
+    TripleBuffer() : mMiddle( 1 ) {}
+
+    T&          getWriteBuffer()            { return mBuffers[mWrite]; }
+    const T&    getReadBuffer() const       { return mBuffers[mRead]; }
+
+    /**  Producer: hands the write buffer over and starts writing into the spare one.
+    */
+    void publish()
+    {
+        mWrite = mMiddle.exchange( mWrite | DIRTY, std::memory_order_acq_rel ) & INDEX;
+    }
+
+    /**  Consumer: swaps in the newest published buffer. Returns false if nothing
+         was published since the last call.
+    */
+    bool update()
+    {
+        if (!( mMiddle.load( std::memory_order_relaxed ) & DIRTY ))
+            return false;
+
+        mRead = mMiddle.exchange( mRead, std::memory_order_acq_rel ) & INDEX;
+        return true;
+    }
+
+private:
+
+    static const uint32_t INDEX = 3;
+    static const uint32_t DIRTY = 4;
+
+    T                       mBuffers[3];
+    std::atomic<uint32_t>   mMiddle;
+    uint32_t                mWrite = 0;     // producer only
+    uint32_t                mRead = 2;      // consumer only
+};
+
+} // namespace ARKit
+
+#endif /* ARFrameState_h */
@@ -0,0 +1,92 @@
+//
+//  ARHitTest.h
+//  CinderARKit
+//
+//  Ray queries against the detected planes, bounded by their extents.
+//
+
+#ifndef ARHitTest_h
+#define ARHitTest_h
+
+#include "cinder/Ray.h"
+#include "ARAnchorStore.h"
+
+namespace ARKit {
+
+/**  Nearest plane a ray hit. mAnchor is invalid if it hit nothing.
+*/
+struct HitResult
+{
+    bool hasHit() const     { return mAnchor.isValid(); }
+
+    AnchorHandle    mAnchor;            // into Session::getPlaneAnchorStore()
+    float           mDistance = 0.0f;   // along the ray, in units of its direction
+    vec3            mPosition;
+    vec3            mNormal;            // plane normal, facing the ray origin
+};
+
+
+/**  Tests rays against plane anchors as the finite rectangles ARKit reports
+     (mCenter and mExtent in the anchor's space) instead of infinite planes, and
+     returns the nearest hit rather than the first.
+
+     The planes are put in a small bounding volume hierarchy whose leaves hold up
+     to four planes side by side (one vector per component), so a ray is tested
+     against a whole leaf at once. Rebuild it whenever the planes change.
+*/
+class PlaneHitTester
+{
+public:
+
+    void build( const AnchorStore<PlaneAnchor>& planes );
+
+    /**  Writes the nearest hit of each of the \a count rays into \a results and
+         returns how many rays hit something.
+    */
+    size_t hitTest( const Ray* rays, size_t count, HitResult* results ) const;
+
+    bool empty() const      { return mNodes.empty(); }
+
+private:
+
+    enum : uint32_t { PACKET_SIZE = 4 };
+
+    // Clang and GCC vector extension, NEON on device and SSE in the simulator
+    typedef float   Float4  __attribute__(( vector_size( 16 ) ));
+    typedef int32_t Int4    __attribute__(( vector_size( 16 ) ));
+
+    struct Packet
+    {
+        Float4          mPx, mPy, mPz;      // rectangle center, world space
+        Float4          mNx, mNy, mNz;      // normal
+        Float4          mUx, mUy, mUz;      // unit axis along extent.x
+        Float4          mVx, mVy, mVz;      // unit axis along extent.z
+        Float4          mHalfU, mHalfV;     // negative in unused lanes
+        AnchorHandle    mHandles[PACKET_SIZE];
+    };
+
+    struct Node
+    {
+        vec3        mMin, mMax;
+        uint32_t    mIndex;     // packet for a leaf, right child otherwise (the left one follows the node)
+        bool        mIsLeaf;
+    };
+
+    struct Plane
+    {
+        vec3            mCenter, mNormal, mU, mV;
+        float           mHalfU, mHalfV;
+        vec3            mMin, mMax;
+        AnchorHandle    mHandle;
+    };
+
+    void buildNode( std::vector<Plane>& planes, size_t begin, size_t end );
+    void hitPacket( const Packet& packet, const vec3& origin, const vec3& dir, HitResult* result ) const;
+
+    std::vector<Node>       mNodes;
+    std::vector<Packet>     mPackets;
+};
+
+} // namespace ARKit
+
+#endif /* ARHitTest_h */
@@ -0,0 +1,120 @@
+//
+//  ARLatency.h
+//  CinderARKit
+//
+//  How old the camera frame and pose are at each step on their way to the
+//  screen, as rolling histograms.
+//
+
+#ifndef ARLatency_h
+#define ARLatency_h
+
+#include "ARFrameState.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace ARKit {
+
+/**  Seconds on a monotonic clock, the time base of all latency timestamps.
+*/
+inline double latencyNow()
+{
+    return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+enum LatencyStage
+{
+    CaptureToArrival,       // camera exposure to the ARKit delegate, ARKit backend only
+    ArrivalToPublish,       // filling the FrameState, recording included
+    PublishToUpdate,        // waiting for the app's update() to pick it up
+    UpdateToUpload,         // until the camera textures are uploaded
+    UploadToDraw,           // until the frame is drawn, from the update if it wasn't uploaded
+    ArrivalToDraw,          // the whole way through the app
+    NUM_LATENCY_STAGES
+};
+
+
+/**  Latencies of the last getWindowSize() samples in logarithmic buckets, eight
+     per doubling between 10 microseconds and 10 seconds, so percentiles are
+     within about 5%.
+*/
+class LatencyHistogram
+{
+public:
+
+    explicit LatencyHistogram( size_t windowSize = 600 );
+
+    void add( double seconds );
+    void clear();
+
+    /**  In seconds, 0 when there are no samples. \a percentile is in [0, 100].
+    */
+    double getPercentile( double percentile ) const;
+
+    size_t getCount() const                 { return mCount; }
+    size_t getWindowSize() const            { return mWindow.size(); }
+
+private:
+
+    enum : uint32_t { BUCKETS_PER_OCTAVE = 8, NUM_BUCKETS = 20 * BUCKETS_PER_OCTAVE };
+
+    static uint32_t getBucket( double seconds );
+    static double   getBucketCenter( uint32_t bucket );
+
+    uint32_t                mBuckets[NUM_BUCKETS];
+    std::vector<uint8_t>    mWindow;            // ring of the bucket of each sample
+    size_t                  mNext = 0;
+    size_t                  mCount = 0;
+};
+
+
+/**  Follows each frame from the session's timestamps through the app thread and
+     feeds the stage latencies into one histogram per stage once the next frame
+     replaces it. App thread only.
+*/
+class LatencyTracker
+{
+public:
+
+    LatencyTracker() {}
+    ~LatencyTracker()                       { closeCsv(); }
+
+    /**  After SessionImpl::update(), starts tracking \a frame if it is a new one.
+    */
+    void markUpdate( const FrameState& frame );
+    void markUpload( uint64_t frameId );
+    void markDraw( uint64_t frameId );
+
+    const LatencyHistogram& getHistogram( LatencyStage stage ) const     { return mHistograms[stage]; }
+    void clear();
+
+    /**  Also writes one line per frame with its stage latencies in milliseconds.
+    */
+    bool openCsv( const fs::path& path );
+    void closeCsv();
+    bool isCsvOpen() const                  { return mCsv != nullptr; }
+
+private:
+
+    struct FrameTimes
+    {
+        uint64_t    mFrameId = 0;
+        double      mCaptureLatency = -1.0;
+        double      mArrival = 0.0;
+        double      mPublish = 0.0;
+        double      mUpdate = 0.0;
+        double      mUpload = 0.0;          // 0 until it happens
+        double      mDraw = 0.0;
+    };
+
+    void finishFrame();
+
+    FrameTimes          mCurrent;
+    LatencyHistogram    mHistograms[NUM_LATENCY_STAGES];
+    FILE*               mCsv = nullptr;
+};
+
+} // namespace ARKit
+
+#endif /* ARLatency_h */
@@ -9,7 +9,20 @@
 #define ARSessionImpl_h
 
 #include "cinder/gl/gl.h"
-#include "ARAnchorTypes.h"
+#include "ARAnchorStore.h"
+#include "ARCameraPyramid.h"
+#include "ARFrameState.h"
+#include "ARHitTest.h"
+#include "ARLatency.h"
+#include "ARSessionRecording.h"
+#include "ARSyntheticWorkload.h"
+
+// Off iOS there is no ARKit, so the session is always driven from a recording
+// or a synthetic workload.
+// Define CINDER_ARKIT_REPLAY in the build settings to do the same on device.
+#if ! defined( CINDER_COCOA_TOUCH ) && ! defined( CINDER_ARKIT_REPLAY )
+    #define CINDER_ARKIT_REPLAY
+#endif
 
 using namespace ci;
 
@@ -39,10 +52,37 @@ public:
     SessionConfiguration& planeDetection( PlaneDetection detectionType ) { mPlaneDetection = detectionType; return *this; }
     SessionConfiguration& imageTrackingEnabled( bool enabled )           { mImageTrackingEnabled = enabled; return *this; }
     
+    /**  Recorded session to play back when built with CINDER_ARKIT_REPLAY.
+         Ignored by the ARKit backend.
+    */
+    SessionConfiguration& replayFile( const fs::path& path )             { mReplayFile = path; return *this; }
+    /**  Starts the recording over at its end. Its anchors are removed first, the
+         ones the app added stay.
+    */
+    SessionConfiguration& replayLoop( bool loop )                        { mReplayLoop = loop; return *this; }
+    
+    /**  Plays the recording on its own thread at the recorded frame rate, publishing
+         frames the same way the ARKit delegate does, instead of one per update().
+    */
+    SessionConfiguration& replayThreaded( bool threaded )                { mReplayThreaded = threaded; return *this; }
+    
+    /**  Generates a session instead of replaying a recording, for stress tests.
+         Like replayFile() it needs CINDER_ARKIT_REPLAY, and replayThreaded() paces it
+         at its frame rate.
+    */
+    SessionConfiguration& synthetic( const SyntheticConfiguration& config ) { mSynthetic = true; mSyntheticConfig = config; return *this; }
+    
 
     TrackingType          mTrackingType = TrackingType::WorldTracking;
     PlaneDetection        mPlaneDetection = PlaneDetection::None;
     bool                  mImageTrackingEnabled = false;
+    
+    fs::path              mReplayFile;
+    bool                  mReplayLoop = true;
+    bool                  mReplayThreaded = false;
+    
+    bool                  mSynthetic = false;
+    SyntheticConfiguration mSyntheticConfig;
 };
 
 
@@ -56,8 +96,15 @@ public:
     void runConfiguration( SessionConfiguration config );
     void pause();
     
+    /**  Called once per app update. Takes the newest published FrameState and applies
+         the queued anchor events, so the app sees one consistent snapshot per update.
+         The replay backend first steps one frame unless it is threaded.
+    */
+    void update();
+    
     /**  Adds an anchor point to the ARSession relative to the current world orientation.
-         Returns the AnchorID of the anchor to reference later on.
+         Returns the AnchorID of the anchor to reference later on. Like every other
+         anchor, it shows up in getAnchors() after the next update().
     */
     const AnchorID addAnchorRelativeToWorld( vec3 position );
     
@@ -70,29 +117,65 @@ public:
     */
     bool isInterfaceInPortraitOrientation() const;
     
+    /**  Nearest plane hit of each ray. The hierarchy is rebuilt lazily after the
+         plane anchors change.
+    */
+    size_t hitTest( const Ray* rays, size_t count, HitResult* results ) const;
     
-    void hitTest();
+    /**  Starts logging every frame and anchor event to \a path. Anchors that already
+         exist are written first so the recording replays from a complete state.
+    */
+    bool startRecording( const fs::path& path, Recording::PlaneEncoding encoding );
+    void stopRecording();
     
     
-    std::vector<Anchor>       mAnchors;
-    std::vector<PlaneAnchor>  mPlaneAnchors;
-    std::vector<ImageAnchor>  mImageAnchors;
+    //===== Producer side, ARKit delegate queue or replay thread ===============//
+    /**  The state to fill for the next frame, stamped with its arrival time.
+         Publish it with publishFrame().
+    */
+    FrameState& beginFrame()
+    {
+        auto& state = mFrameBuffer.getWriteBuffer();
+        state.mArrivalTime = latencyNow();
+        return state;
+    }
+    void        publishFrame();
     
-    bool                   mRGBCaptureEnabled = true;
-    Channel8u              mFrameYChannel;
-    Channel8u              mFrameCbChannel;
-    Channel8u              mFrameCrChannel;
-
-    mat4                   mViewMatrix;
-    mat4                   mProjectionMatrix;
-    vec3                   mCameraPosition;
+    /**  Anchor changes are queued and applied on the app thread in update().
+    */
+    void        queueAnchorEvent( const Recording::AnchorEvent& event );
+    
+    
+    //===== App thread ==========================================================//
+    /**  The snapshot taken by the last update(). Stays untouched until the next one.
+    */
+    const FrameState& getFrame() const      { return mFrameBuffer.getReadBuffer(); }
+    
+    AnchorStore<Anchor>       mAnchors;
+    AnchorStore<PlaneAnchor>  mPlaneAnchors;
+    AnchorStore<ImageAnchor>  mImageAnchors;
     
-    float                  mAmbientLightIntensity;
-    float                  mAmbientColorTemperature;
-
     bool                   mIsRunning = false;
+    std::atomic<bool>      mRGBCaptureEnabled { true };
+    
+    CameraPyramid          mCameraPyramid;
+    
+    Recording::Writer      mRecorder;
+    
+private:
+    
+    void consumeFrameState();
+    void applyAnchorEvent( const Recording::AnchorEvent& event );
+    
+    TripleBuffer<FrameState>                mFrameBuffer;
+    uint64_t                                mNextFrameId = 1;       // producer only
+    
+    std::mutex                              mAnchorEventMutex;
+    std::vector<Recording::AnchorEvent>     mAnchorEvents;
+    std::vector<Recording::AnchorEvent>     mAppliedAnchorEvents;   // app thread only, swapped with mAnchorEvents
     
-    vec2                   mCameraSize = vec2( 1.0f );
+    mutable PlaneHitTester                  mHitTester;
+    mutable bool                            mHitTesterDirty = true;
 };
 
 } // namespace ARKit
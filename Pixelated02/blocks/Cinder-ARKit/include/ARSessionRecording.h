@@ -0,0 +1,302 @@
+//
+//  ARSessionRecording.h
+//  CinderARKit
+//
+//  Binary log of everything the ARKit delegate delivers, so a session
+//  can be replayed off-device.
+//
+
+#ifndef ARSessionRecording_h
+#define ARSessionRecording_h
+
+#include "cinder/gl/gl.h"
+#include "ARAnchorTypes.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace ci;
+
+namespace ARKit {
+namespace Recording {
+
+/**  File layout:
+
+     FileHeader, then a stream of records. Every record is a RecordHeader followed
+     by mSize bytes of payload, padded so the next header starts 8 byte aligned.
+
+     Frame records carry a FrameInfo followed by the Y plane and the interleaved
+     CbCr plane (tightly packed rows), each stored with its own PlaneEncoding.
+     Anchor records carry an AnchorInfo followed by mNameLength bytes of image name.
+*/
+
+const uint32_t MAGIC    = 0x52414943;   // "CIAR"
+const uint32_t VERSION  = 1;
+
+enum RecordType : uint32_t
+{
+    FrameRecord         = 1,
+    AnchorAddedRecord   = 2,
+    AnchorUpdatedRecord = 3,
+    AnchorRemovedRecord = 4
+};
+
+enum AnchorKind : uint32_t
+{
+    Point   = 0,
+    Plane   = 1,
+    Image   = 2
+};
+
+enum PlaneEncoding : uint32_t
+{
+    Raw     = 0,    // bytes as captured
+    DeltaLz = 1     // left-neighbour delta per row, then LZ4 block compression
+};
+
+struct FileHeader
+{
+    uint32_t    mMagic      = MAGIC;
+    uint32_t    mVersion    = VERSION;
+    uint32_t    mFlags      = 0;
+    uint32_t    mReserved   = 0;
+};
+
+struct RecordHeader
+{
+    uint32_t    mType;
+    uint32_t    mSize;
+};
+
+struct FrameInfo
+{
+    double      mTimestamp;
+    mat4        mViewMatrix;
+    mat4        mProjectionMatrix;
+    vec3        mCameraPosition;
+    float       mAmbientLightIntensity;
+    float       mAmbientColorTemperature;
+    uint32_t    mPortrait;
+
+    uint32_t    mYWidth;
+    uint32_t    mYHeight;
+    uint32_t    mYEncoding;
+    uint32_t    mYBytes;
+
+    uint32_t    mCbCrWidth;
+    uint32_t    mCbCrHeight;
+    uint32_t    mCbCrEncoding;
+    uint32_t    mCbCrBytes;
+};
+
+struct AnchorInfo
+{
+    uint32_t    mKind;
+    char        mUid[36];
+    mat4        mTransform;
+    vec3        mCenter;
+    vec3        mExtent;
+    vec2        mPhysicalSize;
+    uint32_t    mNameLength;
+};
+
+static inline size_t paddedSize( size_t size )  { return ( size + 7 ) & ~size_t( 7 ); }
+
+static inline AnchorInfo makeAnchorInfo( AnchorKind kind, const AnchorID& uid, const mat4& transform )
+{
+    AnchorInfo info;
+    memset( (void*)&info, 0, sizeof( AnchorInfo ));
+    info.mKind = kind;
+    uid.toChars( info.mUid );
+    info.mTransform = transform;
+    return info;
+}
+
+static inline AnchorInfo makeAnchorInfo( const Anchor& a )      { return makeAnchorInfo( Point, a.mUid, a.mTransform ); }
+
+static inline AnchorInfo makeAnchorInfo( const PlaneAnchor& a )
+{
+    auto info = makeAnchorInfo( Plane, a.mUid, a.mTransform );
+    info.mCenter = a.mCenter;
+    info.mExtent = a.mExtent;
+    return info;
+}
+
+static inline AnchorInfo makeAnchorInfo( const ImageAnchor& a )
+{
+    auto info = makeAnchorInfo( Image, a.mUid, a.mTransform );
+    info.mPhysicalSize = a.mPhysicalSize;
+    info.mNameLength = (uint32_t)a.mImageName.size();
+    return info;
+}
+
+
+//===== Plane codec ============================================================//
+/**  Scratch memory of encodePlane(). Callers encoding plane after plane keep one
+     around so the delta plane and the LZ4 hash table are only allocated once.
+*/
+struct EncodeBuffers
+{
+    std::vector<uint8_t>    mDelta;
+    std::vector<uint32_t>   mHashTable;
+};
+
+/**  Encodes a width x height plane with \a channels interleaved bytes per pixel.
+     Appends the encoded bytes to \a out and returns how many were written.
+*/
+size_t encodePlane( PlaneEncoding encoding, const uint8_t* src, uint32_t width, uint32_t height, size_t rowBytes, uint32_t channels, std::vector<uint8_t>* out, EncodeBuffers* buffers );
+size_t encodePlane( PlaneEncoding encoding, const uint8_t* src, uint32_t width, uint32_t height, size_t rowBytes, uint32_t channels, std::vector<uint8_t>* out );
+
+/**  Decodes into a tightly packed plane of \a dstBytes. Returns false on corrupt data.
+*/
+bool decodePlane( PlaneEncoding encoding, const uint8_t* src, size_t srcBytes, uint32_t width, uint32_t height, uint32_t channels, uint8_t* dst, size_t dstBytes );
+
+
+/**  A frame as stored. The plane pointers point into the mapped file, which stays
+     mapped for as long as anyone holds on to mMapping, even past Reader::close().
+*/
+struct Frame
+{
+    FrameInfo                   mInfo;
+    const uint8_t*              mYPlane     = nullptr;
+    const uint8_t*              mCbCrPlane  = nullptr;
+    std::shared_ptr<const void> mMapping;
+};
+
+struct AnchorEvent
+{
+    RecordType      mType;
+    AnchorInfo      mInfo;
+    std::string     mImageName;
+
+    AnchorID        getUid() const { return AnchorID::fromString( mInfo.mUid, sizeof( mInfo.mUid )); }
+};
+
+
+/**  Streams a recording frame by frame from a memory mapped file. Pages behind the
+     read cursor are handed back to the OS, so a long capture never has to fit in RAM.
+*/
+class Reader
+{
+public:
+
+    Reader() {}
+    ~Reader();
+
+    /**  Maps the file and validates its header. Returns false if it can't be read.
+    */
+    bool open( const fs::path& path );
+    void close();
+    bool isOpen() const { return mData != nullptr; }
+
+    /**  Reads the next record. Anchor records fill \a anchorEvent and frame records
+         fill \a frame. Returns false at the end of the recording. A record that
+         doesn't fit the file or its own size closes the recording.
+    */
+    bool next( RecordType* type, Frame* frame, AnchorEvent* anchorEvent );
+
+    /**  Goes back to the first record.
+    */
+    void rewind();
+
+    size_t getPosition() const  { return mPosition; }
+    size_t getSize() const      { return mSize; }
+
+private:
+
+    Reader( const Reader& );
+    void operator=( const Reader& );
+
+    void releaseConsumedPages( size_t upTo );
+    bool reject( const char* reason );
+
+    // Unmapped once the reader and every Frame handed out have let go
+    std::shared_ptr<const uint8_t> mMapping;
+    const uint8_t*  mData           = nullptr;
+    size_t          mSize           = 0;
+    size_t          mPosition       = 0;
+    size_t          mReleased       = 0;
+};
+
+
+
+/**  Writes a recording. Records are queued and the planes compressed and written
+     on a background thread, so writeFrame() can be called straight from the ARKit
+     delegate. If the thread falls behind, frames are dropped rather than blocking
+     the caller; anchor events are always kept.
+*/
+class Writer
+{
+public:
+
+    Writer() {}
+    ~Writer();
+
+    /**  \a anchors are written first, ahead of any frame, so a replay of the file
+         starts out with the anchors the session already had.
+    */
+    bool open( const fs::path& path, PlaneEncoding encoding = DeltaLz, const std::vector<AnchorEvent>& anchors = std::vector<AnchorEvent>() );
+
+    /**  Flushes every queued record and closes the file.
+    */
+    void close();
+    bool isOpen() const;
+
+    /**  Queues a frame. The planes are copied before returning.
+         \a info plane sizes are filled in by the writer.
+    */
+    void writeFrame( const FrameInfo& info, const uint8_t* yPlane, size_t yRowBytes, const uint8_t* cbcrPlane, size_t cbcrRowBytes );
+
+    void writeAnchor( RecordType type, const AnchorInfo& info, const std::string& imageName = "" );
+
+    size_t getNumFramesWritten() const;
+    size_t getNumFramesDropped() const;
+
+private:
+
+    Writer( const Writer& );
+    void operator=( const Writer& );
+
+    struct Record
+    {
+        RecordType              mType;
+        FrameInfo               mFrame;
+        AnchorInfo              mAnchor;
+        std::string             mImageName;
+        std::vector<uint8_t>    mYPlane;
+        std::vector<uint8_t>    mCbCrPlane;
+    };
+
+    Record* acquireRecord();
+    void    queueAnchor( RecordType type, const AnchorInfo& info, const std::string& imageName );
+    void    writeThread();
+    void    writeRecord( const Record& record );
+
+    static const size_t MAX_QUEUED_FRAMES = 6;
+
+    mutable std::mutex          mMutex;
+    std::condition_variable     mCondition;
+    std::thread                 mThread;
+    std::deque<Record*>         mQueue;
+    std::vector<Record*>        mFreeRecords;
+    size_t                      mNumQueuedFrames    = 0;
+    size_t                      mNumFramesWritten   = 0;
+    size_t                      mNumFramesDropped   = 0;
+    bool                        mIsClosing          = false;
+
+    FILE*                       mFile               = nullptr;
+    PlaneEncoding               mEncoding           = DeltaLz;
+
+    // Only touched by the writer thread
+    std::vector<uint8_t>        mEncoded;
+    EncodeBuffers               mEncodeBuffers;
+};
+
+} // namespace Recording
+} // namespace ARKit
+
+#endif /* ARSessionRecording_h */
@@ -0,0 +1,115 @@
+//
+//  ARSyntheticWorkload.h
+//  CinderARKit
+//
+//  Procedurally generated session for stress testing: a camera orbiting a room
+//  full of plane anchors that grow and merge, tracked images and camera frames
+//  at any resolution and rate.
+//
+
+#ifndef ARSyntheticWorkload_h
+#define ARSyntheticWorkload_h
+
+#include "ARAnchorTypes.h"
+#include "ARSessionRecording.h"
+
+#include <random>
+
+namespace ARKit {
+
+class SessionImpl;
+
+
+class SyntheticConfiguration
+{
+public:
+    SyntheticConfiguration(){}
+
+    SyntheticConfiguration& numPlanes( size_t count )                   { mNumPlanes = count; return *this; }
+    SyntheticConfiguration& numImages( size_t count )                   { mNumImages = count; return *this; }
+    SyntheticConfiguration& frameRate( float framesPerSecond )          { mFrameRate = framesPerSecond; return *this; }
+
+    /**  Size of the Y plane, CbCr is half that. A zero size publishes frames
+         without a camera image.
+    */
+    SyntheticConfiguration& cameraSize( ivec2 size )                    { mCameraSize = size; return *this; }
+
+    /**  How many plane anchors get an update every frame, round robin. ARKit only
+         reports the planes that changed, a real room is in the tens.
+    */
+    SyntheticConfiguration& planeUpdatesPerFrame( size_t count )        { mPlaneUpdatesPerFrame = count; return *this; }
+
+    /**  Planes merged per second. The absorbed plane is removed and a new one is
+         detected elsewhere, so the plane count stays the same.
+    */
+    SyntheticConfiguration& mergesPerSecond( float rate )               { mMergesPerSecond = rate; return *this; }
+    SyntheticConfiguration& roomSize( float meters )                    { mRoomSize = meters; return *this; }
+    SyntheticConfiguration& seed( uint32_t seed )                       { mSeed = seed; return *this; }
+
+    size_t      mNumPlanes = 64;
+    size_t      mNumImages = 4;
+    float       mFrameRate = 60.0f;
+    ivec2       mCameraSize = ivec2( 1920, 1440 );
+    size_t      mPlaneUpdatesPerFrame = 16;
+    float       mMergesPerSecond = 1.0f;
+    float       mRoomSize = 6.0f;
+    uint32_t    mSeed = 1;
+};
+
+
+/**  Produces one frame per call into a SessionImpl, the same way the ARKit delegate
+     or a recording does. Everything is derived from the seed and the frame count,
+     so a run is repeatable and independent of wall clock time.
+*/
+class SyntheticWorkload
+{
+public:
+
+    void reset( const SyntheticConfiguration& config );
+
+    /**  Queues this frame's anchor events and publishes its FrameState.
+    */
+    void produceFrame( SessionImpl* session, double* timestamp );
+
+private:
+
+    struct Plane
+    {
+        AnchorID    mUid;
+        mat4        mTransform;
+        vec3        mExtent;
+        vec3        mMaxExtent;
+    };
+
+    struct Image
+    {
+        AnchorID    mUid;
+        vec3        mPosition;
+        vec3        mNormal;
+        std::string mName;
+    };
+
+    float       randFloat();                              // [0, 1), same on every platform unlike std distributions
+    float       randFloat( float from, float to )       { return from + ( to - from ) * randFloat(); }
+    AnchorID    generateUid();
+    Plane       generatePlane();
+    void        queuePlane( SessionImpl* session, Recording::RecordType type, const Plane& plane );
+    void        generateCameraImages();
+
+    SyntheticConfiguration  mConfig;
+    std::mt19937            mRand;
+    uint64_t                mFrameIndex = 0;
+
+    std::vector<Plane>      mPlanes;
+    std::vector<Image>      mImages;
+    size_t                  mUpdateCursor = 0;
+    float                   mMergeDebt = 0.0f;
+
+    // A few camera images generated up front and cycled, so producing a frame
+    // costs next to nothing and doesn't skew what is being measured
+    std::vector<std::shared_ptr<std::vector<uint8_t>>>  mCameraImages;
+};
+
+} // namespace ARKit
+
+#endif /* ARSyntheticWorkload_h */
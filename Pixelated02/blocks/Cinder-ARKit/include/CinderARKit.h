@@ -36,9 +36,15 @@ public:
     */
     void pause();
     
+    /**  Call once per App::update(). Steps the recording when built with
+         CINDER_ARKIT_REPLAY, does nothing on a live ARKit session.
+    */
+    void update();
+    
     //===== AR Anchors =========================================================//
     /**  Adds an anchor point to the ARSession relative to the current world orientation.
-         Returns the AnchorID of the anchor to reference later on.
+         Returns the AnchorID of the anchor to reference later on. Like every other
+         anchor, it shows up in getAnchors() after the next update().
     */
     const AnchorID addAnchorRelativeToWorld( vec3 position );
     
@@ -59,10 +65,20 @@ public:
      */
     const std::vector<ImageAnchor>& getImageAnchors() const;
     
-    /**  Finds the anchor with a certain ID if it exists. Returns an empty
-         std::shared_ptr<Anchor> if it doesn't exist.
+    /**  Finds the anchor with a certain ID in constant time. Returns nullptr if it
+         doesn't exist. The pointer is valid until the next update().
     */
-    std::shared_ptr<Anchor> findAnchorWithID( AnchorID anchorID ) const;
+    const Anchor* findAnchorWithID( const AnchorID& anchorID ) const;
+    const PlaneAnchor* findPlaneAnchorWithID( const AnchorID& anchorID ) const;
+    const ImageAnchor* findImageAnchorWithID( const AnchorID& anchorID ) const;
+    
+    /**  The anchor stores themselves. Besides handle lookups they hold the journal of
+         anchors added, updated and removed by the last update() and a version per
+         anchor, so apps can rebuild what depends on anchors incrementally.
+    */
+    const AnchorStore<Anchor>& getAnchorStore() const;
+    const AnchorStore<PlaneAnchor>& getPlaneAnchorStore() const;
+    const AnchorStore<ImageAnchor>& getImageAnchorStore() const;
     
     
     //===== Camera Matrices ====================================================//
@@ -84,14 +100,42 @@ public:
     */
     void setRGBCaptureEnabled( bool captureEnabled );
     
-    /**  Returns the luma texture for the current frame capture
+    /**  Returns the luma texture for the current frame capture. The texture is
+         reused for later frames, don't hold on to it across updates.
     */
     gl::Texture2dRef getFrameLumaTexture() const;
     
+    /**  Sequence number of the current camera frame, increases with every capture
+    */
+    uint64_t getFrameId() const;
+    
+    /**  The consistent snapshot of the frame taken by the last update()
+    */
+    const FrameState& getFrameState() const;
+    
     /**  Draws the converted rgb capture to the desired area
     */
     void drawRGBCaptureTexture( Area area ) const;
     
+    
+    //===== Camera Pyramid =====================================================//
+    /**  Converts every camera frame to RGBA on a worker thread, at half, quarter and
+         eighth of the camera resolution, for consumers that don't need the full
+         image. Off by default.
+    */
+    void setCameraPyramidEnabled( bool enabled );
+    
+    /**  Level 0 is half the camera resolution, each level halves it again. Empty
+         until the first frame has been converted, and a frame or so behind
+         getFrameState() as the conversion runs in the background.
+    */
+    const Surface8u& getCameraPyramidSurface( size_t level ) const;
+    gl::Texture2dRef getCameraPyramidTexture( size_t level ) const;
+    
+    /**  Draws a pyramid level to the desired area, like drawRGBCaptureTexture()
+    */
+    void drawCameraPyramidTexture( size_t level, Area area ) const;
+    
     /**  Returns the estimated light intensity for the scene
          0.0 (very dark) 1.0 (very bright)
     */
@@ -103,19 +147,83 @@ public:
     float getAmbientColorTemperature() const;
 
     
-    void hitTest();
+    /**  Intersects rays with the detected planes, bounded by their extents, and
+         writes the nearest hit of each ray into \a results. Returns how many rays
+         hit a plane. Resolve HitResult::mAnchor with getPlaneAnchorStore().
+    */
+    size_t hitTest( const Ray* rays, size_t count, HitResult* results ) const;
+    std::vector<HitResult> hitTest( const std::vector<Ray>& rays ) const;
+    HitResult hitTest( const Ray& ray ) const;
+    
+    
+    //===== Latency ============================================================//
+    /**  Marks the current frame as drawn. drawRGBCaptureTexture() does this, call
+         it from the app's draw() if it doesn't draw the camera image.
+    */
+    void markFrameDrawn() const;
+    
+    /**  Rolling histogram of how long frames spend in \a stage, from arrival in the
+         session until they are first drawn. Works with every backend, only
+         CaptureToArrival needs ARKit.
+    */
+    const LatencyHistogram& getLatencyHistogram( LatencyStage stage ) const;
+    
+    /**  Writes every frame's stage latencies to a CSV file, to compare builds.
+    */
+    bool startLatencyLog( const fs::path& path );
+    void stopLatencyLog();
+    
+    
+    //===== Recording ==========================================================//
+    /**  Records the session to a file that can be played back with
+         SessionConfiguration::replayFile(). Planes are compressed on a background
+         thread, frames are dropped rather than stalling ARKit if it falls behind.
+    */
+    bool startRecording( const fs::path& path, Recording::PlaneEncoding encoding = Recording::DeltaLz );
+    void stopRecording();
+    bool isRecording() const;
     
 private:
 
     /**  Creates the shaders to draw RGB camera capture
     */
     static gl::GlslProgRef  createCameraRGBProg();
+    static gl::GlslProgRef  createCameraTextureProg();
+    
+    /**  Where the camera image goes in \a area and whether it has to be rotated
+    */
+    Rectf                   getCameraRect( Area area, bool* rotate ) const;
+    
+    struct CameraTextures
+    {
+        gl::Texture2dRef    mY;
+        gl::Texture2dRef    mCbCr;      // interleaved, sampled as .rg
+        uint64_t            mFrameId = 0;
+    };
+    
+    /**  Uploads the current camera frame into the next set of the ring, at most
+         once per frame id, and returns the set holding it.
+    */
+    const CameraTextures&   updateCameraTextures() const;
 
     // Internally handles bridge to objective-c
     SessionImpl             mSessionImpl;
     
-    // Shaders to draw the camera image from YCbCr to RGB
+    // Shaders to draw the camera image from YCbCr to RGB, and an RGBA pyramid level
     gl::GlslProgRef         mYCbCrToRGBProg;
+    gl::GlslProgRef         mCameraTextureProg;
+    
+    // Ring of camera textures so an upload never waits on a draw still reading
+    // the previous frame. Mutable as uploads happen lazily from const getters
+    static const size_t     NUM_CAMERA_TEXTURES = 3;
+    mutable CameraTextures  mCameraTextures[NUM_CAMERA_TEXTURES];
+    mutable size_t          mCameraTextureIndex = 0;
+    
+    mutable gl::Texture2dRef mPyramidTextures[CameraPyramid::NUM_LEVELS];
+    mutable uint64_t        mPyramidTextureFrameIds[CameraPyramid::NUM_LEVELS] = {};
+    
+    // Timestamps are taken from const draw calls too
+    mutable LatencyTracker  mLatency;
     
     
     
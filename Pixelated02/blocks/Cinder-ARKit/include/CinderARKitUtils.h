@@ -46,36 +46,16 @@ static mat4 modelMatFromTransform( matrix_float4x4 transform )
     return toMat4( modelMat );
 }
 
-typedef std::string AnchorID;
-template <typename AnchorType>
-static void updateOrAddAnchor( std::vector<AnchorType>& anchorList, AnchorType anchor )
+static const AnchorID getAnchorIDFromUUID( NSUUID* uid )
 {
-    const auto anchorID = anchor.mUid;
-    auto foundAnchor = std::find_if( anchorList.begin(),
-                                     anchorList.end(),
-                                     [anchorID](const AnchorType& a) -> bool { return (a.mUid == anchorID);} );
-    
-    if (foundAnchor != anchorList.end())
-        *foundAnchor = anchor;
-    else
-        anchorList.push_back(anchor);
-}
-
-template <typename AnchorType>
-static void removeAnchorWithID( std::vector<AnchorType>& anchors, AnchorID anchorID )
-{
-    std::remove_if( anchors.begin(), anchors.end(), [anchorID](const AnchorType& a) -> bool { return (a.mUid == anchorID); } );
-}
-
-static const std::string getUidStringFromUUID( NSUUID* uid)
-{
-    NSString* uidString = uid.UUIDString;
-    return std::string([uidString UTF8String], [uidString lengthOfBytesUsingEncoding:NSUTF8StringEncoding]);
+    uuid_t bytes;
+    [uid getUUIDBytes:bytes];
+    return AnchorID::fromBytes( bytes );
 }
 
-static const std::string getUidStringFromAnchor( ARAnchor* anchor )
+static const AnchorID getAnchorIDFromAnchor( ARAnchor* anchor )
 {
-    return getUidStringFromUUID( anchor.identifier );
+    return getAnchorIDFromUUID( anchor.identifier );
 }
 
 
@@ -0,0 +1,267 @@
+//
+//  ARCameraPyramid.cpp
+//  CinderARKit
+//
+
+#include "ARCameraPyramid.h"
+
+#if defined( __ARM_NEON ) || defined( __ARM_NEON__ )
+    #include <arm_neon.h>
+    #define CINDER_ARKIT_NEON
+#elif defined( __SSE2__ ) || defined( _M_X64 )
+    #include <emmintrin.h>
+    #define CINDER_ARKIT_SSE2
+#endif
+
+using namespace ARKit;
+using namespace std;
+
+namespace {
+
+// BT.601 full range in 10.6 fixed point, the same coefficients as the camera
+// shader. The largest intermediate (255 * 64 + 113 * 127) still fits an int16
+const int Y_SCALE = 64;
+const int CR_TO_R = 90;     // 1.402
+const int CB_TO_G = 22;     // 0.344
+const int CR_TO_G = 46;     // 0.714
+const int CB_TO_B = 113;    // 1.772
+
+inline uint8_t clampToByte( int v )
+{
+    return (uint8_t)( v < 0 ? 0 : ( v > 255 ? 255 : v ));
+}
+
+inline void convertPixel( int y, int cb, int cr, uint8_t* rgba )
+{
+    y *= Y_SCALE;
+    rgba[0] = clampToByte(( y + CR_TO_R * cr + Y_SCALE / 2 ) >> 6 );
+    rgba[1] = clampToByte(( y - CB_TO_G * cb - CR_TO_G * cr + Y_SCALE / 2 ) >> 6 );
+    rgba[2] = clampToByte(( y + CB_TO_B * cb + Y_SCALE / 2 ) >> 6 );
+    rgba[3] = 255;
+}
+
+} // anonymous namespace
+
+
+void ARKit::convertYCbCrToRGBA( const uint8_t* y, ptrdiff_t yRowBytes, const uint8_t* cbcr, ptrdiff_t cbcrRowBytes,
+                                int32_t width, int32_t height, uint8_t* rgba, ptrdiff_t rgbaRowBytes )
+{
+    for (int32_t row = 0; row < height; ++row)
+    {
+        const uint8_t* y0 = y + row * 2 * yRowBytes;
+        const uint8_t* y1 = y0 + yRowBytes;
+        const uint8_t* c  = cbcr + row * cbcrRowBytes;
+        uint8_t* out      = rgba + row * rgbaRowBytes;
+        int32_t x = 0;
+
+#if defined( CINDER_ARKIT_NEON )
+        const int16x8_t bias = vdupq_n_s16( 128 );
+        for (; x + 8 <= width; x += 8)
+        {
+            // Sum each 2x2 luma block, then round
+            const uint16x8_t ySum = vaddq_u16( vpaddlq_u8( vld1q_u8( y0 + x * 2 )), vpaddlq_u8( vld1q_u8( y1 + x * 2 )));
+            const int16x8_t ys = vreinterpretq_s16_u16( vshlq_n_u16( vrshrq_n_u16( ySum, 2 ), 6 ));
+
+            const uint8x8x2_t cc = vld2_u8( c + x * 2 );
+            const int16x8_t cb = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( cc.val[0] )), bias );
+            const int16x8_t cr = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( cc.val[1] )), bias );
+
+            uint8x8x4_t px;
+            px.val[0] = vqrshrun_n_s16( vmlaq_n_s16( ys, cr, CR_TO_R ), 6 );
+            px.val[1] = vqrshrun_n_s16( vmlsq_n_s16( vmlsq_n_s16( ys, cb, CB_TO_G ), cr, CR_TO_G ), 6 );
+            px.val[2] = vqrshrun_n_s16( vmlaq_n_s16( ys, cb, CB_TO_B ), 6 );
+            px.val[3] = vdup_n_u8( 255 );
+            vst4_u8( out + x * 4, px );
+        }
+#elif defined( CINDER_ARKIT_SSE2 )
+        const __m128i lowBytes = _mm_set1_epi16( 0x00ff );
+        const __m128i bias     = _mm_set1_epi16( 128 );
+        const __m128i round    = _mm_set1_epi16( Y_SCALE / 2 );
+        const __m128i alpha    = _mm_set1_epi16( 255 );
+        for (; x + 8 <= width; x += 8)
+        {
+            const __m128i a = _mm_loadu_si128( (const __m128i*)( y0 + x * 2 ));
+            const __m128i b = _mm_loadu_si128( (const __m128i*)( y1 + x * 2 ));
+            const __m128i ySum = _mm_add_epi16( _mm_add_epi16( _mm_and_si128( a, lowBytes ), _mm_srli_epi16( a, 8 )),
+                                                _mm_add_epi16( _mm_and_si128( b, lowBytes ), _mm_srli_epi16( b, 8 )));
+            const __m128i ys = _mm_slli_epi16( _mm_srli_epi16( _mm_add_epi16( ySum, _mm_set1_epi16( 2 )), 2 ), 6 );
+
+            const __m128i cc = _mm_loadu_si128( (const __m128i*)( c + x * 2 ));
+            const __m128i cb = _mm_sub_epi16( _mm_and_si128( cc, lowBytes ), bias );
+            const __m128i cr = _mm_sub_epi16( _mm_srli_epi16( cc, 8 ), bias );
+
+            __m128i r = _mm_add_epi16( ys, _mm_mullo_epi16( cr, _mm_set1_epi16( CR_TO_R )));
+            __m128i g = _mm_sub_epi16( _mm_sub_epi16( ys, _mm_mullo_epi16( cb, _mm_set1_epi16( CB_TO_G ))),
+                                       _mm_mullo_epi16( cr, _mm_set1_epi16( CR_TO_G )));
+            __m128i bl = _mm_add_epi16( ys, _mm_mullo_epi16( cb, _mm_set1_epi16( CB_TO_B )));
+            r  = _mm_srai_epi16( _mm_add_epi16( r, round ), 6 );
+            g  = _mm_srai_epi16( _mm_add_epi16( g, round ), 6 );
+            bl = _mm_srai_epi16( _mm_add_epi16( bl, round ), 6 );
+
+            // Saturate to bytes and interleave to r g b a
+            const __m128i rg = _mm_packus_epi16( r, g );
+            const __m128i ba = _mm_packus_epi16( bl, alpha );
+            const __m128i rgPairs = _mm_unpacklo_epi8( rg, _mm_srli_si128( rg, 8 ));
+            const __m128i baPairs = _mm_unpacklo_epi8( ba, _mm_srli_si128( ba, 8 ));
+            _mm_storeu_si128( (__m128i*)( out + x * 4 ),      _mm_unpacklo_epi16( rgPairs, baPairs ));
+            _mm_storeu_si128( (__m128i*)( out + x * 4 + 16 ), _mm_unpackhi_epi16( rgPairs, baPairs ));
+        }
+#endif
+
+        for (; x < width; ++x)
+        {
+            const int ySum = y0[x * 2] + y0[x * 2 + 1] + y1[x * 2] + y1[x * 2 + 1];
+            convertPixel(( ySum + 2 ) >> 2, c[x * 2] - 128, c[x * 2 + 1] - 128, out + x * 4 );
+        }
+    }
+}
+
+void ARKit::downsampleRGBA( const uint8_t* src, ptrdiff_t srcRowBytes, int32_t width, int32_t height,
+                            uint8_t* dst, ptrdiff_t dstRowBytes )
+{
+    const int32_t dstWidth = width / 2;
+    const int32_t dstHeight = height / 2;
+
+    for (int32_t row = 0; row < dstHeight; ++row)
+    {
+        const uint8_t* s0 = src + row * 2 * srcRowBytes;
+        const uint8_t* s1 = s0 + srcRowBytes;
+        uint8_t* out      = dst + row * dstRowBytes;
+        int32_t x = 0;
+
+#if defined( CINDER_ARKIT_NEON )
+        for (; x + 8 <= dstWidth; x += 8)
+        {
+            // Deinterleaved channels, neighbouring pixels summed pairwise
+            const uint8x16x4_t a = vld4q_u8( s0 + x * 8 );
+            const uint8x16x4_t b = vld4q_u8( s1 + x * 8 );
+            uint8x8x4_t px;
+            for (int ch = 0; ch < 4; ++ch)
+                px.val[ch] = vrshrn_n_u16( vaddq_u16( vpaddlq_u8( a.val[ch] ), vpaddlq_u8( b.val[ch] )), 2 );
+            vst4_u8( out + x * 4, px );
+        }
+#elif defined( CINDER_ARKIT_SSE2 )
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i two  = _mm_set1_epi16( 2 );
+        for (; x + 4 <= dstWidth; x += 4)
+        {
+            // Widen to 16 bits and sum the rows, two pixels per register. Averaging
+            // bytes pairwise would round twice
+            const __m128i a0 = _mm_loadu_si128( (const __m128i*)( s0 + x * 8 ));
+            const __m128i a1 = _mm_loadu_si128( (const __m128i*)( s0 + x * 8 + 16 ));
+            const __m128i b0 = _mm_loadu_si128( (const __m128i*)( s1 + x * 8 ));
+            const __m128i b1 = _mm_loadu_si128( (const __m128i*)( s1 + x * 8 + 16 ));
+            const __m128i p01 = _mm_add_epi16( _mm_unpacklo_epi8( a0, zero ), _mm_unpacklo_epi8( b0, zero ));
+            const __m128i p23 = _mm_add_epi16( _mm_unpackhi_epi8( a0, zero ), _mm_unpackhi_epi8( b0, zero ));
+            const __m128i p45 = _mm_add_epi16( _mm_unpacklo_epi8( a1, zero ), _mm_unpacklo_epi8( b1, zero ));
+            const __m128i p67 = _mm_add_epi16( _mm_unpackhi_epi8( a1, zero ), _mm_unpackhi_epi8( b1, zero ));
+
+            // Then the even and odd pixels, round and pack
+            const __m128i d01 = _mm_add_epi16( _mm_unpacklo_epi64( p01, p23 ), _mm_unpackhi_epi64( p01, p23 ));
+            const __m128i d23 = _mm_add_epi16( _mm_unpacklo_epi64( p45, p67 ), _mm_unpackhi_epi64( p45, p67 ));
+            _mm_storeu_si128( (__m128i*)( out + x * 4 ), _mm_packus_epi16( _mm_srli_epi16( _mm_add_epi16( d01, two ), 2 ),
+                                                                            _mm_srli_epi16( _mm_add_epi16( d23, two ), 2 )));
+        }
+#endif
+
+        for (; x < dstWidth; ++x)
+        {
+            for (int ch = 0; ch < 4; ++ch)
+                out[x * 4 + ch] = (uint8_t)(( s0[x * 8 + ch] + s0[x * 8 + 4 + ch] + s1[x * 8 + ch] + s1[x * 8 + 4 + ch] + 2 ) >> 2 );
+        }
+    }
+}
+
+
+//===== CameraPyramid ==========================================================//
+
+void CameraPyramid::start()
+{
+    if (isRunning())
+        return;
+
+    mIsStopping = false;
+    mThread = std::thread( &CameraPyramid::threadFn, this );
+}
+
+void CameraPyramid::stop()
+{
+    if (!isRunning())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mIsStopping = true;
+    }
+    mCondition.notify_one();
+    mThread.join();
+
+    // Let go of the camera image that was still waiting
+    mPending = FrameState();
+    mHasPending = false;
+}
+
+void CameraPyramid::submit( const FrameState& frame )
+{
+    if (!isRunning() || !frame.mFrameYChannel.getData() || !frame.mFrameCbChannel.getData())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mPending = frame;
+        mHasPending = true;
+    }
+    mCondition.notify_one();
+}
+
+void CameraPyramid::threadFn()
+{
+    while (true)
+    {
+        FrameState frame;
+        {
+            std::unique_lock<std::mutex> lock( mMutex );
+            mCondition.wait( lock, [this] { return mHasPending || mIsStopping; } );
+            if (mIsStopping)
+                return;
+
+            frame = std::move( mPending );
+            mHasPending = false;
+        }
+
+        build( frame, &mLevels.getWriteBuffer() );
+        mLevels.publish();
+    }
+}
+
+void CameraPyramid::build( const FrameState& frame, Levels* levels )
+{
+    const auto& y = frame.mFrameYChannel;
+    const auto& cbcr = frame.mFrameCbChannel;
+    const int32_t width = std::min( cbcr.getWidth(), y.getWidth() / 2 );
+    const int32_t height = std::min( cbcr.getHeight(), y.getHeight() / 2 );
+
+    // Surfaces are reused as long as the camera resolution stays the same
+    for (uint32_t level = 0; level < NUM_LEVELS; ++level)
+    {
+        auto& surface = levels->mSurfaces[level];
+        const int32_t levelWidth = std::max( width >> level, 1 );
+        const int32_t levelHeight = std::max( height >> level, 1 );
+        if (!surface || surface.getWidth() != levelWidth || surface.getHeight() != levelHeight)
+            surface = Surface8u( levelWidth, levelHeight, true, SurfaceChannelOrder::RGBA );
+    }
+
+    // The Cb channel starts at the base of the interleaved CbCr plane
+    auto& base = levels->mSurfaces[0];
+    convertYCbCrToRGBA( y.getData(), y.getRowBytes(), cbcr.getData(), cbcr.getRowBytes(),
+                        width, height, base.getData(), base.getRowBytes() );
+
+    for (uint32_t level = 1; level < NUM_LEVELS; ++level)
+    {
+        const auto& src = levels->mSurfaces[level - 1];
+        auto& dst = levels->mSurfaces[level];
+        downsampleRGBA( src.getData(), src.getRowBytes(), src.getWidth(), src.getHeight(), dst.getData(), dst.getRowBytes() );
+    }
+
+    levels->mFrameId = frame.mFrameId;
+}
@@ -0,0 +1,231 @@
+//
+//  ARHitTest.cpp
+//  CinderARKit
+//
+
+#include "ARHitTest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace ARKit;
+using namespace std;
+
+namespace {
+
+const float PARALLEL_EPSILON = 1e-6f;
+const float BOUNDS_PADDING = 1e-4f;     // keeps the boxes of flat planes from having zero thickness
+
+bool intersectBounds( const vec3& bmin, const vec3& bmax, const vec3& origin, const vec3& invDir, float maxDistance )
+{
+    float enter = 0.0f;
+    float exit = maxDistance;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        // Parallel to the slab, the ray is inside it all the way or never. Multiplying
+        // by the infinite inverse would give nan for an origin right on the slab
+        if (!std::isfinite( invDir[axis] ))
+        {
+            if (origin[axis] < bmin[axis] || origin[axis] > bmax[axis])
+                return false;
+            continue;
+        }
+
+        const float t0 = ( bmin[axis] - origin[axis] ) * invDir[axis];
+        const float t1 = ( bmax[axis] - origin[axis] ) * invDir[axis];
+        enter = std::max( enter, std::min( t0, t1 ));
+        exit = std::min( exit, std::max( t0, t1 ));
+    }
+
+    return enter <= exit;
+}
+
+} // anonymous namespace
+
+
+void PlaneHitTester::build( const AnchorStore<PlaneAnchor>& planeAnchors )
+{
+    mNodes.clear();
+    mPackets.clear();
+
+    const auto& anchors = planeAnchors.getAnchors();
+    if (anchors.empty())
+        return;
+
+    std::vector<Plane> planes( anchors.size() );
+    for (size_t i = 0; i < anchors.size(); ++i)
+    {
+        const auto& anchor = anchors[i];
+        const mat4& m = anchor.mTransform;
+        Plane& plane = planes[i];
+
+        // ARKit planes lie in the anchor's xz plane, mExtent is their full size
+        plane.mCenter = vec3( m * vec4( anchor.mCenter, 1.0f ));
+        plane.mU = normalize( vec3( m[0] ));
+        plane.mNormal = normalize( vec3( m[1] ));
+        plane.mV = normalize( vec3( m[2] ));
+        plane.mHalfU = anchor.mExtent.x * 0.5f * length( vec3( m[0] ));
+        plane.mHalfV = anchor.mExtent.z * 0.5f * length( vec3( m[2] ));
+        plane.mHandle = planeAnchors.getHandle( i );
+
+        const vec3 reach = glm::abs( plane.mU ) * plane.mHalfU + glm::abs( plane.mV ) * plane.mHalfV + vec3( BOUNDS_PADDING );
+        plane.mMin = plane.mCenter - reach;
+        plane.mMax = plane.mCenter + reach;
+    }
+
+    mNodes.reserve( 2 * planes.size() / PACKET_SIZE + 1 );
+    buildNode( planes, 0, planes.size() );
+}
+
+void PlaneHitTester::buildNode( std::vector<Plane>& planes, size_t begin, size_t end )
+{
+    const uint32_t nodeIndex = (uint32_t)mNodes.size();
+    mNodes.push_back( Node() );
+
+    vec3 bmin( numeric_limits<float>::max() );
+    vec3 bmax( -numeric_limits<float>::max() );
+    for (size_t i = begin; i < end; ++i)
+    {
+        bmin = glm::min( bmin, planes[i].mMin );
+        bmax = glm::max( bmax, planes[i].mMax );
+    }
+    mNodes[nodeIndex].mMin = bmin;
+    mNodes[nodeIndex].mMax = bmax;
+
+    if (end - begin <= PACKET_SIZE)
+    {
+        Packet packet;
+        for (uint32_t lane = 0; lane < PACKET_SIZE; ++lane)
+        {
+            const bool used = begin + lane < end;
+            const Plane& plane = planes[used ? begin + lane : begin];
+
+            packet.mPx[lane] = plane.mCenter.x;  packet.mPy[lane] = plane.mCenter.y;  packet.mPz[lane] = plane.mCenter.z;
+            packet.mNx[lane] = plane.mNormal.x;  packet.mNy[lane] = plane.mNormal.y;  packet.mNz[lane] = plane.mNormal.z;
+            packet.mUx[lane] = plane.mU.x;       packet.mUy[lane] = plane.mU.y;       packet.mUz[lane] = plane.mU.z;
+            packet.mVx[lane] = plane.mV.x;       packet.mVy[lane] = plane.mV.y;       packet.mVz[lane] = plane.mV.z;
+            packet.mHalfU[lane] = used ? plane.mHalfU : -1.0f;
+            packet.mHalfV[lane] = used ? plane.mHalfV : -1.0f;
+            packet.mHandles[lane] = used ? plane.mHandle : AnchorHandle();
+        }
+
+        mNodes[nodeIndex].mIsLeaf = true;
+        mNodes[nodeIndex].mIndex = (uint32_t)mPackets.size();
+        mPackets.push_back( packet );
+        return;
+    }
+
+    // Median split along the longest axis of the centers
+    vec3 cmin( numeric_limits<float>::max() );
+    vec3 cmax( -numeric_limits<float>::max() );
+    for (size_t i = begin; i < end; ++i)
+    {
+        cmin = glm::min( cmin, planes[i].mCenter );
+        cmax = glm::max( cmax, planes[i].mCenter );
+    }
+    const vec3 size = cmax - cmin;
+    const int axis = size.x > size.y ? ( size.x > size.z ? 0 : 2 ) : ( size.y > size.z ? 1 : 2 );
+
+    const size_t mid = begin + ( end - begin ) / 2;
+    std::nth_element( planes.begin() + begin, planes.begin() + mid, planes.begin() + end,
+                      [axis]( const Plane& a, const Plane& b ) { return a.mCenter[axis] < b.mCenter[axis]; } );
+
+    mNodes[nodeIndex].mIsLeaf = false;
+    buildNode( planes, begin, mid );
+    mNodes[nodeIndex].mIndex = (uint32_t)mNodes.size();
+    buildNode( planes, mid, end );
+}
+
+void PlaneHitTester::hitPacket( const Packet& p, const vec3& origin, const vec3& dir, HitResult* result ) const
+{
+    const Float4 ox = { origin.x, origin.x, origin.x, origin.x };
+    const Float4 oy = { origin.y, origin.y, origin.y, origin.y };
+    const Float4 oz = { origin.z, origin.z, origin.z, origin.z };
+    const Float4 dx = { dir.x, dir.x, dir.x, dir.x };
+    const Float4 dy = { dir.y, dir.y, dir.y, dir.y };
+    const Float4 dz = { dir.z, dir.z, dir.z, dir.z };
+    const Float4 zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+    const Float4 epsilon = { PARALLEL_EPSILON, PARALLEL_EPSILON, PARALLEL_EPSILON, PARALLEL_EPSILON };
+
+    // Parallel lanes divide by zero, the mask below throws their inf / nan away
+    const Float4 denom = p.mNx * dx + p.mNy * dy + p.mNz * dz;
+    const Float4 num = p.mNx * ( p.mPx - ox ) + p.mNy * ( p.mPy - oy ) + p.mNz * ( p.mPz - oz );
+    const Float4 t = num / denom;
+
+    const Float4 hx = ox + dx * t - p.mPx;
+    const Float4 hy = oy + dy * t - p.mPy;
+    const Float4 hz = oz + dz * t - p.mPz;
+    const Float4 u = hx * p.mUx + hy * p.mUy + hz * p.mUz;
+    const Float4 v = hx * p.mVx + hy * p.mVy + hz * p.mVz;
+
+    const Int4 inside = ( denom * denom >= epsilon * epsilon ) & ( t >= zero )
+                      & ( u <= p.mHalfU ) & ( -u <= p.mHalfU )
+                      & ( v <= p.mHalfV ) & ( -v <= p.mHalfV );
+
+    for (uint32_t i = 0; i < PACKET_SIZE; ++i)
+    {
+        if (inside[i] && t[i] < result->mDistance)
+        {
+            result->mDistance = t[i];
+            result->mAnchor = p.mHandles[i];
+            result->mNormal = vec3( p.mNx[i], p.mNy[i], p.mNz[i] );
+        }
+    }
+}
+
+size_t PlaneHitTester::hitTest( const Ray* rays, size_t count, HitResult* results ) const
+{
+    size_t numHits = 0;
+
+    for (size_t r = 0; r < count; ++r)
+    {
+        const vec3& origin = rays[r].getOrigin();
+        const vec3& dir = rays[r].getDirection();
+        const vec3 invDir = 1.0f / dir;
+
+        HitResult& result = results[r];
+        result = HitResult();
+        result.mDistance = numeric_limits<float>::max();
+
+        if (!mNodes.empty())
+        {
+            uint32_t stack[64];
+            uint32_t stackSize = 0;
+            stack[stackSize++] = 0;
+
+            while (stackSize > 0)
+            {
+                const uint32_t index = stack[--stackSize];
+                const Node& node = mNodes[index];
+                if (!intersectBounds( node.mMin, node.mMax, origin, invDir, result.mDistance ))
+                    continue;
+
+                if (node.mIsLeaf)
+                {
+                    hitPacket( mPackets[node.mIndex], origin, dir, &result );
+                }
+                else
+                {
+                    stack[stackSize++] = node.mIndex;
+                    stack[stackSize++] = index + 1;
+                }
+            }
+        }
+
+        if (result.hasHit())
+        {
+            result.mPosition = origin + dir * result.mDistance;
+            if (dot( result.mNormal, dir ) > 0.0f)
+                result.mNormal = -result.mNormal;
+            ++numHits;
+        }
+        else
+        {
+            result = HitResult();
+        }
+    }
+
+    return numHits;
+}
@@ -0,0 +1,174 @@
+//
+//  ARLatency.cpp
+//  CinderARKit
+//
+
+#include "ARLatency.h"
+
+#include <cmath>
+
+using namespace ARKit;
+using namespace ci::app;
+using namespace std;
+
+static const double MIN_LATENCY = 1e-5;
+
+
+//===== LatencyHistogram =======================================================//
+
+LatencyHistogram::LatencyHistogram( size_t windowSize )
+    : mWindow( std::max<size_t>( windowSize, 1 ))
+{
+    clear();
+}
+
+void LatencyHistogram::clear()
+{
+    std::fill( mBuckets, mBuckets + NUM_BUCKETS, 0 );
+    mNext = 0;
+    mCount = 0;
+}
+
+uint32_t LatencyHistogram::getBucket( double seconds )
+{
+    if (seconds <= MIN_LATENCY)
+        return 0;
+
+    const double bucket = std::log2( seconds / MIN_LATENCY ) * BUCKETS_PER_OCTAVE;
+    return (uint32_t)std::min( bucket, (double)( NUM_BUCKETS - 1 ));
+}
+
+double LatencyHistogram::getBucketCenter( uint32_t bucket )
+{
+    return MIN_LATENCY * std::exp2(( bucket + 0.5 ) / BUCKETS_PER_OCTAVE );
+}
+
+void LatencyHistogram::add( double seconds )
+{
+    // The oldest sample drops out once the window is full
+    if (mCount == mWindow.size())
+        mBuckets[mWindow[mNext]]--;
+    else
+        mCount++;
+
+    const uint32_t bucket = getBucket( seconds );
+    mBuckets[bucket]++;
+    mWindow[mNext] = (uint8_t)bucket;
+    mNext = ( mNext + 1 ) % mWindow.size();
+}
+
+double LatencyHistogram::getPercentile( double percentile ) const
+{
+    if (mCount == 0)
+        return 0.0;
+
+    const size_t rank = std::max<size_t>( 1, (size_t)std::ceil( percentile / 100.0 * mCount ));
+    size_t seen = 0;
+    for (uint32_t bucket = 0; bucket < NUM_BUCKETS; ++bucket)
+    {
+        seen += mBuckets[bucket];
+        if (seen >= rank)
+            return getBucketCenter( bucket );
+    }
+
+    return getBucketCenter( NUM_BUCKETS - 1 );
+}
+
+
+//===== LatencyTracker =========================================================//
+
+void LatencyTracker::markUpdate( const FrameState& frame )
+{
+    if (frame.mFrameId == mCurrent.mFrameId || frame.mFrameId == 0)
+        return;
+
+    finishFrame();
+
+    mCurrent = FrameTimes();
+    mCurrent.mFrameId = frame.mFrameId;
+    mCurrent.mCaptureLatency = frame.mCaptureLatency;
+    mCurrent.mArrival = frame.mArrivalTime;
+    mCurrent.mPublish = frame.mPublishTime;
+    mCurrent.mUpdate = latencyNow();
+}
+
+void LatencyTracker::markUpload( uint64_t frameId )
+{
+    if (frameId == mCurrent.mFrameId && mCurrent.mUpload == 0.0)
+        mCurrent.mUpload = latencyNow();
+}
+
+void LatencyTracker::markDraw( uint64_t frameId )
+{
+    // Only the first draw counts, that's when the frame first reaches the screen
+    if (frameId == mCurrent.mFrameId && mCurrent.mDraw == 0.0)
+        mCurrent.mDraw = latencyNow();
+}
+
+void LatencyTracker::clear()
+{
+    for (auto& histogram : mHistograms)
+        histogram.clear();
+}
+
+void LatencyTracker::finishFrame()
+{
+    const FrameTimes& t = mCurrent;
+    if (t.mFrameId == 0)
+        return;
+
+    double stages[NUM_LATENCY_STAGES];
+    std::fill( stages, stages + NUM_LATENCY_STAGES, -1.0 );
+
+    stages[CaptureToArrival] = t.mCaptureLatency;
+    stages[ArrivalToPublish] = t.mPublish - t.mArrival;
+    stages[PublishToUpdate]  = t.mUpdate - t.mPublish;
+    if (t.mUpload > 0.0)
+        stages[UpdateToUpload] = t.mUpload - t.mUpdate;
+    if (t.mDraw > 0.0)
+    {
+        stages[UploadToDraw]  = t.mDraw - ( t.mUpload > 0.0 ? t.mUpload : t.mUpdate );
+        stages[ArrivalToDraw] = t.mDraw - t.mArrival;
+    }
+
+    for (int stage = 0; stage < NUM_LATENCY_STAGES; ++stage)
+        if (stages[stage] >= 0.0)
+            mHistograms[stage].add( stages[stage] );
+
+    if (mCsv)
+    {
+        fprintf( mCsv, "%llu", (unsigned long long)t.mFrameId );
+        for (int stage = 0; stage < NUM_LATENCY_STAGES; ++stage)
+        {
+            if (stages[stage] >= 0.0)
+                fprintf( mCsv, ",%.3f", stages[stage] * 1000.0 );
+            else
+                fputs( ",", mCsv );
+        }
+        fputs( "\n", mCsv );
+    }
+}
+
+bool LatencyTracker::openCsv( const fs::path& path )
+{
+    closeCsv();
+
+    mCsv = fopen( path.string().c_str(), "w" );
+    if (!mCsv)
+    {
+        console() << "Error: Could not open " << path << " for writing" << endl;
+        return false;
+    }
+
+    fputs( "frame,capture_to_arrival_ms,arrival_to_publish_ms,publish_to_update_ms,update_to_upload_ms,upload_to_draw_ms,arrival_to_draw_ms\n", mCsv );
+    return true;
+}
+
+void LatencyTracker::closeCsv()
+{
+    if (!mCsv)
+        return;
+
+    fclose( mCsv );
+    mCsv = nullptr;
+}
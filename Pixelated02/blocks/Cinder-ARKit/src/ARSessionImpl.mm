@@ -5,6 +5,9 @@
 //  Created by Felix Faire on 11/08/2017.
 //
 
+#import "ARSessionImpl.h"
+
+#if ! defined( CINDER_ARKIT_REPLAY )
 
 #import <Foundation/Foundation.h>
 #import <ARKit/ARKit.h>
@@ -24,7 +27,6 @@
 
 @end
 
-#import "ARSessionImpl.h"
 #import "CinderARKitUtils.h"
 
 #include "cinder/gl/gl.h"
@@ -71,10 +73,15 @@ void SessionImpl::pause()
     [appleARKitSession->mARSession pause];
 }
 
+void SessionImpl::update()
+{
+    consumeFrameState();
+}
+
 const AnchorID SessionImpl::addAnchorRelativeToCamera( vec3 offset )
 {
     NSUUID* uid = [appleARKitSession addAnchorRelativeToCameraWithxOffset:@(offset.x) yOffset:@(offset.y) zOffset:@(offset.z)];
-    return getUidStringFromUUID(uid);
+    return getAnchorIDFromUUID(uid);
 }
 
 bool SessionImpl::isInterfaceInPortraitOrientation() const
@@ -82,9 +89,30 @@ bool SessionImpl::isInterfaceInPortraitOrientation() const
     return UIInterfaceOrientationIsPortrait( [[UIApplication sharedApplication] statusBarOrientation] );
 }
 
-void SessionImpl::hitTest()
+
+// Delegate queue helpers
+
+/**  Keeps the captured image locked and alive for as long as a FrameState points into it.
+*/
+static std::shared_ptr<void> retainPixelBuffer( CVPixelBufferRef pixelBuffer )
+{
+    CVPixelBufferRetain( pixelBuffer );
+    CVPixelBufferLockBaseAddress( pixelBuffer, kCVPixelBufferLock_ReadOnly );
+    
+    return std::shared_ptr<void>( pixelBuffer, []( void* p ) {
+        CVPixelBufferUnlockBaseAddress( (CVPixelBufferRef)p, kCVPixelBufferLock_ReadOnly );
+        CVPixelBufferRelease( (CVPixelBufferRef)p );
+    });
+}
+
+template <typename T>
+static void queueAnchor( Recording::RecordType type, const T& anchor, const std::string& imageName = "" )
 {
-    CI_ASSERT_MSG(true, "Start hit testing");
+    Recording::AnchorEvent event;
+    event.mType = type;
+    event.mInfo = Recording::makeAnchorInfo( anchor );
+    event.mImageName = imageName;
+    ciARKitSession->queueAnchorEvent( event );
 }
 
 
@@ -104,38 +132,52 @@ void SessionImpl::hitTest()
 
 - (void)session:(ARSession*)session didUpdateFrame:(ARFrame*)frame
 {
-    ciARKitSession->mIsRunning = true;
+    // Fill the next snapshot, the app only sees it once it is published whole
+    auto& state = ciARKitSession->beginFrame();
+    
+    // ARFrame timestamps count system uptime
+    state.mCaptureLatency = [[NSProcessInfo processInfo] systemUptime] - frame.timestamp;
     
     auto orientation = [[UIApplication sharedApplication] statusBarOrientation];
+    state.mTimestamp = frame.timestamp;
+    state.mPortrait = UIInterfaceOrientationIsPortrait( orientation );
     
     // Update view matrix
-    ciARKitSession->mViewMatrix = toMat4([frame.camera viewMatrixForOrientation:orientation]);
+    state.mViewMatrix = toMat4([frame.camera viewMatrixForOrientation:orientation]);
     
     //  Update Camera position
     mat4 mtxTransform = toMat4(frame.camera.transform);
-    ciARKitSession->mCameraPosition = vec3(mtxTransform[3]);
+    state.mCameraPosition = vec3(mtxTransform[3]);
     
     // Update projection matrix
     auto viewBounds = [[UIScreen mainScreen] bounds];
     CGSize viewportSize = viewBounds.size;
-    ciARKitSession->mProjectionMatrix = toMat4([frame.camera projectionMatrixForOrientation:orientation
+    state.mProjectionMatrix = toMat4([frame.camera projectionMatrixForOrientation:orientation
                                                                        viewportSize:viewportSize
                                                                              zNear:0.001
                                                                               zFar:1000]);
     // Update light estimate
-    ciARKitSession->mAmbientLightIntensity = (float)[[frame lightEstimate] ambientIntensity] / 2000.0f;
-    ciARKitSession->mAmbientColorTemperature = (float)[[frame lightEstimate] ambientColorTemperature];
+    state.mAmbientLightIntensity = (float)[[frame lightEstimate] ambientIntensity] / 2000.0f;
+    state.mAmbientColorTemperature = (float)[[frame lightEstimate] ambientColorTemperature];
     
     // Capture pixel YCbCr
     if (ciARKitSession->mRGBCaptureEnabled)
     {
         CVPixelBufferRef pixelBuffer = frame.capturedImage;
-        ciARKitSession->mFrameYChannel  = getChannelForCVPixelBuffer( pixelBuffer, 0 );
-        ciARKitSession->mFrameCbChannel = getChannelForCVPixelBuffer( pixelBuffer, 1, 2, 0 );
-        ciARKitSession->mFrameCrChannel = getChannelForCVPixelBuffer( pixelBuffer, 1, 2, 1 );
+        state.mImageOwner = retainPixelBuffer( pixelBuffer );
+        state.mFrameYChannel  = getChannelForCVPixelBuffer( pixelBuffer, 0 );
+        state.mFrameCbChannel = getChannelForCVPixelBuffer( pixelBuffer, 1, 2, 0 );
+        state.mFrameCrChannel = getChannelForCVPixelBuffer( pixelBuffer, 1, 2, 1 );
         
-        ciARKitSession->mCameraSize = vec2( (float)CVPixelBufferGetWidth( pixelBuffer ), (float)CVPixelBufferGetHeight( pixelBuffer ));
+        state.mCameraSize = vec2( (float)CVPixelBufferGetWidth( pixelBuffer ), (float)CVPixelBufferGetHeight( pixelBuffer ));
+    }
+    else
+    {
+        state.mFrameYChannel = state.mFrameCbChannel = state.mFrameCrChannel = Channel8u();
+        state.mImageOwner.reset();
     }
+    
+    ciARKitSession->publishFrame();
 }
 
 
@@ -145,23 +187,26 @@ void SessionImpl::hitTest()
 {
     for (ARAnchor* anchor in anchors)
     {
-        const auto uid = getUidStringFromAnchor( anchor );
+        const auto uid = getAnchorIDFromAnchor( anchor );
         
         if ([anchor isKindOfClass:[ARPlaneAnchor class]])
         {
             ARPlaneAnchor* pa = (ARPlaneAnchor*)anchor;
-            updateOrAddAnchor(ciARKitSession->mPlaneAnchors, PlaneAnchor( uid, toMat4( pa.transform ), toVec3( pa.center ), toVec3( pa.extent )));
+            const PlaneAnchor planeAnchor( uid, toMat4( pa.transform ), toVec3( pa.center ), toVec3( pa.extent ));
+            queueAnchor( Recording::AnchorAddedRecord, planeAnchor );
         }
         else if ([anchor isKindOfClass:[ARImageAnchor class]])
         {
             ARImageAnchor* ia = (ARImageAnchor*)anchor;
             CGSize physSize = [[ia referenceImage] physicalSize];
             //[session setWorldOrigin:ia.transform];
-            updateOrAddAnchor(ciARKitSession->mImageAnchors, ImageAnchor( uid, toMat4( ia.transform ), glm::vec2(physSize.width, physSize.height), [[[ia referenceImage] name] UTF8String]));
+            const ImageAnchor imageAnchor( uid, toMat4( ia.transform ), glm::vec2(physSize.width, physSize.height), [[[ia referenceImage] name] UTF8String]);
+            queueAnchor( Recording::AnchorAddedRecord, imageAnchor, imageAnchor.mImageName );
         }
         else
         {
-            updateOrAddAnchor(ciARKitSession->mAnchors, Anchor( uid, toMat4( anchor.transform )));
+            const Anchor pointAnchor( uid, toMat4( anchor.transform ));
+            queueAnchor( Recording::AnchorAddedRecord, pointAnchor );
         }
     }
 }
@@ -170,23 +215,26 @@ void SessionImpl::hitTest()
 {
     for (ARAnchor* anchor in anchors)
     {
-        const auto uid = getUidStringFromAnchor( anchor );
+        const auto uid = getAnchorIDFromAnchor( anchor );
         
         if ( [anchor isKindOfClass:[ARPlaneAnchor class]] )
         {
             ARPlaneAnchor* pa = (ARPlaneAnchor*)anchor;
-            updateOrAddAnchor(ciARKitSession->mPlaneAnchors, PlaneAnchor( uid, toMat4( pa.transform ), toVec3( pa.center ), toVec3( pa.extent )));
+            const PlaneAnchor planeAnchor( uid, toMat4( pa.transform ), toVec3( pa.center ), toVec3( pa.extent ));
+            queueAnchor( Recording::AnchorUpdatedRecord, planeAnchor );
         }
         else if ( [anchor isKindOfClass:[ARImageAnchor class]] )
         {
             ARImageAnchor* ia = (ARImageAnchor*)anchor;
             CGSize physSize = [[ia referenceImage] physicalSize];
             //[session setWorldOrigin:ia.transform];
-            updateOrAddAnchor(ciARKitSession->mImageAnchors, ImageAnchor( uid, toMat4( ia.transform ), glm::vec2(physSize.width, physSize.height), [[[ia referenceImage] name] UTF8String]));
+            const ImageAnchor imageAnchor( uid, toMat4( ia.transform ), glm::vec2(physSize.width, physSize.height), [[[ia referenceImage] name] UTF8String]);
+            queueAnchor( Recording::AnchorUpdatedRecord, imageAnchor, imageAnchor.mImageName );
         }
         else
         {
-            updateOrAddAnchor(ciARKitSession->mAnchors, Anchor( uid, toMat4( anchor.transform )));
+            const Anchor pointAnchor( uid, toMat4( anchor.transform ));
+            queueAnchor( Recording::AnchorUpdatedRecord, pointAnchor );
         }
     }
 }
@@ -195,12 +243,17 @@ void SessionImpl::hitTest()
 {
     for (ARAnchor* anchor in anchors)
     {
+        auto kind = Recording::Point;
+        
         if ( [anchor isKindOfClass:[ARPlaneAnchor class]] )
-            removeAnchorWithID( ciARKitSession->mPlaneAnchors, getUidStringFromAnchor( anchor ));
+            kind = Recording::Plane;
         else if ( [anchor isKindOfClass:[ARImageAnchor class]] )
-            removeAnchorWithID( ciARKitSession->mImageAnchors, getUidStringFromAnchor( anchor ));
-        else
-            removeAnchorWithID( ciARKitSession->mAnchors, getUidStringFromAnchor( anchor ));
+            kind = Recording::Image;
+        
+        Recording::AnchorEvent event;
+        event.mType = Recording::AnchorRemovedRecord;
+        event.mInfo = Recording::makeAnchorInfo( kind, getAnchorIDFromAnchor( anchor ), mat4() );
+        ciARKitSession->queueAnchorEvent( event );
     }
 }
 
@@ -259,3 +312,4 @@ void SessionImpl::hitTest()
 
 @end
 
+#endif // ! defined( CINDER_ARKIT_REPLAY )
@@ -0,0 +1,159 @@
+//
+//  ARSessionImplShared.cpp
+//  CinderARKit
+//
+//  The parts of SessionImpl that don't depend on the backend: handing frames
+//  and anchor events over to the app thread, and recording them.
+//
+
+#include "ARSessionImpl.h"
+
+using namespace ARKit;
+using namespace ARKit::Recording;
+using namespace ci::app;
+using namespace std;
+
+//===== Producer side ==========================================================//
+
+void SessionImpl::publishFrame()
+{
+    auto& state = mFrameBuffer.getWriteBuffer();
+    state.mFrameId = mNextFrameId++;
+
+    if (mRecorder.isOpen() && state.mFrameYChannel.getData())
+    {
+        FrameInfo info;
+        info.mTimestamp = state.mTimestamp;
+        info.mViewMatrix = state.mViewMatrix;
+        info.mProjectionMatrix = state.mProjectionMatrix;
+        info.mCameraPosition = state.mCameraPosition;
+        info.mAmbientLightIntensity = state.mAmbientLightIntensity;
+        info.mAmbientColorTemperature = state.mAmbientColorTemperature;
+        info.mPortrait = state.mPortrait ? 1 : 0;
+        info.mYWidth = (uint32_t)state.mFrameYChannel.getWidth();
+        info.mYHeight = (uint32_t)state.mFrameYChannel.getHeight();
+        info.mCbCrWidth = (uint32_t)state.mFrameCbChannel.getWidth();
+        info.mCbCrHeight = (uint32_t)state.mFrameCbChannel.getHeight();
+
+        // The Cb channel starts at the base of the interleaved CbCr plane
+        mRecorder.writeFrame( info, state.mFrameYChannel.getData(), state.mFrameYChannel.getRowBytes(),
+                                    state.mFrameCbChannel.getData(), state.mFrameCbChannel.getRowBytes() );
+    }
+
+    state.mPublishTime = latencyNow();
+    mFrameBuffer.publish();
+}
+
+void SessionImpl::queueAnchorEvent( const AnchorEvent& event )
+{
+    // Recorded under the lock, so it lands either in the snapshot startRecording()
+    // takes or after it
+    std::lock_guard<std::mutex> lock( mAnchorEventMutex );
+    if (mRecorder.isOpen())
+        mRecorder.writeAnchor( event.mType, event.mInfo, event.mImageName );
+
+    mAnchorEvents.push_back( event );
+}
+
+
+//===== App thread =============================================================//
+
+void SessionImpl::consumeFrameState()
+{
+    if (mFrameBuffer.update())
+    {
+        mIsRunning = true;
+        if (mCameraPyramid.isRunning())
+            mCameraPyramid.submit( getFrame() );
+    }
+    mCameraPyramid.update();
+
+    mAnchors.clearChanges();
+    mPlaneAnchors.clearChanges();
+    mImageAnchors.clearChanges();
+
+    {
+        std::lock_guard<std::mutex> lock( mAnchorEventMutex );
+        std::swap( mAnchorEvents, mAppliedAnchorEvents );
+    }
+
+    for (const auto& event : mAppliedAnchorEvents)
+        applyAnchorEvent( event );
+    mAppliedAnchorEvents.clear();
+
+    if (!mPlaneAnchors.getChanges().empty())
+        mHitTesterDirty = true;
+}
+
+size_t SessionImpl::hitTest( const Ray* rays, size_t count, HitResult* results ) const
+{
+    if (mHitTesterDirty)
+    {
+        mHitTester.build( mPlaneAnchors );
+        mHitTesterDirty = false;
+    }
+
+    return mHitTester.hitTest( rays, count, results );
+}
+
+void SessionImpl::applyAnchorEvent( const AnchorEvent& event )
+{
+    const auto uid = event.getUid();
+    const auto& info = event.mInfo;
+
+    if (event.mType == AnchorRemovedRecord)
+    {
+        if (info.mKind == Plane)
+            mPlaneAnchors.remove( uid );
+        else if (info.mKind == Image)
+            mImageAnchors.remove( uid );
+        else
+            mAnchors.remove( uid );
+        return;
+    }
+
+    if (info.mKind == Plane)
+        mPlaneAnchors.addOrUpdate( PlaneAnchor( uid, info.mTransform, info.mCenter, info.mExtent ));
+    else if (info.mKind == Image)
+        mImageAnchors.addOrUpdate( ImageAnchor( uid, info.mTransform, info.mPhysicalSize, event.mImageName ));
+    else
+        mAnchors.addOrUpdate( Anchor( uid, info.mTransform ));
+}
+
+
+//===== Recording ==============================================================//
+
+bool SessionImpl::startRecording( const fs::path& path, PlaneEncoding encoding )
+{
+    std::vector<AnchorEvent> anchors;
+    auto addAnchor = [&anchors]( const AnchorInfo& info, const std::string& imageName ) {
+        anchors.push_back( AnchorEvent{ AnchorAddedRecord, info, imageName } );
+    };
+
+    std::lock_guard<std::mutex> lock( mAnchorEventMutex );
+
+    // The stores as of the last update(), then the events queued since that
+    // update() hasn't applied yet
+    for (const auto& a : mAnchors.getAnchors())
+        addAnchor( makeAnchorInfo( a ), "" );
+    for (const auto& a : mPlaneAnchors.getAnchors())
+        addAnchor( makeAnchorInfo( a ), "" );
+    for (const auto& a : mImageAnchors.getAnchors())
+        addAnchor( makeAnchorInfo( a ), a.mImageName );
+    anchors.insert( anchors.end(), mAnchorEvents.begin(), mAnchorEvents.end() );
+
+    if (!mRecorder.open( path, encoding, anchors ))
+        return false;
+
+    console() << "Recording session to " << path << endl;
+    return true;
+}
+
+void SessionImpl::stopRecording()
+{
+    if (!mRecorder.isOpen())
+        return;
+
+    mRecorder.close();
+    console() << "Recorded " << mRecorder.getNumFramesWritten() << " frames, dropped " << mRecorder.getNumFramesDropped() << endl;
+}
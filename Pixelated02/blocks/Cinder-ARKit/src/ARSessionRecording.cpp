@@ -0,0 +1,594 @@
+//
+//  ARSessionRecording.cpp
+//  CinderARKit
+//
+
+#include "ARSessionRecording.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ARKit;
+using namespace ARKit::Recording;
+using namespace ci::app;
+using namespace std;
+
+Reader::~Reader()
+{
+    close();
+}
+
+bool Reader::open( const fs::path& path )
+{
+    close();
+
+    const int fd = ::open( path.string().c_str(), O_RDONLY );
+    if (fd < 0)
+    {
+        console() << "Error: Cannot open recording " << path << endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof( FileHeader ))
+    {
+        console() << "Error: Recording " << path << " is empty" << endl;
+        ::close( fd );
+        return false;
+    }
+
+    void* data = mmap( nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+
+    if (data == MAP_FAILED)
+    {
+        console() << "Error: Cannot map recording " << path << endl;
+        return false;
+    }
+
+    madvise( data, (size_t)st.st_size, MADV_SEQUENTIAL );
+
+    FileHeader header;
+    memcpy( &header, data, sizeof( FileHeader ));
+
+    if (header.mMagic != MAGIC || header.mVersion > VERSION)
+    {
+        console() << "Error: " << path << " is not a recording this build can read" << endl;
+        munmap( data, (size_t)st.st_size );
+        return false;
+    }
+
+    const size_t size = (size_t)st.st_size;
+    mMapping = std::shared_ptr<const uint8_t>( (const uint8_t*)data, [size]( const uint8_t* p ) { munmap( (void*)p, size ); } );
+    mData = mMapping.get();
+    mSize = size;
+    rewind();
+
+    return true;
+}
+
+void Reader::close()
+{
+    // Frames still being read keep the file mapped
+    mMapping.reset();
+    mData = nullptr;
+    mSize = mPosition = mReleased = 0;
+}
+
+void Reader::rewind()
+{
+    mPosition = sizeof( FileHeader );
+    mReleased = 0;
+}
+
+bool Reader::next( RecordType* type, Frame* frame, AnchorEvent* anchorEvent )
+{
+    if (!mData || mPosition + sizeof( RecordHeader ) > mSize)
+        return false;
+
+    RecordHeader header;
+    memcpy( &header, mData + mPosition, sizeof( RecordHeader ));
+
+    const size_t payloadStart = mPosition + sizeof( RecordHeader );
+    if (payloadStart + header.mSize > mSize)
+        return reject( "is truncated" );
+
+    // Everything before this record is no longer referenced by the caller
+    releaseConsumedPages( mPosition );
+
+    const uint8_t* payload = mData + payloadStart;
+    *type = (RecordType)header.mType;
+
+    switch (header.mType)
+    {
+        case FrameRecord:
+        {
+            if (header.mSize < sizeof( FrameInfo ))
+                return reject( "has a frame record too short for its header" );
+
+            const auto& info = frame->mInfo;
+            memcpy( &frame->mInfo, payload, sizeof( FrameInfo ));
+            if (sizeof( FrameInfo ) + (uint64_t)info.mYBytes + info.mCbCrBytes > header.mSize)
+                return reject( "has planes past the end of their frame record" );
+
+            // Raw planes are read in place, so they have to be exactly the size of the image
+            if (( info.mYEncoding == Raw && info.mYBytes != (uint64_t)info.mYWidth * info.mYHeight ) ||
+                ( info.mCbCrEncoding == Raw && info.mCbCrBytes != (uint64_t)info.mCbCrWidth * info.mCbCrHeight * 2 ))
+                return reject( "has raw planes that don't match their size" );
+
+            frame->mYPlane    = payload + sizeof( FrameInfo );
+            frame->mCbCrPlane = frame->mYPlane + info.mYBytes;
+            frame->mMapping   = mMapping;
+            break;
+        }
+
+        case AnchorAddedRecord:
+        case AnchorUpdatedRecord:
+        case AnchorRemovedRecord:
+        {
+            if (header.mSize < sizeof( AnchorInfo ))
+                return reject( "has an anchor record too short for its header" );
+
+            anchorEvent->mType = (RecordType)header.mType;
+            memcpy( &anchorEvent->mInfo, payload, sizeof( AnchorInfo ));
+            if (sizeof( AnchorInfo ) + (uint64_t)anchorEvent->mInfo.mNameLength > header.mSize)
+                return reject( "has an image name past the end of its anchor record" );
+
+            anchorEvent->mImageName.assign( (const char*)payload + sizeof( AnchorInfo ), anchorEvent->mInfo.mNameLength );
+            break;
+        }
+
+        default:
+            // Unknown records from newer writers are skipped
+            break;
+    }
+
+    mPosition = payloadStart + paddedSize( header.mSize );
+
+    return true;
+}
+
+bool Reader::reject( const char* reason )
+{
+    console() << "Error: Recording " << reason << " at byte " << mPosition << ", closing it" << endl;
+    close();
+    return false;
+}
+
+void Reader::releaseConsumedPages( size_t upTo )
+{
+    static const size_t pageSize = (size_t)sysconf( _SC_PAGESIZE );
+
+    const size_t end = upTo & ~( pageSize - 1 );
+    if (end <= mReleased)
+        return;
+
+    madvise( (void*)( mData + mReleased ), end - mReleased, MADV_DONTNEED );
+    mReleased = end;
+}
+
+
+//===== Plane codec ============================================================//
+// LZ4 block format: a token byte (literal length << 4 | match length - 4), the
+// literals, a 16 bit little endian offset and extra length bytes where a nibble
+// overflows. The last 5 bytes are always literals and no match starts within
+// the last 12, which keeps the decoder's copy loops simple.
+
+static const uint32_t LZ_MIN_MATCH      = 4;
+static const uint32_t LZ_LAST_LITERALS  = 5;
+static const uint32_t LZ_MATCH_LIMIT    = 12;
+static const uint32_t LZ_MAX_OFFSET     = 65535;
+static const uint32_t LZ_HASH_BITS      = 14;
+
+static inline uint32_t read32( const uint8_t* p )
+{
+    uint32_t v;
+    memcpy( &v, p, 4 );
+    return v;
+}
+
+static inline uint32_t lzHash( uint32_t v )
+{
+    return ( v * 2654435761u ) >> ( 32 - LZ_HASH_BITS );
+}
+
+static inline void lzWriteLength( std::vector<uint8_t>* out, size_t length )
+{
+    while (length >= 255)
+    {
+        out->push_back( 255 );
+        length -= 255;
+    }
+    out->push_back( (uint8_t)length );
+}
+
+static void lzWriteSequence( std::vector<uint8_t>* out, const uint8_t* literals, size_t numLiterals, size_t offset, size_t matchLength )
+{
+    const size_t litNibble   = std::min<size_t>( numLiterals, 15 );
+    const size_t matchNibble = matchLength ? std::min<size_t>( matchLength - LZ_MIN_MATCH, 15 ) : 0;
+    out->push_back( (uint8_t)(( litNibble << 4 ) | matchNibble ));
+
+    if (litNibble == 15)
+        lzWriteLength( out, numLiterals - 15 );
+    out->insert( out->end(), literals, literals + numLiterals );
+
+    if (!matchLength)
+        return;
+
+    out->push_back( (uint8_t)( offset & 0xff ));
+    out->push_back( (uint8_t)( offset >> 8 ));
+    if (matchNibble == 15)
+        lzWriteLength( out, matchLength - LZ_MIN_MATCH - 15 );
+}
+
+static void lzCompress( const uint8_t* src, size_t size, std::vector<uint8_t>* out, std::vector<uint32_t>* hashTable )
+{
+    // Cleared every time, so the output doesn't depend on what was compressed before
+    hashTable->assign( 1 << LZ_HASH_BITS, 0 );
+    uint32_t* table = hashTable->data();
+
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    if (size > LZ_MATCH_LIMIT)
+    {
+        const size_t matchEnd = size - LZ_LAST_LITERALS;
+        const size_t searchEnd = size - LZ_MATCH_LIMIT;
+
+        while (pos < searchEnd)
+        {
+            const uint32_t seq = read32( src + pos );
+            const uint32_t h = lzHash( seq );
+            const size_t candidate = table[h];
+            table[h] = (uint32_t)pos;
+
+            if (candidate >= pos || pos - candidate > LZ_MAX_OFFSET || read32( src + candidate ) != seq)
+            {
+                ++pos;
+                continue;
+            }
+
+            size_t length = LZ_MIN_MATCH;
+            while (pos + length < matchEnd && src[candidate + length] == src[pos + length])
+                ++length;
+
+            lzWriteSequence( out, src + anchor, pos - anchor, pos - candidate, length );
+            pos += length;
+            anchor = pos;
+        }
+    }
+
+    lzWriteSequence( out, src + anchor, size - anchor, 0, 0 );
+}
+
+static bool lzDecompress( const uint8_t* src, size_t srcBytes, uint8_t* dst, size_t dstBytes )
+{
+    const uint8_t* ip = src;
+    const uint8_t* const ipEnd = src + srcBytes;
+    uint8_t* op = dst;
+    uint8_t* const opEnd = dst + dstBytes;
+
+    while (ip < ipEnd)
+    {
+        const uint8_t token = *ip++;
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15)
+        {
+            uint8_t b;
+            do {
+                if (ip >= ipEnd) return false;
+                b = *ip++;
+                numLiterals += b;
+            } while (b == 255);
+        }
+
+        if (numLiterals > (size_t)( ipEnd - ip ) || numLiterals > (size_t)( opEnd - op ))
+            return false;
+        memcpy( op, ip, numLiterals );
+        ip += numLiterals;
+        op += numLiterals;
+
+        // The last sequence has no match
+        if (ip == ipEnd)
+            break;
+
+        if (ipEnd - ip < 2)
+            return false;
+        const size_t offset = ip[0] | ( ip[1] << 8 );
+        ip += 2;
+
+        size_t matchLength = ( token & 15 ) + LZ_MIN_MATCH;
+        if (( token & 15 ) == 15)
+        {
+            uint8_t b;
+            do {
+                if (ip >= ipEnd) return false;
+                b = *ip++;
+                matchLength += b;
+            } while (b == 255);
+        }
+
+        if (offset == 0 || offset > (size_t)( op - dst ) || matchLength > (size_t)( opEnd - op ))
+            return false;
+
+        // Byte copy, matches may overlap their own output
+        const uint8_t* match = op - offset;
+        for (size_t i = 0; i < matchLength; ++i)
+            op[i] = match[i];
+        op += matchLength;
+    }
+
+    return op == opEnd;
+}
+
+size_t ARKit::Recording::encodePlane( PlaneEncoding encoding, const uint8_t* src, uint32_t width, uint32_t height, size_t rowBytes, uint32_t channels, std::vector<uint8_t>* out )
+{
+    EncodeBuffers buffers;
+    return encodePlane( encoding, src, width, height, rowBytes, channels, out, &buffers );
+}
+
+size_t ARKit::Recording::encodePlane( PlaneEncoding encoding, const uint8_t* src, uint32_t width, uint32_t height, size_t rowBytes, uint32_t channels, std::vector<uint8_t>* out, EncodeBuffers* buffers )
+{
+    const size_t start = out->size();
+    const size_t packedRow = (size_t)width * channels;
+
+    if (encoding == Raw)
+    {
+        for (uint32_t y = 0; y < height; ++y)
+            out->insert( out->end(), src + y * rowBytes, src + y * rowBytes + packedRow );
+        return out->size() - start;
+    }
+
+    // Predict each byte from its left neighbour in the same channel, which turns
+    // the smooth gradients of a camera image into long runs of small values
+    auto& delta = buffers->mDelta;
+    delta.resize( packedRow * height );
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t* row = src + y * rowBytes;
+        uint8_t* d = delta.data() + y * packedRow;
+
+        for (uint32_t c = 0; c < channels && c < packedRow; ++c)
+            d[c] = row[c];
+        for (size_t x = channels; x < packedRow; ++x)
+            d[x] = (uint8_t)( row[x] - row[x - channels] );
+    }
+
+    lzCompress( delta.data(), delta.size(), out, &buffers->mHashTable );
+    return out->size() - start;
+}
+
+bool ARKit::Recording::decodePlane( PlaneEncoding encoding, const uint8_t* src, size_t srcBytes, uint32_t width, uint32_t height, uint32_t channels, uint8_t* dst, size_t dstBytes )
+{
+    const size_t packedRow = (size_t)width * channels;
+    if (packedRow * height != dstBytes)
+        return false;
+
+    if (encoding == Raw)
+    {
+        if (srcBytes != dstBytes)
+            return false;
+        memcpy( dst, src, dstBytes );
+        return true;
+    }
+
+    if (encoding != DeltaLz || !lzDecompress( src, srcBytes, dst, dstBytes ))
+        return false;
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        uint8_t* row = dst + y * packedRow;
+        for (size_t x = channels; x < packedRow; ++x)
+            row[x] = (uint8_t)( row[x] + row[x - channels] );
+    }
+
+    return true;
+}
+
+
+//===== Writer =================================================================//
+
+Writer::~Writer()
+{
+    close();
+}
+
+bool Writer::open( const fs::path& path, PlaneEncoding encoding, const std::vector<AnchorEvent>& anchors )
+{
+    close();
+
+    FILE* file = fopen( path.string().c_str(), "wb" );
+    if (!file)
+    {
+        console() << "Error: Cannot create recording " << path << endl;
+        return false;
+    }
+
+    FileHeader header;
+    fwrite( &header, sizeof( FileHeader ), 1, file );
+
+    std::lock_guard<std::mutex> lock( mMutex );
+    mFile = file;
+    mEncoding = encoding;
+    mIsClosing = false;
+    mNumQueuedFrames = mNumFramesWritten = mNumFramesDropped = 0;
+    for (const auto& anchor : anchors)
+        queueAnchor( anchor.mType, anchor.mInfo, anchor.mImageName );
+    mThread = std::thread( &Writer::writeThread, this );
+
+    return true;
+}
+
+void Writer::close()
+{
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        if (!mFile)
+            return;
+        mIsClosing = true;
+    }
+
+    mCondition.notify_one();
+    mThread.join();
+
+    std::lock_guard<std::mutex> lock( mMutex );
+    fclose( mFile );
+    mFile = nullptr;
+
+    for (auto record : mFreeRecords)
+        delete record;
+    mFreeRecords.clear();
+}
+
+bool Writer::isOpen() const
+{
+    std::lock_guard<std::mutex> lock( mMutex );
+    return mFile != nullptr && !mIsClosing;
+}
+
+size_t Writer::getNumFramesWritten() const
+{
+    std::lock_guard<std::mutex> lock( mMutex );
+    return mNumFramesWritten;
+}
+
+size_t Writer::getNumFramesDropped() const
+{
+    std::lock_guard<std::mutex> lock( mMutex );
+    return mNumFramesDropped;
+}
+
+Writer::Record* Writer::acquireRecord()
+{
+    if (mFreeRecords.empty())
+        return new Record();
+
+    auto record = mFreeRecords.back();
+    mFreeRecords.pop_back();
+    return record;
+}
+
+void Writer::writeFrame( const FrameInfo& info, const uint8_t* yPlane, size_t yRowBytes, const uint8_t* cbcrPlane, size_t cbcrRowBytes )
+{
+    Record* record;
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        if (!mFile || mIsClosing)
+            return;
+
+        if (mNumQueuedFrames >= MAX_QUEUED_FRAMES)
+        {
+            ++mNumFramesDropped;
+            return;
+        }
+
+        record = acquireRecord();
+        ++mNumQueuedFrames;
+    }
+
+    // Copy outside the lock, the planes belong to the caller
+    record->mType = FrameRecord;
+    record->mFrame = info;
+
+    const size_t yRow = info.mYWidth;
+    record->mYPlane.resize( yRow * info.mYHeight );
+    for (uint32_t y = 0; y < info.mYHeight; ++y)
+        memcpy( record->mYPlane.data() + y * yRow, yPlane + y * yRowBytes, yRow );
+
+    const size_t cbcrRow = info.mCbCrWidth * 2;
+    record->mCbCrPlane.resize( cbcrRow * info.mCbCrHeight );
+    for (uint32_t y = 0; y < info.mCbCrHeight; ++y)
+        memcpy( record->mCbCrPlane.data() + y * cbcrRow, cbcrPlane + y * cbcrRowBytes, cbcrRow );
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mQueue.push_back( record );
+    }
+    mCondition.notify_one();
+}
+
+void Writer::writeAnchor( RecordType type, const AnchorInfo& info, const std::string& imageName )
+{
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        if (!mFile || mIsClosing)
+            return;
+
+        queueAnchor( type, info, imageName );
+    }
+    mCondition.notify_one();
+}
+
+void Writer::queueAnchor( RecordType type, const AnchorInfo& info, const std::string& imageName )
+{
+    auto record = acquireRecord();
+    record->mType = type;
+    record->mAnchor = info;
+    record->mAnchor.mNameLength = (uint32_t)imageName.size();
+    record->mImageName = imageName;
+    mQueue.push_back( record );
+}
+
+void Writer::writeThread()
+{
+    while (true)
+    {
+        Record* record;
+        {
+            std::unique_lock<std::mutex> lock( mMutex );
+            // Frames still being copied by writeFrame() count as queued, so
+            // closing waits for them instead of leaking their records
+            mCondition.wait( lock, [this] { return !mQueue.empty() || ( mIsClosing && mNumQueuedFrames == 0 ); } );
+
+            if (mQueue.empty())
+                return;
+
+            record = mQueue.front();
+            mQueue.pop_front();
+        }
+
+        writeRecord( *record );
+
+        std::lock_guard<std::mutex> lock( mMutex );
+        if (record->mType == FrameRecord)
+        {
+            --mNumQueuedFrames;
+            ++mNumFramesWritten;
+        }
+        mFreeRecords.push_back( record );
+    }
+}
+
+void Writer::writeRecord( const Record& record )
+{
+    static const uint8_t padding[8] = { 0 };
+
+    mEncoded.clear();
+
+    if (record.mType == FrameRecord)
+    {
+        FrameInfo info = record.mFrame;
+        info.mYEncoding = info.mCbCrEncoding = mEncoding;
+        info.mYBytes    = (uint32_t)encodePlane( mEncoding, record.mYPlane.data(), info.mYWidth, info.mYHeight, info.mYWidth, 1, &mEncoded, &mEncodeBuffers );
+        info.mCbCrBytes = (uint32_t)encodePlane( mEncoding, record.mCbCrPlane.data(), info.mCbCrWidth, info.mCbCrHeight, info.mCbCrWidth * 2, 2, &mEncoded, &mEncodeBuffers );
+
+        RecordHeader header = { FrameRecord, (uint32_t)( sizeof( FrameInfo ) + mEncoded.size() ) };
+        fwrite( &header, sizeof( RecordHeader ), 1, mFile );
+        fwrite( &info, sizeof( FrameInfo ), 1, mFile );
+        fwrite( mEncoded.data(), 1, mEncoded.size(), mFile );
+        fwrite( padding, 1, paddedSize( header.mSize ) - header.mSize, mFile );
+    }
+    else
+    {
+        RecordHeader header = { record.mType, (uint32_t)( sizeof( AnchorInfo ) + record.mImageName.size() ) };
+        fwrite( &header, sizeof( RecordHeader ), 1, mFile );
+        fwrite( &record.mAnchor, sizeof( AnchorInfo ), 1, mFile );
+        fwrite( record.mImageName.data(), 1, record.mImageName.size(), mFile );
+        fwrite( padding, 1, paddedSize( header.mSize ) - header.mSize, mFile );
+    }
+}
+
@@ -0,0 +1,378 @@
+//
+//  ARSessionReplayImpl.cpp
+//  CinderARKit
+//
+//  SessionImpl backend that plays back a recorded session, or generates a
+//  synthetic one, instead of talking to ARKit. Steps one frame per update() so
+//  runs are deterministic, or plays on its own thread at the recorded rate to
+//  mimic the ARKit delegate.
+//
+
+#include "ARSessionImpl.h"
+
+#if defined( CINDER_ARKIT_REPLAY )
+
+#include "ARSessionRecording.h"
+#include "ARSyntheticWorkload.h"
+#include "cinder/Rand.h"
+
+#include <chrono>
+#include <map>
+
+// Global instance of the replayed session, mirrors the ARKit bridge
+static ARKit::SessionImpl*          ciARKitSession = nullptr;
+static ARKit::Recording::Reader*    replayReader = nullptr;
+static ARKit::SyntheticWorkload*    syntheticWorkload = nullptr;
+static bool                         replaySynthetic = false;
+static bool                         replayLoop = true;
+// Frames read since the start of the recording, to point at a corrupt one
+static size_t                       replayFrameIndex = 0;
+// Anchors the recording has added and not removed yet, the ones a rewind takes out
+static std::map<ARKit::AnchorID, ARKit::Recording::AnchorKind> replayAnchors;
+static bool                         replayThreaded = false;
+static std::thread                  replayThread;
+static std::atomic<bool>            replayThreadRunning( false );
+
+/**  Camera planes of a replayed frame, either decoded into mPlanes or read in place
+     from the recording, which mMapping then keeps mapped. Held through
+     FrameState::mImageOwner, so closing the recording never pulls the planes out
+     from under a frame the app or the camera pyramid is still reading.
+*/
+struct ReplayImage
+{
+    std::shared_ptr<const void> mMapping;
+    std::vector<uint8_t>        mPlanes;
+};
+static std::vector<std::shared_ptr<ReplayImage>> replayImages;
+
+
+using namespace ARKit;
+using namespace ARKit::Recording;
+using namespace ci::app;
+using namespace std;
+
+static const AnchorID generateUid()
+{
+    // Random version 4 UUID, like the ones ARKit hands out
+    const uint64_t hi = ( (uint64_t)randUint() << 32 ) | randUint();
+    const uint64_t lo = ( (uint64_t)randUint() << 32 ) | randUint();
+    return AnchorID( ( hi & ~0xf000ull ) | 0x4000ull, ( lo & ~( 3ull << 62 )) | ( 2ull << 62 ));
+}
+
+/**  An image no frame holds on to any more, or a new one
+*/
+static std::shared_ptr<ReplayImage> acquireReplayImage()
+{
+    for (const auto& image : replayImages)
+    {
+        if (image.use_count() == 1)
+            return image;
+    }
+
+    replayImages.push_back( std::make_shared<ReplayImage>() );
+    return replayImages.back();
+}
+
+/**  Lets go of the images, the ones still in use go once their frames do
+*/
+static void releaseReplayImages()
+{
+    replayImages.clear();
+}
+
+/**  Queues the anchor events of the recording, keeping track of which anchors it
+     has in the session
+*/
+static void queueReplayAnchorEvent( SessionImpl* session, const AnchorEvent& event )
+{
+    if (event.mType == AnchorRemovedRecord)
+        replayAnchors.erase( event.getUid() );
+    else
+        replayAnchors[event.getUid()] = (AnchorKind)event.mInfo.mKind;
+
+    session->queueAnchorEvent( event );
+}
+
+/**  Removes the anchors the recording added, through the journal like any other
+     removal. Anchors the app added itself stay.
+*/
+static void removeReplayAnchors( SessionImpl* session )
+{
+    for (const auto& anchor : replayAnchors)
+        session->queueAnchorEvent( AnchorEvent{ AnchorRemovedRecord, makeAnchorInfo( anchor.second, anchor.first, mat4( 1.0f )), "" } );
+    replayAnchors.clear();
+}
+
+/**  Reads the next frame into the session's write buffer. Sets \a hasFrame to false
+     if its camera image is corrupt.
+*/
+static bool readFrame( SessionImpl* session, bool* hasRewound, double* timestamp, bool* hasFrame )
+{
+    RecordType type;
+    Frame frame;
+    AnchorEvent anchorEvent;
+
+    *hasFrame = false;
+    while (true)
+    {
+        if (!replayReader->next( &type, &frame, &anchorEvent ))
+        {
+            if (!replayLoop || !replayReader->isOpen())
+                return false;
+
+            if (*hasRewound)
+            {
+                console() << "Error: No frame of the recording could be decoded, stopping replay" << endl;
+                replayReader->close();
+                return false;
+            }
+
+            replayReader->rewind();
+            replayFrameIndex = 0;
+            removeReplayAnchors( session );
+            *hasRewound = true;
+            continue;
+        }
+
+        if (type == FrameRecord)
+            break;
+
+        if (type == AnchorAddedRecord || type == AnchorUpdatedRecord || type == AnchorRemovedRecord)
+            queueReplayAnchorEvent( session, anchorEvent );
+    }
+    const size_t frameIndex = replayFrameIndex++;
+
+    const auto& info = frame.mInfo;
+    auto& state = session->beginFrame();
+    *timestamp = info.mTimestamp;
+
+    state.mTimestamp = info.mTimestamp;
+    state.mViewMatrix = info.mViewMatrix;
+    state.mProjectionMatrix = info.mProjectionMatrix;
+    state.mCameraPosition = info.mCameraPosition;
+    state.mAmbientLightIntensity = info.mAmbientLightIntensity;
+    state.mAmbientColorTemperature = info.mAmbientColorTemperature;
+    state.mPortrait = info.mPortrait != 0;
+
+    if (!session->mRGBCaptureEnabled)
+    {
+        state.mFrameYChannel = state.mFrameCbChannel = state.mFrameCrChannel = Channel8u();
+        state.mImageOwner.reset();
+        *hasFrame = true;
+        return true;
+    }
+
+    // Raw planes are wrapped in place and keep the mapping alive, compressed ones
+    // are decoded. The state's previous image goes first, so it can be reused
+    const uint8_t* y    = frame.mYPlane;
+    const uint8_t* cbcr = frame.mCbCrPlane;
+    const size_t yBytes = (size_t)info.mYWidth * info.mYHeight;
+    const size_t cbcrBytes = (size_t)info.mCbCrWidth * info.mCbCrHeight * 2;
+
+    state.mImageOwner.reset();
+    auto image = acquireReplayImage();
+
+    if (info.mYEncoding != Raw || info.mCbCrEncoding != Raw)
+    {
+        image->mMapping.reset();
+        image->mPlanes.resize( yBytes + cbcrBytes );
+
+        if (!decodePlane( (PlaneEncoding)info.mYEncoding, y, info.mYBytes, info.mYWidth, info.mYHeight, 1, image->mPlanes.data(), yBytes ) ||
+            !decodePlane( (PlaneEncoding)info.mCbCrEncoding, cbcr, info.mCbCrBytes, info.mCbCrWidth, info.mCbCrHeight, 2, image->mPlanes.data() + yBytes, cbcrBytes ))
+        {
+            console() << "Error: Corrupt camera image in frame " << frameIndex << " of the recording, skipping it" << endl;
+            state.mFrameYChannel = state.mFrameCbChannel = state.mFrameCrChannel = Channel8u();
+            return true;
+        }
+
+        y    = image->mPlanes.data();
+        cbcr = image->mPlanes.data() + yBytes;
+    }
+    else
+    {
+        image->mMapping = frame.mMapping;
+    }
+    state.mImageOwner = image;
+
+    state.mFrameYChannel  = Channel8u( (int32_t)info.mYWidth, (int32_t)info.mYHeight, (ptrdiff_t)info.mYWidth, 1, const_cast<uint8_t*>( y ));
+    state.mFrameCbChannel = Channel8u( (int32_t)info.mCbCrWidth, (int32_t)info.mCbCrHeight, (ptrdiff_t)info.mCbCrWidth * 2, 2, const_cast<uint8_t*>( cbcr ));
+    state.mFrameCrChannel = Channel8u( (int32_t)info.mCbCrWidth, (int32_t)info.mCbCrHeight, (ptrdiff_t)info.mCbCrWidth * 2, 2, const_cast<uint8_t*>( cbcr + 1 ));
+    state.mCameraSize = vec2( (float)info.mYWidth, (float)info.mYHeight );
+
+    *hasFrame = true;
+    return true;
+}
+
+/**  Reads up to and including the next frame whose camera image decodes, queues the
+     anchor events in between and publishes the frame. Corrupt frames are logged and
+     skipped. Returns false once the recording has ended, and closes it when a whole
+     loop of it had no frame to show.
+*/
+static bool produceFrame( SessionImpl* session, bool* hasRewound, double* timestamp )
+{
+    *hasRewound = false;
+    while (true)
+    {
+        bool hasFrame;
+        if (!readFrame( session, hasRewound, timestamp, &hasFrame ))
+            return false;
+        if (hasFrame)
+            break;
+    }
+    session->publishFrame();
+    return true;
+}
+
+static bool produceNextFrame( SessionImpl* session, bool* hasRewound, double* timestamp )
+{
+    if (replaySynthetic)
+    {
+        *hasRewound = false;
+        syntheticWorkload->produceFrame( session, timestamp );
+        return true;
+    }
+
+    return produceFrame( session, hasRewound, timestamp );
+}
+
+/**  Publishes frames at the pace they were captured, like the ARKit delegate queue.
+*/
+static void replayThreadFn( SessionImpl* session )
+{
+    typedef std::chrono::steady_clock Clock;
+
+    auto start = Clock::now();
+    double firstTimestamp = -1.0;
+
+    while (replayThreadRunning)
+    {
+        bool hasRewound;
+        double timestamp;
+        if (!produceNextFrame( session, &hasRewound, &timestamp ))
+            break;
+
+        if (firstTimestamp < 0.0 || hasRewound)
+        {
+            start = Clock::now();
+            firstTimestamp = timestamp;
+        }
+
+        std::this_thread::sleep_until( start + std::chrono::duration<double>( timestamp - firstTimestamp ));
+    }
+}
+
+static void stopReplayThread()
+{
+    replayThreadRunning = false;
+    if (replayThread.joinable())
+        replayThread.join();
+}
+
+// Cinder ARKit Session implementation
+SessionImpl::SessionImpl()
+{
+    // You already have an ARSession instance running
+    CI_ASSERT( ciARKitSession == nullptr );
+
+    ciARKitSession = this;
+    replayReader = new Reader();
+    syntheticWorkload = new SyntheticWorkload();
+}
+
+SessionImpl::~SessionImpl()
+{
+    CI_ASSERT( ciARKitSession == this );
+    ciARKitSession = nullptr;
+
+    stopReplayThread();
+    delete replayReader;
+    replayReader = nullptr;
+    releaseReplayImages();
+    delete syntheticWorkload;
+    syntheticWorkload = nullptr;
+}
+
+void SessionImpl::runConfiguration( SessionConfiguration config )
+{
+    if (config.mReplayFile.empty() && !config.mSynthetic)
+    {
+        console() << "Error: Replay backend needs a recording, set SessionConfiguration::replayFile() or synthetic()" << endl;
+        return;
+    }
+
+    stopReplayThread();
+    replaySynthetic = false;
+    releaseReplayImages();
+    // The next recording starts over from the anchors the app added
+    removeReplayAnchors( this );
+
+    if (config.mSynthetic)
+    {
+        replayReader->close();
+        syntheticWorkload->reset( config.mSyntheticConfig );
+        replaySynthetic = true;
+        console() << "Generating synthetic session: " << config.mSyntheticConfig.mNumPlanes << " planes, "
+                  << config.mSyntheticConfig.mNumImages << " images at " << config.mSyntheticConfig.mFrameRate << " Hz" << endl;
+    }
+    else if (replayReader->open( config.mReplayFile ))
+    {
+        replayLoop = config.mReplayLoop;
+        replayFrameIndex = 0;
+        console() << "Replaying " << config.mReplayFile << " (" << replayReader->getSize() / ( 1024 * 1024 ) << " MB)" << endl;
+    }
+    else
+    {
+        return;
+    }
+
+    replayThreaded = config.mReplayThreaded;
+    if (replayThreaded)
+    {
+        replayThreadRunning = true;
+        replayThread = std::thread( replayThreadFn, this );
+    }
+}
+
+void SessionImpl::pause()
+{
+    stopReplayThread();
+    mIsRunning = false;
+    replaySynthetic = false;
+    replayReader->close();
+    releaseReplayImages();
+}
+
+void SessionImpl::update()
+{
+    if (!replayThreaded && ( replaySynthetic || replayReader->isOpen() ))
+    {
+        bool hasRewound;
+        double timestamp;
+        produceNextFrame( this, &hasRewound, &timestamp );
+    }
+
+    consumeFrameState();
+}
+
+// Queued like the delegate's events on device, so the anchor shows up and is
+// journaled as Added by the next update() instead of being cleared by it
+const AnchorID SessionImpl::addAnchorRelativeToWorld( vec3 position )
+{
+    const auto uid = generateUid();
+    queueAnchorEvent( AnchorEvent{ AnchorAddedRecord, makeAnchorInfo( Anchor( uid, glm::translate( mat4( 1.0f ), position ))), "" } );
+    return uid;
+}
+
+const AnchorID SessionImpl::addAnchorRelativeToCamera( vec3 offset )
+{
+    const auto uid = generateUid();
+    queueAnchorEvent( AnchorEvent{ AnchorAddedRecord, makeAnchorInfo( Anchor( uid, glm::inverse( getFrame().mViewMatrix ) * glm::translate( mat4( 1.0f ), offset ))), "" } );
+    return uid;
+}
+
+bool SessionImpl::isInterfaceInPortraitOrientation() const
+{
+    return getFrame().mPortrait;
+}
+
+#endif // defined( CINDER_ARKIT_REPLAY )
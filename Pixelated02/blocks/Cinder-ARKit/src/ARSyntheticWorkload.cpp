@@ -0,0 +1,259 @@
+//
+//  ARSyntheticWorkload.cpp
+//  CinderARKit
+//
+
+#include "ARSyntheticWorkload.h"
+#include "ARSessionImpl.h"
+
+using namespace ARKit;
+using namespace std;
+
+namespace {
+
+const size_t NUM_CAMERA_IMAGES = 4;
+const float  EYE_HEIGHT = 1.5f;
+
+/**  Anchor transform whose y axis is \a normal, the way ARKit orients planes.
+*/
+mat4 makePlaneTransform( const vec3& position, const vec3& normal, float angle )
+{
+    // Any in-plane axis, rotated by angle around the normal
+    const vec3 reference = std::abs( normal.y ) > 0.9f ? vec3( 1, 0, 0 ) : vec3( 0, 1, 0 );
+    const vec3 a = normalize( cross( reference, normal ));
+    const vec3 b = cross( normal, a );
+    const vec3 u = a * cos( angle ) + b * sin( angle );
+    const vec3 v = cross( u, normal );
+
+    mat4 m;
+    m[0] = vec4( u, 0.0f );
+    m[1] = vec4( normal, 0.0f );
+    m[2] = vec4( v, 0.0f );
+    m[3] = vec4( position, 1.0f );
+    return m;
+}
+
+} // anonymous namespace
+
+
+void SyntheticWorkload::reset( const SyntheticConfiguration& config )
+{
+    mConfig = config;
+    mConfig.mFrameRate = std::max( mConfig.mFrameRate, 1.0f );
+
+    mRand.seed( config.mSeed );
+    mFrameIndex = 0;
+    mPlanes.clear();
+    mImages.clear();
+    mUpdateCursor = 0;
+    mMergeDebt = 0.0f;
+
+    generateCameraImages();
+}
+
+float SyntheticWorkload::randFloat()
+{
+    return (float)( mRand() >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+AnchorID SyntheticWorkload::generateUid()
+{
+    // Random version 4 UUID, like the ones ARKit hands out
+    const uint64_t hi = ( (uint64_t)mRand() << 32 ) | mRand();
+    const uint64_t lo = ( (uint64_t)mRand() << 32 ) | mRand();
+    return AnchorID( ( hi & ~0xf000ull ) | 0x4000ull, ( lo & ~( 3ull << 62 )) | ( 2ull << 62 ));
+}
+
+SyntheticWorkload::Plane SyntheticWorkload::generatePlane()
+{
+    const float halfRoom = mConfig.mRoomSize * 0.5f;
+    Plane plane;
+    plane.mUid = generateUid();
+
+    // Mostly floors and tables, the rest walls
+    if (randFloat() < 0.7f)
+    {
+        const vec3 position( randFloat( -halfRoom, halfRoom ), randFloat( 0.0f, 1.2f ), randFloat( -halfRoom, halfRoom ));
+        plane.mTransform = makePlaneTransform( position, vec3( 0, 1, 0 ), randFloat( 0.0f, 6.2832f ));
+    }
+    else
+    {
+        const float angle = randFloat( 0.0f, 6.2832f );
+        const vec3 normal( cos( angle ), 0.0f, sin( angle ));
+        const vec3 position = -normal * randFloat( halfRoom * 0.5f, halfRoom ) + vec3( 0, randFloat( 0.5f, 2.0f ), 0 );
+        plane.mTransform = makePlaneTransform( position, normal, 0.0f );
+    }
+
+    plane.mExtent = vec3( randFloat( 0.05f, 0.2f ), 0.0f, randFloat( 0.05f, 0.2f ));
+    plane.mMaxExtent = vec3( randFloat( 0.5f, 3.0f ), 0.0f, randFloat( 0.5f, 3.0f ));
+    return plane;
+}
+
+void SyntheticWorkload::queuePlane( SessionImpl* session, Recording::RecordType type, const Plane& plane )
+{
+    Recording::AnchorEvent event;
+    event.mType = type;
+    event.mInfo = Recording::makeAnchorInfo( PlaneAnchor( plane.mUid, plane.mTransform, vec3( 0.0f ), plane.mExtent ));
+    session->queueAnchorEvent( event );
+}
+
+void SyntheticWorkload::generateCameraImages()
+{
+    mCameraImages.clear();
+
+    const int width = mConfig.mCameraSize.x;
+    const int height = mConfig.mCameraSize.y;
+    if (width < 2 || height < 2)
+        return;
+
+    const int cbcrWidth = width / 2;
+    const int cbcrHeight = height / 2;
+
+    // Diagonal bands that shift from image to image, so consecutive frames differ
+    for (size_t i = 0; i < NUM_CAMERA_IMAGES; ++i)
+    {
+        auto image = std::make_shared<std::vector<uint8_t>>( (size_t)width * height + (size_t)cbcrWidth * cbcrHeight * 2 );
+        uint8_t* y = image->data();
+        uint8_t* cbcr = y + (size_t)width * height;
+        const int phase = (int)i * 16;
+
+        for (int row = 0; row < height; ++row)
+            for (int col = 0; col < width; ++col)
+                y[(size_t)row * width + col] = (uint8_t)( ( col + row + phase ) & 0xff );
+
+        for (int row = 0; row < cbcrHeight; ++row)
+        {
+            for (int col = 0; col < cbcrWidth; ++col)
+            {
+                cbcr[( (size_t)row * cbcrWidth + col ) * 2]     = (uint8_t)( 128 + ( ( col + phase ) & 0x3f ) - 32 );
+                cbcr[( (size_t)row * cbcrWidth + col ) * 2 + 1] = (uint8_t)( 128 + ( ( row + phase ) & 0x3f ) - 32 );
+            }
+        }
+
+        mCameraImages.push_back( image );
+    }
+}
+
+void SyntheticWorkload::produceFrame( SessionImpl* session, double* timestamp )
+{
+    const float dt = 1.0f / mConfig.mFrameRate;
+    const double time = (double)mFrameIndex * dt;
+    *timestamp = time;
+
+    // Everything is detected on the first frame, which doubles as a burst test
+    if (mFrameIndex == 0)
+    {
+        for (size_t i = 0; i < mConfig.mNumPlanes; ++i)
+        {
+            mPlanes.push_back( generatePlane() );
+            queuePlane( session, Recording::AnchorAddedRecord, mPlanes.back() );
+        }
+
+        const float halfRoom = mConfig.mRoomSize * 0.5f;
+        for (size_t i = 0; i < mConfig.mNumImages; ++i)
+        {
+            Image image;
+            image.mUid = generateUid();
+            image.mPosition = vec3( randFloat( -halfRoom, halfRoom ), randFloat( 0.5f, 2.0f ), randFloat( -halfRoom, halfRoom ));
+            image.mNormal = normalize( vec3( 0, EYE_HEIGHT, 0 ) - image.mPosition );
+            image.mName = "synthetic_" + std::to_string( i );
+            mImages.push_back( image );
+        }
+    }
+
+    // Merges: the absorbed plane goes, the survivor takes over its size and a new
+    // plane shows up elsewhere
+    mMergeDebt += mConfig.mMergesPerSecond * dt;
+    while (mMergeDebt >= 1.0f && mPlanes.size() >= 2)
+    {
+        mMergeDebt -= 1.0f;
+
+        const size_t survivor = mRand() % mPlanes.size();
+        const size_t absorbed = ( survivor + 1 + mRand() % ( mPlanes.size() - 1 )) % mPlanes.size();
+
+        Plane& plane = mPlanes[survivor];
+        plane.mMaxExtent = glm::max( plane.mMaxExtent, mPlanes[absorbed].mMaxExtent ) * 1.2f;
+        plane.mExtent = glm::max( plane.mExtent, mPlanes[absorbed].mExtent );
+        queuePlane( session, Recording::AnchorUpdatedRecord, plane );
+
+        Recording::AnchorEvent removed;
+        removed.mType = Recording::AnchorRemovedRecord;
+        removed.mInfo = Recording::makeAnchorInfo( Recording::Plane, mPlanes[absorbed].mUid, mat4() );
+        session->queueAnchorEvent( removed );
+
+        mPlanes[absorbed] = generatePlane();
+        queuePlane( session, Recording::AnchorAddedRecord, mPlanes[absorbed] );
+    }
+
+    // Growth, round robin. Each plane grows by as much as it would have over the
+    // frames since its last update
+    const size_t numUpdates = std::min( mConfig.mPlaneUpdatesPerFrame, mPlanes.size() );
+    if (numUpdates > 0)
+    {
+        const float growth = 0.25f * dt * (float)mPlanes.size() / (float)numUpdates;
+        for (size_t i = 0; i < numUpdates; ++i)
+        {
+            Plane& plane = mPlanes[mUpdateCursor];
+            mUpdateCursor = ( mUpdateCursor + 1 ) % mPlanes.size();
+
+            plane.mExtent = glm::min( plane.mExtent + vec3( growth, 0.0f, growth ), plane.mMaxExtent );
+            queuePlane( session, Recording::AnchorUpdatedRecord, plane );
+        }
+    }
+
+    // Tracked images jitter a little every frame, like real tracking noise
+    for (size_t i = 0; i < mImages.size(); ++i)
+    {
+        const Image& image = mImages[i];
+        const float wobble = 0.002f * (float)sin( time * 7.0 + (double)i );
+
+        Recording::AnchorEvent event;
+        event.mType = mFrameIndex == 0 ? Recording::AnchorAddedRecord : Recording::AnchorUpdatedRecord;
+        event.mInfo = Recording::makeAnchorInfo( ImageAnchor( image.mUid, makePlaneTransform( image.mPosition + vec3( wobble ), image.mNormal, 0.0f ),
+                                                              vec2( 0.2f, 0.15f ), image.mName ));
+        event.mImageName = image.mName;
+        session->queueAnchorEvent( event );
+    }
+
+    // Camera orbits the room looking towards the middle
+    const float radius = mConfig.mRoomSize * 0.3f;
+    const float angle = (float)( time * 0.3 );
+    const vec3 eye( radius * cos( angle ), EYE_HEIGHT + 0.1f * sin( angle * 3.0f ), radius * sin( angle ));
+    const vec3 target( 0.3f * sin( angle * 2.0f ), 0.8f, 0.0f );
+
+    auto& state = session->beginFrame();
+    state.mTimestamp = time;
+    state.mPortrait = true;
+    state.mViewMatrix = glm::lookAt( eye, target, vec3( 0, 1, 0 ));
+    state.mCameraPosition = eye;
+    state.mAmbientLightIntensity = 0.5f;
+    state.mAmbientColorTemperature = 6500.0f;
+
+    const ivec2 size = mConfig.mCameraSize;
+    const float aspect = size.x > 0 && size.y > 0 ? (float)size.y / (float)size.x : 0.75f;
+    state.mProjectionMatrix = glm::perspective( 1.0f, aspect, 0.001f, 1000.0f );
+
+    if (!session->mRGBCaptureEnabled || mCameraImages.empty())
+    {
+        state.mFrameYChannel = state.mFrameCbChannel = state.mFrameCrChannel = Channel8u();
+        state.mImageOwner.reset();
+    }
+    else
+    {
+        // The images never change, so they are shared with the state instead of copied
+        const auto& image = mCameraImages[mFrameIndex % mCameraImages.size()];
+        uint8_t* y = image->data();
+        uint8_t* cbcr = y + (size_t)size.x * size.y;
+        const int cbcrWidth = size.x / 2;
+        const int cbcrHeight = size.y / 2;
+
+        state.mImageOwner = image;
+        state.mFrameYChannel  = Channel8u( size.x, size.y, (ptrdiff_t)size.x, 1, y );
+        state.mFrameCbChannel = Channel8u( cbcrWidth, cbcrHeight, (ptrdiff_t)cbcrWidth * 2, 2, cbcr );
+        state.mFrameCrChannel = Channel8u( cbcrWidth, cbcrHeight, (ptrdiff_t)cbcrWidth * 2, 2, cbcr + 1 );
+        state.mCameraSize = vec2( size );
+    }
+
+    session->publishFrame();
+    ++mFrameIndex;
+}
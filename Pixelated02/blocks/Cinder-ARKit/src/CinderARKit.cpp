@@ -14,68 +14,191 @@ using namespace std;
 Session::Session()
 {
     mYCbCrToRGBProg = createCameraRGBProg();
+    mCameraTextureProg = createCameraTextureProg();
 }
 
 void Session::runConfiguration( SessionConfiguration config )       { mSessionImpl.runConfiguration( config ); }
 void Session::pause()                                               { mSessionImpl.pause(); }
 const AnchorID Session::addAnchorRelativeToWorld( vec3 position )   { return mSessionImpl.addAnchorRelativeToWorld( position ); }
 const AnchorID Session::addAnchorRelativeToCamera( vec3 offset )    { return mSessionImpl.addAnchorRelativeToCamera( offset ); }
-gl::Texture2dRef Session::getFrameLumaTexture() const               { return gl::Texture2d::create( mSessionImpl.mFrameYChannel ); }
-float Session::getAmbientLightIntensity() const                     { return mSessionImpl.mAmbientLightIntensity; }
-float Session::getAmbientColorTemperature() const                   { return mSessionImpl.mAmbientColorTemperature; }
-const std::vector<Anchor>& Session::getAnchors() const              { return mSessionImpl.mAnchors; }
-const std::vector<PlaneAnchor>& Session::getPlaneAnchors() const    { return mSessionImpl.mPlaneAnchors; }
-const std::vector<ImageAnchor>& Session::getImageAnchors() const    { return mSessionImpl.mImageAnchors; }
+gl::Texture2dRef Session::getFrameLumaTexture() const               { return updateCameraTextures().mY; }
+uint64_t Session::getFrameId() const                                { return mSessionImpl.getFrame().mFrameId; }
+const FrameState& Session::getFrameState() const                    { return mSessionImpl.getFrame(); }
+float Session::getAmbientLightIntensity() const                     { return mSessionImpl.getFrame().mAmbientLightIntensity; }
+float Session::getAmbientColorTemperature() const                   { return mSessionImpl.getFrame().mAmbientColorTemperature; }
+const std::vector<Anchor>& Session::getAnchors() const              { return mSessionImpl.mAnchors.getAnchors(); }
+const std::vector<PlaneAnchor>& Session::getPlaneAnchors() const    { return mSessionImpl.mPlaneAnchors.getAnchors(); }
+const std::vector<ImageAnchor>& Session::getImageAnchors() const    { return mSessionImpl.mImageAnchors.getAnchors(); }
+const Anchor* Session::findAnchorWithID( const AnchorID& anchorID ) const               { return mSessionImpl.mAnchors.get( anchorID ); }
+const PlaneAnchor* Session::findPlaneAnchorWithID( const AnchorID& anchorID ) const     { return mSessionImpl.mPlaneAnchors.get( anchorID ); }
+const ImageAnchor* Session::findImageAnchorWithID( const AnchorID& anchorID ) const     { return mSessionImpl.mImageAnchors.get( anchorID ); }
+const AnchorStore<Anchor>& Session::getAnchorStore() const                              { return mSessionImpl.mAnchors; }
+const AnchorStore<PlaneAnchor>& Session::getPlaneAnchorStore() const                    { return mSessionImpl.mPlaneAnchors; }
+const AnchorStore<ImageAnchor>& Session::getImageAnchorStore() const                    { return mSessionImpl.mImageAnchors; }
 void Session::setRGBCaptureEnabled( bool captureEnabled )           { mSessionImpl.mRGBCaptureEnabled = captureEnabled; }
-const mat4 Session::getViewMatrix() const                           { return mSessionImpl.mViewMatrix; }
-const mat4 Session::getProjectionMatrix() const                     { return mSessionImpl.mProjectionMatrix; }
-const vec3 Session::getCameraPosition() const                       { return mSessionImpl.mCameraPosition; }
+const mat4 Session::getViewMatrix() const                           { return mSessionImpl.getFrame().mViewMatrix; }
+const mat4 Session::getProjectionMatrix() const                     { return mSessionImpl.getFrame().mProjectionMatrix; }
+const vec3 Session::getCameraPosition() const                       { return mSessionImpl.getFrame().mCameraPosition; }
+void Session::stopRecording()                                       { mSessionImpl.stopRecording(); }
+bool Session::isRecording() const                                   { return mSessionImpl.mRecorder.isOpen(); }
 
-std::shared_ptr<Anchor> Session::findAnchorWithID( AnchorID anchorID ) const
+void Session::update()
 {
-    const auto foundAnchor = std::find_if( mSessionImpl.mAnchors.begin(), mSessionImpl.mAnchors.end(), [anchorID](const Anchor& a) { return (a.mUid == anchorID); });
-    
-    if (foundAnchor != mSessionImpl.mAnchors.end())
-        return std::make_shared<Anchor>( *foundAnchor );
+    mSessionImpl.update();
+    mLatency.markUpdate( mSessionImpl.getFrame() );
+}
+
+void Session::markFrameDrawn() const                                { mLatency.markDraw( mSessionImpl.getFrame().mFrameId ); }
+const LatencyHistogram& Session::getLatencyHistogram( LatencyStage stage ) const    { return mLatency.getHistogram( stage ); }
+bool Session::startLatencyLog( const fs::path& path )               { return mLatency.openCsv( path ); }
+void Session::stopLatencyLog()                                      { mLatency.closeCsv(); }
+
+bool Session::startRecording( const fs::path& path, Recording::PlaneEncoding encoding )
+{
+    return mSessionImpl.startRecording( path, encoding );
+}
+
+// Uploads a plane with its row padding in place, no repacking on the CPU
+static void uploadPlane( const gl::Texture2dRef& texture, const Channel8u& channel, GLenum format, GLint bytesPerPixel )
+{
+    gl::ScopedTextureBind texScp( texture );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, (GLint)channel.getRowBytes() / bytesPerPixel );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, texture->getWidth(), texture->getHeight(), format, GL_UNSIGNED_BYTE, channel.getData() );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+}
+
+static gl::Texture2dRef createPlaneTexture( const gl::Texture2dRef& texture, int32_t width, int32_t height, GLint internalFormat )
+{
+    if (texture && texture->getWidth() == width && texture->getHeight() == height)
+        return texture;
     
-    return nullptr;
+    return gl::Texture2d::create( width, height, gl::Texture2d::Format()
+                                    .internalFormat( internalFormat )
+                                    .minFilter( GL_LINEAR )
+                                    .magFilter( GL_LINEAR )
+                                    .wrap( GL_CLAMP_TO_EDGE ));
 }
 
-void Session::drawRGBCaptureTexture( Area area ) const
+const Session::CameraTextures& Session::updateCameraTextures() const
 {
-    if (!mSessionImpl.mIsRunning)
-        return;
+    const auto& frame = mSessionImpl.getFrame();
+    const auto& current = mCameraTextures[mCameraTextureIndex];
+    if (current.mFrameId == frame.mFrameId || !frame.mFrameYChannel.getData())
+        return current;
     
-    const auto texY  = gl::Texture2d::create( mSessionImpl.mFrameYChannel );
-    const auto texCr = gl::Texture2d::create( mSessionImpl.mFrameCrChannel );
-    const auto texCb = gl::Texture2d::create( mSessionImpl.mFrameCbChannel );
+    // The Cb channel starts at the base of the interleaved CbCr plane
+    const auto& y    = frame.mFrameYChannel;
+    const auto& cbcr = frame.mFrameCbChannel;
     
-    auto cameraRect = Rectf( vec2( 0.0f ), mSessionImpl.mCameraSize );
-    bool rotate = false;
+    mCameraTextureIndex = ( mCameraTextureIndex + 1 ) % NUM_CAMERA_TEXTURES;
+    auto& next = mCameraTextures[mCameraTextureIndex];
     
-    gl::ScopedMatrices matScp;
+    next.mY    = createPlaneTexture( next.mY, y.getWidth(), y.getHeight(), GL_R8 );
+    next.mCbCr = createPlaneTexture( next.mCbCr, cbcr.getWidth(), cbcr.getHeight(), GL_RG8 );
+    uploadPlane( next.mY, y, GL_RED, 1 );
+    uploadPlane( next.mCbCr, cbcr, GL_RG, 2 );
+    next.mFrameId = frame.mFrameId;
+    mLatency.markUpload( frame.mFrameId );
+    
+    return next;
+}
+
+Rectf Session::getCameraRect( Area area, bool* rotate ) const
+{
+    const auto& cameraSize = mSessionImpl.getFrame().mCameraSize;
+    auto cameraRect = Rectf( vec2( 0.0f ), cameraSize );
+    *rotate = false;
     
     if (mSessionImpl.isInterfaceInPortraitOrientation())
     {
-        cameraRect = Rectf( vec2( 0.0f ), vec2( mSessionImpl.mCameraSize.y, mSessionImpl.mCameraSize.x ));
-        rotate = true;
+        cameraRect = Rectf( vec2( 0.0f ), vec2( cameraSize.y, cameraSize.x ));
+        *rotate = true;
     }
     
+    return cameraRect.getCenteredFill( area, true );
+}
+
+void Session::drawRGBCaptureTexture( Area area ) const
+{
+    if (!mSessionImpl.mIsRunning)
+        return;
+    
+    const auto& textures = updateCameraTextures();
+    if (!textures.mY)
+        return;
+    
+    bool rotate;
+    const auto cameraRect = getCameraRect( area, &rotate );
+    
+    gl::ScopedMatrices matScp;
     gl::ScopedGlslProg glslProg( mYCbCrToRGBProg );
-    gl::ScopedTextureBind yScp( texY, 0 );
-    gl::ScopedTextureBind cbScp( texCb, 1 );
-    gl::ScopedTextureBind crScp( texCr, 2 );
+    gl::ScopedTextureBind yScp( textures.mY, 0 );
+    gl::ScopedTextureBind cbcrScp( textures.mCbCr, 1 );
     mYCbCrToRGBProg->uniform( "u_YTex", 0 );
-    mYCbCrToRGBProg->uniform( "u_CbTex", 1 );
-    mYCbCrToRGBProg->uniform( "u_CrTex", 2 );
+    mYCbCrToRGBProg->uniform( "u_CbCrTex", 1 );
     mYCbCrToRGBProg->uniform( "u_Rotate", rotate );
-    gl::drawSolidRect( cameraRect.getCenteredFill( area, true ));
+    gl::drawSolidRect( cameraRect );
+    
+    markFrameDrawn();
 }
 
-gl::GlslProgRef Session::createCameraRGBProg()
+void Session::setCameraPyramidEnabled( bool enabled )
 {
-    return gl::GlslProg::create( gl::GlslProg::Format()
-            .vertex( CI_GLSL(100, precision mediump float;
+    if (enabled)
+        mSessionImpl.mCameraPyramid.start();
+    else
+        mSessionImpl.mCameraPyramid.stop();
+}
+
+const Surface8u& Session::getCameraPyramidSurface( size_t level ) const
+{
+    const auto& levels = mSessionImpl.mCameraPyramid.getLevels();
+    return levels.mSurfaces[std::min<size_t>( level, CameraPyramid::NUM_LEVELS - 1 )];
+}
+
+gl::Texture2dRef Session::getCameraPyramidTexture( size_t level ) const
+{
+    level = std::min<size_t>( level, CameraPyramid::NUM_LEVELS - 1 );
+    
+    const auto& levels = mSessionImpl.mCameraPyramid.getLevels();
+    const auto& surface = levels.mSurfaces[level];
+    auto& texture = mPyramidTextures[level];
+    if (!surface || mPyramidTextureFrameIds[level] == levels.mFrameId)
+        return texture;
+    
+    if (texture && texture->getWidth() == surface.getWidth() && texture->getHeight() == surface.getHeight())
+        texture->update( surface );
+    else
+        texture = gl::Texture2d::create( surface, gl::Texture2d::Format()
+                                            .minFilter( GL_LINEAR )
+                                            .magFilter( GL_LINEAR )
+                                            .wrap( GL_CLAMP_TO_EDGE ));
+    
+    mPyramidTextureFrameIds[level] = levels.mFrameId;
+    return texture;
+}
+
+void Session::drawCameraPyramidTexture( size_t level, Area area ) const
+{
+    const auto texture = getCameraPyramidTexture( level );
+    if (!texture)
+        return;
+    
+    bool rotate;
+    const auto cameraRect = getCameraRect( area, &rotate );
+    
+    gl::ScopedMatrices matScp;
+    gl::ScopedGlslProg glslProg( mCameraTextureProg );
+    gl::ScopedTextureBind texScp( texture, 0 );
+    mCameraTextureProg->uniform( "u_Tex", 0 );
+    mCameraTextureProg->uniform( "u_Rotate", rotate );
+    gl::drawSolidRect( cameraRect );
+}
+
+// Shared by both camera shaders, rotates the image for portrait
+static const char* cameraVertexShader = CI_GLSL(100, precision mediump float;
 
             uniform mat4 ciModelViewProjection;
             uniform bool u_Rotate;
@@ -100,12 +223,16 @@ gl::GlslProgRef Session::createCameraRGBProg()
                 }
                 
                 gl_Position = ciModelViewProjection * ciPosition;
-            }))
+            });
+
+gl::GlslProgRef Session::createCameraRGBProg()
+{
+    return gl::GlslProg::create( gl::GlslProg::Format()
+            .vertex( cameraVertexShader )
             .fragment( CI_GLSL(100, precision mediump float;
     
             uniform sampler2D u_YTex;
-            uniform sampler2D u_CbTex;
-            uniform sampler2D u_CrTex;
+            uniform sampler2D u_CbCrTex;
     
             varying vec2 v_TexCoord;
 
@@ -113,9 +240,10 @@ gl::GlslProgRef Session::createCameraRGBProg()
             {
                 vec3 rgb = vec3( 0.0 );
                 
-                float y  = texture2D( u_YTex,  v_TexCoord ).r;
-                float cb = texture2D( u_CbTex, v_TexCoord ).r - 0.5;
-                float cr = texture2D( u_CrTex, v_TexCoord ).r - 0.5;
+                float y    = texture2D( u_YTex, v_TexCoord ).r;
+                vec2 cbcr  = texture2D( u_CbCrTex, v_TexCoord ).rg - vec2( 0.5 );
+                float cb   = cbcr.x;
+                float cr   = cbcr.y;
 
                 rgb.x = y + 1.402 * cr;
                 rgb.y = y -0.344 * cb - 0.714 * cr;
@@ -125,6 +253,37 @@ gl::GlslProgRef Session::createCameraRGBProg()
             })));
 }
 
-void Session::hitTest() {
-    console() << "hit test" <<endl;
+gl::GlslProgRef Session::createCameraTextureProg()
+{
+    return gl::GlslProg::create( gl::GlslProg::Format()
+            .vertex( cameraVertexShader )
+            .fragment( CI_GLSL(100, precision mediump float;
+    
+            uniform sampler2D u_Tex;
+    
+            varying vec2 v_TexCoord;
+
+            void main()
+            {
+                gl_FragColor = vec4( texture2D( u_Tex, v_TexCoord ).rgb, 1.0 );
+            })));
+}
+
+size_t Session::hitTest( const Ray* rays, size_t count, HitResult* results ) const
+{
+    return mSessionImpl.hitTest( rays, count, results );
+}
+
+std::vector<HitResult> Session::hitTest( const std::vector<Ray>& rays ) const
+{
+    std::vector<HitResult> results( rays.size() );
+    mSessionImpl.hitTest( rays.data(), rays.size(), results.data() );
+    return results;
+}
+
+HitResult Session::hitTest( const Ray& ray ) const
+{
+    HitResult result;
+    mSessionImpl.hitTest( &ray, 1, &result );
+    return result;
 }
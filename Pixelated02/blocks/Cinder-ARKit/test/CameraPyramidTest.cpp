@@ -0,0 +1,114 @@
+//
+//  CameraPyramidTest.cpp
+//  CinderARKit
+//
+//  The SSE2 / NEON loops of the pyramid against the per pixel formulas, byte for
+//  byte, at widths that end in every tail length.
+//
+
+#include "ARCameraPyramid.h"
+#include "Check.h"
+
+#include <random>
+
+using namespace ARKit;
+
+static std::vector<uint8_t> randomBytes( size_t count, std::mt19937& rng )
+{
+    std::vector<uint8_t> bytes( count );
+    for (auto& b : bytes)
+        b = (uint8_t)rng();
+    return bytes;
+}
+
+static uint8_t clampToByte( int v )
+{
+    return (uint8_t)( v < 0 ? 0 : ( v > 255 ? 255 : v ));
+}
+
+static void testConvert( std::mt19937& rng )
+{
+    for (int i = 0; i < 200; ++i)
+    {
+        const int32_t width = 1 + rng() % 40;
+        const int32_t height = 1 + rng() % 6;
+        const ptrdiff_t yRowBytes = width * 2 + rng() % 8;
+        const ptrdiff_t cbcrRowBytes = width * 2 + rng() % 8;
+        const ptrdiff_t rgbaRowBytes = width * 4 + rng() % 8;
+
+        const auto y = randomBytes( yRowBytes * height * 2, rng );
+        const auto cbcr = randomBytes( cbcrRowBytes * height, rng );
+        std::vector<uint8_t> rgba( rgbaRowBytes * height, 0xEE );
+        convertYCbCrToRGBA( y.data(), yRowBytes, cbcr.data(), cbcrRowBytes, width, height, rgba.data(), rgbaRowBytes );
+
+        for (int32_t row = 0; row < height; ++row)
+        {
+            for (int32_t x = 0; x < width; ++x)
+            {
+                const uint8_t* y0 = &y[row * 2 * yRowBytes + x * 2];
+                const uint8_t* y1 = y0 + yRowBytes;
+                const int luma = (( y0[0] + y0[1] + y1[0] + y1[1] + 2 ) >> 2 ) * 64;
+                const int cb = cbcr[row * cbcrRowBytes + x * 2] - 128;
+                const int cr = cbcr[row * cbcrRowBytes + x * 2 + 1] - 128;
+                const uint8_t* px = &rgba[row * rgbaRowBytes + x * 4];
+
+                CHECK( px[0] == clampToByte(( luma + 90 * cr + 32 ) >> 6 ));
+                CHECK( px[1] == clampToByte(( luma - 22 * cb - 46 * cr + 32 ) >> 6 ));
+                CHECK( px[2] == clampToByte(( luma + 113 * cb + 32 ) >> 6 ));
+                CHECK( px[3] == 255 );
+            }
+            // Row padding is left alone
+            for (ptrdiff_t b = width * 4; b < rgbaRowBytes; ++b)
+                CHECK( rgba[row * rgbaRowBytes + b] == 0xEE );
+        }
+    }
+}
+
+static void testDownsample( std::mt19937& rng )
+{
+    for (int i = 0; i < 200; ++i)
+    {
+        const int32_t width = 2 + rng() % 80;
+        const int32_t height = 2 + rng() % 8;
+        const ptrdiff_t srcRowBytes = width * 4 + rng() % 8;
+        const ptrdiff_t dstRowBytes = width / 2 * 4 + rng() % 8;
+
+        const auto src = randomBytes( srcRowBytes * height, rng );
+        std::vector<uint8_t> dst( dstRowBytes * ( height / 2 ), 0xEE );
+        downsampleRGBA( src.data(), srcRowBytes, width, height, dst.data(), dstRowBytes );
+
+        for (int32_t row = 0; row < height / 2; ++row)
+        {
+            const uint8_t* s0 = &src[row * 2 * srcRowBytes];
+            const uint8_t* s1 = s0 + srcRowBytes;
+            for (int32_t x = 0; x < width / 2; ++x)
+            {
+                for (int ch = 0; ch < 4; ++ch)
+                {
+                    const int sum = s0[x * 8 + ch] + s0[x * 8 + 4 + ch] + s1[x * 8 + ch] + s1[x * 8 + 4 + ch];
+                    CHECK( dst[row * dstRowBytes + x * 4 + ch] == ( sum + 2 ) >> 2 );
+                }
+            }
+            for (ptrdiff_t b = width / 2 * 4; b < dstRowBytes; ++b)
+                CHECK( dst[row * dstRowBytes + b] == 0xEE );
+        }
+    }
+
+    // Averaging pairs of bytes first rounds 0, 0, 1, 0 up to 1
+    const int32_t width = 32;
+    std::vector<uint8_t> src( width * 4 * 2, 0 );
+    for (int32_t x = 0; x < width; x += 2)
+        src[width * 4 + x * 4] = 1;
+    std::vector<uint8_t> dst( width / 2 * 4, 0xEE );
+    downsampleRGBA( src.data(), width * 4, width, 2, dst.data(), width / 2 * 4 );
+    for (uint8_t b : dst)
+        CHECK( b == 0 );
+}
+
+int main()
+{
+    std::mt19937 rng( 5 );
+    testConvert( rng );
+    testDownsample( rng );
+    return reportChecks( "CameraPyramidTest" );
+}
@@ -0,0 +1,34 @@
+//
+//  Check.h
+//  CinderARKit
+//
+//  Assertions for the block's tests, which keep going after a failure and
+//  report it through the exit code for ctest.
+//
+
+#ifndef Check_h
+#define Check_h
+
+#include <cstdio>
+
+static int gNumFailures = 0;
+
+#define CHECK( condition ) \
+    do { \
+        if (!( condition )) \
+        { \
+            std::fprintf( stderr, "%s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #condition ); \
+            ++gNumFailures; \
+        } \
+    } while (0)
+
+static inline int reportChecks( const char* name )
+{
+    if (gNumFailures)
+        std::fprintf( stderr, "%s: %d checks failed\n", name, gNumFailures );
+    else
+        std::printf( "%s: passed\n", name );
+    return gNumFailures ? 1 : 0;
+}
+
+#endif /* Check_h */
@@ -0,0 +1,195 @@
+//
+//  HitTestTest.cpp
+//  CinderARKit
+//
+//  PlaneHitTester against testing every ray against every plane, including the
+//  rays that go straight along an axis or start right on a bounding box.
+//
+
+#include "ARHitTest.h"
+#include "Check.h"
+
+#include <cmath>
+#include <limits>
+#include <random>
+
+using namespace ARKit;
+
+const float PADDING = 1e-4f;    // BOUNDS_PADDING of ARHitTest.cpp
+
+struct ReferencePlane
+{
+    vec3            mCenter, mNormal, mU, mV;
+    float           mHalfU, mHalfV;
+    AnchorHandle    mHandle;
+};
+
+static std::vector<ReferencePlane> makeReferencePlanes( const AnchorStore<PlaneAnchor>& store )
+{
+    std::vector<ReferencePlane> planes;
+    for (size_t i = 0; i < store.size(); ++i)
+    {
+        const auto& anchor = store.getAnchors()[i];
+        const mat4& m = anchor.mTransform;
+
+        ReferencePlane plane;
+        plane.mCenter = vec3( m * vec4( anchor.mCenter, 1.0f ));
+        plane.mU = normalize( vec3( m[0] ));
+        plane.mNormal = normalize( vec3( m[1] ));
+        plane.mV = normalize( vec3( m[2] ));
+        plane.mHalfU = anchor.mExtent.x * 0.5f * length( vec3( m[0] ));
+        plane.mHalfV = anchor.mExtent.z * 0.5f * length( vec3( m[2] ));
+        plane.mHandle = store.getHandle( i );
+        planes.push_back( plane );
+    }
+    return planes;
+}
+
+/**  The nearest hit the slow way, with the same arithmetic as a packet lane.
+*/
+static HitResult bruteForceHit( const std::vector<ReferencePlane>& planes, const Ray& ray )
+{
+    const vec3& o = ray.getOrigin();
+    const vec3& d = ray.getDirection();
+
+    HitResult result;
+    result.mDistance = std::numeric_limits<float>::max();
+    for (const auto& p : planes)
+    {
+        const float denom = p.mNormal.x * d.x + p.mNormal.y * d.y + p.mNormal.z * d.z;
+        if (denom * denom < 1e-6f * 1e-6f)
+            continue;
+
+        const float t = ( p.mNormal.x * ( p.mCenter.x - o.x ) + p.mNormal.y * ( p.mCenter.y - o.y ) + p.mNormal.z * ( p.mCenter.z - o.z )) / denom;
+        const vec3 h( o.x + d.x * t - p.mCenter.x, o.y + d.y * t - p.mCenter.y, o.z + d.z * t - p.mCenter.z );
+        const float u = h.x * p.mU.x + h.y * p.mU.y + h.z * p.mU.z;
+        const float v = h.x * p.mV.x + h.y * p.mV.y + h.z * p.mV.z;
+
+        if (t >= 0.0f && std::abs( u ) <= p.mHalfU && std::abs( v ) <= p.mHalfV && t < result.mDistance)
+        {
+            result.mDistance = t;
+            result.mAnchor = p.mHandle;
+        }
+    }
+    if (!result.hasHit())
+        result = HitResult();
+    return result;
+}
+
+/**  Floors, ceilings and walls like ARKit finds them, and a few planes at odd angles.
+*/
+static void addPlanes( AnchorStore<PlaneAnchor>* store, int count, std::mt19937& rng )
+{
+    std::uniform_real_distribution<float> position( -4.0f, 4.0f );
+    std::uniform_real_distribution<float> extent( 0.2f, 3.0f );
+    std::uniform_real_distribution<float> angle( 0.0f, 6.2831853f );
+
+    for (int i = 0; i < count; ++i)
+    {
+        mat4 transform = glm::translate( mat4( 1.0f ), vec3( position( rng ), position( rng ), position( rng )));
+        switch (i % 4)
+        {
+            case 0:     break;
+            case 1:     transform = glm::rotate( transform, 1.5707964f, vec3( 1, 0, 0 )); break;
+            case 2:     transform = glm::rotate( transform, 1.5707964f, vec3( 0, 0, 1 )); break;
+            default:    transform = glm::rotate( transform, angle( rng ), normalize( vec3( position( rng ), position( rng ), position( rng )) + vec3( 0.01f ))); break;
+        }
+
+        const vec3 center( position( rng ) * 0.1f, 0.0f, position( rng ) * 0.1f );
+        store->addOrUpdate( PlaneAnchor( AnchorID( 1, (uint64_t)i ), transform, center, vec3( extent( rng ), 0.0f, extent( rng ))));
+    }
+}
+
+static void checkRays( const PlaneHitTester& tester, const std::vector<ReferencePlane>& planes, const std::vector<Ray>& rays )
+{
+    std::vector<HitResult> results( rays.size() );
+    const size_t numHits = tester.hitTest( rays.data(), rays.size(), results.data() );
+
+    size_t numExpected = 0;
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        const HitResult expected = bruteForceHit( planes, rays[i] );
+        const HitResult& result = results[i];
+        numExpected += expected.hasHit();
+
+        CHECK( result.hasHit() == expected.hasHit() );
+        if (!result.hasHit() || !expected.hasHit())
+            continue;
+
+        // Overlapping planes can tie, then either one will do
+        CHECK( std::abs( result.mDistance - expected.mDistance ) <= 1e-5f * ( 1.0f + expected.mDistance ));
+        CHECK( result.mAnchor == expected.mAnchor || result.mDistance == expected.mDistance );
+        CHECK( dot( result.mNormal, rays[i].getDirection() ) <= 0.0f );
+    }
+    CHECK( numHits == numExpected );
+}
+
+int main()
+{
+    std::mt19937 rng( 11 );
+    std::uniform_real_distribution<float> unit( -1.0f, 1.0f );
+
+    for (int count : { 1, 3, 4, 5, 17, 64 })
+    {
+        AnchorStore<PlaneAnchor> store;
+        addPlanes( &store, count, rng );
+
+        PlaneHitTester tester;
+        tester.build( store );
+        const auto planes = makeReferencePlanes( store );
+
+        // Anywhere to anywhere
+        std::vector<Ray> rays;
+        for (int i = 0; i < 2000; ++i)
+            rays.push_back( Ray( vec3( unit( rng ), unit( rng ), unit( rng )) * 6.0f, normalize( vec3( unit( rng ), unit( rng ), unit( rng )))));
+        checkRays( tester, planes, rays );
+
+        // Straight along an axis, where the inverse direction is infinite twice
+        rays.clear();
+        for (int i = 0; i < 2000; ++i)
+        {
+            vec3 dir( 0.0f );
+            dir[i % 3] = i % 2 ? 1.0f : -1.0f;
+            rays.push_back( Ray( vec3( unit( rng ), unit( rng ), unit( rng )) * 6.0f, dir ));
+        }
+        checkRays( tester, planes, rays );
+
+        // Starting right on a face of each plane's bounds, or on the plane itself,
+        // with the components across the face held still
+        rays.clear();
+        for (const auto& p : planes)
+        {
+            const vec3 reach = glm::abs( p.mU ) * p.mHalfU + glm::abs( p.mV ) * p.mHalfV + vec3( PADDING );
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (float side : { -1.0f, 1.0f })
+                {
+                    vec3 origin = p.mCenter + p.mU * p.mHalfU * unit( rng ) * 0.5f + p.mV * p.mHalfV * unit( rng ) * 0.5f;
+                    origin[axis] = p.mCenter[axis] + side * reach[axis];
+
+                    for (int i = 0; i < 8; ++i)
+                    {
+                        vec3 dir( unit( rng ), unit( rng ), unit( rng ));
+                        dir[axis] = 0.0f;
+                        if (i % 2)
+                            dir[( axis + 1 ) % 3] = 0.0f;
+                        if (length( dir ) > 0.01f)
+                            rays.push_back( Ray( origin, normalize( dir )));
+                    }
+                }
+            }
+
+            const vec3 onPlane = p.mCenter + p.mU * p.mHalfU * unit( rng ) * 0.9f + p.mV * p.mHalfV * unit( rng ) * 0.9f;
+            rays.push_back( Ray( onPlane, p.mNormal ));
+            rays.push_back( Ray( onPlane, -p.mNormal ));
+        }
+        checkRays( tester, planes, rays );
+    }
+
+    // Nothing to hit
+    PlaneHitTester empty;
+    empty.build( AnchorStore<PlaneAnchor>() );
+    checkRays( empty, std::vector<ReferencePlane>(), { Ray( vec3( 0.0f ), vec3( 0, -1, 0 )) } );
+
+    return reportChecks( "HitTestTest" );
+}
@@ -0,0 +1,163 @@
+//
+//  RecordingTest.cpp
+//  CinderARKit
+//
+//  Planes through encodePlane() and decodePlane(), and whole recordings through
+//  Writer and back out of Reader, byte for byte.
+//
+
+#include "ARSessionRecording.h"
+#include "cinder/Utilities.h"
+#include "Check.h"
+
+#include <random>
+
+using namespace ARKit;
+using namespace ARKit::Recording;
+
+/**  A smooth gradient with some noise on top, like a camera image, with \a rowBytes
+     past the packed row so the encoder has to skip the padding.
+*/
+static std::vector<uint8_t> makePlane( uint32_t width, uint32_t height, size_t rowBytes, uint32_t channels, std::mt19937& rng )
+{
+    std::vector<uint8_t> plane( rowBytes * height, 0xEE );
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width * channels; ++x)
+            plane[y * rowBytes + x] = (uint8_t)( x / channels + y * 3 + ( rng() & 7 ) );
+    }
+    return plane;
+}
+
+static std::vector<uint8_t> packPlane( const std::vector<uint8_t>& plane, uint32_t width, uint32_t height, size_t rowBytes, uint32_t channels )
+{
+    std::vector<uint8_t> packed;
+    for (uint32_t y = 0; y < height; ++y)
+        packed.insert( packed.end(), plane.begin() + y * rowBytes, plane.begin() + y * rowBytes + width * channels );
+    return packed;
+}
+
+static void testPlaneCodec( std::mt19937& rng )
+{
+    EncodeBuffers buffers;
+    for (PlaneEncoding encoding : { Raw, DeltaLz })
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            const uint32_t channels = 1 + i % 2;
+            const uint32_t width = 1 + rng() % 97;
+            const uint32_t height = 1 + rng() % 61;
+            const size_t rowBytes = width * channels + rng() % 16;
+            const auto plane = makePlane( width, height, rowBytes, channels, rng );
+            const auto packed = packPlane( plane, width, height, rowBytes, channels );
+
+            // Reused scratch memory has to give the same bytes as fresh scratch memory
+            std::vector<uint8_t> fresh, reused;
+            encodePlane( encoding, plane.data(), width, height, rowBytes, channels, &fresh );
+            encodePlane( encoding, plane.data(), width, height, rowBytes, channels, &reused, &buffers );
+            CHECK( fresh == reused );
+
+            std::vector<uint8_t> decoded( packed.size() );
+            CHECK( decodePlane( encoding, fresh.data(), fresh.size(), width, height, channels, decoded.data(), decoded.size() ));
+            CHECK( decoded == packed );
+        }
+    }
+}
+
+static void testRoundTrip( PlaneEncoding encoding, std::mt19937& rng )
+{
+    const fs::path path = getTemporaryDirectory() / "CinderARKitRecordingTest.arrec";
+    const uint32_t yWidth = 64, yHeight = 48;
+    const uint32_t cbcrWidth = yWidth / 2, cbcrHeight = yHeight / 2;
+    const size_t yRowBytes = yWidth + 8, cbcrRowBytes = cbcrWidth * 2 + 8;
+    const int numFrames = 4;
+
+    // Anchors the session already had when the recording started
+    const auto point = makeAnchorInfo( Anchor( AnchorID( 1, 2 ), mat4( 1.0f )));
+    const auto image = makeAnchorInfo( ImageAnchor( AnchorID( 3, 4 ), mat4( 2.0f ), vec2( 0.2f, 0.3f ), "poster" ));
+    std::vector<AnchorEvent> anchors = {
+        AnchorEvent{ AnchorAddedRecord, point, "" },
+        AnchorEvent{ AnchorAddedRecord, image, "poster" } };
+
+    std::vector<std::vector<uint8_t>> yPlanes, cbcrPlanes;
+    {
+        Writer writer;
+        CHECK( writer.open( path, encoding, anchors ));
+        for (int i = 0; i < numFrames; ++i)
+        {
+            yPlanes.push_back( makePlane( yWidth, yHeight, yRowBytes, 1, rng ));
+            cbcrPlanes.push_back( makePlane( cbcrWidth, cbcrHeight, cbcrRowBytes, 2, rng ));
+
+            FrameInfo info;
+            memset( (void*)&info, 0, sizeof( FrameInfo ));
+            info.mTimestamp = i;
+            info.mYWidth = yWidth;
+            info.mYHeight = yHeight;
+            info.mCbCrWidth = cbcrWidth;
+            info.mCbCrHeight = cbcrHeight;
+            writer.writeFrame( info, yPlanes.back().data(), yRowBytes, cbcrPlanes.back().data(), cbcrRowBytes );
+
+            // Slower than the camera, so the writer never has to drop a frame
+            while (writer.getNumFramesWritten() < (size_t)i + 1)
+                std::this_thread::yield();
+        }
+        writer.writeAnchor( AnchorRemovedRecord, point );
+        writer.close();
+        CHECK( writer.getNumFramesDropped() == 0 );
+    }
+
+    Reader reader;
+    CHECK( reader.open( path ));
+
+    RecordType type;
+    Frame frame;
+    AnchorEvent event;
+
+    // The snapshot comes ahead of every frame
+    for (const auto& anchor : anchors)
+    {
+        CHECK( reader.next( &type, &frame, &event ));
+        CHECK( type == AnchorAddedRecord );
+        CHECK( memcmp( &event.mInfo, &anchor.mInfo, sizeof( AnchorInfo )) == 0 );
+        CHECK( event.mImageName == anchor.mImageName );
+    }
+
+    for (int i = 0; i < numFrames; ++i)
+    {
+        CHECK( reader.next( &type, &frame, &event ));
+        CHECK( type == FrameRecord );
+        CHECK( frame.mInfo.mTimestamp == i );
+        CHECK( frame.mInfo.mYEncoding == encoding && frame.mInfo.mCbCrEncoding == encoding );
+
+        const auto y = packPlane( yPlanes[i], yWidth, yHeight, yRowBytes, 1 );
+        const auto cbcr = packPlane( cbcrPlanes[i], cbcrWidth, cbcrHeight, cbcrRowBytes, 2 );
+        std::vector<uint8_t> yRead( y.size() ), cbcrRead( cbcr.size() );
+        CHECK( decodePlane( encoding, frame.mYPlane, frame.mInfo.mYBytes, yWidth, yHeight, 1, yRead.data(), yRead.size() ));
+        CHECK( decodePlane( encoding, frame.mCbCrPlane, frame.mInfo.mCbCrBytes, cbcrWidth, cbcrHeight, 2, cbcrRead.data(), cbcrRead.size() ));
+        CHECK( yRead == y );
+        CHECK( cbcrRead == cbcr );
+    }
+
+    CHECK( reader.next( &type, &frame, &event ));
+    CHECK( type == AnchorRemovedRecord && event.getUid() == AnchorID( 1, 2 ));
+    CHECK( !reader.next( &type, &frame, &event ));
+
+    // A frame handed out keeps its planes readable after the reader lets go
+    reader.rewind();
+    while (reader.next( &type, &frame, &event ) && type != FrameRecord) {}
+    const uint8_t first = frame.mYPlane[0];
+    reader.close();
+    CHECK( frame.mYPlane[0] == first );
+    frame = Frame();
+
+    fs::remove( path );
+}
+
+int main()
+{
+    std::mt19937 rng( 7 );
+    testPlaneCodec( rng );
+    testRoundTrip( Raw, rng );
+    testRoundTrip( DeltaLz, rng );
+    return reportChecks( "RecordingTest" );
+}
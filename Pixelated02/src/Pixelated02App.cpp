@@ -3,10 +3,12 @@
 #include "cinder/gl/gl.h"
 #include "cinder/gl/Fbo.h"
 #include "cinder/Rand.h"
+#include "cinder/Utilities.h"
 
 #include "CinderARKit.h"
 #include "BatchHelpers.h"
 #include "ViewParticles.hpp"
+#include "CounterRand.hpp"
 #include "Utils.hpp"
 
 using namespace ci;
@@ -53,7 +55,26 @@ void Pixelated02App::setup()
                         .trackingType( ARKit::TrackingType::WorldTracking )
                         .planeDetection( ARKit::PlaneDetection::Both );
     
+    // Live ARKit unless launched with --replay FILE, a recording in the assets or at
+    // that path. Playing it back needs the block built with CINDER_ARKIT_REPLAY
+    const auto& args = getCommandLineArgs();
+    auto replayArg = find(args.begin(), args.end(), "--replay");
+    if(replayArg != args.end() && replayArg + 1 != args.end()) {
+        fs::path replayPath = getAssetPath(*(replayArg + 1));
+        if(replayPath.empty()) {
+            replayPath = *(replayArg + 1);
+        }
+        
+        if(fs::exists(replayPath)) {
+            console() << "Replaying " << replayPath << endl;
+            config.replayFile(replayPath);
+        } else {
+            console() << "No recording at " << *(replayArg + 1) << ", running a live session" << endl;
+        }
+    }
+    
     mARSession.runConfiguration( config );
+    mARSession.setCameraPyramidEnabled( true );
     
     
     // helpers
@@ -65,9 +86,11 @@ void Pixelated02App::setup()
     mFboEnv = gl::Fbo::create( FBO_WIDTH, FBO_HEIGHT, fboFormatEnv.colorTexture() );
     
     
-    // views
+    // views, --seed N fills them with the same particles again
+    uint32_t seed = CounterRand::pickSeed( args );
+    console() << "Particle seed " << seed << ", run with --seed " << seed << " for the same particles" << endl;
     for(int i=0; i<NUM_VIEWS; i++) {
-        ViewParticlesRef view = ViewParticles::create();
+        ViewParticlesRef view = ViewParticles::create( seed );
         particleViews.push_back(view);
     }
     
@@ -75,18 +98,21 @@ void Pixelated02App::setup()
 }
 
 void Pixelated02App::touchesBegan( TouchEvent event ) {
+    // three finger tap toggles recording the session for replay
+    if(event.getTouches().size() >= 3) {
+        if(mARSession.isRecording()) {
+            mARSession.stopRecording();
+        } else {
+            mARSession.startRecording( getDocumentsDirectory() / "session.ciar" );
+        }
+        return;
+    }
+    
     resetView();
 }
 
 
 void Pixelated02App::resetView() {
-    auto anchors = mARSession.getPlaneAnchors();
-    
-    if(anchors.size() == 0) return;
-        
-    auto anchor = anchors.at(0);
-    vec3 hit;
-    
     Ray rayCam = AlfridUtils::getLookRay(mARSession.getCameraPosition(), mARSession.getViewMatrix());
     
 //    vec3 dir = rayCam.getDirection();
@@ -96,13 +122,18 @@ void Pixelated02App::resetView() {
 //    dir = normalize(dir);
 //    rayCam.setDirection(dir);
     
-    bool hasHit = Utils::hitTest(rayCam, anchor, &hit);
+    ARKit::HitResult result = mARSession.hitTest(rayCam);
             
-    if(hasHit) {
+    if(result.hasHit()) {
+        const ARKit::PlaneAnchor& anchor = *mARSession.getPlaneAnchorStore().get(result.mAnchor);
+        vec3 hit = result.mPosition;
         mHits.push_back(hit);
         
         mat4 mtxProj = mARSession.getProjectionMatrix() * mARSession.getViewMatrix();
         
+        // snapshot the camera for the particle colours
+        updateBackground();
+        
         ViewParticlesRef view = particleViews.at(mIndex);
         view->reset(anchor.mUid, anchor.mTransform, mtxProj, hit, mFboEnv->getColorTexture());
         
@@ -119,7 +150,7 @@ void Pixelated02App::resetView() {
 
 
 void Pixelated02App::update() {
-    updateBackground();
+    mARSession.update();
     
     
     gl::enableDepth();
@@ -137,7 +168,8 @@ void Pixelated02App::updateBackground() {
 
     gl::ScopedMatrices matScp;
 
-    mARSession.drawRGBCaptureTexture(getWindowBounds());
+    // half resolution is plenty for sampling particle colours
+    mARSession.drawCameraPyramidTexture(0, getWindowBounds());
 }
 
 
@@ -167,11 +199,12 @@ void Pixelated02App::draw()
 
     
     // draw hit point from camera to plane ( anchor )
-    auto anchors = mARSession.getPlaneAnchors();
+    const auto& anchors = mARSession.getPlaneAnchors();
+    Ray rayCam = AlfridUtils::getLookRay(mARSession.getCameraPosition(), mARSession.getViewMatrix());
 
     /*
     float s = 0.01f;
-    for(auto a: anchors) {
+    for(const auto& a: anchors) {
         vec3 pos = vec3(a.mTransform * vec4(0.0, 0.0, 0.0, 1.0));
         vec3 dir = vec3(a.mTransform * vec4(0.0, 1.0, 0.0, 0.0));
         vec3 target = pos + dir * 0.15f;
@@ -182,16 +215,9 @@ void Pixelated02App::draw()
     }
      */
 
-    for(auto a: anchors) {
-            vec3 hit;
-            
-            Ray rayCam = AlfridUtils::getLookRay(mARSession.getCameraPosition(), mARSession.getViewMatrix());
-            
-            bool hasHit = Utils::hitTest(rayCam, a, &hit);
-            
-            if(hasHit) {
-                bBall->draw(hit, vec3(0.0025f), vec3(1.0, 0.0, 0.0));
-            }
+    ARKit::HitResult result = mARSession.hitTest(rayCam);
+    if(result.hasHit()) {
+        bBall->draw(result.mPosition, vec3(0.0025f), vec3(1.0, 0.0, 0.0));
     }
     
     
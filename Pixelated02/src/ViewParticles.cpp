@@ -7,6 +7,7 @@
 
 #include "ViewParticles.hpp"
 #include "cinder/Rand.h"
+#include "CounterRand.hpp"
 
 
 struct Particle
@@ -18,7 +19,10 @@ struct Particle
     vec3 extra;
 };
 
-void ViewParticles::init() {
+constexpr ParticleField ParticleLayout::FIELDS[];
+static_assert( Particles::DYNAMIC_STRIDE == sizeof(Particle), "ParticleLayout doesn't match Particle" );
+
+void ViewParticles::init( uint32_t particleSeed ) {
     // buffers
     
     vector<Particle> particles;
@@ -26,77 +30,43 @@ void ViewParticles::init() {
     float range = 0.2;
     float range_z = 0.001;
     
+    // Every value is a function of ( seed, stream, particle ), batched per attribute
+    enum { RAND_ANGLE, RAND_RADIUS, RAND_Y, RAND_COLOR, RAND_EXTRA_Y, RAND_EXTRA_Z };
+    CounterRand rand( particleSeed );
+    size_t count = particles.size();
+    vector<float> angle( count ), radius( count ), ys( count ), extraY( count ), extraZ( count );
+    vector<vec3> color( count );
+    rand.fill( angle.data(), count, RAND_ANGLE, 0, 0.0f, M_PI * 2.0 );
+    rand.fill( radius.data(), count, RAND_RADIUS, 0 );
+    rand.fill( ys.data(), count, RAND_Y, 0, -range_z, range_z );
+    rand.fillVec3( color.data(), count, RAND_COLOR, 0 );
+    rand.fill( extraY.data(), count, RAND_EXTRA_Y, 0 );
+    rand.fill( extraZ.data(), count, RAND_EXTRA_Z, 0, 0.0f, 0.8f );
+    
     for( int i =0; i<particles.size(); i++) {
-        float a = randFloat(M_PI * 2.0);
-        float r = sqrt(randFloat()) * range;
+        float a = angle[i];
+        float r = sqrt(radius[i]) * range;
         float x = cos(a) * r;
         float z = sin(a) * r;
-        float y = randFloat(-range_z, range_z);
+        float y = ys[i];
         
         auto &p = particles.at( i );
         
         p.pos = vec3(x, y, z);
         p.posOrg = vec3(x, y, z);
         p.vel = vec3(0, 0, 0);
-        p.color = randVec3();
-        p.extra = vec3(0, randFloat(), randFloat(0.0f, 0.8f));
+        p.color = color[i];
+        p.extra = vec3(0, extraY[i], extraZ[i]);
     }
     
     
-    mParticleBuffer[mSourceIndex]       = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), particles.data(), GL_STATIC_DRAW );
-    mParticleBuffer[mDestinationIndex]  = gl::Vbo::create( GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), nullptr, GL_STATIC_DRAW );
-    
-    
-    for( int i = 0; i < 2; ++i )
-    {    // Describe the particle layout for OpenGL.
-        mAttributes[i] = gl::Vao::create();
-        gl::ScopedVao vao( mAttributes[i] );
-        
-        // Define attributes as offsets into the bound particle buffer
-        gl::ScopedBuffer buffer( mParticleBuffer[i] );
-        gl::enableVertexAttribArray( 0 );
-        gl::enableVertexAttribArray( 1 );
-        gl::enableVertexAttribArray( 2 );
-        gl::enableVertexAttribArray( 3 );
-        gl::enableVertexAttribArray( 4 );
-        gl::vertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, pos) );
-        gl::vertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, posOrg) );
-        gl::vertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, vel) );
-        gl::vertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, color) );
-        gl::vertexAttribPointer( 4, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const GLvoid*)offsetof(Particle, extra) );
-    }
-    
+    mParticles.init( particles.size(), particles.data() );
     
     
     // init shaders
-    mShaderRender = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag"))
-       .attribLocation( "ciPosition", 0 )
-       .attribLocation( "iPositionOrg", 1 )
-       .attribLocation( "iVel", 2 )
-       .attribLocation( "iColor", 3 )
-       .attribLocation( "iExtra", 4 )
-    );
-    
-    mShaderInit = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "init.vert" ) ).fragment( loadAsset("no_op_es3.frag"))
-    .feedbackFormat( GL_INTERLEAVED_ATTRIBS )
-    .feedbackVaryings( { "position", "positionOrg", "velocity", "color", "extra"} )
-    .attribLocation( "iPosition", 0 )
-    .attribLocation( "iPositionOrg", 1 )
-    .attribLocation( "iVel", 2 )
-    .attribLocation( "iColor", 3 )
-    .attribLocation( "iExtra", 4 )
-    );
-    
-    
-    mShaderUpdate = gl::GlslProg::create( gl::GlslProg::Format().vertex( loadAsset( "update.vert" ) ).fragment( loadAsset("no_op_es3.frag"))
-    .feedbackFormat( GL_INTERLEAVED_ATTRIBS )
-    .feedbackVaryings( { "position", "positionOrg", "velocity", "color", "extra"} )
-    .attribLocation( "iPosition", 0 )
-    .attribLocation( "iPositionOrg", 1 )
-    .attribLocation( "iVel", 2 )
-    .attribLocation( "iColor", 3 )
-    .attribLocation( "iExtra", 4 )
-    );
+    mShaderRender = gl::GlslProg::create( Particles::renderFormat( gl::GlslProg::Format().vertex( loadAsset( "render.vert" ) ).fragment( loadAsset("render.frag") ) ) );
+    mShaderInit = gl::GlslProg::create( Particles::updateFormat( gl::GlslProg::Format().vertex( loadAsset( "init.vert" ) ).fragment( loadAsset("no_op_es3.frag") ) ) );
+    mShaderUpdate = gl::GlslProg::create( Particles::updateFormat( gl::GlslProg::Format().vertex( loadAsset( "update.vert" ) ).fragment( loadAsset("no_op_es3.frag") ) ) );
     
     int FBO_SIZE = 2048;
     
@@ -163,21 +133,13 @@ void ViewParticles::reset(ARKit::AnchorID mId, mat4 mMtxModel, mat4 mMtxProj, ve
     
     // save color
     gl::ScopedGlslProg prog( mShaderInit );
-    gl::ScopedState rasterizer( GL_RASTERIZER_DISCARD, true );
     mShaderInit->uniform("uShadowMatrix", mtxProj);
     mShaderInit->uniform("uModelMatrix", mtxModel);
     mShaderInit->uniform("uTranslate", pos);
     gl::ScopedTextureBind texScope( texture, (uint8_t) 0 );
     mShaderInit->uniform( "uShadowMap", 0 );
     
-    gl::ScopedVao source( mAttributes[mSourceIndex] );
-    gl::bindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, mParticleBuffer[mDestinationIndex] );
-    gl::beginTransformFeedback( GL_POINTS );
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
-
-    gl::endTransformFeedback();
-
-    std::swap( mSourceIndex, mDestinationIndex );
+    mParticles.update();
     
     
     // setup light camera
@@ -208,19 +170,11 @@ void ViewParticles::update() {
     
     
     gl::ScopedGlslProg prog( mShaderUpdate );
-    gl::ScopedState rasterizer( GL_RASTERIZER_DISCARD, true );    // turn off fragment stage
     mShaderUpdate->uniform("uTime", float(getElapsedSeconds()) + mSeed);
     mShaderUpdate->uniform("uOffset", _offset->getValue());
     mShaderUpdate->uniform("uSeed", mSeed);
     
-    gl::ScopedVao source( mAttributes[mSourceIndex] );
-    gl::bindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, mParticleBuffer[mDestinationIndex] );
-    gl::beginTransformFeedback( GL_POINTS );
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
-
-    gl::endTransformFeedback();
-
-    std::swap( mSourceIndex, mDestinationIndex );
+    mParticles.update();
 }
 
 
@@ -236,9 +190,7 @@ void ViewParticles::_updateShadowMap() {
     gl::ScopedGlslProg prog( mShaderRender );
     mShaderRender->uniform("uViewport", vec2(getWindowSize()));
 
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+    mParticles.draw();
 }
 
 
@@ -256,9 +208,7 @@ void ViewParticles::render() {
     
     mShaderRender->uniform("uShadowMatrix", _mtxShadow);
     
-    gl::ScopedVao vao( mAttributes[mSourceIndex] );
-    gl::context()->setDefaultShaderVars();
-    gl::drawArrays( GL_POINTS, 0, NUM_PARTICLES );
+    mParticles.draw();
 }
 
 void ViewParticles::renderFloor() {
@@ -12,6 +12,7 @@
 #include "CinderARKit.h"
 #include <stdio.h>
 #include "EaseNumber.hpp"
+#include "ParticleSystem.hpp"
 
 
 using namespace ci;
@@ -20,6 +21,19 @@ using namespace std;
 
 const int NUM_PARTICLES = 50e3;
 
+// Shared by init.vert, update.vert and render.vert
+struct ParticleLayout {
+    static constexpr ParticleField FIELDS[] = {
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iPosition",    "position",     "ciPosition" },
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iPositionOrg", "positionOrg" },
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iVel",         "velocity" },
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iColor",       "color" },
+        { ParticleType::Vec3,   ParticleStream::Dynamic,    "iExtra",       "extra" },
+    };
+};
+
+typedef ParticleSystem<ParticleLayout> Particles;
+
 
 typedef std::shared_ptr<class ViewParticles> ViewParticlesRef;
 
@@ -35,18 +49,19 @@ public:
     
     
     
-    ViewParticles() {
-        init();
+    // Same \a particleSeed, same particles
+    ViewParticles( uint32_t particleSeed ) {
+        init( particleSeed );
     }
     
-    static ViewParticlesRef create() { return std::make_shared<ViewParticles>(); }
+    static ViewParticlesRef create( uint32_t particleSeed ) { return std::make_shared<ViewParticles>( particleSeed ); }
     
     void reset(ARKit::AnchorID mId, mat4 mMtxModel, mat4 mMtxProj, vec3 mPos, gl::Texture2dRef mTexture);
     void render();
     void renderFloor();
     void update();
     void open();
-    void init();
+    void init( uint32_t particleSeed );
     
     
     gl::Texture2dRef    mShadowMapTex;
@@ -63,11 +78,7 @@ protected:
     gl::BatchRef        mBatchFloor;
     
     // particles
-    gl::VaoRef          mAttributes[2];
-    gl::VboRef          mParticleBuffer[2];
-    
-    std::uint32_t       mSourceIndex        = 0;
-    std::uint32_t       mDestinationIndex   = 1;
+    Particles           mParticles;
     
     // offsets
     EaseNumberRef       _offset;
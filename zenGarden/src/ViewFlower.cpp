@@ -13,8 +13,11 @@ void ViewFlower::_init() {
     
     timeStart = getElapsedSeconds();
     
-    numLeaves = floor(randFloat(3, 6));
-    numPetals = floor(randFloat(4, 7));
+    CounterRand seeded( _seed );
+    CounterRand::Stream rand = seeded.getStream( _index );
+    
+    numLeaves = floor(rand.nextFloat(3, 6));
+    numPetals = floor(rand.nextFloat(4, 7));
     
     _offset = EaseNumber::create(0);
     _offsetOpening = EaseNumber::create(0);
@@ -25,9 +28,13 @@ void ViewFlower::_init() {
     _offset->setValue(1);
     
     // set top + controls
-    _top = getPos(randFloat(12.0f, 18.0f), 1.0f);
-    _ctrl0 = getPos(randFloat(0.3f, 0.4f) * _top.y, 3.0f);
-    _ctrl1 = getPos(randFloat(0.6f, 0.7f) * _top.y, 3.0f);
+    // One at a time, the order of function arguments isn't defined
+    float top = rand.nextFloat(12.0f, 18.0f);
+    _top = getPos(top, 1.0f, rand);
+    float ctrl0 = rand.nextFloat(0.3f, 0.4f);
+    _ctrl0 = getPos(ctrl0 * _top.y, 3.0f, rand);
+    float ctrl1 = rand.nextFloat(0.6f, 0.7f);
+    _ctrl1 = getPos(ctrl1 * _top.y, 3.0f, rand);
     
     
     // stem
@@ -48,15 +55,19 @@ void ViewFlower::_init() {
     
     for(int i=0; i<num; i++) {
         
-        float h = randFloat(15.0f, 10.0f);
+        float h = rand.nextFloat(15.0f, 10.0f);
         float r = 5.5f;
         
         InstanceData data;
-        data.pos = getPos(0.0f, 0.5f);
-        data.end = getPos(h, 1.5f);
-        data.ctrl0 = getPos(h * randFloat(0.2, 0.3), r);
-        data.ctrl1 = getPos(h * randFloat(0.6, 0.7), r);
-        data.extra = vec3(randFloat(), randFloat(), randFloat());
+        data.pos = getPos(0.0f, 0.5f, rand);
+        data.end = getPos(h, 1.5f, rand);
+        float ctrl0 = rand.nextFloat(0.2, 0.3);
+        data.ctrl0 = getPos(h * ctrl0, r, rand);
+        float ctrl1 = rand.nextFloat(0.6, 0.7);
+        data.ctrl1 = getPos(h * ctrl1, r, rand);
+        data.extra.x = rand.nextFloat();
+        data.extra.y = rand.nextFloat();
+        data.extra.z = rand.nextFloat();
         
         instanceData.push_back(data);
     }
@@ -91,7 +102,8 @@ void ViewFlower::_init() {
     // instancing
     vector<vec3> extras;
     for(int i=0; i<numPetals; i++) {
-        extras.push_back(vec3(i, randFloat(), randFloat()));
+        float y = rand.nextFloat();
+        extras.push_back(vec3(i, y, rand.nextFloat()));
     }
     gl::VboRef mInstanceDataVboPetals = gl::Vbo::create( GL_ARRAY_BUFFER, extras.size() * sizeof(vec3), extras.data(), GL_STATIC_DRAW );
     geom::BufferLayout instanceDataLayoutPetals;
@@ -107,8 +119,9 @@ void ViewFlower::_init() {
 }
 
 
-vec3 ViewFlower::getPos(float y, float r) {
-    return vec3(randFloat(-r, r), y, randFloat(-r, r));
+vec3 ViewFlower::getPos(float y, float r, CounterRand::Stream& rand) {
+    float x = rand.nextFloat(-r, r);
+    return vec3(x, y, rand.nextFloat(-r, r));
 }
 
 
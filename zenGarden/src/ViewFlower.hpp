@@ -10,7 +10,7 @@
 
 #include <stdio.h>
 #include "cinder/gl/gl.h"
-#include "cinder/Rand.h"
+#include "CounterRand.hpp"
 #include "BatchHelpers.h"
 #include "cinder/Perlin.h"
 
@@ -32,10 +32,13 @@ public:
         vec3 extra;
     };
     
-    static ViewFlowerRef create(vec3 mPos) { return std::make_shared<ViewFlower>(mPos); }
+    // \a index picks the flower's random stream, with the same \a seed the nth flower always grows the same way
+    static ViewFlowerRef create(vec3 mPos, uint32_t seed, uint64_t index) { return std::make_shared<ViewFlower>(mPos, seed, index); }
     
-    ViewFlower(vec3 mPos) {
+    ViewFlower(vec3 mPos, uint32_t seed, uint64_t index) {
         _pos = mPos;
+        _seed = seed;
+        _index = index;
         _init();
     }
     
@@ -54,11 +57,13 @@ private :
     float timeStart;
     
     vec3 _pos;
+    uint32_t _seed;
+    uint64_t _index;
     vec3 _top;
     vec3 _ctrl0;
     vec3 _ctrl1;
         
-    vec3 getPos(float y, float r);
+    vec3 getPos(float y, float r, CounterRand::Stream& rand);
     
     Perlin perlin;
     
@@ -4,6 +4,7 @@
 
 
 #include "CinderARKit.h"
+#include "CounterRand.hpp"
 #include "BatchHelpers.h"
 #include "Utils.hpp"
 
@@ -30,12 +31,16 @@ private:
     
     BatchBallRef bBall;
     vector<ViewFlowerRef>   _flowers;
+    uint32_t                _seed;
     gl::FboRef              mFboEnv;
     ViewBackground*         _vBg;
 };
 
 void zenGardenApp::setup()
 {
+    _seed = CounterRand::pickSeed( getCommandLineArgs() );
+    console() << "Flower seed " << _seed << ", run with --seed " << _seed << " to grow the same garden" << endl;
+    
     auto config = ARKit::SessionConfiguration()
                         .trackingType( ARKit::TrackingType::WorldTracking )
                         .planeDetection( ARKit::PlaneDetection::Both );
@@ -65,7 +70,7 @@ void zenGardenApp::touchesBegan( TouchEvent event )
         
         if(hasHit) {
     
-            ViewFlowerRef vFlower = ViewFlower::create(hit);
+            ViewFlowerRef vFlower = ViewFlower::create(hit, _seed, _flowers.size());
             _flowers.push_back(vFlower);
             
             return;